@@ -1,9 +1,43 @@
+/*
+*   Build with:
+*
+*       cc -O2 -pthread -o file_manager file_manager.c -lm
+*
+*   -pthread is needed for the worker threads and -lm for log()/exp()/floor()
+*   used by the line sampler.
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <limits.h>
 #include <unistd.h>
 #include <errno.h>
+#include <strings.h>
 #include <dirent.h>
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <regex.h>
+#include <math.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/random.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/file.h>
+#include <sys/sysmacros.h>
+#include <sys/inotify.h>
+#include <sys/syscall.h>
+#include <linux/ioprio.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 /* START CONSTANT DEFINITIONS */
 
@@ -14,6 +48,13 @@
 #define ACTION_CREATE_FILE 3
 #define   ACTION_READ_FILE 4
 #define   ACTION_READ_LINE 5
+#define ACTION_FILTER_LINES 6
+#define ACTION_REPLACE_TEXT 7
+#define ACTION_RECOUNT_LINES 8
+#define ACTION_INSERT_LINES 9
+#define ACTION_DELETE_LINES 10
+#define ACTION_REPLACE_LINE 11
+#define ACTION_MOVE_LINES 12
 
 /* Define max file name size */
 #define MAX_FILE_NAME_SIZE 255
@@ -21,6 +62,9 @@
 /* Define max line content size */
 #define MAX_LINE_CONTENT_SIZE 2048
 
+/* Define max number of characters of a replaced line kept in its changelog entry (longer lines are cut short) */
+#define MAX_LOGGED_LINE_SIZE 1024
+
 /* Define size for current working directory */
 #define MAX_FILE_PATH_SIZE 1000
 
@@ -37,1045 +81,15086 @@
 #define SUCCESS 0
 #define FAILURE -1
 
+/* Definition of record delimiter types used by the line operations */
+#define DELIMITER_LF 0
+#define DELIMITER_CRLF 1
+#define DELIMITER_NUL 2
+#define DELIMITER_CUSTOM 3
+
+/* Define size of the blocks read by the record scanners */
+#define SCAN_BUFFER_SIZE 65536
+
+/* Define the upper limit on threads started by the parallel executor */
+#define MAX_WORKER_THREADS 64
+
+/* Define the number of bytes classified at once by the statistics pass (one bit per byte) */
+#define STATISTICS_CHUNK_SIZE 64
+
+/* Define size of the blocks read by the statistics pass */
+#define STATISTICS_BUFFER_SIZE (1 << 20)
+
+/* Define modes of the line filter */
+#define FILTER_KEEP_MATCHING 0
+#define FILTER_DELETE_MATCHING 1
+#define FILTER_COUNT_MATCHING 2
+
+/* Define max number of literals matched by the line filter */
+#define MAX_FILTER_LITERALS 32
+
+/* Define size of the blocks read by the line filter (grown for longer lines) */
+#define FILTER_BUFFER_SIZE (1 << 20)
+
+/* Define max number of regex groups (\0 to \9) available to replacements */
+#define MAX_REGEX_GROUPS 10
+
+/* Define size of the first read made when looking for the end of a single line */
+#define SAMPLE_READ_SIZE 4096
+
+/* Define max number of files joined at once */
+#define MAX_JOIN_FILES 256
+
+/* Define max number of descriptors kept open between operations (lowered to fit RLIMIT_NOFILE) */
+#define MAX_CACHED_DESCRIPTORS 64
+
+/* Define name of the metadata cache kept in the changelog folder */
+#define METADATA_CACHE_NAME "metadata.cache"
+
+/* Define the marker at the start of a metadata cache file ("FMMC"), changed whenever its layout changes */
+#define METADATA_CACHE_MAGIC 0x434D4D46
+
+/* Define the smallest number of slots in the metadata cache (always a power of two) */
+#define MIN_METADATA_CACHE_SLOTS 1024
+
+/* Define the primes used by the XXH64 checksum */
+#define CHECKSUM_PRIME_1 11400714785074694791ULL
+#define CHECKSUM_PRIME_2 14029467366897019727ULL
+#define CHECKSUM_PRIME_3 1609587929392839161ULL
+#define CHECKSUM_PRIME_4 9650029242287828579ULL
+#define CHECKSUM_PRIME_5 2870177450012600261ULL
+
+/* Define flags of a metadata cache entry */
+#define METADATA_IN_USE 1
+#define METADATA_HAS_CHECKSUM 2
+
+/* Define max number of largest files and directories reported by the disk usage summary */
+#define MAX_USAGE_ENTRIES 1000
+
+/* Define the number of independently locked parts of the hardlink inode set */
+#define INODE_SET_SHARDS 64
+
+/* Define max number of glob patterns given to find, and of tokens in each (one bit per token in the matcher) */
+#define MAX_GLOB_PATTERNS 16
+#define MAX_GLOB_TOKENS 63
+
+/* Define max number of DFA states built for a glob before it falls back to simulating the NFA */
+#define MAX_GLOB_DFA_STATES 256
+
+/* Define size of the directory entry and output buffers used by find */
+#define FIND_BUFFER_SIZE 65536
+
+/* Define comparisons used by the find size and age predicates */
+#define COMPARE_NONE 0
+#define COMPARE_LESS 1
+#define COMPARE_EQUAL 2
+#define COMPARE_GREATER 3
+
+/* Define name prefix of the trigram index files kept in the changelog folder (one per indexed directory) */
+#define TRIGRAM_INDEX_PREFIX "trigrams"
+
+/* Define the marker at the start of a trigram index file ("TRGI"), changed whenever its layout changes */
+#define TRIGRAM_INDEX_MAGIC 0x49475254
+
+/* Define max number of distinct trigrams indexed for one file. Files with more are always scanned */
+#define MAX_FILE_TRIGRAMS (1 << 20)
+
+/* Define flags of a trigram index file entry */
+#define TRIGRAM_FILE_UNINDEXED 1
+
+/* Define name prefix of the word index files kept in the changelog folder (one set per indexed directory) */
+#define WORD_INDEX_PREFIX "words"
+
+/* Define the marker at the start of a word index segment ("FWWS"), changed whenever its layout changes */
+#define WORD_SEGMENT_MAGIC 0x53575746
+
+/* Define max length of an indexed word. Longer words are indexed by their first bytes */
+#define MAX_WORD_LENGTH 64
+
+/* Define the number of word index segments that starts a background merge */
+#define WORD_MERGE_THRESHOLD 8
+
+/* Define max number of words in a word query */
+#define MAX_QUERY_WORDS 32
+
+/* Define flags of a word index file entry */
+#define WORD_FILE_APPENDED 1
+#define WORD_FILE_REMOVED 2
+#define WORD_FILE_UNTERMINATED 4
+#define WORD_FILE_RACY 8
+
+/* Define name of the log written by the background changelog scrub, kept in the changelog folder */
+#define SCRUB_LOG_NAME "scrub.log"
+
+/* Define the pause between passes of the background changelog scrub, in seconds */
+#define SCRUB_INTERVAL_SECONDS 60
+
+/* Define outcomes of checking one file with the changelog scrub */
+#define SCRUB_OK 0
+#define SCRUB_MISMATCH 1
+#define SCRUB_ORPHANED 2
+#define SCRUB_UNTRACKED 3
+#define SCRUB_CHANGED 4
+#define SCRUB_FAILED 5
+#define SCRUB_SKIPPED 6
+
+/* Define the burst allowed by the I/O rate limits, in milliseconds' worth of the limit */
+#define IO_LIMIT_BURST_MS 100
+
+/* Define the largest block moved by one copy call while I/O is rate limited */
+#define IO_LIMIT_CHUNK_SIZE (1 << 20)
+
+/* Define how often the adaptive I/O limits are adjusted, in milliseconds */
+#define IO_ADAPT_INTERVAL_MS 100
+
+/* Define the lowest fraction of the configured I/O limits the adaptive mode backs off to */
+#define IO_MIN_SCALE (1.0 / 64)
+
+/* Define how often the progress of a long operation is reported, in milliseconds */
+#define PROGRESS_INTERVAL_MS 250
+
+/* Define the block size long operations read and write between progress and cancellation checks */
+#define PROGRESS_BLOCK_SIZE (1 << 20)
+
+/* Define size of each buffer in the copy pipeline (lowered to fit the memory budget) */
+#define COPY_BLOCK_SIZE (4 << 20)
+
+/* Define the number of buffers in the copy pipeline's ring */
+#define COPY_RING_SIZE 4
+
+/* Define the buffer alignment needed to re-read a copy with O_DIRECT */
+#define DIRECT_IO_ALIGNMENT 4096
+
+/* Define size of the blocks read by the byte range viewer (a multiple of HEX_ROW_BYTES) */
+#define HEX_VIEW_BLOCK_SIZE 65536
+
+/* Define the number of bytes shown on each row of the hex view */
+#define HEX_ROW_BYTES 16
+
+/* Define the most characters in one row of the hex view (16 offset digits, hex and text) */
+#define HEX_ROW_SIZE 80
+
+/* Define the number of lines between the offsets kept by the pager's line index */
+#define PAGER_INDEX_STRIDE 4096
+
+/* Define the screen size the pager uses when it can't ask the terminal */
+#define PAGER_DEFAULT_ROWS 24
+#define PAGER_DEFAULT_COLUMNS 80
+
+/* Define the number of operations in the menu (the quit option comes after these) */
+#define NUMBER_OF_OPERATIONS 35
+
 /* END CONSTANT DEFINITIONS */
 
+/* START STRUCTURE DEFINITIONS */
+
 /*
-*   Function: fileExists
-*   --------------------
-*   Determines whether a file with the given name already exists
-*
-*   file_name: the name of the file to check
+*   Structure: record_delimiter
+*   ---------------------------
+*   Describes how records (lines) are terminated in a file.
 *
-*   returns: 1 if the file exists, 0 if it doesn't
-*            Allows for semantically logical code. For example:
-*               1. if (fileExists(...)) -> true when the function returns 1
-*               2. if(!fileExists(...)) -> true when the function returns 0
+*   type: one of the DELIMITER_* constants.
+*   byte: the terminating byte. For CRLF this is the '\n' that follows the '\r'.
 */
 
-int fileExists(const char *file_name)
+struct record_delimiter
 {
-    return !access(file_name, F_OK);
-}
+    int type;
+    unsigned char byte;
+};
 
 /*
-*   Function: openFile
+*   Structure: session
 *   ------------------
-*   A wrapper for fopen() that opens a file and exits if fopen() fails.
+*   Settings shared by every operation for the lifetime of the program.
 *
-*   file_name: the name of the file to open
-*   mode: the I/O mode
-*
-*   returns: a pointer to the newly-opened file, or NULL if the program
-*            fails to open the file.
+*   changelog_directory_fd: an O_PATH handle on the changelog directory.
+*   delimiter: the record delimiter used by the line operations.
 */
 
-FILE *openFile(const char *file_name, const char *mode)
+struct session
 {
-    FILE *file = fopen(file_name, mode);
-    if (file == NULL)
-    {
-        fprintf(stderr, "\n[Error] Failed to open file '%s': %s.\n", file_name, strerror(errno));
-        return NULL;
-    }
-    return file;
-}
+    int changelog_directory_fd;
+    struct record_delimiter delimiter;
+};
 
 /*
-*   Function: createFile
-*   --------------------
-*   Creates a new file with the specified name.
-*
-*   file_name: the name to give the new file.
+*   Structure: parallel_job
+*   -----------------------
+*   A set of tasks shared between the worker threads of runInParallel().
 *
-*   returns: SUCCESS on success and FAILURE on failure.
+*   task: the function run for each task index.
+*   context: passed through to every call of task.
+*   task_count: the number of tasks.
+*   next_task: the next task index to hand out.
 */
 
-int createFile(const char *file_name)
+struct parallel_job
 {
-    FILE *file;
+    void (*task)(int task_index, void *context);
+    void *context;
+    int task_count;
+    int next_task;
+};
 
-    if (fileExists(file_name))
-    {
-        fprintf(stderr, "\n[Error] Failed to create file '%s': File aready exists.\n", file_name);
-        return FAILURE;
-    }
+/*
+*   Structure: file_list
+*   --------------------
+*   A growable list of file paths.
+*/
 
-    /* Creates a file if it doesn't exist */
-    file = openFile(file_name, "a");
+struct file_list
+{
+    char **paths;
+    int count;
+    int capacity;
+};
 
-    if (!file)
-    {
-        fprintf(stderr, "\n[Error] Failed to create file '%s': See above for more information.\n", file_name);
-        return FAILURE;
-    }
+/*
+*   Structure: file_statistics
+*   --------------------------
+*   wc-style statistics for a file, plus the state needed to compute them
+*   a chunk at a time.
+*/
 
-    fclose(file);
-    return SUCCESS;
-}
+struct file_statistics
+{
+    long bytes;
+    long lines;
+    long words;
+    long characters;
+    long invalid_sequences;
+    long longest_line;
+
+    /* Running state */
+    long line_start;
+    uint64_t whitespace_carry;
+    uint64_t carriage_return_carry;
+    int utf8_remaining;
+    unsigned char utf8_lower;
+    unsigned char utf8_upper;
+};
 
 /*
-*   Function: deleteFile
-*   --------------------
-*   Deletes an existing file with the specified name
-*
-*   file_name: the name of the file to delete
+*   Structure: chunk_masks
+*   ----------------------
+*   Per-byte classification of a statistics chunk, one bit per byte.
 */
 
-int deleteFile(const char *file_name)
+struct chunk_masks
 {
-    if (remove(file_name))
-    {
-        fprintf(stderr, "\n[Error] Failed to delete file '%s': %s\n", file_name, strerror(errno));
-        return FAILURE;
-    }
+    uint64_t delimiters;
+    uint64_t carriage_returns;
+    uint64_t whitespace;
+    uint64_t continuation;
+    uint64_t non_ascii;
+};
 
-    return SUCCESS;
-}
+/*
+*   Structure: statistics_job
+*   -------------------------
+*   The files and results of a parallel statistics run.
+*/
+
+struct statistics_job
+{
+    const struct file_list *files;
+    const struct record_delimiter *delimiter;
+    struct file_statistics *results;
+    int *errors;
+};
 
 /*
-*   Function: wrename
-*   -----------------
-*   A wrapper for rename() to handle errors.
+*   Structure: line_matcher
+*   -----------------------
+*   A pattern compiled once and then matched against every line of a file.
 *
-*   returns: FAILURE on failure and SUCCESS on success.
+*   use_regex: 1 if lines are matched against regex, 0 if against the literals.
+*   regex: the compiled extended regular expression.
+*   literals: the literals to prefilter with. For a literal set, every line containing
+*             one of them matches. For a regex, this is its required literal, if any.
+*   next_hits, searched: per-literal cache of the next occurrence in the current buffer.
 */
 
-int wrename(const char *old_file_name, const char *new_file_name)
+struct line_matcher
 {
-    if (rename(old_file_name, new_file_name))
-    {
-        fprintf(stderr, "\n[Error] Failed to rename file '%s' to '%s': %s\n", old_file_name, new_file_name, strerror(errno));
-        return FAILURE;
-    }
-    return SUCCESS;
-}
+    int use_regex;
+    regex_t regex;
+    char *literals[MAX_FILTER_LITERALS];
+    size_t literal_lengths[MAX_FILTER_LITERALS];
+    int literal_count;
+    size_t next_hits[MAX_FILTER_LITERALS];
+    int searched[MAX_FILTER_LITERALS];
+};
 
 /*
-*   Function: getChangelogFileName
-*   ------------------------------
-*   Gets the name of the changelog for the given file (the file + .changelog).
+*   Structure: line_buffer
+*   ----------------------
+*   A buffer used to stream a file a block of complete lines at a time.
 *
-*   file_name: name of the file to get the changelog name of.
-*   changelog_file_name: variable to read the changelog file name into.
-*   file_name_size: the size of the file_name array
+*   data: the buffered bytes.
+*   size: the allocated size of data.
+*   filled: the number of bytes read into data.
+*   region_end: the end of the complete lines available for processing.
+*   at_end: set once the end of the file has been read.
 */
 
-void getChangelogFileName(const char *file_name, char *changelog_file_name, const int file_name_size)
+struct line_buffer
 {
-    memcpy(changelog_file_name, file_name, file_name_size);
-    strcat(changelog_file_name, ".changelog");
-}
+    char *data;
+    size_t size;
+    size_t filled;
+    size_t region_end;
+    int at_end;
+};
 
 /*
-*   Function: getNumberOfLinesInFile
-*   --------------------------------
-*   Counts the number of lines in a specified file.
-*
-*   file_name: the name of the file to count the lines from.
+*   Structure: split_job
+*   --------------------
+*   State shared by the parallel tasks of a split.
 *
-*   returns: the number of lines in the specified file
+*   fd: the file being split.
+*   boundaries: part_count + 1 offsets. Part i is [boundaries[i], boundaries[i + 1]).
+*   part_lines: in line mode, the number of lines before each boundary.
+*   chunk_lines: in line mode, the number of lines ending in each chunk_size chunk.
+*   errors: the result of writing each part.
 */
 
-int getNumberOfLinesInFile(FILE *file)
+struct split_job
 {
-    int line_count = 0;
-    int current_character;
-
-    /* Whilst the pointer isn't at the end of the file */
-    while (current_character != EOF)
-    {
-        current_character = fgetc(file);
-        if (current_character == '\n')
-        {
-            line_count++;
-        }
-    }
+    const char *file_name;
+    const struct record_delimiter *delimiter;
+    int fd;
+    off_t file_size;
+    int by_lines;
+    int part_count;
+    off_t *boundaries;
+    long *part_lines;
+    long total_lines;
+    int chunk_count;
+    off_t chunk_size;
+    long *chunk_lines;
+    int *errors;
+};
 
-    /* Set the file pointer to the start of the file once finished */
-    fseek(file, 0, SEEK_SET);
+/*
+*   Structure: line_sample
+*   ----------------------
+*   A line picked by the sampler.
+*
+*   start: the offset of the first byte of the line.
+*   end: the offset just past the line's delimiter.
+*   line_number: the line number, or 0 if it isn't known (approximate sampling).
+*/
 
-    return line_count;
-}
+struct line_sample
+{
+    off_t start;
+    off_t end;
+    long line_number;
+};
 
 /*
-*   Function: validateLineNumber
+*   Structure: cached_descriptor
 *   ----------------------------
-*   Validates whether a given line number is in a file.
-*
-*   file: the file stream to read from.
-*   line_number: the line number to check.
+*   A file descriptor kept open by the descriptor cache.
 *
-*   returns: SUCCESS for a valid line number, otherwise FAILURE.
+*   file_name: the name the descriptor was opened with, or NULL once it is invalidated.
+*   directory_fd: the directory the name is relative to.
+*   flags: the open() flags the descriptor was opened with.
+*   fd: the descriptor, or -1 if the slot is free.
+*   device: the device of the opened file.
+*   inode: the inode of the opened file.
+*   users: the number of callers currently using the descriptor.
+*   last_used: the cache clock at the last use, for least-recently-used eviction.
 */
 
-int validateLineNumber(FILE *file, const int line_number)
+struct cached_descriptor
 {
-    int line_count = getNumberOfLinesInFile(file);
-    if (line_number > line_count || line_number < 1)
-    {
-        fprintf(stderr, "\n[Error] Line %d is out of range. Please enter a valid line number.\n", line_number);
-        return FAILURE;
-    }
-    return SUCCESS;
-}
+    char *file_name;
+    int directory_fd;
+    int flags;
+    int fd;
+    dev_t device;
+    ino_t inode;
+    int users;
+    unsigned long last_used;
+};
 
 /*
-*   Function: getFileContents
-*   ------------------------
-*   Gets the contents of an existing file.
-*
-*   file: the file steam to read from.
+*   Structure: checksum_state
+*   -------------------------
+*   The state of a streaming XXH64 checksum.
 *
-*   returns: the contents of the specified file
+*   accumulators: the four lanes that consume 32-byte stripes.
+*   total_length: the number of bytes added so far.
+*   pending: bytes waiting for a full stripe.
+*   pending_length: the number of bytes in pending.
 */
 
-char *getFileContents(FILE *file)
+struct checksum_state
 {
-    long size_of_file;
+    uint64_t accumulators[4];
+    uint64_t total_length;
+    unsigned char pending[32];
+    size_t pending_length;
+};
 
-    /* Set the stream to the end of the file */
-    fseek(file, 0, SEEK_END);
-
-    /* Get the current value of the position indicator (in bytes) */
-    size_of_file = ftell(file);
+/*
+*   Structure: metadata_entry
+*   -------------------------
+*   What is known about a file, as stored in the metadata cache. Entries are keyed by
+*   device and inode, and are only valid while the size and timestamps still match.
+*
+*   device: the device holding the file.
+*   inode: the inode of the file.
+*   size: the size of the file in bytes.
+*   modified_ns: the modification time, in nanoseconds since the epoch.
+*   changed_ns: the status change time, in nanoseconds since the epoch.
+*   lines: the number of lines, counted with the delimiter below.
+*   checksum: the XXH64 checksum of the contents, if METADATA_HAS_CHECKSUM is set.
+*   flags: METADATA_* flags.
+*   delimiter_type: the type of the delimiter the lines were counted with.
+*   delimiter_byte: the byte of the delimiter the lines were counted with.
+*/
 
-    /* Set the stream to the beginning of the file */
-    fseek(file, 0, SEEK_SET);
+struct metadata_entry
+{
+    uint64_t device;
+    uint64_t inode;
+    uint64_t size;
+    int64_t modified_ns;
+    int64_t changed_ns;
+    int64_t lines;
+    uint64_t checksum;
+    uint32_t flags;
+    uint8_t delimiter_type;
+    uint8_t delimiter_byte;
+    uint16_t padding;
+};
 
-    char *file_contents = malloc(size_of_file);
-    fread(file_contents, 1, size_of_file, file);
+/*
+*   Structure: metadata_cache_header
+*   --------------------------------
+*   The start of the metadata cache file, followed by slot_count entries
+*   forming an open-addressed hash table.
+*/
 
-    return file_contents;
-}
+struct metadata_cache_header
+{
+    uint32_t magic;
+    uint32_t entry_size;
+    uint64_t slot_count;
+    uint64_t entry_count;
+    uint64_t padding;
+};
 
 /*
-*   Function: copyFile
-*   ------------------
-*   Creates a new file with a specified name and the contents of an existing file
-*
-*   existing_file_name: the name of the file the contents will be copied from.
-*   new_file_name: the name of the new file.
+*   Structure: metadata_cache
+*   -------------------------
+*   A metadata cache file mapped into memory.
 *
-*   returns: SUCCESS if the new file was created with the source file contents,
-*            FAILURE if an operation fails.
+*   fd: the open cache file.
+*   header: the mapped header.
+*   entries: the mapped hash table.
+*   mapped_size: the size of the mapping in bytes.
 */
 
-int copyFile(const char *source_file_name, const char *new_file_name)
+struct metadata_cache
 {
+    int fd;
+    struct metadata_cache_header *header;
+    struct metadata_entry *entries;
+    size_t mapped_size;
+};
 
-    FILE *source_file;
-    FILE *new_file;
-    char *file_contents;
-
-    if (fileExists(new_file_name))
-    {
-        fprintf(stderr, "\n[Error] Failed to copy contents from '%s' to '%s': File '%s' already exists.\n", source_file_name, new_file_name, new_file_name);
-        return FAILURE;
-    }
+/*
+*   Structure: metadata_job
+*   -----------------------
+*   The files and results of a parallel metadata report.
+*
+*   files: the files to report on.
+*   cache: the metadata cache (only read while the job runs).
+*   delimiter: the record delimiter used to count lines.
+*   with_checksum: whether checksums are needed.
+*   cutoff_ns: files changed after this time aren't added to the cache.
+*   results: the metadata found for each file.
+*   from_cache: set for files answered from the cache.
+*   errors: set for files that couldn't be read.
+*/
 
-    source_file = openFile(source_file_name, "r");
+struct metadata_job
+{
+    const struct file_list *files;
+    const struct metadata_cache *cache;
+    const struct record_delimiter *delimiter;
+    int with_checksum;
+    int64_t cutoff_ns;
+    struct metadata_entry *results;
+    char *from_cache;
+    int *errors;
+};
 
-    if (!source_file || createFile(new_file_name))
-    {
-        fprintf(stderr, "\n[Error] Failed to copy contents from '%s' to '%s': See above for more information.\n", source_file_name, new_file_name);
-        return FAILURE;
-    }
+/*
+*   Structure: usage_entry
+*   ----------------------
+*   A file or directory ranked by the disk usage summary.
+*
+*   allocated: the bytes allocated on disk.
+*   apparent: the apparent size in bytes.
+*   path: the path of the file or directory.
+*/
 
-    file_contents = getFileContents(source_file);
+struct usage_entry
+{
+    uint64_t allocated;
+    uint64_t apparent;
+    char *path;
+};
 
-    new_file = openFile(new_file_name, "w");
-    if (!new_file)
-    { return FAILURE; }
+/*
+*   Structure: usage_heap
+*   ---------------------
+*   A bounded min-heap keeping the largest entries seen, by allocated size.
+*
+*   entries: the heap, smallest entry first.
+*   count: the number of entries in the heap.
+*   capacity: the most entries the heap keeps.
+*/
 
-    fprintf(new_file, "%s", file_contents);
-    fclose(new_file);
+struct usage_heap
+{
+    struct usage_entry *entries;
+    int count;
+    int capacity;
+};
 
-    free(file_contents);
+/*
+*   Structure: usage_directory
+*   --------------------------
+*   A directory found by the disk usage walk. Directories are stored after their
+*   parent, so totals can be rolled up by walking the list backwards.
+*
+*   path: the path of the directory.
+*   parent: the index of the parent directory, or -1 for the top directory.
+*   allocated: the bytes allocated by the directory and its contents.
+*   apparent: the apparent size of the directory and its contents.
+*/
 
-    return SUCCESS;
+struct usage_directory
+{
+    char *path;
+    long parent;
+    uint64_t allocated;
+    uint64_t apparent;
+};
 
+/*
+*   Structure: inode_key
+*   --------------------
+*   Identifies a file by device and inode, to count hardlinked files once.
+*/
 
-}
+struct inode_key
+{
+    uint64_t device;
+    uint64_t inode;
+};
 
 /*
-*   Function: appendLineToFile
+*   Structure: inode_set_shard
 *   --------------------------
-*   Creates a new line of content at the end of the specified file.
+*   Part of the set of hardlinked inodes already counted, with its own lock so
+*   the walk's threads rarely wait for each other.
 *
-*   file_name: the name of the file to append content to.
-*   content: the content to be appended to the file.
+*   lock: guards the shard.
+*   keys: an open-addressed table of inodes (an all-zero key is a free slot).
+*   count: the number of inodes in the shard.
+*   capacity: the number of slots in the table (a power of two, or 0).
+*/
+
+struct inode_set_shard
+{
+    pthread_mutex_t lock;
+    struct inode_key *keys;
+    size_t count;
+    size_t capacity;
+};
+
+/*
+*   Structure: usage_job
+*   --------------------
+*   The shared state of a parallel disk usage walk. Directories waiting to be
+*   read are kept on a stack, and each worker takes one at a time.
 *
-*   returns: SUCCESS if the content is appended to the file,
-*            FAILURE if an operation fails.
+*   lock: guards the directories, the stack and active_workers.
+*   work_available: signalled when directories are pushed or the walk ends.
+*   directories: every directory found so far.
+*   directory_count: the number of directories found.
+*   directory_capacity: the allocated size of directories.
+*   stack: indexes of directories waiting to be read.
+*   stack_count: the number of directories waiting.
+*   stack_capacity: the allocated size of stack.
+*   active_workers: the number of workers reading a directory.
+*   inodes: the set of hardlinked inodes already counted.
+*   heaps: the largest files seen by each worker.
+*   files: the number of files counted by each worker.
+*   errors: the number of entries each worker couldn't read.
 */
 
-int appendLineToFile(const char *file_name, const char *content)
+struct usage_job
 {
-    FILE *file;
+    pthread_mutex_t lock;
+    pthread_cond_t work_available;
+    struct usage_directory *directories;
+    long directory_count;
+    long directory_capacity;
+    long *stack;
+    long stack_count;
+    long stack_capacity;
+    int active_workers;
+    struct inode_set_shard inodes[INODE_SET_SHARDS];
+    struct usage_heap *heaps;
+    long *files;
+    long *errors;
+};
 
-    if (!fileExists(file_name))
-    {
+/*
+*   Structure: glob_pattern
+*   -----------------------
+*   A glob compiled into an NFA. Position i means the first i tokens have been
+*   matched, so a set of positions fits in a 64-bit mask. A '*' token loops on
+*   its own position; every other token moves to the next position on a byte
+*   in its class.
+*
+*   classes: the set of bytes matched by each token (unused for '*').
+*   literals: the byte matched by each token, or -1 if it isn't a single byte.
+*   stars: a mask with bit i set if token i is '*'.
+*   token_count: the number of tokens (also the accepting position).
+*   prefix_length: the number of literal tokens at the start.
+*   suffix_length: the number of literal tokens after the last '*'.
+*/
+
+struct glob_pattern
+{
+    unsigned char classes[MAX_GLOB_TOKENS][32];
+    int literals[MAX_GLOB_TOKENS];
+    uint64_t stars;
+    int token_count;
+    int prefix_length;
+    int suffix_length;
+};
+
+/*
+*   Structure: glob_dfa
+*   -------------------
+*   A DFA for a glob, built lazily from its NFA as names are matched. Each worker
+*   has its own, so no locking is needed. State 0 is the dead state and state 1 the start.
+*
+*   states: the set of NFA positions for each state.
+*   transitions: the next state for each state and byte, or -1 if not built yet.
+*   state_count: the number of states built.
+*   state_capacity: the number of states transitions has room for.
+*/
+
+struct glob_dfa
+{
+    uint64_t states[MAX_GLOB_DFA_STATES];
+    int *transitions;
+    int state_count;
+    int state_capacity;
+};
+
+/*
+*   Structure: find_query
+*   ---------------------
+*   What find looks for. A name matches if it matches any glob (or there are no
+*   globs), and the size and age predicates hold.
+*
+*   patterns: the compiled globs.
+*   pattern_count: the number of globs.
+*   size_comparison: a COMPARE_* constant for the size predicate.
+*   size: the size to compare against, in bytes.
+*   age_comparison: a COMPARE_* constant for the modification time predicate.
+*   modified_ns: the modification time to compare against, in nanoseconds since the epoch.
+*/
+
+struct find_query
+{
+    struct glob_pattern patterns[MAX_GLOB_PATTERNS];
+    int pattern_count;
+    int size_comparison;
+    uint64_t size;
+    int age_comparison;
+    int64_t modified_ns;
+};
+
+/*
+*   Structure: find_job
+*   -------------------
+*   The shared state of a parallel find. Directories waiting to be read are kept
+*   on a stack, as in the disk usage walk.
+*
+*   lock: guards the stack and active_workers.
+*   work_available: signalled when directories are pushed or the walk ends.
+*   stack: paths of directories waiting to be read.
+*   stack_count: the number of directories waiting.
+*   stack_capacity: the allocated size of stack.
+*   active_workers: the number of workers reading a directory.
+*   query: what to look for.
+*   index: the index of the top directory, taken by the worker that reads it.
+*   dfas: each worker's DFAs, one per glob.
+*   matches: the number of matches found by each worker.
+*   errors: the number of entries each worker couldn't read.
+*/
+
+struct find_job
+{
+    pthread_mutex_t lock;
+    pthread_cond_t work_available;
+    char **stack;
+    long stack_count;
+    long stack_capacity;
+    int active_workers;
+    const struct find_query *query;
+    const struct directory_index *index;
+    struct glob_dfa *dfas;
+    long *matches;
+    long *errors;
+};
+
+/*
+*   Structure: entry_status
+*   -----------------------
+*   The parts of a file's status used by the metadata report, find and the
+*   directory index.
+*
+*   mode: the file type and permissions, or 0 if unknown.
+*   device: the device holding the file.
+*   inode: the inode of the file.
+*   size: the size of the file in bytes.
+*   modified_ns: the modification time, in nanoseconds since the epoch.
+*   changed_ns: the status change time, in nanoseconds since the epoch.
+*/
+
+struct entry_status
+{
+    uint32_t mode;
+    uint64_t device;
+    uint64_t inode;
+    uint64_t size;
+    int64_t modified_ns;
+    int64_t changed_ns;
+};
+
+/*
+*   Structure: indexed_entry
+*   ------------------------
+*   An entry of the directory index.
+*
+*   name: the name of the entry.
+*   hash: the hash of the name.
+*   next: the next entry in the same hash bucket, or -1.
+*   status: the entry's status (not following symlinks).
+*/
+
+struct indexed_entry
+{
+    char *name;
+    uint64_t hash;
+    long next;
+    struct entry_status status;
+};
+
+/*
+*   Structure: directory_index
+*   --------------------------
+*   The entries of the working directory, kept current from inotify events
+*   instead of being read again for every operation.
+*
+*   inotify_fd: the inotify instance watching the directory.
+*   device: the device holding the directory.
+*   inode: the inode of the directory.
+*   entries: the entries of the directory, in no particular order.
+*   count: the number of entries.
+*   capacity: the allocated size of entries.
+*   buckets: the first entry in each hash bucket, or -1.
+*   bucket_count: the number of buckets (a power of two).
+*/
+
+struct directory_index
+{
+    int inotify_fd;
+    uint64_t device;
+    uint64_t inode;
+    struct indexed_entry *entries;
+    long count;
+    long capacity;
+    long *buckets;
+    long bucket_count;
+};
+
+/*
+*   Structure: trigram_index_header
+*   -------------------------------
+*   The start of a trigram index file. The header is followed by the file
+*   entries, the trigram entries, the postings and the file names.
+*
+*   magic: TRIGRAM_INDEX_MAGIC.
+*   file_count: the number of file entries, sorted by name.
+*   trigram_count: the number of trigram entries, sorted by trigram.
+*   postings_size: the size of the postings in bytes.
+*   names_size: the size of the file names in bytes.
+*   cutoff_ns: files changed after this time are read again on the next update.
+*/
+
+struct trigram_index_header
+{
+    uint32_t magic;
+    uint32_t reserved;
+    uint64_t file_count;
+    uint64_t trigram_count;
+    uint64_t postings_size;
+    uint64_t names_size;
+    int64_t cutoff_ns;
+};
+
+/*
+*   Structure: trigram_file_entry
+*   -----------------------------
+*   A file covered by a trigram index, with the status it had when it was read.
+*
+*   name_offset: the offset of the file's name in the names.
+*   size, modified_ns, changed_ns, device, inode: the file's status.
+*   name_length: the length of the name.
+*   flags: TRIGRAM_FILE_UNINDEXED if the file's trigrams weren't kept.
+*/
+
+struct trigram_file_entry
+{
+    uint64_t name_offset;
+    uint64_t size;
+    int64_t modified_ns;
+    int64_t changed_ns;
+    uint64_t device;
+    uint64_t inode;
+    uint32_t name_length;
+    uint32_t flags;
+};
+
+/*
+*   Structure: trigram_entry
+*   ------------------------
+*   A trigram and the files containing it. The file numbers are stored in
+*   increasing order as varint-encoded differences.
+*
+*   trigram: the three bytes, first byte highest.
+*   file_count: the number of files containing the trigram.
+*   offset: the offset of the trigram's postings.
+*/
+
+struct trigram_entry
+{
+    uint32_t trigram;
+    uint32_t file_count;
+    uint64_t offset;
+};
+
+/*
+*   Structure: trigram_index
+*   ------------------------
+*   A trigram index file mapped into memory.
+*
+*   map: the mapping, or NULL if there is no index.
+*   mapped_size: the size of the mapping.
+*   header, files, trigrams, postings, names: the parts of the file.
+*/
+
+struct trigram_index
+{
+    void *map;
+    size_t mapped_size;
+    const struct trigram_index_header *header;
+    const struct trigram_file_entry *files;
+    const struct trigram_entry *trigrams;
+    const unsigned char *postings;
+    const char *names;
+};
+
+/*
+*   Structure: trigram_list
+*   -----------------------
+*   The distinct trigrams of one file, in increasing order.
+*/
+
+struct trigram_list
+{
+    uint32_t *trigrams;
+    long count;
+    long capacity;
+};
+
+/*
+*   Structure: trigram_build_job
+*   ----------------------------
+*   The shared state of a trigram index update.
+*
+*   directory_name: the indexed directory.
+*   files: the files in the directory, sorted by name.
+*   old: the previous index of the directory.
+*   old_files: for each file, its number in the previous index if it is unchanged, otherwise -1.
+*   entries: the new file entries.
+*   lists: the trigrams of each file.
+*   next_file: the next file to hand out to a worker.
+*   rescanned: the number of files read.
+*   errors: the number of files that couldn't be read.
+*/
+
+struct trigram_build_job
+{
+    const char *directory_name;
+    const struct file_list *files;
+    const struct trigram_index *old;
+    long *old_files;
+    struct trigram_file_entry *entries;
+    struct trigram_list *lists;
+    int next_file;
+    int rescanned;
+    int errors;
+};
+
+/*
+*   Structure: content_search_job
+*   -----------------------------
+*   The shared state of a content search.
+*
+*   files: the files in the directory.
+*   candidates: the numbers of the files to scan.
+*   candidate_count: the number of candidates.
+*   next_candidate: the next candidate to hand out to a worker.
+*   patterns: the pattern, as given to compileLineMatcher().
+*   use_regex: whether the pattern is a regex.
+*   delimiter: the record delimiter that terminates each line.
+*   matching_lines: the number of matching lines.
+*   matching_files: the number of files with a matching line.
+*   errors: the number of files that couldn't be searched.
+*/
+
+struct content_search_job
+{
+    const struct file_list *files;
+    const long *candidates;
+    long candidate_count;
+    long next_candidate;
+    char **patterns;
+    int use_regex;
+    const struct record_delimiter *delimiter;
+    long matching_lines;
+    long matching_files;
+    long errors;
+};
+
+/*
+*   Structure: word_segment_header
+*   ------------------------------
+*   The start of a word index segment. The header is followed by the file
+*   entries, the word entries, the postings and the strings (file names and words).
+*
+*   magic: WORD_SEGMENT_MAGIC.
+*   delimiter_type, delimiter_byte: the record delimiter the line numbers were counted with.
+*   file_count: the number of file entries.
+*   word_count: the number of word entries, sorted by word.
+*   postings_size: the size of the postings in bytes.
+*   strings_size: the size of the strings in bytes.
+*/
+
+struct word_segment_header
+{
+    uint32_t magic;
+    uint16_t delimiter_type;
+    uint16_t delimiter_byte;
+    uint64_t file_count;
+    uint64_t word_count;
+    uint64_t postings_size;
+    uint64_t strings_size;
+};
+
+/*
+*   Structure: word_file_entry
+*   --------------------------
+*   A file covered by a word index segment, with the status it had when it was read.
+*   A segment's entry for a file replaces the entries in older segments, unless
+*   it only holds appended lines.
+*
+*   name_offset: the offset of the file's name in the strings.
+*   size, modified_ns, changed_ns, device, inode: the file's status.
+*   lines: the number of lines in the file.
+*   name_length: the length of the name.
+*   flags: WORD_FILE_APPENDED, WORD_FILE_REMOVED, WORD_FILE_UNTERMINATED and WORD_FILE_RACY.
+*/
+
+struct word_file_entry
+{
+    uint64_t name_offset;
+    uint64_t size;
+    int64_t modified_ns;
+    int64_t changed_ns;
+    uint64_t device;
+    uint64_t inode;
+    uint64_t lines;
+    uint32_t name_length;
+    uint32_t flags;
+};
+
+/*
+*   Structure: word_entry
+*   ---------------------
+*   A word and the lines containing it. The postings are (file, line) pairs in
+*   increasing order, stored as varints: the difference from the previous file,
+*   then the line, or the difference from the previous line within the same file.
+*
+*   word_offset: the offset of the word in the strings.
+*   postings_offset: the offset of the word's postings.
+*   word_length: the length of the word.
+*   posting_count: the number of (file, line) pairs.
+*/
+
+struct word_entry
+{
+    uint64_t word_offset;
+    uint64_t postings_offset;
+    uint32_t word_length;
+    uint32_t posting_count;
+};
+
+/*
+*   Structure: word_segment
+*   -----------------------
+*   A word index segment mapped into memory.
+*/
+
+struct word_segment
+{
+    void *map;
+    size_t mapped_size;
+    const struct word_segment_header *header;
+    const struct word_file_entry *files;
+    const struct word_entry *words;
+    const unsigned char *postings;
+    const char *strings;
+};
+
+/*
+*   Structure: word_view
+*   --------------------
+*   The current state of one indexed file, gathered from the segments.
+*
+*   name: the file's name.
+*   newest: the file's entry in the newest segment that has one.
+*   next: the next view in the same hash bucket, or -1.
+*   complete: set once an entry that replaces all older ones has been seen.
+*/
+
+struct word_view
+{
+    const char *name;
+    const struct word_file_entry *newest;
+    long next;
+    int complete;
+};
+
+/*
+*   Structure: word_index
+*   ---------------------
+*   The segments of a directory's word index, oldest first, and the files they cover.
+*
+*   base_name: the name the index files start with.
+*   segment_names: the names of the segment files.
+*   segments: the mapped segments.
+*   segment_count: the number of segments.
+*   next_segment: the number of the next segment to be written.
+*   rebuild: set if the segments can't be used (e.g. the delimiter changed) and must be replaced.
+*   live: for each segment, the view each file entry belongs to, or -1 if a newer
+*         entry replaces it.
+*   views: the files covered by the index.
+*   view_count: the number of views.
+*   buckets: the first view in each hash bucket, or -1.
+*   bucket_count: the number of buckets (a power of two).
+*/
+
+struct word_index
+{
+    char base_name[MAX_FILE_NAME_SIZE];
+    char **segment_names;
+    struct word_segment *segments;
+    int segment_count;
+    long next_segment;
+    int rebuild;
+    long **live;
+    struct word_view *views;
+    long view_count;
+    long *buckets;
+    long bucket_count;
+};
+
+/*
+*   Structure: word_tokens
+*   ----------------------
+*   The words of one file, in the order they appear. Each word is stored as its
+*   length (one byte), its bytes and its line number (four bytes).
+*
+*   data: the stored words.
+*   length: the number of bytes used.
+*   capacity: the allocated size of data.
+*   entry: the status of the file and its line count.
+*   error: set if the file couldn't be read.
+*/
+
+struct word_tokens
+{
+    unsigned char *data;
+    size_t length;
+    size_t capacity;
+    struct word_file_entry entry;
+    int error;
+};
+
+/*
+*   Structure: word_tokenize_job
+*   ----------------------------
+*   The files read in parallel by an update of a word index.
+*/
+
+struct word_tokenize_job
+{
+    char **paths;
+    struct word_tokens *tokens;
+    const struct record_delimiter *delimiter;
+};
+
+/*
+*   Structure: word_posting
+*   -----------------------
+*   A line containing a word, while a segment is being built.
+*/
+
+struct word_posting
+{
+    uint32_t file;
+    uint32_t line;
+};
+
+/*
+*   Structure: word_builder_entry
+*   -----------------------------
+*   A word and its postings, while a segment is being built.
+*/
+
+struct word_builder_entry
+{
+    char *word;
+    uint32_t length;
+    long next;
+    struct word_posting *postings;
+    long count;
+    long capacity;
+};
+
+/*
+*   Structure: word_builder
+*   -----------------------
+*   A word index segment being built in memory.
+*
+*   words: the words added so far.
+*   word_count, word_capacity: the number and allocated size of words.
+*   buckets, bucket_count: the hash buckets of words.
+*   files: the file entries added so far.
+*   names: the name of each file.
+*   file_count, file_capacity: the number and allocated size of files.
+*/
+
+struct word_builder
+{
+    struct word_builder_entry *words;
+    long word_count;
+    long word_capacity;
+    long *buckets;
+    long bucket_count;
+    struct word_file_entry *files;
+    char **names;
+    long file_count;
+    long file_capacity;
+};
+
+/*
+*   Structure: word_merge
+*   ---------------------
+*   What the background merge thread is merging.
+*/
+
+struct word_merge
+{
+    int changelog_directory_fd;
+    char base_name[MAX_FILE_NAME_SIZE];
+    struct record_delimiter delimiter;
+};
+
+/*
+*   Structure: scrub_throttle
+*   -------------------------
+*   Limits the read rate of a changelog scrub across its workers.
+*
+*   lock: guards bytes.
+*   bytes_per_second: the most bytes read per second, or 0 for no limit.
+*   start_ns: when the scrub started (monotonic clock).
+*   bytes: the number of bytes read so far.
+*/
+
+struct scrub_throttle
+{
+    pthread_mutex_t lock;
+    int64_t bytes_per_second;
+    int64_t start_ns;
+    int64_t bytes;
+};
+
+/*
+*   Structure: scrub_entry
+*   ----------------------
+*   A file checked by the changelog scrub.
+*
+*   name: the file's name.
+*   has_changelog: set if the file has a changelog.
+*   exists: set if the file exists.
+*   outcome: SCRUB_OK, SCRUB_MISMATCH, SCRUB_ORPHANED, SCRUB_UNTRACKED, SCRUB_CHANGED,
+*            SCRUB_FAILED or SCRUB_SKIPPED.
+*   repaired: set if the changelog was repaired.
+*   error: the errno of a failed read.
+*   logged: the line count in the file's last changelog entry, or -1 if none.
+*   counted: the line count found in the file.
+*/
+
+struct scrub_entry
+{
+    char *name;
+    int has_changelog;
+    int exists;
+    int outcome;
+    int repaired;
+    int error;
+    long logged;
+    long counted;
+};
+
+/*
+*   Structure: scrub_job
+*   --------------------
+*   The files checked by a changelog scrub.
+*/
+
+struct scrub_job
+{
+    struct scrub_entry *entries;
+    int count;
+    const struct session *session;
+    struct scrub_throttle *throttle;
+    int repair;
+    const int *stop;
+};
+
+/*
+*   Structure: background_scrub
+*   ---------------------------
+*   The settings of the background changelog scrub, which keeps its own copy of the session.
+*/
+
+struct background_scrub
+{
+    struct session session;
+    int repair;
+    int64_t bytes_per_second;
+};
+
+/*
+*   Structure: memory_header
+*   ------------------------
+*   The header in front of a tracked allocation. It is padded to 16 bytes so the
+*   block keeps malloc()'s alignment.
+*/
+
+struct memory_header
+{
+    size_t size;
+    size_t reserved;
+};
+
+/*
+*   Structure: operation_memory
+*   ---------------------------
+*   The memory used by one menu operation.
+*
+*   runs: the number of times the operation has run.
+*   last_allocated, last_resident: the peak tracked allocation and peak resident size of the last run.
+*   peak_allocated, peak_resident: the highest of those over all runs.
+*/
+
+struct operation_memory
+{
+    long runs;
+    int64_t last_allocated;
+    int64_t last_resident;
+    int64_t peak_allocated;
+    int64_t peak_resident;
+};
+
+/*
+*   Structure: io_limiter
+*   ---------------------
+*   Token buckets that limit the bytes and operations per second of bulk I/O.
+*
+*   lock: guards the rest.
+*   bytes_per_second, operations_per_second: the configured limits, 0 for none.
+*   latency_target_ns: the latency that makes the adaptive mode back off, 0 to not adapt.
+*   latency_ns: the recent average I/O latency.
+*   scale: the fraction of the configured limits in force.
+*   byte_tokens, operation_tokens: what can be used before waiting (negative while in debt).
+*   refilled_ns: when the buckets were last refilled.
+*   adjusted_ns: when the scale was last adjusted.
+*   active: set if any limit is configured.
+*/
+
+struct io_limiter
+{
+    pthread_mutex_t lock;
+    int64_t bytes_per_second;
+    int64_t operations_per_second;
+    int64_t latency_target_ns;
+    int64_t latency_ns;
+    double scale;
+    double byte_tokens;
+    double operation_tokens;
+    int64_t refilled_ns;
+    int64_t adjusted_ns;
+    int active;
+};
+
+/*
+*   Structure: progress
+*   -------------------
+*   The progress of a long operation, reported in bytes as its blocks are processed.
+*
+*   label: what the operation is doing, or NULL if no progress is being reported.
+*   total: the number of bytes the operation will process.
+*   done: the number of bytes processed so far.
+*   reported_ns: when the progress was last reported (or the operation started).
+*   shown: set once a progress line has been displayed.
+*/
+
+struct progress
+{
+    const char *label;
+    int64_t total;
+    int64_t done;
+    int64_t reported_ns;
+    int shown;
+};
+
+/*
+*   Structure: copy_block
+*   ---------------------
+*   One buffer in the ring of the copy pipeline.
+*
+*   allocation: the tracked allocation holding the buffer.
+*   data: the buffer, aligned to DIRECT_IO_ALIGNMENT.
+*   length: the number of bytes read into it.
+*/
+
+struct copy_block
+{
+    void *allocation;
+    unsigned char *data;
+    size_t length;
+};
+
+/*
+*   Structure: copy_pipeline
+*   ------------------------
+*   A copy split into reader, checksum and writer stages that pass blocks
+*   around a ring. Block n is in blocks[n % COPY_RING_SIZE]; the reader only
+*   reuses a buffer once both the checksum and writer stages are done with it.
+*
+*   lock: guards the counts and flags.
+*   changed: signalled whenever a count or flag changes.
+*   blocks: the ring of buffers.
+*   block_size: the size of each buffer. Every block but the last is full.
+*   source_fd, destination_fd: the files being copied.
+*   read_count, hashed_count, written_count: the number of blocks each stage has finished.
+*   finished: set once the reader has read the last block.
+*   error: the errno of the first failure (ECANCELED if cancelled), or 0.
+*   checksum: the checksum of the blocks read.
+*/
+
+struct copy_pipeline
+{
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    struct copy_block blocks[COPY_RING_SIZE];
+    size_t block_size;
+    int source_fd;
+    int destination_fd;
+    long read_count;
+    long hashed_count;
+    long written_count;
+    int finished;
+    int error;
+    struct checksum_state checksum;
+};
+
+/*
+*   Structure: pager
+*   ----------------
+*   A file mapped for paging, with a line index that is only built as far as
+*   it has been needed. The index keeps the offset of every PAGER_INDEX_STRIDE'th
+*   line, so finding any indexed line scans at most that many lines.
+*
+*   data: the mapped file.
+*   size: the size of the file.
+*   delimiter: the record delimiter that terminates each line.
+*   checkpoints: checkpoints[i] is the offset of line i * PAGER_INDEX_STRIDE + 1.
+*   checkpoint_count, checkpoint_capacity: the number of checkpoints and the room for them.
+*   indexed_lines: the number of lines scanned so far.
+*   indexed_offset: the offset of the line after the last one scanned.
+*   indexed_to_end: set once the scan reaches the end, when indexed_lines is the line count.
+*/
+
+struct pager
+{
+    const unsigned char *data;
+    size_t size;
+    struct record_delimiter delimiter;
+    size_t *checkpoints;
+    long checkpoint_count;
+    long checkpoint_capacity;
+    long indexed_lines;
+    size_t indexed_offset;
+    int indexed_to_end;
+};
+
+/* Changelogs are always written by this program, so they always use LF */
+static const struct record_delimiter LINE_FEED_DELIMITER = { DELIMITER_LF, '\n' };
+
+/* END STRUCTURE DEFINITIONS */
+
+/*
+*   The directory the program was started in. main() opens it once, and every file
+*   operation resolves names relative to it, so renaming the directory mid-session
+*   has no effect.
+*/
+
+static int working_directory_fd = AT_FDCWD;
+
+/*
+*   Descriptors kept open between operations, so repeated operations on the same files
+*   don't open them again. Shared by the worker threads, so guarded by a lock.
+*/
+
+static struct cached_descriptor descriptor_cache[MAX_CACHED_DESCRIPTORS];
+static int descriptor_cache_capacity = -1;
+static unsigned long descriptor_cache_clock;
+static pthread_mutex_t descriptor_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+*   Function: getDescriptorCacheCapacity
+*   ------------------------------------
+*   Gets the number of descriptors the cache may hold. Uses at most a quarter of
+*   RLIMIT_NOFILE, leaving the rest for temporary files and parallel operations.
+*   Must be called with the cache lock held.
+*
+*   returns: the capacity of the cache.
+*/
+
+int getDescriptorCacheCapacity()
+{
+    struct rlimit limit;
+    int slot;
+
+    if (descriptor_cache_capacity < 0)
+    {
+        descriptor_cache_capacity = MAX_CACHED_DESCRIPTORS;
+        if (!getrlimit(RLIMIT_NOFILE, &limit) && limit.rlim_cur != RLIM_INFINITY
+            && limit.rlim_cur / 4 < MAX_CACHED_DESCRIPTORS)
+        {
+            descriptor_cache_capacity = limit.rlim_cur / 4;
+        }
+
+        for (slot = 0; slot < MAX_CACHED_DESCRIPTORS; slot++)
+        {
+            descriptor_cache[slot].fd = -1;
+        }
+    }
+    return descriptor_cache_capacity;
+}
+
+/*
+*   Function: dropCachedDescriptor
+*   ------------------------------
+*   Removes a descriptor from the cache so it is never handed out again. It is closed
+*   now if nobody is using it, or by releaseDescriptor() once the last user is done.
+*   Must be called with the cache lock held.
+*
+*   entry: the cache slot to drop.
+*/
+
+void dropCachedDescriptor(struct cached_descriptor *entry)
+{
+    free(entry->file_name);
+    entry->file_name = NULL;
+
+    if (entry->users == 0)
+    {
+        close(entry->fd);
+        entry->fd = -1;
+    }
+}
+
+/*
+*   Function: acquireDescriptor
+*   ---------------------------
+*   Gets a descriptor for a file from the cache, opening the file only if it isn't cached.
+*   A cached descriptor is only reused while the name still refers to the same inode, so
+*   files replaced behind the program's back are reopened. The descriptor is shared, so
+*   callers should use pread()/pwrite() rather than relying on the file offset.
+*
+*   directory_fd: the directory the name is relative to.
+*   file_name: the name of the file.
+*   flags: the open() flags. Flags that create or truncate the file bypass the cache,
+*          apart from O_CREAT with O_APPEND.
+*
+*   returns: the descriptor, which must be given back with releaseDescriptor(),
+*            or -1 if the file can't be opened.
+*/
+
+int acquireDescriptor(const int directory_fd, const char *file_name, const int flags)
+{
+    struct cached_descriptor *entry;
+    struct cached_descriptor *free_entry = NULL;
+    struct cached_descriptor *oldest_entry = NULL;
+    struct stat file_status;
+    int name_exists;
+    int capacity;
+    int slot;
+    int fd;
+
+    if ((flags & (O_TRUNC | O_EXCL)) || ((flags & O_CREAT) && !(flags & O_APPEND)))
+    {
+        return openat(directory_fd, file_name, flags | O_CLOEXEC, 0666);
+    }
+
+    name_exists = !fstatat(directory_fd, file_name, &file_status, 0);
+
+    pthread_mutex_lock(&descriptor_cache_lock);
+    capacity = getDescriptorCacheCapacity();
+    for (slot = 0; slot < capacity; slot++)
+    {
+        entry = &descriptor_cache[slot];
+        if (entry->fd < 0)
+        {
+            free_entry = free_entry ? free_entry : entry;
+            continue;
+        }
+        if (entry->file_name && entry->directory_fd == directory_fd && !strcmp(entry->file_name, file_name))
+        {
+            if (!name_exists || entry->device != file_status.st_dev || entry->inode != file_status.st_ino)
+            {
+                /* The file was deleted or replaced since it was cached */
+                dropCachedDescriptor(entry);
+                if (entry->fd < 0)
+                {
+                    free_entry = free_entry ? free_entry : entry;
+                    continue;
+                }
+            }
+            else if (entry->flags == flags)
+            {
+                entry->users++;
+                entry->last_used = ++descriptor_cache_clock;
+                pthread_mutex_unlock(&descriptor_cache_lock);
+                return entry->fd;
+            }
+        }
+
+        if (entry->users == 0 && (!oldest_entry || entry->last_used < oldest_entry->last_used))
+        {
+            oldest_entry = entry;
+        }
+    }
+    pthread_mutex_unlock(&descriptor_cache_lock);
+
+    fd = openat(directory_fd, file_name, flags | O_CLOEXEC, 0666);
+    if (fd < 0 || fstat(fd, &file_status))
+    {
+        return fd;
+    }
+
+    pthread_mutex_lock(&descriptor_cache_lock);
+
+    /* Evict the least recently used descriptor if there's no free slot */
+    entry = free_entry && free_entry->fd < 0 ? free_entry : NULL;
+    if (!entry && oldest_entry && oldest_entry->users == 0 && oldest_entry->fd >= 0)
+    {
+        dropCachedDescriptor(oldest_entry);
+        entry = oldest_entry;
+    }
+
+    /* Without a slot, the descriptor is closed again by releaseDescriptor() */
+    if (entry && (entry->file_name = strdup(file_name)))
+    {
+        entry->directory_fd = directory_fd;
+        entry->flags = flags;
+        entry->fd = fd;
+        entry->device = file_status.st_dev;
+        entry->inode = file_status.st_ino;
+        entry->users = 1;
+        entry->last_used = ++descriptor_cache_clock;
+    }
+    pthread_mutex_unlock(&descriptor_cache_lock);
+
+    return fd;
+}
+
+/*
+*   Function: releaseDescriptor
+*   ---------------------------
+*   Gives back a descriptor from acquireDescriptor(). It stays open in the cache
+*   unless it was invalidated or never cached, in which case it is closed.
+*
+*   fd: the descriptor to give back.
+*
+*   returns: SUCCESS, or FAILURE if closing the descriptor fails.
+*/
+
+int releaseDescriptor(const int fd)
+{
+    int capacity;
+    int slot;
+
+    pthread_mutex_lock(&descriptor_cache_lock);
+    capacity = getDescriptorCacheCapacity();
+    for (slot = 0; slot < capacity; slot++)
+    {
+        if (descriptor_cache[slot].fd == fd && descriptor_cache[slot].users > 0)
+        {
+            descriptor_cache[slot].users--;
+            if (!descriptor_cache[slot].file_name)
+            {
+                dropCachedDescriptor(&descriptor_cache[slot]);
+            }
+            pthread_mutex_unlock(&descriptor_cache_lock);
+            return SUCCESS;
+        }
+    }
+    pthread_mutex_unlock(&descriptor_cache_lock);
+
+    return close(fd) ? FAILURE : SUCCESS;
+}
+
+/*
+*   Function: invalidateDescriptors
+*   -------------------------------
+*   Drops every cached descriptor for a name. Called whenever the program deletes
+*   or renames a file, so the old file isn't used again (or kept alive).
+*
+*   directory_fd: the directory the name is relative to.
+*   file_name: the name of the file.
+*/
+
+void invalidateDescriptors(const int directory_fd, const char *file_name)
+{
+    int capacity;
+    int slot;
+
+    pthread_mutex_lock(&descriptor_cache_lock);
+    capacity = getDescriptorCacheCapacity();
+    for (slot = 0; slot < capacity; slot++)
+    {
+        if (descriptor_cache[slot].fd >= 0 && descriptor_cache[slot].file_name
+            && descriptor_cache[slot].directory_fd == directory_fd && !strcmp(descriptor_cache[slot].file_name, file_name))
+        {
+            dropCachedDescriptor(&descriptor_cache[slot]);
+        }
+    }
+    pthread_mutex_unlock(&descriptor_cache_lock);
+}
+
+/*
+*   Function: fileExists
+*   --------------------
+*   Determines whether a file with the given name already exists
+*
+*   file_name: the name of the file to check
+*
+*   returns: 1 if the file exists, 0 if it doesn't
+*            Allows for semantically logical code. For example:
+*               1. if (fileExists(...)) -> true when the function returns 1
+*               2. if(!fileExists(...)) -> true when the function returns 0
+*/
+
+int fileExists(const char *file_name)
+{
+    return !faccessat(working_directory_fd, file_name, F_OK, 0);
+}
+
+/*
+*   Function: openFileAt
+*   --------------------
+*   A replacement for fopen() that opens a file relative to a directory handle.
+*   Files that are read or appended to are opened through the descriptor cache.
+*
+*   directory_fd: the directory to open the file in.
+*   file_name: the name of the file to open
+*   mode: the fopen() I/O mode ("r", "w" or "a", optionally with '+' and 'b')
+*
+*   returns: a pointer to the newly-opened file, or NULL if the program
+*            fails to open the file.
+*/
+
+FILE *openFileAt(const int directory_fd, const char *file_name, const char *mode)
+{
+    FILE *file = NULL;
+    int stream_fd;
+    int flags;
+    int fd;
+
+    switch (mode[0])
+    {
+        case 'r': flags = 0; break;
+        case 'w': flags = O_CREAT | O_TRUNC; break;
+        case 'a': flags = O_CREAT | O_APPEND; break;
+        default: errno = EINVAL; flags = -1; break;
+    }
+
+    if (flags >= 0)
+    {
+        if (strchr(mode, '+'))
+        { flags |= O_RDWR; }
+        else
+        { flags |= mode[0] == 'r' ? O_RDONLY : O_WRONLY; }
+
+        fd = acquireDescriptor(directory_fd, file_name, flags);
+        if (fd >= 0)
+        {
+            /* The stream gets its own descriptor, so fclose() leaves the cached one open */
+            stream_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+            releaseDescriptor(fd);
+
+            if (stream_fd >= 0 && (mode[0] != 'r' || lseek(stream_fd, 0, SEEK_SET) == 0))
+            {
+                file = fdopen(stream_fd, mode);
+            }
+            if (stream_fd >= 0 && !file)
+            { close(stream_fd); }
+        }
+    }
+
+    if (file == NULL)
+    {
+        fprintf(stderr, "\n[Error] Failed to open file '%s': %s.\n", file_name, strerror(errno));
+        return NULL;
+    }
+    return file;
+}
+
+/*
+*   Function: openFile
+*   ------------------
+*   A wrapper for fopen() that opens a file in the working directory and
+*   reports an error if it fails.
+*
+*   file_name: the name of the file to open
+*   mode: the I/O mode
+*
+*   returns: a pointer to the newly-opened file, or NULL if the program
+*            fails to open the file.
+*/
+
+FILE *openFile(const char *file_name, const char *mode)
+{
+    return openFileAt(working_directory_fd, file_name, mode);
+}
+
+/*
+*   Function: createFile
+*   --------------------
+*   Creates a new file with the specified name.
+*
+*   file_name: the name to give the new file.
+*
+*   returns: SUCCESS on success and FAILURE on failure.
+*/
+
+int createFile(const char *file_name)
+{
+    /* O_EXCL makes the existence check and the creation a single step */
+    int fd = openat(working_directory_fd, file_name, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+
+    if (fd < 0 && errno == EEXIST)
+    {
+        fprintf(stderr, "\n[Error] Failed to create file '%s': File aready exists.\n", file_name);
+        return FAILURE;
+    }
+
+    if (fd < 0)
+    {
+        fprintf(stderr, "\n[Error] Failed to create file '%s': %s\n", file_name, strerror(errno));
+        return FAILURE;
+    }
+
+    close(fd);
+    return SUCCESS;
+}
+
+/*
+*   Function: deleteFileAt
+*   ----------------------
+*   Deletes an existing file with the specified name from a directory.
+*
+*   directory_fd: the directory holding the file.
+*   file_name: the name of the file to delete
+*
+*   returns: SUCCESS on success and FAILURE on failure.
+*/
+
+int deleteFileAt(const int directory_fd, const char *file_name)
+{
+    invalidateDescriptors(directory_fd, file_name);
+    if (unlinkat(directory_fd, file_name, 0))
+    {
+        fprintf(stderr, "\n[Error] Failed to delete file '%s': %s\n", file_name, strerror(errno));
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
+
+/*
+*   Function: deleteFile
+*   --------------------
+*   Deletes an existing file with the specified name
+*
+*   file_name: the name of the file to delete
+*/
+
+int deleteFile(const char *file_name)
+{
+    invalidateDescriptors(working_directory_fd, file_name);
+    if (unlinkat(working_directory_fd, file_name, 0))
+    {
+        fprintf(stderr, "\n[Error] Failed to delete file '%s': %s\n", file_name, strerror(errno));
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
+
+/*
+*   Function: wrename
+*   -----------------
+*   A wrapper for renameat() in the working directory to handle errors.
+*
+*   returns: FAILURE on failure and SUCCESS on success.
+*/
+
+int wrename(const char *old_file_name, const char *new_file_name)
+{
+    invalidateDescriptors(working_directory_fd, old_file_name);
+    invalidateDescriptors(working_directory_fd, new_file_name);
+    if (renameat(working_directory_fd, old_file_name, working_directory_fd, new_file_name))
+    {
+        fprintf(stderr, "\n[Error] Failed to rename file '%s' to '%s': %s\n", old_file_name, new_file_name, strerror(errno));
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+/*
+*   Function: commitTemporaryFile
+*   -----------------------------
+*   Replaces a file with the temporary file in one atomic rename, so the file
+*   is never missing or half written. The temporary file takes on the
+*   permissions of the file it replaces, and is deleted if the rename fails.
+*
+*   file_name: the name of the file to replace.
+*
+*   returns: SUCCESS if the file was replaced, FAILURE if an operation fails.
+*/
+
+int commitTemporaryFile(const char *file_name)
+{
+    struct stat file_status;
+
+    if (!fstatat(working_directory_fd, file_name, &file_status, 0))
+    {
+        fchmodat(working_directory_fd, TEMP_FILE_NAME, file_status.st_mode & 07777, 0);
+    }
+
+    if (wrename(TEMP_FILE_NAME, file_name))
+    {
+        deleteFile(TEMP_FILE_NAME);
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+/*
+*   Function: getChangelogFileName
+*   ------------------------------
+*   Gets the name of the changelog for the given file (the file + .changelog).
+*
+*   file_name: name of the file to get the changelog name of.
+*   changelog_file_name: variable to read the changelog file name into.
+*   file_name_size: the size of the changelog_file_name array
+*
+*   returns: SUCCESS if the name fits, FAILURE if it would be truncated.
+*/
+
+int getChangelogFileName(const char *file_name, char *changelog_file_name, const int file_name_size)
+{
+    int length = snprintf(changelog_file_name, file_name_size, "%s.changelog", file_name);
+
+    if (length < 0 || length >= file_name_size)
+    {
+        fprintf(stderr, "\n[Error] The changelog name for '%s' is too long.\n", file_name);
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+/*
+*   Function: getTimeInNanoseconds
+*   ------------------------------
+*   Converts a timestamp to nanoseconds since the epoch.
+*
+*   seconds: the whole seconds.
+*   nanoseconds: the nanoseconds within the second.
+*
+*   returns: the timestamp in nanoseconds.
+*/
+
+int64_t getTimeInNanoseconds(const int64_t seconds, const int64_t nanoseconds)
+{
+    return seconds * 1000000000 + nanoseconds;
+}
+
+/*
+*   The I/O rate limits shared by every bulk read and write. io_limiter is only
+*   changed while its lock is held; active is read without it so unlimited I/O
+*   pays for a single check.
+*/
+
+static struct io_limiter io_limiter = { PTHREAD_MUTEX_INITIALIZER, 0, 0, 0, 0, 1.0, 0, 0, 0, 0, 0 };
+
+/*
+*   The I/O scheduling class chosen with setIOPriority(), as an ioprio value.
+*   Threads that were already running apply it themselves with applyIOPriority().
+*/
+
+static int io_priority = IOPRIO_PRIO_VALUE(IOPRIO_CLASS_NONE, 0);
+
+/*
+*   Function: getMonotonicTime
+*   --------------------------
+*   Gets the time from a clock that never jumps, for measuring intervals.
+*
+*   returns: the time in nanoseconds.
+*/
+
+int64_t getMonotonicTime()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return getTimeInNanoseconds(now.tv_sec, now.tv_nsec);
+}
+
+/*
+*   Function: setIOLimits
+*   ---------------------
+*   Sets the rate limits applied to bulk I/O. The buckets start full.
+*
+*   bytes_per_second: the most bytes read and written per second, or 0 for no limit.
+*   operations_per_second: the most reads and writes per second, or 0 for no limit.
+*   latency_target_ns: the I/O latency above which the limits are scaled down
+*                      until it recovers, or 0 to keep them fixed.
+*/
+
+void setIOLimits(const int64_t bytes_per_second, const int64_t operations_per_second, const int64_t latency_target_ns)
+{
+    pthread_mutex_lock(&io_limiter.lock);
+    io_limiter.bytes_per_second = bytes_per_second;
+    io_limiter.operations_per_second = operations_per_second;
+    io_limiter.latency_target_ns = latency_target_ns;
+    io_limiter.scale = 1.0;
+    io_limiter.byte_tokens = bytes_per_second * IO_LIMIT_BURST_MS / 1000.0;
+    io_limiter.operation_tokens = operations_per_second * IO_LIMIT_BURST_MS / 1000.0;
+    io_limiter.refilled_ns = getMonotonicTime();
+    io_limiter.adjusted_ns = io_limiter.refilled_ns;
+    io_limiter.latency_ns = 0;
+    __atomic_store_n(&io_limiter.active, bytes_per_second > 0 || operations_per_second > 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&io_limiter.lock);
+}
+
+/*
+*   Function: startIO
+*   -----------------
+*   Marks the start of a read or write, so limitIO() can measure its latency.
+*
+*   returns: the current time, or 0 if I/O isn't limited.
+*/
+
+int64_t startIO()
+{
+    return __atomic_load_n(&io_limiter.active, __ATOMIC_RELAXED) ? getMonotonicTime() : 0;
+}
+
+/*
+*   Function: getIOChunkSize
+*   ------------------------
+*   Gets how much one copy call should move, so a limited copy is charged in
+*   small steps instead of one large burst.
+*
+*   length: the number of bytes left to copy.
+*
+*   returns: the number of bytes to move with the next call.
+*/
+
+off_t getIOChunkSize(const off_t length)
+{
+    return __atomic_load_n(&io_limiter.active, __ATOMIC_RELAXED) && length > IO_LIMIT_CHUNK_SIZE ? IO_LIMIT_CHUNK_SIZE : length;
+}
+
+/*
+*   Function: limitIO
+*   -----------------
+*   Charges a finished read or write to the token buckets and sleeps until the
+*   I/O is back within the limits. The buckets are refilled at the limit rates
+*   and hold at most IO_LIMIT_BURST_MS worth of tokens; an I/O larger than the
+*   tokens left borrows from the future and waits for the debt to be repaid.
+*   With a latency target, the limits are halved when the average latency goes
+*   over it and raised again slowly once it is back under.
+*
+*   bytes: the number of bytes moved.
+*   operations: the number of reads and writes made.
+*   started_ns: the value from startIO(), or 0 to skip the latency measurement.
+*/
+
+void limitIO(const int64_t bytes, const int operations, const int64_t started_ns)
+{
+    struct timespec pause;
+    double bytes_per_second;
+    double operations_per_second;
+    double wait_seconds = 0;
+    int64_t now_ns;
+
+    if (!__atomic_load_n(&io_limiter.active, __ATOMIC_RELAXED) || (bytes <= 0 && operations <= 0))
+    { return; }
+
+    now_ns = getMonotonicTime();
+    pthread_mutex_lock(&io_limiter.lock);
+
+    if (io_limiter.latency_target_ns && started_ns)
+    {
+        /* Average the latency of recent I/O, weighting the newest by an eighth */
+        io_limiter.latency_ns += (now_ns - started_ns - io_limiter.latency_ns) / 8;
+        if (now_ns - io_limiter.adjusted_ns >= (int64_t) IO_ADAPT_INTERVAL_MS * 1000000)
+        {
+            if (io_limiter.latency_ns > io_limiter.latency_target_ns)
+            { io_limiter.scale = io_limiter.scale / 2 > IO_MIN_SCALE ? io_limiter.scale / 2 : IO_MIN_SCALE; }
+            else
+            { io_limiter.scale = io_limiter.scale + 1.0 / 16 < 1 ? io_limiter.scale + 1.0 / 16 : 1; }
+            io_limiter.adjusted_ns = now_ns;
+        }
+    }
+
+    bytes_per_second = io_limiter.bytes_per_second * io_limiter.scale;
+    operations_per_second = io_limiter.operations_per_second * io_limiter.scale;
+    if (bytes_per_second > 0)
+    {
+        io_limiter.byte_tokens += (now_ns - io_limiter.refilled_ns) / 1e9 * bytes_per_second;
+        if (io_limiter.byte_tokens > bytes_per_second * IO_LIMIT_BURST_MS / 1000)
+        { io_limiter.byte_tokens = bytes_per_second * IO_LIMIT_BURST_MS / 1000; }
+        io_limiter.byte_tokens -= bytes;
+        if (io_limiter.byte_tokens < 0)
+        { wait_seconds = -io_limiter.byte_tokens / bytes_per_second; }
+    }
+    if (operations_per_second > 0)
+    {
+        io_limiter.operation_tokens += (now_ns - io_limiter.refilled_ns) / 1e9 * operations_per_second;
+        if (io_limiter.operation_tokens > operations_per_second * IO_LIMIT_BURST_MS / 1000)
+        { io_limiter.operation_tokens = operations_per_second * IO_LIMIT_BURST_MS / 1000; }
+        io_limiter.operation_tokens -= operations;
+        if (io_limiter.operation_tokens < 0 && -io_limiter.operation_tokens / operations_per_second > wait_seconds)
+        { wait_seconds = -io_limiter.operation_tokens / operations_per_second; }
+    }
+    io_limiter.refilled_ns = now_ns;
+    pthread_mutex_unlock(&io_limiter.lock);
+
+    if (wait_seconds > 0)
+    {
+        pause.tv_sec = (time_t) wait_seconds;
+        pause.tv_nsec = (long) ((wait_seconds - pause.tv_sec) * 1e9);
+        nanosleep(&pause, NULL);
+    }
+}
+
+/*
+*   Function: limitedPread
+*   ----------------------
+*   pread() within the I/O limits.
+*/
+
+ssize_t limitedPread(const int fd, void *buffer, const size_t count, const off_t offset)
+{
+    int64_t started_ns = startIO();
+    ssize_t bytes_read = pread(fd, buffer, count, offset);
+
+    limitIO(bytes_read, 1, started_ns);
+    return bytes_read;
+}
+
+/*
+*   Function: limitedPwrite
+*   -----------------------
+*   pwrite() within the I/O limits.
+*/
+
+ssize_t limitedPwrite(const int fd, const void *buffer, const size_t count, const off_t offset)
+{
+    int64_t started_ns = startIO();
+    ssize_t bytes_written = pwrite(fd, buffer, count, offset);
+
+    limitIO(bytes_written, 1, started_ns);
+    return bytes_written;
+}
+
+/*
+*   Function: limitedFread
+*   ----------------------
+*   fread() of bytes within the I/O limits.
+*/
+
+size_t limitedFread(void *buffer, const size_t count, FILE *file)
+{
+    int64_t started_ns = startIO();
+    size_t bytes_read = fread(buffer, 1, count, file);
+
+    limitIO(bytes_read, 1, started_ns);
+    return bytes_read;
+}
+
+/*
+*   Function: limitedFwrite
+*   -----------------------
+*   fwrite() of bytes within the I/O limits. Writes are buffered by the stream,
+*   so only their size is charged, not their latency.
+*/
+
+size_t limitedFwrite(const void *buffer, const size_t count, FILE *file)
+{
+    size_t bytes_written = fwrite(buffer, 1, count, file);
+
+    limitIO(bytes_written, 1, 0);
+    return bytes_written;
+}
+
+/*
+*   Function: setIOPriority
+*   -----------------------
+*   Sets the kernel I/O scheduling class of the program. The kernel only changes
+*   the calling thread, which threads started afterwards inherit; the background
+*   scrub and a running word index merge switch over before their next block or
+*   segment (see applyIOPriority()).
+*
+*   io_class: IOPRIO_CLASS_IDLE, IOPRIO_CLASS_BE or IOPRIO_CLASS_NONE (the default).
+*   level: the priority within the best-effort class, 0 (highest) to 7.
+*
+*   returns: SUCCESS if the class was set, FAILURE if the kernel refused it.
+*/
+
+int setIOPriority(const int io_class, const int level)
+{
+    int value = IOPRIO_PRIO_VALUE(io_class, io_class == IOPRIO_CLASS_BE ? level : 0);
+
+    if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, value))
+    {
+        fprintf(stderr, "\n[Error] Failed to set the I/O priority: %s\n", strerror(errno));
+        return FAILURE;
+    }
+    __atomic_store_n(&io_priority, value, __ATOMIC_RELAXED);
+    return SUCCESS;
+}
+
+/*
+*   Function: applyIOPriority
+*   -------------------------
+*   Gives the calling thread the I/O scheduling class last set with setIOPriority().
+*   Long-running background threads call it between units of work, since a class
+*   set after they started doesn't reach them otherwise.
+*/
+
+void applyIOPriority()
+{
+    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, __atomic_load_n(&io_priority, __ATOMIC_RELAXED));
+}
+
+/*
+*   Macro: DEFINE_RECORD_SCANNER
+*   ----------------------------
+*   Generates a record scanner specialised for one delimiter at compile time.
+*   Every scanner has the same signature and behaviour:
+*
+*   file: the file stream to read from.
+*   custom_byte: the delimiter byte, only used by the custom scanner.
+*   start_offset: the byte offset to start scanning from.
+*   records_to_skip: the number of delimiters to consume before stopping.
+*   offset_after: set to the offset just past the last delimiter consumed
+*                 (start_offset if none were consumed).
+*
+*   returns: the number of delimiters consumed, which is less than
+*            records_to_skip if the end of the file was reached first.
+*
+*   Single byte delimiters are found with memchr(), which is vectorised by the C library.
+*   CRLF looks for '\n' and then checks the byte before it, carrying the last
+*   byte of each block over to the next so pairs split across blocks are found.
+*/
+
+#define DEFINE_RECORD_SCANNER(function_name, delimiter_byte, requires_carriage_return)            \
+long function_name(FILE *file, const unsigned char custom_byte, const long start_offset,          \
+                   const long records_to_skip, long *offset_after)                                 \
+{                                                                                                  \
+    char buffer[SCAN_BUFFER_SIZE];                                                                 \
+    long records_found = 0;                                                                        \
+    long block_offset = start_offset;                                                              \
+    int previous_byte = -1;                                                                        \
+    size_t bytes_read;                                                                             \
+                                                                                                   \
+    (void) custom_byte;                                                                            \
+    *offset_after = start_offset;                                                                  \
+    fseek(file, start_offset, SEEK_SET);                                                           \
+                                                                                                   \
+    while (records_found < records_to_skip                                                         \
+           && (bytes_read = limitedFread(buffer, sizeof(buffer), file)) > 0)                       \
+    {                                                                                              \
+        const char *position = buffer;                                                             \
+        const char *block_end = buffer + bytes_read;                                               \
+        const char *match;                                                                         \
+                                                                                                   \
+        while (records_found < records_to_skip                                                     \
+               && (match = memchr(position, (delimiter_byte), block_end - position)) != NULL)      \
+        {                                                                                          \
+            if (!(requires_carriage_return)                                                        \
+                || (match > buffer ? match[-1] == '\r' : previous_byte == '\r'))                   \
+            {                                                                                      \
+                records_found++;                                                                   \
+                *offset_after = block_offset + (match - buffer) + 1;                               \
+            }                                                                                      \
+            position = match + 1;                                                                  \
+        }                                                                                          \
+                                                                                                   \
+        previous_byte = (unsigned char) block_end[-1];                                             \
+        block_offset += bytes_read;                                                                \
+    }                                                                                              \
+                                                                                                   \
+    return records_found;                                                                          \
+}
+
+DEFINE_RECORD_SCANNER(scanRecordsLF, '\n', 0)
+DEFINE_RECORD_SCANNER(scanRecordsCRLF, '\n', 1)
+DEFINE_RECORD_SCANNER(scanRecordsNUL, '\0', 0)
+DEFINE_RECORD_SCANNER(scanRecordsCustom, custom_byte, 0)
+
+/*
+*   Function: scanRecords
+*   ---------------------
+*   Dispatches to the record scanner specialised for the given delimiter.
+*   See DEFINE_RECORD_SCANNER for the meaning of the arguments and return value.
+*/
+
+long scanRecords(FILE *file, const struct record_delimiter *delimiter, const long start_offset,
+                 const long records_to_skip, long *offset_after)
+{
+    switch (delimiter->type)
+    {
+        case DELIMITER_CRLF:
+            return scanRecordsCRLF(file, '\n', start_offset, records_to_skip, offset_after);
+        case DELIMITER_NUL:
+            return scanRecordsNUL(file, '\0', start_offset, records_to_skip, offset_after);
+        case DELIMITER_CUSTOM:
+            return scanRecordsCustom(file, delimiter->byte, start_offset, records_to_skip, offset_after);
+        default:
+            return scanRecordsLF(file, '\n', start_offset, records_to_skip, offset_after);
+    }
+}
+
+/*
+*   Function: getDelimiterLength
+*   ----------------------------
+*   Gets the number of bytes a delimiter takes up in a file.
+*
+*   delimiter: the record delimiter.
+*
+*   returns: 2 for CRLF, otherwise 1.
+*/
+
+int getDelimiterLength(const struct record_delimiter *delimiter)
+{
+    return delimiter->type == DELIMITER_CRLF ? 2 : 1;
+}
+
+/*
+*   Function: writeDelimiter
+*   ------------------------
+*   Writes a record delimiter to a file stream.
+*
+*   file: the file stream to write to.
+*   delimiter: the record delimiter to write.
+*/
+
+void writeDelimiter(FILE *file, const struct record_delimiter *delimiter)
+{
+    if (delimiter->type == DELIMITER_CRLF)
+    {
+        putc('\r', file);
+    }
+    putc(delimiter->byte, file);
+}
+
+/*
+*   Function: getNumberOfLinesInFile
+*   --------------------------------
+*   Counts the number of lines (records) in a specified file.
+*
+*   file: the file stream to count the lines from.
+*   delimiter: the record delimiter that terminates each line.
+*
+*   returns: the number of lines in the specified file
+*/
+
+long getNumberOfLinesInFile(FILE *file, const struct record_delimiter *delimiter)
+{
+    long line_count;
+    long offset_after;
+
+    line_count = scanRecords(file, delimiter, 0, LONG_MAX, &offset_after);
+
+    /* Set the file pointer to the start of the file once finished */
+    fseek(file, 0, SEEK_SET);
+
+    return line_count;
+}
+
+/*
+*   Function: findLineBounds
+*   ------------------------
+*   Finds where a line starts and ends in a single pass, validating the line number on the way.
+*
+*   file: the file stream to read from.
+*   delimiter: the record delimiter that terminates each line.
+*   line_number: the line number to find.
+*   line_start: set to the offset of the first byte of the line.
+*   line_end: set to the offset just past the line's delimiter.
+*
+*   returns: SUCCESS for a valid line number, otherwise FAILURE.
+*/
+
+int findLineBounds(FILE *file, const struct record_delimiter *delimiter, const long line_number,
+                   long *line_start, long *line_end)
+{
+    if (line_number < 1
+        || scanRecords(file, delimiter, 0, line_number - 1, line_start) != line_number - 1
+        || scanRecords(file, delimiter, *line_start, 1, line_end) != 1)
+    {
+        fprintf(stderr, "\n[Error] Line %ld is out of range. Please enter a valid line number.\n", line_number);
+        return FAILURE;
+    }
+
+    fseek(file, 0, SEEK_SET);
+    return SUCCESS;
+}
+
+/*
+*   Ctrl-C while an operation reports progress asks it to stop at its next block
+*   boundary instead of killing the program, so no temporary file is left behind.
+*   Anywhere else, including the prompts, it quits as usual. progress is the
+*   progress of the running operation; operations run one at a time, so there is
+*   only one.
+*/
+
+static volatile sig_atomic_t operation_running = 0;
+static volatile sig_atomic_t cancel_requested = 0;
+static struct progress progress;
+
+/*
+*   Function: handleInterrupt
+*   -------------------------
+*   Handles SIGINT: requests that the running operation stops, or quits if no
+*   operation is reporting progress.
+*
+*   signal_number: the signal received.
+*/
+
+void handleInterrupt(int signal_number)
+{
+    if (!operation_running)
+    {
+        signal(signal_number, SIG_DFL);
+        raise(signal_number);
+        return;
+    }
+    cancel_requested = 1;
+}
+
+/*
+*   Function: installInterruptHandler
+*   ---------------------------------
+*   Installs the SIGINT handler. Interrupted reads are restarted, so input
+*   prompts are unaffected and the operation stops at its next check.
+*
+*   returns: SUCCESS if the handler is installed,
+*            FAILURE if it can't be.
+*/
+
+int installInterruptHandler()
+{
+    struct sigaction action;
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handleInterrupt;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGINT, &action, NULL))
+    {
+        fprintf(stderr, "\n[Error] Failed to install the interrupt handler: %s\n", strerror(errno));
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+/*
+*   Function: isCancelled
+*   ---------------------
+*   Checks whether the running operation has been asked to stop.
+*
+*   returns: 1 if Ctrl-C was pressed since progress was last started, otherwise 0.
+*/
+
+int isCancelled()
+{
+    return cancel_requested != 0;
+}
+
+/*
+*   Function: startProgress
+*   -----------------------
+*   Starts reporting the progress of a long operation, and lets Ctrl-C cancel
+*   it until finishProgress(). Nothing is displayed unless it runs for longer
+*   than PROGRESS_INTERVAL_MS.
+*
+*   label: what the operation is doing.
+*   total: the number of bytes the operation will process.
+*/
+
+void startProgress(const char *label, const int64_t total)
+{
+    cancel_requested = 0;
+    operation_running = 1;
+    progress.label = label;
+    progress.total = total;
+    progress.done = 0;
+    progress.reported_ns = getMonotonicTime();
+    progress.shown = 0;
+}
+
+/*
+*   Function: reportProgress
+*   ------------------------
+*   Adds processed bytes to the running operation's progress, and displays
+*   it if PROGRESS_INTERVAL_MS has passed since it was last displayed.
+*
+*   bytes: the number of bytes just processed.
+*/
+
+void reportProgress(const int64_t bytes)
+{
+    int64_t now;
+
+    progress.done += bytes;
+    if (!progress.label)
+    { return; }
+
+    now = getMonotonicTime();
+    if (now - progress.reported_ns < (int64_t) PROGRESS_INTERVAL_MS * 1000000)
+    { return; }
+
+    fprintf(stderr, "\r%s: %3d%% (%.1f of %.1f MB)", progress.label,
+            progress.total > 0 ? (int) (progress.done * 100 / progress.total) : 100,
+            progress.done / 1048576.0, progress.total / 1048576.0);
+    fflush(stderr);
+    progress.reported_ns = now;
+    progress.shown = 1;
+}
+
+/*
+*   Function: finishProgress
+*   ------------------------
+*   Stops reporting progress, ending the progress line if one was displayed.
+*   Ctrl-C quits again from here on, but isCancelled() still reports a
+*   cancellation so the operation can clean up. The request is cleared before
+*   the next operation starts.
+*/
+
+void finishProgress()
+{
+    operation_running = 0;
+    if (progress.shown)
+    {
+        fprintf(stderr, "\r%s: %s (%.1f of %.1f MB)\n", progress.label, isCancelled() ? "cancelled" : "done",
+                progress.done / 1048576.0, progress.total / 1048576.0);
+    }
+    progress.label = NULL;
+    progress.shown = 0;
+}
+
+/*
+*   Function: copyFileRange
+*   -----------------------
+*   Copies a range of bytes from one file stream to another in blocks,
+*   reporting progress and stopping early if the operation is cancelled.
+*
+*   source: the file stream to copy from.
+*   destination: the file stream to copy to.
+*   start_offset: the offset of the first byte to copy.
+*   length: the number of bytes to copy, or -1 to copy until the end of the file.
+*
+*   returns: SUCCESS if the range is copied,
+*            FAILURE if a write fails or the operation is cancelled (errno is ECANCELED).
+*/
+
+int copyFileRange(FILE *source, FILE *destination, const long start_offset, long length)
+{
+    char buffer[SCAN_BUFFER_SIZE];
+    size_t bytes_read;
+    size_t bytes_wanted;
+
+    fseek(source, start_offset, SEEK_SET);
+    while (length != 0)
+    {
+        if (isCancelled())
+        {
+            errno = ECANCELED;
+            return FAILURE;
+        }
+
+        bytes_wanted = (length < 0 || length > (long) sizeof(buffer)) ? sizeof(buffer) : (size_t) length;
+        bytes_read = limitedFread(buffer, bytes_wanted, source);
+        if (bytes_read == 0)
+        { break; }
+
+        if (limitedFwrite(buffer, bytes_read, destination) != bytes_read)
+        { return FAILURE; }
+        reportProgress(bytes_read);
+        if (length > 0)
+        {
+            length -= bytes_read;
+        }
+    }
+    return SUCCESS;
+}
+
+/*
+*   The memory budget and the bytes held by tracked allocations. Large buffers
+*   whose size depends on the input are tracked, so operations can choose a
+*   streaming strategy before they would go over the budget.
+*/
+
+static int64_t memory_budget = 0;
+static int64_t memory_in_use = 0;
+static int64_t memory_peak = 0;
+static int resident_peak_reset = 0;
+static struct operation_memory operation_memory[NUMBER_OF_OPERATIONS];
+
+/*
+*   Function: getDefaultMemoryBudget
+*   --------------------------------
+*   Gets the memory budget used until one is set: half of the physical memory.
+*
+*   returns: the budget in bytes.
+*/
+
+int64_t getDefaultMemoryBudget()
+{
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long page_size = sysconf(_SC_PAGESIZE);
+
+    if (pages < 1 || page_size < 1)
+    {
+        return (int64_t) 1 << 30;
+    }
+    return (int64_t) pages * page_size / 2;
+}
+
+/*
+*   Function: fitsMemoryBudget
+*   --------------------------
+*   Checks whether an allocation would keep the tracked memory within the budget.
+*
+*   size: the number of bytes about to be allocated.
+*
+*   returns: 1 if the allocation fits, 0 if it would go over the budget.
+*/
+
+int fitsMemoryBudget(const uint64_t size)
+{
+    return size <= (uint64_t) memory_budget
+           && (int64_t) size <= memory_budget - __atomic_load_n(&memory_in_use, __ATOMIC_RELAXED);
+}
+
+/*
+*   Function: addTrackedBytes
+*   -------------------------
+*   Adds to the bytes held by tracked allocations and raises the peak if needed.
+*
+*   bytes: the change, negative when memory is freed.
+*/
+
+void addTrackedBytes(const int64_t bytes)
+{
+    int64_t in_use = __atomic_add_fetch(&memory_in_use, bytes, __ATOMIC_RELAXED);
+    int64_t peak = __atomic_load_n(&memory_peak, __ATOMIC_RELAXED);
+
+    while (in_use > peak
+           && !__atomic_compare_exchange_n(&memory_peak, &peak, in_use, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/*
+*   Function: allocateTracked
+*   -------------------------
+*   Allocates memory that counts towards the memory budget and the operation's peak.
+*   The size is kept in a header in front of the block.
+*
+*   size: the number of bytes to allocate.
+*
+*   returns: the block (free with freeTracked()), or NULL if memory runs out.
+*/
+
+void *allocateTracked(const size_t size)
+{
+    struct memory_header *header = malloc(sizeof(*header) + size);
+
+    if (!header)
+    { return NULL; }
+    header->size = size;
+    addTrackedBytes(size);
+    return header + 1;
+}
+
+/*
+*   Function: reallocateTracked
+*   ---------------------------
+*   Resizes a block from allocateTracked().
+*
+*   block: the block, or NULL to allocate a new one.
+*   size: the new size.
+*
+*   returns: the resized block, or NULL if memory runs out (the old block is kept).
+*/
+
+void *reallocateTracked(void *block, const size_t size)
+{
+    struct memory_header *header = block ? (struct memory_header *) block - 1 : NULL;
+    size_t old_size = header ? header->size : 0;
+
+    header = realloc(header, sizeof(*header) + size);
+    if (!header)
+    { return NULL; }
+    header->size = size;
+    addTrackedBytes((int64_t) size - (int64_t) old_size);
+    return header + 1;
+}
+
+/*
+*   Function: freeTracked
+*   ---------------------
+*   Frees a block from allocateTracked().
+*
+*   block: the block, or NULL.
+*/
+
+void freeTracked(void *block)
+{
+    struct memory_header *header;
+
+    if (!block)
+    { return; }
+    header = (struct memory_header *) block - 1;
+    addTrackedBytes(-(int64_t) header->size);
+    free(header);
+}
+
+/*
+*   Function: getPeakResidentSize
+*   -----------------------------
+*   Reads the process's peak resident set size (VmHWM) from /proc.
+*
+*   returns: the peak in bytes, or -1 if it can't be read.
+*/
+
+int64_t getPeakResidentSize()
+{
+    char line[DEFAULT_INPUT_BUFFER];
+    long long kilobytes = -1;
+    FILE *status = fopen("/proc/self/status", "r");
+
+    if (!status)
+    { return -1; }
+    while (fgets(line, sizeof(line), status) && sscanf(line, "VmHWM: %lld kB", &kilobytes) != 1);
+    fclose(status);
+    return kilobytes < 0 ? -1 : kilobytes * 1024;
+}
+
+/*
+*   Function: beginOperationMemory
+*   ------------------------------
+*   Starts measuring the memory used by an operation: the tracked peak is reset to
+*   what is in use now, and the kernel's peak resident size is reset to the current one.
+*
+*   returns: the tracked bytes in use when the operation starts.
+*/
+
+int64_t beginOperationMemory()
+{
+    int64_t in_use = __atomic_load_n(&memory_in_use, __ATOMIC_RELAXED);
+    int fd = open("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);
+
+    __atomic_store_n(&memory_peak, in_use, __ATOMIC_RELAXED);
+
+    /* Writing 5 resets VmHWM. Without it the peak would cover the whole run so far */
+    resident_peak_reset = fd >= 0 && write(fd, "5", 1) == 1;
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    return in_use;
+}
+
+/*
+*   Function: endOperationMemory
+*   ----------------------------
+*   Records the memory used by an operation, keeping the highest of its runs.
+*
+*   operation: the operation's number in the menu.
+*   baseline: the value returned by beginOperationMemory().
+*/
+
+void endOperationMemory(const int operation, const int64_t baseline)
+{
+    struct operation_memory *stats = &operation_memory[operation];
+    int64_t allocated = __atomic_load_n(&memory_peak, __ATOMIC_RELAXED) - baseline;
+    int64_t resident = resident_peak_reset ? getPeakResidentSize() : -1;
+
+    if (stats->runs++ == 0)
+    {
+        stats->peak_resident = -1;
+    }
+    stats->last_allocated = allocated;
+    stats->last_resident = resident;
+    if (allocated > stats->peak_allocated)
+    { stats->peak_allocated = allocated; }
+    if (resident > stats->peak_resident)
+    { stats->peak_resident = resident; }
+}
+
+/*
+*   Function: formatMegabytes
+*   -------------------------
+*   Formats a number of bytes in megabytes for the memory report.
+*
+*   bytes: the number of bytes, or -1 if unknown.
+*   output: set to the text (at least 32 bytes).
+*
+*   returns: output.
+*/
+
+char *formatMegabytes(const int64_t bytes, char *output)
+{
+    if (bytes < 0)
+    { strcpy(output, "-"); }
+    else
+    { snprintf(output, 32, "%.2f", bytes / 1048576.0); }
+    return output;
+}
+
+/*
+*   Function: showMemoryUse
+*   -----------------------
+*   Displays the memory budget and, for each operation run so far, the peak
+*   tracked allocation and peak resident size of its last run and of all its runs.
+*   The resident size is unknown ('-') where the kernel's peak can't be reset.
+*/
+
+void showMemoryUse()
+{
+    char sizes[4][32];
+    int operation;
+
+    printf("Memory budget: %.1f MB (%.1f MB held by tracked buffers)\n", memory_budget / 1048576.0,
+           __atomic_load_n(&memory_in_use, __ATOMIC_RELAXED) / 1048576.0);
+    printf("%9s %6s %16s %16s %16s %16s\n", "Operation", "Runs", "Last alloc (MB)", "Last RSS (MB)", "Peak alloc (MB)",
+           "Peak RSS (MB)");
+
+    for (operation = 0; operation < NUMBER_OF_OPERATIONS; operation++)
+    {
+        if (operation_memory[operation].runs)
+        {
+            printf("%9d %6ld %16s %16s %16s %16s\n", operation, operation_memory[operation].runs,
+                   formatMegabytes(operation_memory[operation].last_allocated, sizes[0]),
+                   formatMegabytes(operation_memory[operation].last_resident, sizes[1]),
+                   formatMegabytes(operation_memory[operation].peak_allocated, sizes[2]),
+                   formatMegabytes(operation_memory[operation].peak_resident, sizes[3]));
+        }
+    }
+}
+
+/*
+*   Function: getNumberOfWorkers
+*   ----------------------------
+*   Gets the number of worker threads the parallel executor should start.
+*
+*   task_count: the number of tasks that will be run.
+*
+*   returns: the number of online processors, capped at the number of tasks.
+*/
+
+int getNumberOfWorkers(const int task_count)
+{
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (processors < 1)
+    {
+        processors = 1;
+    }
+    if (processors > MAX_WORKER_THREADS)
+    {
+        processors = MAX_WORKER_THREADS;
+    }
+    return task_count < processors ? task_count : (int) processors;
+}
+
+/*
+*   Function: parallelWorker
+*   ------------------------
+*   Thread body for runInParallel(). Claims task indexes until none are left.
+*
+*   argument: the parallel_job being run.
+*/
+
+void *parallelWorker(void *argument)
+{
+    struct parallel_job *job = argument;
+    int task_index;
+
+    while ((task_index = __atomic_fetch_add(&job->next_task, 1, __ATOMIC_RELAXED)) < job->task_count)
+    {
+        job->task(task_index, job->context);
+    }
+    return NULL;
+}
+
+/*
+*   Function: runInParallel
+*   -----------------------
+*   Runs a task once for every index in [0, task_count) across a pool of worker threads
+*   and waits for all of them to finish. Tasks are handed out one at a time, so
+*   uneven tasks (e.g. files of very different sizes) balance themselves.
+*   Falls back to running on the calling thread if threads can't be started.
+*
+*   task_count: the number of tasks to run.
+*   task: the function called with each task index and the context.
+*   context: passed through to every call of task.
+*/
+
+void runInParallel(const int task_count, void (*task)(int task_index, void *context), void *context)
+{
+    pthread_t workers[MAX_WORKER_THREADS];
+    struct parallel_job job = { task, context, task_count, 0 };
+    int worker_count = getNumberOfWorkers(task_count);
+    int started = 0;
+
+    /* The calling thread is one of the workers, so start one fewer thread */
+    while (started < worker_count - 1 && !pthread_create(&workers[started], NULL, parallelWorker, &job))
+    {
+        started++;
+    }
+
+    parallelWorker(&job);
+
+    while (started > 0)
+    {
+        pthread_join(workers[--started], NULL);
+    }
+}
+
+/*
+*   Function: addFileToList
+*   -----------------------
+*   Adds a copy of a path to a file list, growing the list if needed.
+*
+*   list: the file list to add to.
+*   path: the path to add.
+*
+*   returns: SUCCESS if the path was added, FAILURE if memory runs out.
+*/
+
+int addFileToList(struct file_list *list, const char *path)
+{
+    char **paths;
+
+    if (list->count == list->capacity)
+    {
+        int capacity = list->capacity ? list->capacity * 2 : 64;
+        paths = realloc(list->paths, capacity * sizeof(*paths));
+        if (!paths)
+        {
+            fprintf(stderr, "\n[Error] Failed to build file list: %s\n", strerror(errno));
+            return FAILURE;
+        }
+        list->paths = paths;
+        list->capacity = capacity;
+    }
+
+    list->paths[list->count] = strdup(path);
+    if (!list->paths[list->count])
+    {
+        fprintf(stderr, "\n[Error] Failed to build file list: %s\n", strerror(errno));
+        return FAILURE;
+    }
+    list->count++;
+    return SUCCESS;
+}
+
+/*
+*   Function: freeFileList
+*   ----------------------
+*   Frees every path in a file list and the list itself.
+*
+*   list: the file list to free.
+*/
+
+void freeFileList(struct file_list *list)
+{
+    int i;
+
+    for (i = 0; i < list->count; i++)
+    {
+        free(list->paths[i]);
+    }
+    free(list->paths);
+    list->paths = NULL;
+    list->count = 0;
+    list->capacity = 0;
+}
+
+/*
+*   Function: openDirectory
+*   -----------------------
+*   Opens a directory in the working directory for reading its entries.
+*
+*   directory_name: the directory to open.
+*
+*   returns: the open directory stream, or NULL if it can't be opened.
+*/
+
+DIR *openDirectory(const char *directory_name)
+{
+    DIR *directory = NULL;
+    int fd = openat(working_directory_fd, directory_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if (fd >= 0)
+    {
+        directory = fdopendir(fd);
+        if (!directory)
+        { close(fd); }
+    }
+
+    if (!directory)
+    {
+        fprintf(stderr, "\n[Error] Failed to open directory '%s': %s\n", directory_name, strerror(errno));
+    }
+    return directory;
+}
+
+/*
+*   Function: getEntryStatus
+*   ------------------------
+*   Gets the status of a file with a single statx() call.
+*
+*   directory_fd: the directory the name is relative to.
+*   file_name: the name of the file.
+*   flags: statx() flags, e.g. AT_SYMLINK_NOFOLLOW.
+*   status: the status to fill in.
+*
+*   returns: SUCCESS, or FAILURE (with errno set) if statx() fails.
+*/
+
+int getEntryStatus(const int directory_fd, const char *file_name, const int flags, struct entry_status *status)
+{
+    struct statx file_status;
+
+    if (statx(directory_fd, file_name, flags | AT_NO_AUTOMOUNT, STATX_TYPE | STATX_MODE | STATX_INO | STATX_SIZE | STATX_MTIME | STATX_CTIME,
+              &file_status))
+    {
+        return FAILURE;
+    }
+
+    status->mode = file_status.stx_mode;
+    status->device = makedev(file_status.stx_dev_major, file_status.stx_dev_minor);
+    status->inode = file_status.stx_ino;
+    status->size = file_status.stx_size;
+    status->modified_ns = getTimeInNanoseconds(file_status.stx_mtime.tv_sec, file_status.stx_mtime.tv_nsec);
+    status->changed_ns = getTimeInNanoseconds(file_status.stx_ctime.tv_sec, file_status.stx_ctime.tv_nsec);
+    return SUCCESS;
+}
+
+/*
+*   The index of the working directory, or NULL while indexing is off.
+*   Only the main thread changes it, between operations.
+*/
+
+static struct directory_index *working_directory_index = NULL;
+
+/*
+*   Function: hashEntryName
+*   -----------------------
+*   Hashes a file name for the directory index (FNV-1a).
+*
+*   name: the name to hash.
+*
+*   returns: the hash.
+*/
+
+uint64_t hashEntryName(const char *name)
+{
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (; *name; name++)
+    {
+        hash = (hash ^ (unsigned char) *name) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+/*
+*   Function: findIndexedEntry
+*   --------------------------
+*   Looks a name up in the directory index.
+*
+*   index: the directory index.
+*   name: the name to find.
+*
+*   returns: the position of the entry, or -1 if it isn't in the index.
+*/
+
+long findIndexedEntry(const struct directory_index *index, const char *name)
+{
+    uint64_t hash = hashEntryName(name);
+    long entry;
+
+    for (entry = index->buckets[hash & (index->bucket_count - 1)]; entry >= 0; entry = index->entries[entry].next)
+    {
+        if (index->entries[entry].hash == hash && !strcmp(index->entries[entry].name, name))
+        { return entry; }
+    }
+    return -1;
+}
+
+/*
+*   Function: linkIndexedEntry
+*   --------------------------
+*   Puts an entry at the front of its hash bucket.
+*
+*   index: the directory index.
+*   entry: the position of the entry.
+*/
+
+void linkIndexedEntry(struct directory_index *index, const long entry)
+{
+    long *bucket = &index->buckets[index->entries[entry].hash & (index->bucket_count - 1)];
+
+    index->entries[entry].next = *bucket;
+    *bucket = entry;
+}
+
+/*
+*   Function: resizeIndexBuckets
+*   ----------------------------
+*   Rebuilds the hash buckets so there is at least one per entry.
+*
+*   index: the directory index.
+*
+*   returns: SUCCESS, or FAILURE if memory runs out (the old buckets are kept).
+*/
+
+int resizeIndexBuckets(struct directory_index *index)
+{
+    long bucket_count = 1024;
+    long *buckets;
+    long entry;
+
+    while (bucket_count < index->count)
+    {
+        bucket_count *= 2;
+    }
+    if (bucket_count == index->bucket_count)
+    { return SUCCESS; }
+
+    buckets = malloc(bucket_count * sizeof(*buckets));
+    if (!buckets)
+    { return FAILURE; }
+
+    free(index->buckets);
+    index->buckets = buckets;
+    index->bucket_count = bucket_count;
+    memset(buckets, 0xFF, bucket_count * sizeof(*buckets));
+    for (entry = 0; entry < index->count; entry++)
+    {
+        linkIndexedEntry(index, entry);
+    }
+    return SUCCESS;
+}
+
+/*
+*   Function: appendIndexedEntry
+*   ----------------------------
+*   Adds a name to the end of the index without hashing it into a bucket.
+*
+*   index: the directory index.
+*   name: the name to add.
+*
+*   returns: the position of the new entry, or -1 if memory runs out.
+*/
+
+long appendIndexedEntry(struct directory_index *index, const char *name)
+{
+    struct indexed_entry *entries;
+    long capacity;
+
+    if (index->count == index->capacity)
+    {
+        capacity = index->capacity ? index->capacity * 2 : 1024;
+        entries = realloc(index->entries, capacity * sizeof(*entries));
+        if (!entries)
+        { return -1; }
+        index->entries = entries;
+        index->capacity = capacity;
+    }
+
+    memset(&index->entries[index->count], 0, sizeof(*index->entries));
+    index->entries[index->count].name = strdup(name);
+    if (!index->entries[index->count].name)
+    { return -1; }
+    index->entries[index->count].hash = hashEntryName(name);
+    return index->count++;
+}
+
+/*
+*   Function: updateIndexedEntry
+*   ----------------------------
+*   Brings one name in the index up to date: adds or refreshes it if it exists,
+*   and removes it if it doesn't.
+*
+*   index: the directory index.
+*   name: the name that changed.
+*
+*   returns: SUCCESS, or FAILURE if memory runs out.
+*/
+
+int updateIndexedEntry(struct directory_index *index, const char *name)
+{
+    struct entry_status status;
+    long entry = findIndexedEntry(index, name);
+    long last = index->count - 1;
+    long *link;
+
+    if (!getEntryStatus(working_directory_fd, name, AT_SYMLINK_NOFOLLOW, &status))
+    {
+        if (entry < 0)
+        {
+            entry = appendIndexedEntry(index, name);
+            if (entry < 0 || resizeIndexBuckets(index))
+            { return FAILURE; }
+            linkIndexedEntry(index, entry);
+        }
+        index->entries[entry].status = status;
+        return SUCCESS;
+    }
+
+    if (entry < 0)
+    { return SUCCESS; }
+
+    /* Unlink the entry, then move the last entry into its place */
+    for (link = &index->buckets[index->entries[entry].hash & (index->bucket_count - 1)]; *link != entry;
+         link = &index->entries[*link].next);
+    *link = index->entries[entry].next;
+    free(index->entries[entry].name);
+
+    if (entry != last)
+    {
+        for (link = &index->buckets[index->entries[last].hash & (index->bucket_count - 1)]; *link != last;
+             link = &index->entries[*link].next);
+        *link = entry;
+        index->entries[entry] = index->entries[last];
+    }
+    index->count--;
+    return SUCCESS;
+}
+
+/*
+*   Function: indexStatusTask
+*   -------------------------
+*   Parallel task that gets the status of one block of index entries.
+*
+*   task_index: the index of the block.
+*   context: the directory_index.
+*/
+
+void indexStatusTask(int task_index, void *context)
+{
+    struct directory_index *index = context;
+    long entry;
+
+    for (entry = (long) task_index * 1024; entry < index->count && entry < (long) (task_index + 1) * 1024; entry++)
+    {
+        if (getEntryStatus(working_directory_fd, index->entries[entry].name, AT_SYMLINK_NOFOLLOW, &index->entries[entry].status))
+        {
+            index->entries[entry].status.mode = 0;
+        }
+    }
+}
+
+/*
+*   Function: scanDirectoryIndex
+*   ----------------------------
+*   Reads the whole working directory into the index, replacing what was there.
+*   Entry statuses are fetched in parallel.
+*
+*   index: the directory index.
+*
+*   returns: SUCCESS, or FAILURE if the directory can't be read.
+*/
+
+int scanDirectoryIndex(struct directory_index *index)
+{
+    struct dirent64 *directory_entry;
+    char *buffer;
+    ssize_t bytes_read;
+    ssize_t offset;
+    long entry;
+    int fd;
+
+    for (entry = 0; entry < index->count; entry++)
+    {
+        free(index->entries[entry].name);
+    }
+    index->count = 0;
+
+    fd = openat(working_directory_fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    buffer = malloc(FIND_BUFFER_SIZE);
+    if (fd < 0 || !buffer)
+    {
+        fprintf(stderr, "\n[Error] Failed to index the current directory: %s\n", strerror(errno));
+        free(buffer);
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return FAILURE;
+    }
+
+    while ((bytes_read = getdents64(fd, buffer, FIND_BUFFER_SIZE)) > 0)
+    {
+        for (offset = 0; offset < bytes_read; offset += directory_entry->d_reclen)
+        {
+            directory_entry = (struct dirent64 *) (buffer + offset);
+            if (strcmp(directory_entry->d_name, ".") && strcmp(directory_entry->d_name, "..")
+                && appendIndexedEntry(index, directory_entry->d_name) < 0)
+            {
+                bytes_read = -1;
+                break;
+            }
+        }
+        if (bytes_read < 0)
+        { break; }
+    }
+
+    free(buffer);
+    close(fd);
+    if (bytes_read < 0 || resizeIndexBuckets(index))
+    {
+        fprintf(stderr, "\n[Error] Failed to index the current directory: %s\n", strerror(errno));
+        return FAILURE;
+    }
+
+    memset(index->buckets, 0xFF, index->bucket_count * sizeof(*index->buckets));
+    for (entry = 0; entry < index->count; entry++)
+    {
+        linkIndexedEntry(index, entry);
+    }
+    runInParallel((index->count + 1023) / 1024, indexStatusTask, index);
+    return SUCCESS;
+}
+
+/*
+*   Function: stopDirectoryIndex
+*   ----------------------------
+*   Turns the directory index off and frees it.
+*/
+
+void stopDirectoryIndex()
+{
+    struct directory_index *index = working_directory_index;
+    long entry;
+
+    if (!index)
+    { return; }
+
+    for (entry = 0; entry < index->count; entry++)
+    {
+        free(index->entries[entry].name);
+    }
+    if (index->inotify_fd >= 0)
+    {
+        close(index->inotify_fd);
+    }
+    free(index->entries);
+    free(index->buckets);
+    free(index);
+    working_directory_index = NULL;
+}
+
+/*
+*   Function: startDirectoryIndex
+*   -----------------------------
+*   Turns the directory index on: starts watching the working directory, then
+*   reads it. Watching first means nothing that changes during the read is missed.
+*
+*   returns: SUCCESS if the index is on, FAILURE if an operation fails.
+*/
+
+int startDirectoryIndex()
+{
+    struct directory_index *index;
+    struct stat directory_status;
+    char watch_path[64];
+
+    index = calloc(1, sizeof(*index));
+    if (!index)
+    {
+        fprintf(stderr, "\n[Error] Failed to index the current directory: %s\n", strerror(errno));
+        return FAILURE;
+    }
+    working_directory_index = index;
+
+    /* Watch through the directory handle, so a renamed directory is still the one watched */
+    snprintf(watch_path, sizeof(watch_path), "/proc/self/fd/%d", working_directory_fd);
+    index->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (index->inotify_fd < 0 || fstat(working_directory_fd, &directory_status)
+        || inotify_add_watch(index->inotify_fd, working_directory_fd == AT_FDCWD ? "." : watch_path,
+                             IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_MODIFY | IN_ATTRIB
+                             | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_ONLYDIR | IN_EXCL_UNLINK) < 0)
+    {
+        fprintf(stderr, "\n[Error] Failed to watch the current directory: %s\n", strerror(errno));
+        stopDirectoryIndex();
+        return FAILURE;
+    }
+    index->device = directory_status.st_dev;
+    index->inode = directory_status.st_ino;
+
+    if (scanDirectoryIndex(index))
+    {
+        stopDirectoryIndex();
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+/*
+*   Function: refreshDirectoryIndex
+*   -------------------------------
+*   Applies the inotify events that arrived since the last refresh. If the event
+*   queue overflowed, some changes are unknown, so the directory is read again.
+*
+*   returns: SUCCESS if the index is current, FAILURE if it had to be turned off.
+*/
+
+int refreshDirectoryIndex()
+{
+    struct directory_index *index = working_directory_index;
+    const struct inotify_event *event;
+    char events[FIND_BUFFER_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t bytes_read;
+    ssize_t offset;
+    int overflowed = 0;
+
+    if (!index)
+    { return FAILURE; }
+
+    while ((bytes_read = read(index->inotify_fd, events, sizeof(events))) > 0)
+    {
+        for (offset = 0; offset < bytes_read; offset += sizeof(*event) + event->len)
+        {
+            event = (const struct inotify_event *) (events + offset);
+
+            if (event->mask & (IN_DELETE_SELF | IN_IGNORED))
+            {
+                fprintf(stderr, "\n[Error] The current directory was deleted. Turning the directory index off.\n");
+                stopDirectoryIndex();
+                return FAILURE;
+            }
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                overflowed = 1;
+            }
+            else if (event->len && !overflowed && updateIndexedEntry(index, event->name))
+            {
+                overflowed = 1;
+            }
+        }
+    }
+
+    if (overflowed && scanDirectoryIndex(index))
+    {
+        stopDirectoryIndex();
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+/*
+*   Function: getDirectoryIndex
+*   ---------------------------
+*   Gets the up-to-date index of a directory, if it is the indexed one.
+*
+*   directory_name: the directory, relative to the working directory.
+*
+*   returns: the index, or NULL if the directory isn't indexed.
+*/
+
+const struct directory_index *getDirectoryIndex(const char *directory_name)
+{
+    struct stat directory_status;
+
+    if (!working_directory_index
+        || fstatat(working_directory_fd, directory_name, &directory_status, 0)
+        || directory_status.st_dev != working_directory_index->device
+        || directory_status.st_ino != working_directory_index->inode
+        || refreshDirectoryIndex())
+    {
+        return NULL;
+    }
+    return working_directory_index;
+}
+
+/*
+*   Function: collectFilesInDirectory
+*   ---------------------------------
+*   Builds a list of the regular files in a directory, skipping hidden entries
+*   the same way the directory listing does.
+*
+*   directory_name: the directory to list.
+*   list: the (empty) file list to add the paths to.
+*
+*   returns: SUCCESS if every file in the directory was listed,
+*            FAILURE if an operation fails, in which case the list is freed.
+*/
+
+int collectFilesInDirectory(const char *directory_name, struct file_list *list)
+{
+    const struct directory_index *index = getDirectoryIndex(directory_name);
+    DIR *directory;
+    struct dirent *directory_pointer;
+    struct stat file_status;
+    char *path;
+    size_t path_size;
+    long entry;
+    int status = SUCCESS;
+
+    if (index)
+    {
+        for (entry = 0; entry < index->count; entry++)
+        {
+            if (index->entries[entry].name[0] == '.')
+            { continue; }
+
+            path_size = strlen(directory_name) + strlen(index->entries[entry].name) + 2;
+            path = malloc(path_size);
+            if (!path)
+            {
+                fprintf(stderr, "\n[Error] Failed to build file list: %s\n", strerror(errno));
+                status = FAILURE;
+                break;
+            }
+            snprintf(path, path_size, "%s/%s", directory_name, index->entries[entry].name);
+
+            if ((S_ISREG(index->entries[entry].status.mode)
+                 || ((!index->entries[entry].status.mode || S_ISLNK(index->entries[entry].status.mode))
+                     && !fstatat(working_directory_fd, path, &file_status, 0) && S_ISREG(file_status.st_mode)))
+                && addFileToList(list, path))
+            {
+                free(path);
+                status = FAILURE;
+                break;
+            }
+            free(path);
+        }
+    }
+    else
+    {
+        directory = openDirectory(directory_name);
+        if (!directory)
+        { return FAILURE; }
+
+        while ((directory_pointer = readdir(directory)) != NULL)
+        {
+            if (directory_pointer->d_name[0] == '.')
+            { continue; }
+
+            path_size = strlen(directory_name) + strlen(directory_pointer->d_name) + 2;
+            path = malloc(path_size);
+            if (!path)
+            {
+                fprintf(stderr, "\n[Error] Failed to build file list: %s\n", strerror(errno));
+                status = FAILURE;
+                break;
+            }
+            snprintf(path, path_size, "%s/%s", directory_name, directory_pointer->d_name);
+
+            /* The entry type usually comes with the entry, which saves a stat() per file */
+            if ((directory_pointer->d_type == DT_REG
+                 || ((directory_pointer->d_type == DT_UNKNOWN || directory_pointer->d_type == DT_LNK)
+                     && !fstatat(dirfd(directory), directory_pointer->d_name, &file_status, 0) && S_ISREG(file_status.st_mode)))
+                && addFileToList(list, path))
+            {
+                free(path);
+                status = FAILURE;
+                break;
+            }
+            free(path);
+        }
+        closedir(directory);
+    }
+
+    /* A partial list would be taken for the whole directory */
+    if (status)
+    { freeFileList(list); }
+    return status;
+}
+
+/*
+*   Function: rotateLeft
+*   --------------------
+*   Rotates the bits of a 64-bit number to the left.
+*
+*   value: the number to rotate.
+*   bits: the number of bits to rotate by (1 to 63).
+*
+*   returns: the rotated number.
+*/
+
+uint64_t rotateLeft(const uint64_t value, const int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+/*
+*   Function: readLittleEndian
+*   --------------------------
+*   Reads a little-endian number of up to 8 bytes, whatever the byte order of the machine.
+*
+*   bytes: the bytes to read.
+*   count: the number of bytes in the number.
+*
+*   returns: the number.
+*/
+
+uint64_t readLittleEndian(const unsigned char *bytes, const int count)
+{
+    uint64_t value = 0;
+    int i;
+
+    for (i = count - 1; i >= 0; i--)
+    {
+        value = (value << 8) | bytes[i];
+    }
+    return value;
+}
+
+/*
+*   Function: checksumRound
+*   -----------------------
+*   Mixes 8 bytes of input into an XXH64 accumulator.
+*
+*   accumulator: the accumulator to mix into.
+*   input: the input bytes as a number.
+*
+*   returns: the new accumulator.
+*/
+
+uint64_t checksumRound(uint64_t accumulator, const uint64_t input)
+{
+    accumulator += input * CHECKSUM_PRIME_2;
+    accumulator = rotateLeft(accumulator, 31);
+    return accumulator * CHECKSUM_PRIME_1;
+}
+
+/*
+*   Function: initialiseChecksum
+*   ----------------------------
+*   Starts a new XXH64 checksum (with a seed of 0).
+*
+*   state: the checksum state to initialise.
+*/
+
+void initialiseChecksum(struct checksum_state *state)
+{
+    memset(state, 0, sizeof(*state));
+    state->accumulators[0] = CHECKSUM_PRIME_1 + CHECKSUM_PRIME_2;
+    state->accumulators[1] = CHECKSUM_PRIME_2;
+    state->accumulators[2] = 0;
+    state->accumulators[3] = 0 - CHECKSUM_PRIME_1;
+}
+
+/*
+*   Function: addStripeToChecksum
+*   -----------------------------
+*   Mixes a 32-byte stripe into the four accumulators, 8 bytes each.
+*
+*   state: the checksum state.
+*   stripe: the 32 bytes to add.
+*/
+
+void addStripeToChecksum(struct checksum_state *state, const unsigned char *stripe)
+{
+    int i;
+
+    for (i = 0; i < 4; i++)
+    {
+        state->accumulators[i] = checksumRound(state->accumulators[i], readLittleEndian(stripe + i * 8, 8));
+    }
+}
+
+/*
+*   Function: updateChecksum
+*   ------------------------
+*   Adds a block of bytes to a checksum. Blocks can be any size; bytes that
+*   don't fill a stripe are held until the next call.
+*
+*   state: the checksum state.
+*   data: the bytes to add.
+*   length: the number of bytes to add.
+*/
+
+void updateChecksum(struct checksum_state *state, const unsigned char *data, size_t length)
+{
+    size_t taken;
+
+    state->total_length += length;
+
+    if (state->pending_length)
+    {
+        taken = sizeof(state->pending) - state->pending_length;
+        if (taken > length)
+        { taken = length; }
+
+        memcpy(state->pending + state->pending_length, data, taken);
+        state->pending_length += taken;
+        data += taken;
+        length -= taken;
+
+        if (state->pending_length < sizeof(state->pending))
+        { return; }
+
+        addStripeToChecksum(state, state->pending);
+        state->pending_length = 0;
+    }
+
+    for (; length >= sizeof(state->pending); data += sizeof(state->pending), length -= sizeof(state->pending))
+    {
+        addStripeToChecksum(state, data);
+    }
+
+    memcpy(state->pending, data, length);
+    state->pending_length = length;
+}
+
+/*
+*   Function: finishChecksum
+*   ------------------------
+*   Gets the checksum of everything added so far.
+*
+*   state: the checksum state.
+*
+*   returns: the XXH64 checksum.
+*/
+
+uint64_t finishChecksum(const struct checksum_state *state)
+{
+    const unsigned char *tail = state->pending;
+    size_t remaining = state->pending_length;
+    uint64_t hash;
+    int i;
+
+    if (state->total_length >= sizeof(state->pending))
+    {
+        hash = rotateLeft(state->accumulators[0], 1) + rotateLeft(state->accumulators[1], 7)
+               + rotateLeft(state->accumulators[2], 12) + rotateLeft(state->accumulators[3], 18);
+        for (i = 0; i < 4; i++)
+        {
+            hash ^= checksumRound(0, state->accumulators[i]);
+            hash = hash * CHECKSUM_PRIME_1 + CHECKSUM_PRIME_4;
+        }
+    }
+    else
+    {
+        hash = CHECKSUM_PRIME_5;
+    }
+    hash += state->total_length;
+
+    for (; remaining >= 8; tail += 8, remaining -= 8)
+    {
+        hash ^= checksumRound(0, readLittleEndian(tail, 8));
+        hash = rotateLeft(hash, 27) * CHECKSUM_PRIME_1 + CHECKSUM_PRIME_4;
+    }
+    if (remaining >= 4)
+    {
+        hash ^= readLittleEndian(tail, 4) * CHECKSUM_PRIME_1;
+        hash = rotateLeft(hash, 23) * CHECKSUM_PRIME_2 + CHECKSUM_PRIME_3;
+        tail += 4;
+        remaining -= 4;
+    }
+    for (; remaining > 0; tail++, remaining--)
+    {
+        hash ^= *tail * CHECKSUM_PRIME_5;
+        hash = rotateLeft(hash, 11) * CHECKSUM_PRIME_1;
+    }
+
+    /* Make every input bit affect every output bit */
+    hash ^= hash >> 33;
+    hash *= CHECKSUM_PRIME_2;
+    hash ^= hash >> 29;
+    hash *= CHECKSUM_PRIME_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+/*
+*   Function: getFileContents
+*   ------------------------
+*   Gets the contents of an existing file, if they fit in the memory budget.
+*
+*   file: the file steam to read from.
+*   length: set to the number of bytes read.
+*
+*   returns: the contents of the specified file, terminated by '\0' (free with freeTracked()),
+*            or NULL if they can't be read. errno is EFBIG if they don't fit in the budget,
+*            in which case the file should be streamed instead, or ECANCELED if the
+*            operation was cancelled while reading.
+*/
+
+char *getFileContents(FILE *file, long *length)
+{
+    long size_of_file;
+    char *file_contents;
+    size_t bytes_wanted;
+    size_t bytes_read;
+
+    *length = 0;
+
+    /* Set the stream to the end of the file */
+    fseek(file, 0, SEEK_END);
+
+    /* Get the current value of the position indicator (in bytes) */
+    size_of_file = ftell(file);
+
+    /* Set the stream to the beginning of the file */
+    fseek(file, 0, SEEK_SET);
+
+    if (size_of_file < 0)
+    { return NULL; }
+    if (!fitsMemoryBudget((uint64_t) size_of_file + 1))
+    {
+        errno = EFBIG;
+        return NULL;
+    }
+
+    file_contents = allocateTracked(size_of_file + 1);
+    if (!file_contents)
+    { return NULL; }
+
+    /* Read in blocks so progress can be reported and Ctrl-C doesn't wait for the whole file */
+    while (*length < size_of_file)
+    {
+        if (isCancelled())
+        {
+            freeTracked(file_contents);
+            *length = 0;
+            errno = ECANCELED;
+            return NULL;
+        }
+
+        bytes_wanted = size_of_file - *length > PROGRESS_BLOCK_SIZE ? PROGRESS_BLOCK_SIZE : (size_t) (size_of_file - *length);
+        bytes_read = limitedFread(file_contents + *length, bytes_wanted, file);
+        *length += bytes_read;
+        reportProgress(bytes_read);
+        if (bytes_read < bytes_wanted)
+        { break; }
+    }
+    file_contents[*length] = '\0';
+
+    return file_contents;
+}
+
+/*
+*   Function: failCopyPipeline
+*   --------------------------
+*   Stops every stage of a copy pipeline after a failure.
+*
+*   pipeline: the copy pipeline.
+*   error: the errno describing the failure.
+*/
+
+void failCopyPipeline(struct copy_pipeline *pipeline, const int error)
+{
+    pthread_mutex_lock(&pipeline->lock);
+    if (!pipeline->error)
+    { pipeline->error = error ? error : EIO; }
+    pthread_cond_broadcast(&pipeline->changed);
+    pthread_mutex_unlock(&pipeline->lock);
+}
+
+/*
+*   Function: waitForCopyBlock
+*   --------------------------
+*   Waits until the reader has produced the block a stage needs next.
+*
+*   pipeline: the copy pipeline.
+*   count: the number of blocks the stage has finished.
+*
+*   returns: the block to process, or NULL once every block is done or the copy failed.
+*/
+
+struct copy_block *waitForCopyBlock(struct copy_pipeline *pipeline, const long count)
+{
+    struct copy_block *block = NULL;
+
+    pthread_mutex_lock(&pipeline->lock);
+    while (!pipeline->error && count == pipeline->read_count && !pipeline->finished)
+    {
+        pthread_cond_wait(&pipeline->changed, &pipeline->lock);
+    }
+    if (!pipeline->error && count < pipeline->read_count)
+    { block = &pipeline->blocks[count % COPY_RING_SIZE]; }
+    pthread_mutex_unlock(&pipeline->lock);
+    return block;
+}
+
+/*
+*   Function: finishCopyBlock
+*   -------------------------
+*   Marks a block as done by a stage, so the reader can reuse its buffer.
+*
+*   pipeline: the copy pipeline.
+*   count: the stage's count of finished blocks.
+*/
+
+void finishCopyBlock(struct copy_pipeline *pipeline, long *count)
+{
+    pthread_mutex_lock(&pipeline->lock);
+    (*count)++;
+    pthread_cond_broadcast(&pipeline->changed);
+    pthread_mutex_unlock(&pipeline->lock);
+}
+
+/*
+*   Function: checksumCopyBlocks
+*   ----------------------------
+*   The checksum stage of a copy pipeline, run on its own thread.
+*
+*   context: the copy pipeline.
+*
+*   returns: NULL.
+*/
+
+void *checksumCopyBlocks(void *context)
+{
+    struct copy_pipeline *pipeline = context;
+    struct copy_block *block;
+
+    while ((block = waitForCopyBlock(pipeline, pipeline->hashed_count)) != NULL)
+    {
+        updateChecksum(&pipeline->checksum, block->data, block->length);
+        finishCopyBlock(pipeline, &pipeline->hashed_count);
+    }
+    return NULL;
+}
+
+/*
+*   Function: writeCopyBlocks
+*   -------------------------
+*   The writer stage of a copy pipeline, run on its own thread.
+*
+*   context: the copy pipeline.
+*
+*   returns: NULL.
+*/
+
+void *writeCopyBlocks(void *context)
+{
+    struct copy_pipeline *pipeline = context;
+    struct copy_block *block;
+    off_t offset;
+    size_t written;
+    ssize_t bytes_written;
+
+    while ((block = waitForCopyBlock(pipeline, pipeline->written_count)) != NULL)
+    {
+        offset = (off_t) pipeline->written_count * pipeline->block_size;
+        for (written = 0; written < block->length; written += bytes_written)
+        {
+            bytes_written = limitedPwrite(pipeline->destination_fd, block->data + written,
+                                          getIOChunkSize(block->length - written), offset + written);
+            if (bytes_written <= 0)
+            {
+                failCopyPipeline(pipeline, bytes_written < 0 ? errno : ENOSPC);
+                return NULL;
+            }
+        }
+        finishCopyBlock(pipeline, &pipeline->written_count);
+    }
+    return NULL;
+}
+
+/*
+*   Function: readIntoBlock
+*   -----------------------
+*   Fills a buffer from a file, stopping early only at the end of the file.
+*
+*   fd: the file to read.
+*   buffer: the buffer to fill.
+*   size: the size of the buffer.
+*   offset: the offset to read from.
+*
+*   returns: the number of bytes read, or -1 if a read fails.
+*/
+
+ssize_t readIntoBlock(const int fd, unsigned char *buffer, const size_t size, const off_t offset)
+{
+    size_t length = 0;
+    ssize_t bytes_read;
+
+    while (length < size)
+    {
+        bytes_read = limitedPread(fd, buffer + length, getIOChunkSize(size - length), offset + length);
+        if (bytes_read < 0 && errno == EINTR)
+        { continue; }
+        if (bytes_read < 0)
+        { return -1; }
+        if (bytes_read == 0)
+        { break; }
+        length += bytes_read;
+    }
+    return length;
+}
+
+/*
+*   Function: runCopyPipeline
+*   -------------------------
+*   Copies a whole file through the pipeline. The calling thread reads, so it
+*   can report progress and notice Ctrl-C, while two threads checksum and
+*   write the blocks it has read.
+*
+*   pipeline: the copy pipeline, with its file descriptors and buffers set.
+*
+*   returns: SUCCESS if the file is copied (its checksum is then in pipeline->checksum),
+*            FAILURE if an operation fails, with errno set.
+*/
+
+int runCopyPipeline(struct copy_pipeline *pipeline)
+{
+    struct copy_block *block;
+    pthread_t checksum_thread;
+    pthread_t writer_thread;
+    off_t offset = 0;
+    ssize_t length;
+    long reusable;
+    int error;
+
+    initialiseChecksum(&pipeline->checksum);
+    if (pthread_create(&checksum_thread, NULL, checksumCopyBlocks, pipeline))
+    {
+        errno = EAGAIN;
+        return FAILURE;
+    }
+    if (pthread_create(&writer_thread, NULL, writeCopyBlocks, pipeline))
+    {
+        failCopyPipeline(pipeline, EAGAIN);
+        pthread_join(checksum_thread, NULL);
+        errno = EAGAIN;
+        return FAILURE;
+    }
+
+    while (1)
+    {
+        /* Wait for both later stages to be done with the oldest buffer */
+        pthread_mutex_lock(&pipeline->lock);
+        while (1)
+        {
+            reusable = pipeline->hashed_count < pipeline->written_count ? pipeline->hashed_count : pipeline->written_count;
+            if (pipeline->error || pipeline->read_count - reusable < COPY_RING_SIZE)
+            { break; }
+            pthread_cond_wait(&pipeline->changed, &pipeline->lock);
+        }
+        error = pipeline->error;
+        pthread_mutex_unlock(&pipeline->lock);
+
+        if (error)
+        { break; }
+        if (isCancelled())
+        {
+            failCopyPipeline(pipeline, ECANCELED);
+            break;
+        }
+
+        block = &pipeline->blocks[pipeline->read_count % COPY_RING_SIZE];
+        length = readIntoBlock(pipeline->source_fd, block->data, pipeline->block_size, offset);
+        if (length < 0)
+        {
+            failCopyPipeline(pipeline, errno);
+            break;
+        }
+        block->length = length;
+        offset += length;
+        reportProgress(length);
+
+        /* A short block is the last one; an empty one isn't passed on */
+        pthread_mutex_lock(&pipeline->lock);
+        if (length > 0)
+        { pipeline->read_count++; }
+        pipeline->finished = (size_t) length < pipeline->block_size;
+        pthread_cond_broadcast(&pipeline->changed);
+        pthread_mutex_unlock(&pipeline->lock);
+        if (pipeline->finished)
+        { break; }
+    }
+
+    pthread_join(checksum_thread, NULL);
+    pthread_join(writer_thread, NULL);
+    if (pipeline->error)
+    {
+        errno = pipeline->error;
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+/*
+*   Function: createCopyPipeline
+*   ----------------------------
+*   Sets up a copy pipeline, with buffers no larger than the file needs and
+*   small enough to fit in the memory budget.
+*
+*   pipeline: the pipeline to set up.
+*   source_fd, destination_fd: the files to copy between.
+*   file_size: the size of the source file.
+*
+*   returns: SUCCESS if the pipeline is ready,
+*            FAILURE if its buffers can't be allocated.
+*/
+
+int createCopyPipeline(struct copy_pipeline *pipeline, const int source_fd, const int destination_fd, const off_t file_size)
+{
+    size_t block_size = COPY_BLOCK_SIZE;
+    int i;
+
+    memset(pipeline, 0, sizeof(*pipeline));
+    pthread_mutex_init(&pipeline->lock, NULL);
+    pthread_cond_init(&pipeline->changed, NULL);
+    pipeline->source_fd = source_fd;
+    pipeline->destination_fd = destination_fd;
+
+    while (block_size > DIRECT_IO_ALIGNMENT && (off_t) block_size / 2 >= file_size)
+    { block_size /= 2; }
+    while (block_size > SCAN_BUFFER_SIZE && !fitsMemoryBudget((uint64_t) COPY_RING_SIZE * (block_size + DIRECT_IO_ALIGNMENT)))
+    { block_size /= 2; }
+    pipeline->block_size = block_size;
+
+    for (i = 0; i < COPY_RING_SIZE; i++)
+    {
+        pipeline->blocks[i].allocation = allocateTracked(block_size + DIRECT_IO_ALIGNMENT);
+        if (!pipeline->blocks[i].allocation)
+        {
+            errno = ENOMEM;
+            return FAILURE;
+        }
+        pipeline->blocks[i].data = (unsigned char *) (((uintptr_t) pipeline->blocks[i].allocation + DIRECT_IO_ALIGNMENT - 1)
+                                                      & ~(uintptr_t) (DIRECT_IO_ALIGNMENT - 1));
+    }
+    return SUCCESS;
+}
+
+/*
+*   Function: freeCopyPipeline
+*   --------------------------
+*   Frees the buffers of a copy pipeline.
+*
+*   pipeline: the pipeline to free.
+*/
+
+void freeCopyPipeline(struct copy_pipeline *pipeline)
+{
+    int i;
+
+    for (i = 0; i < COPY_RING_SIZE; i++)
+    {
+        freeTracked(pipeline->blocks[i].allocation);
+    }
+    pthread_mutex_destroy(&pipeline->lock);
+    pthread_cond_destroy(&pipeline->changed);
+}
+
+/*
+*   Function: verifyCopy
+*   --------------------
+*   Re-reads a copy from the disk and compares its checksum with the source's.
+*   The copy is read with O_DIRECT, or, where the file system doesn't support
+*   it, after flushing it and dropping it from the page cache, so the check
+*   sees what was stored rather than what is still in memory.
+*
+*   file_name: the name of the copy.
+*   destination_fd: the copy, open for writing.
+*   expected: the checksum of the source.
+*   buffer: a buffer aligned to DIRECT_IO_ALIGNMENT.
+*   buffer_size: the size of the buffer (a multiple of DIRECT_IO_ALIGNMENT).
+*
+*   returns: SUCCESS if the checksums match,
+*            FAILURE if they don't or an operation fails, with errno set.
+*/
+
+int verifyCopy(const char *file_name, const int destination_fd, const uint64_t expected,
+               unsigned char *buffer, const size_t buffer_size)
+{
+    struct checksum_state checksum;
+    ssize_t length;
+    off_t offset = 0;
+    int direct = 1;
+    int fd;
+
+    if (fdatasync(destination_fd))
+    { return FAILURE; }
+
+    fd = openat(working_directory_fd, file_name, O_RDONLY | O_DIRECT | O_CLOEXEC);
+    if (fd < 0)
+    {
+        direct = 0;
+        fd = openat(working_directory_fd, file_name, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        { return FAILURE; }
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    }
+
+    initialiseChecksum(&checksum);
+    while (1)
+    {
+        if (isCancelled())
+        {
+            close(fd);
+            errno = ECANCELED;
+            return FAILURE;
+        }
+
+        length = readIntoBlock(fd, buffer, buffer_size, offset);
+
+        /* Some file systems accept O_DIRECT but reject the reads; start again without it */
+        if (length < 0 && errno == EINVAL && direct)
+        {
+            close(fd);
+            fd = openat(working_directory_fd, file_name, O_RDONLY | O_CLOEXEC);
+            if (fd < 0)
+            { return FAILURE; }
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+            reportProgress(-offset);
+            direct = 0;
+            offset = 0;
+            initialiseChecksum(&checksum);
+            continue;
+        }
+        if (length < 0)
+        {
+            close(fd);
+            return FAILURE;
+        }
+
+        updateChecksum(&checksum, buffer, length);
+        offset += length;
+        reportProgress(length);
+        if ((size_t) length < buffer_size)
+        { break; }
+    }
+    close(fd);
+
+    if (finishChecksum(&checksum) != expected)
+    {
+        errno = EIO;
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+/*
+*   Function: copyFile
+*   ------------------
+*   Creates a new file with a specified name and the contents of an existing file.
+*   The file is copied through a pipeline that checksums each block as it is
+*   written, so the copy can be verified without reading the source again.
+*   Progress is reported as it runs; if it fails or is cancelled, the new file is removed.
+*
+*   existing_file_name: the name of the file the contents will be copied from.
+*   new_file_name: the name of the new file.
+*   verify: 1 to re-read the new file from the disk and compare checksums, 0 to skip it.
+*
+*   returns: SUCCESS if the new file was created with the source file contents,
+*            FAILURE if an operation fails.
+*/
+
+int copyFile(const char *source_file_name, const char *new_file_name, const int verify)
+{
+    struct copy_pipeline pipeline;
+    struct stat file_status;
+    int destination_fd;
+    int source_fd;
+    int status;
+
+    source_fd = acquireDescriptor(working_directory_fd, source_file_name, O_RDONLY);
+    if (source_fd < 0 || fstat(source_fd, &file_status))
+    {
+        fprintf(stderr, "\n[Error] Failed to copy contents from '%s' to '%s': %s\n", source_file_name, new_file_name, strerror(errno));
+        if (source_fd >= 0)
+        { releaseDescriptor(source_fd); }
+        return FAILURE;
+    }
+
+    /* O_EXCL makes the existence check and the creation a single step */
+    destination_fd = openat(working_directory_fd, new_file_name, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+    if (destination_fd < 0)
+    {
+        if (errno == EEXIST)
+        { fprintf(stderr, "\n[Error] Failed to copy contents from '%s' to '%s': File '%s' already exists.\n", source_file_name, new_file_name, new_file_name); }
+        else
+        { fprintf(stderr, "\n[Error] Failed to create file '%s': %s\n", new_file_name, strerror(errno)); }
+        releaseDescriptor(source_fd);
+        return FAILURE;
+    }
+    posix_fadvise(source_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    startProgress(verify ? "Copying and verifying" : "Copying", verify ? 2 * (int64_t) file_status.st_size : file_status.st_size);
+    status = createCopyPipeline(&pipeline, source_fd, destination_fd, file_status.st_size);
+    if (!status)
+    { status = runCopyPipeline(&pipeline); }
+    if (!status && verify)
+    {
+        status = verifyCopy(new_file_name, destination_fd, finishChecksum(&pipeline.checksum),
+                            pipeline.blocks[0].data, pipeline.block_size);
+    }
+    finishProgress();
+    freeCopyPipeline(&pipeline);
+
+    if (close(destination_fd) && !status)
+    { status = FAILURE; }
+    releaseDescriptor(source_fd);
+
+    /* The source is never written, so a failed copy only has to remove the new file */
+    if (status)
+    {
+        if (isCancelled())
+        { fprintf(stderr, "\n[Error] Copying '%s' was cancelled: '%s' was not created.\n", source_file_name, new_file_name); }
+        else if (verify && errno == EIO)
+        { fprintf(stderr, "\n[Error] Failed to verify '%s': It doesn't match '%s' after being written. It was removed.\n", new_file_name, source_file_name); }
+        else
+        { fprintf(stderr, "\n[Error] Failed to copy contents from '%s' to '%s': %s\n", source_file_name, new_file_name, strerror(errno)); }
+        deleteFile(new_file_name);
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
+
+/*
+*   Function: appendLineToFile
+*   --------------------------
+*   Creates a new line of content at the end of the specified file.
+*
+*   file_name: the name of the file to append content to.
+*   content: the content to be appended to the file.
+*   delimiter: the record delimiter written after the content.
+*
+*   returns: SUCCESS if the content is appended to the file,
+*            FAILURE if an operation fails.
+*/
+
+int appendLineToFile(const char *file_name, const char *content, const struct record_delimiter *delimiter)
+{
+    FILE *file;
+
+    if (!fileExists(file_name))
+    {
         fprintf(stderr, "\n[Error] Cannot append to file '%s': %s\n", file_name, strerror(errno));
         return FAILURE;
     }
 
-    file = openFile(file_name, "a");
-    if (!file)
+    file = openFile(file_name, "a");
+    if (!file)
+    {
+        fprintf(stderr, "\n[Error] Cannot append to file '%s': See above for more information.\n", file_name);
+        return FAILURE;
+     }
+
+    fputs(content, file);
+    writeDelimiter(file, delimiter);
+    fclose(file);
+
+    return SUCCESS;
+}
+
+/*
+*   Function: displayFileAt
+*   -----------------------
+*   Displays the contents of a file in a directory. The file is read in one go if
+*   it fits in the memory budget, otherwise it is streamed in blocks.
+*
+*   directory_fd: the directory holding the file.
+*   file_name: the name of the file to read from.
+*
+*   returns: SUCCESS if the content is displayed,
+*            FAILURE if an operation fails.
+*/
+
+int displayFileAt(const int directory_fd, const char *file_name)
+{
+    FILE *file;
+    char *file_contents;
+    long length;
+
+    file = openFileAt(directory_fd, file_name, "rb");
+    if (!file)
+    { return FAILURE; }
+
+    fseek(file, 0, SEEK_END);
+    startProgress("Reading", ftell(file));
+    file_contents = getFileContents(file, &length);
+    if (!file_contents && errno != EFBIG)
+    {
+        finishProgress();
+        fprintf(stderr, "\n[Error] Failed to read file '%s': %s\n", file_name, strerror(errno));
+        fclose(file);
+        return FAILURE;
+    }
+
+    printf("Contents of file:\n");
+    if (file_contents)
+    { fwrite(file_contents, 1, length, stdout); }
+    else if (copyFileRange(file, stdout, 0, -1))
+    {
+        finishProgress();
+        fprintf(stderr, "\n[Error] Failed to read file '%s': %s\n", file_name, strerror(errno));
+        fclose(file);
+        return FAILURE;
+    }
+    finishProgress();
+    fclose(file);
+
+    freeTracked(file_contents);
+    return SUCCESS;
+}
+
+/*
+*   Function: displayFile
+*   ---------------------
+*   Reads the contents of a file and displays them to the console.
+*
+*   file_name: the name of the file to read from.
+*
+*   returns: SUCCESS if the content is displayed,
+*            FAILURE if an operation fails.
+*/
+
+int displayFile(const char *file_name)
+{
+    return displayFileAt(working_directory_fd, file_name);
+}
+
+/*
+*   Function: formatHexRows
+*   -----------------------
+*   Formats bytes as rows of an offset, HEX_ROW_BYTES bytes in hex (in groups
+*   of two) and the same bytes as text, with '.' for anything unprintable.
+*   Full rows are converted 16 bytes at a time with SSE2 where available.
+*
+*   bytes: the bytes to format.
+*   length: the number of bytes.
+*   offset: the file offset of the first byte.
+*   offset_width: the number of hex digits in each offset.
+*   output: set to the rows (at least HEX_ROW_SIZE bytes per row).
+*
+*   returns: the number of characters written to output.
+*/
+
+size_t formatHexRows(const unsigned char *bytes, const size_t length, const off_t offset, const int offset_width,
+                     char *output)
+{
+    static const char hex_digits[] = "0123456789abcdef";
+    char digits[HEX_ROW_BYTES * 2];
+    char text[HEX_ROW_BYTES];
+    char *position = output;
+    size_t row_length;
+    size_t start;
+    size_t i;
+
+    for (start = 0; start < length; start += HEX_ROW_BYTES)
+    {
+        row_length = length - start < HEX_ROW_BYTES ? length - start : HEX_ROW_BYTES;
+
+#ifdef __SSE2__
+        if (row_length == HEX_ROW_BYTES)
+        {
+            /* Nibbles 10 to 15 become 'a' to 'f' by adding 'a' - '0' - 10 on top of '0' */
+            const __m128i low_nibbles = _mm_set1_epi8(0x0F);
+            const __m128i nine = _mm_set1_epi8(9);
+            const __m128i zero = _mm_set1_epi8('0');
+            const __m128i letter_offset = _mm_set1_epi8('a' - '0' - 10);
+            const __m128i space = _mm_set1_epi8(' ' - 1);
+            const __m128i tilde = _mm_set1_epi8('~' + 1);
+            const __m128i dot = _mm_set1_epi8('.');
+            __m128i row = _mm_loadu_si128((const __m128i *) (bytes + start));
+            __m128i high = _mm_and_si128(_mm_srli_epi16(row, 4), low_nibbles);
+            __m128i low = _mm_and_si128(row, low_nibbles);
+            __m128i printable;
+
+            high = _mm_add_epi8(_mm_add_epi8(high, zero), _mm_and_si128(_mm_cmpgt_epi8(high, nine), letter_offset));
+            low = _mm_add_epi8(_mm_add_epi8(low, zero), _mm_and_si128(_mm_cmpgt_epi8(low, nine), letter_offset));
+            _mm_storeu_si128((__m128i *) digits, _mm_unpacklo_epi8(high, low));
+            _mm_storeu_si128((__m128i *) (digits + 16), _mm_unpackhi_epi8(high, low));
+
+            /* Bytes from 0x80 are negative as signed bytes, so they fail the first comparison */
+            printable = _mm_and_si128(_mm_cmpgt_epi8(row, space), _mm_cmplt_epi8(row, tilde));
+            _mm_storeu_si128((__m128i *) text, _mm_or_si128(_mm_and_si128(printable, row), _mm_andnot_si128(printable, dot)));
+        }
+        else
+#endif
+        {
+            for (i = 0; i < row_length; i++)
+            {
+                unsigned char byte = bytes[start + i];
+
+                digits[i * 2] = hex_digits[byte >> 4];
+                digits[i * 2 + 1] = hex_digits[byte & 0x0F];
+                text[i] = (byte >= ' ' && byte <= '~') ? (char) byte : '.';
+            }
+        }
+
+        position += sprintf(position, "%0*llx: ", offset_width, (unsigned long long) (offset + start));
+        for (i = 0; i < HEX_ROW_BYTES; i += 2)
+        {
+            if (i < row_length)
+            {
+                position[0] = digits[i * 2];
+                position[1] = digits[i * 2 + 1];
+            }
+            else
+            { position[0] = position[1] = ' '; }
+
+            if (i + 1 < row_length)
+            {
+                position[2] = digits[i * 2 + 2];
+                position[3] = digits[i * 2 + 3];
+            }
+            else
+            { position[2] = position[3] = ' '; }
+            position[4] = ' ';
+            position += 5;
+        }
+        *position++ = ' ';
+        memcpy(position, text, row_length);
+        position += row_length;
+        *position++ = '\n';
+    }
+    return position - output;
+}
+
+/*
+*   Function: displayByteRange
+*   --------------------------
+*   Displays a range of bytes of a file, in hex or as they are. Only the range
+*   is read, one block at a time, so it works the same on files of any size
+*   and on files holding NUL bytes.
+*
+*   file_name: the name of the file.
+*   offset: the offset of the first byte, or a negative number to count back from the end.
+*   length: the number of bytes to show, or -1 for everything up to the end.
+*   as_hex: 1 to show the bytes in hex, 0 to write them unchanged.
+*   page_rows: the number of hex rows to show before asking to continue, or 0 to not stop.
+*
+*   returns: SUCCESS if the range is displayed,
+*            FAILURE if an operation fails.
+*/
+
+int displayByteRange(const char *file_name, off_t offset, off_t length, const int as_hex, const long page_rows)
+{
+    char page_input[DEFAULT_INPUT_BUFFER];
+    struct stat file_status;
+    unsigned char *buffer;
+    char *output = NULL;
+    off_t page_used = 0;
+    off_t page_bytes;
+    off_t end;
+    size_t wanted;
+    ssize_t bytes_read;
+    int offset_width = 8;
+    int last_byte = '\n';
+    int fd;
+
+    fd = acquireDescriptor(working_directory_fd, file_name, O_RDONLY);
+    if (fd < 0 || fstat(fd, &file_status))
+    {
+        fprintf(stderr, "\n[Error] Failed to read file '%s': %s\n", file_name, strerror(errno));
+        if (fd >= 0)
+        { releaseDescriptor(fd); }
+        return FAILURE;
+    }
+
+    if (offset < 0)
+    { offset = offset < -file_status.st_size ? 0 : file_status.st_size + offset; }
+    if (offset > file_status.st_size)
+    {
+        fprintf(stderr, "\n[Error] Offset %lld is past the end of '%s' (%lld bytes).\n",
+                (long long) offset, file_name, (long long) file_status.st_size);
+        releaseDescriptor(fd);
+        return FAILURE;
+    }
+    end = (length < 0 || length > file_status.st_size - offset) ? file_status.st_size : offset + length;
+
+    buffer = allocateTracked(HEX_VIEW_BLOCK_SIZE);
+    if (as_hex)
+    { output = allocateTracked(HEX_VIEW_BLOCK_SIZE / HEX_ROW_BYTES * HEX_ROW_SIZE); }
+    if (!buffer || (as_hex && !output))
+    {
+        fprintf(stderr, "\n[Error] Failed to display '%s': %s\n", file_name, strerror(ENOMEM));
+        freeTracked(buffer);
+        freeTracked(output);
+        releaseDescriptor(fd);
+        return FAILURE;
+    }
+
+    /* Size the offsets for the last one shown, so every row lines up */
+    while (offset_width < 16 && (end >> (offset_width * 4)) != 0)
+    { offset_width++; }
+    page_bytes = as_hex ? (off_t) page_rows * HEX_ROW_BYTES : 0;
+
+    printf("Bytes %lld to %lld of '%s' (%lld bytes):\n", (long long) offset, (long long) end, file_name,
+           (long long) file_status.st_size);
+    while (offset < end)
+    {
+        wanted = end - offset < HEX_VIEW_BLOCK_SIZE ? end - offset : HEX_VIEW_BLOCK_SIZE;
+        if (page_bytes && (off_t) wanted > page_bytes - page_used)
+        { wanted = page_bytes - page_used; }
+
+        bytes_read = limitedPread(fd, buffer, wanted, offset);
+        if (bytes_read <= 0)
+        {
+            if (bytes_read < 0)
+            { fprintf(stderr, "\n[Error] Failed to read file '%s': %s\n", file_name, strerror(errno)); }
+            break;
+        }
+
+        if (as_hex)
+        { fwrite(output, 1, formatHexRows(buffer, bytes_read, offset, offset_width, output), stdout); }
+        else
+        {
+            fwrite(buffer, 1, bytes_read, stdout);
+            last_byte = buffer[bytes_read - 1];
+        }
+        offset += bytes_read;
+
+        page_used += bytes_read;
+        if (page_bytes && page_used == page_bytes && offset < end)
+        {
+            printf("-- More -- (Enter for the next page, q to stop): ");
+            if (!fgets(page_input, sizeof(page_input), stdin) || page_input[0] == 'q' || page_input[0] == 'Q')
+            { break; }
+            page_used = 0;
+        }
+    }
+
+    /* Raw bytes may not end with a newline; don't leave the prompt on the same line */
+    if (last_byte != '\n')
+    { printf("\n"); }
+    fflush(stdout);
+
+    freeTracked(buffer);
+    freeTracked(output);
+    releaseDescriptor(fd);
+    return SUCCESS;
+}
+
+/*
+*   Function: findPagerLineEnd
+*   --------------------------
+*   Finds where the line starting at an offset ends.
+*
+*   pager: the pager.
+*   offset: the offset of the start of a line.
+*
+*   returns: the offset just past the line's delimiter, or the size of the file for the last line.
+*/
+
+size_t findPagerLineEnd(const struct pager *pager, size_t offset)
+{
+    const unsigned char *match;
+
+    while ((match = memchr(pager->data + offset, pager->delimiter.byte, pager->size - offset)) != NULL)
+    {
+        offset = match - pager->data + 1;
+        if (pager->delimiter.type != DELIMITER_CRLF || (match > pager->data && match[-1] == '\r'))
+        { return offset; }
+    }
+    return pager->size;
+}
+
+/*
+*   Function: findPagerLineStart
+*   ----------------------------
+*   Finds the start of the line before an offset by scanning backwards, so the
+*   end of a file can be shown without reading the rest of it.
+*
+*   pager: the pager.
+*   offset: the offset of the start of a line, or the size of the file.
+*
+*   returns: the offset of the start of the previous line, or 0 if there is none.
+*/
+
+size_t findPagerLineStart(const struct pager *pager, size_t offset)
+{
+    const unsigned char *match;
+
+    /* Skip the byte that ends the previous line, then look for the delimiter before it */
+    if (offset > 0)
+    { offset--; }
+    while (offset > 0 && (match = memrchr(pager->data, pager->delimiter.byte, offset)) != NULL)
+    {
+        if (pager->delimiter.type != DELIMITER_CRLF || (match > pager->data && match[-1] == '\r'))
+        { return match - pager->data + 1; }
+        offset = match - pager->data;
+    }
+    return 0;
+}
+
+/*
+*   Function: extendPagerIndex
+*   --------------------------
+*   Scans lines past the end of the index until a line has been reached or the
+*   file ends. Stops early if the operation is cancelled. Whenever it returns,
+*   there is a checkpoint for every PAGER_INDEX_STRIDE lines scanned.
+*
+*   pager: the pager.
+*   line_number: the line to reach.
+*
+*   returns: SUCCESS if the index reaches the line or the end of the file,
+*            FAILURE if memory runs out or the operation is cancelled.
+*/
+
+int extendPagerIndex(struct pager *pager, const long line_number)
+{
+    size_t *checkpoints;
+    size_t reported_offset = pager->indexed_offset;
+    int status = SUCCESS;
+
+    if (pager->indexed_to_end || pager->indexed_lines + 1 >= line_number)
+    { return SUCCESS; }
+
+    startProgress("Indexing", pager->size - pager->indexed_offset);
+    while (!pager->indexed_to_end && pager->indexed_lines + 1 < line_number)
+    {
+        if (pager->indexed_offset == pager->size)
+        {
+            pager->indexed_to_end = 1;
+            break;
+        }
+
+        pager->indexed_offset = findPagerLineEnd(pager, pager->indexed_offset);
+        pager->indexed_lines++;
+        if (pager->indexed_lines % PAGER_INDEX_STRIDE != 0)
+        { continue; }
+
+        if (pager->checkpoint_count == pager->checkpoint_capacity)
+        {
+            checkpoints = reallocateTracked(pager->checkpoints, pager->checkpoint_capacity * 2 * sizeof(*checkpoints));
+            if (!checkpoints)
+            {
+                /* Go back to the last checkpoint, so there is always one per PAGER_INDEX_STRIDE lines scanned */
+                pager->indexed_lines -= PAGER_INDEX_STRIDE;
+                pager->indexed_offset = pager->checkpoints[pager->checkpoint_count - 1];
+                status = FAILURE;
+                break;
+            }
+            pager->checkpoints = checkpoints;
+            pager->checkpoint_capacity *= 2;
+        }
+        pager->checkpoints[pager->checkpoint_count++] = pager->indexed_offset;
+
+        /* Cancelling only between checkpoints keeps the index consistent for the next jump */
+        reportProgress(pager->indexed_offset - reported_offset);
+        reported_offset = pager->indexed_offset;
+        if (isCancelled())
+        {
+            status = FAILURE;
+            break;
+        }
+    }
+    reportProgress(pager->indexed_offset - reported_offset);
+    finishProgress();
+    return status;
+}
+
+/*
+*   Function: findPagerLine
+*   -----------------------
+*   Finds the offset of a line, extending the index only as far as the line.
+*
+*   pager: the pager.
+*   line_number: the line to find.
+*   offset: set to the offset of the start of the line.
+*
+*   returns: SUCCESS if the line is found,
+*            FAILURE if the file has fewer lines or the search is cancelled.
+*/
+
+int findPagerLine(struct pager *pager, const long line_number, size_t *offset)
+{
+    long line;
+
+    if (line_number < 1 || extendPagerIndex(pager, line_number)
+        || line_number > pager->indexed_lines + (pager->indexed_offset < pager->size))
+    { return FAILURE; }
+
+    line = (line_number - 1) / PAGER_INDEX_STRIDE * PAGER_INDEX_STRIDE + 1;
+    for (*offset = pager->checkpoints[(line_number - 1) / PAGER_INDEX_STRIDE]; line < line_number; line++)
+    {
+        *offset = findPagerLineEnd(pager, *offset);
+    }
+    return SUCCESS;
+}
+
+/*
+*   Function: getScreenSize
+*   -----------------------
+*   Gets the size of the terminal, or a default if the output isn't a terminal.
+*
+*   rows: set to the number of rows.
+*   columns: set to the number of columns.
+*/
+
+void getScreenSize(int *rows, int *columns)
+{
+    struct winsize window;
+
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &window) == 0 && window.ws_row > 0 && window.ws_col > 0)
+    {
+        *rows = window.ws_row;
+        *columns = window.ws_col;
+        return;
+    }
+    *rows = PAGER_DEFAULT_ROWS;
+    *columns = PAGER_DEFAULT_COLUMNS;
+}
+
+/*
+*   Function: showPagerScreen
+*   -------------------------
+*   Displays one screen of lines, cut to the width of the screen.
+*
+*   pager: the pager.
+*   top: the offset of the first line to show.
+*   top_line: the number of the first line, or 0 if it isn't known.
+*   rows: the number of lines to show.
+*   columns: the width of the screen.
+*   lines_shown: set to the number of lines shown.
+*
+*   returns: the offset of the line after the last one shown.
+*/
+
+size_t showPagerScreen(const struct pager *pager, size_t top, const long top_line, const int rows, const int columns,
+                       int *lines_shown)
+{
+    size_t line_end;
+    size_t content_length;
+    int width;
+
+    for (*lines_shown = 0; *lines_shown < rows && top < pager->size; (*lines_shown)++, top = line_end)
+    {
+        line_end = findPagerLineEnd(pager, top);
+        content_length = line_end - top;
+        if (content_length > 0 && pager->data[line_end - 1] == pager->delimiter.byte)
+        { content_length -= getDelimiterLength(&pager->delimiter); }
+
+        width = columns;
+        if (top_line > 0)
+        { width -= printf("%7ld  ", top_line + *lines_shown); }
+        if (width < 1)
+        { width = 1; }
+        fwrite(pager->data + top, 1, content_length < (size_t) width ? content_length : (size_t) width, stdout);
+        printf("\n");
+    }
+    return top;
+}
+
+/*
+*   Function: pageFile
+*   ------------------
+*   Shows a file one screen at a time. The file is mapped rather than read, lines
+*   are only indexed as far as the pager has gone, and the end is found by
+*   scanning backwards, so opening and jumping to the end of any file is instant.
+*
+*   file_name: the name of the file.
+*   delimiter: the record delimiter that terminates each line.
+*   line_count: set to the number of lines if the pager scanned to the end, otherwise -1.
+*
+*   returns: SUCCESS if the file was paged through,
+*            FAILURE if an operation fails.
+*/
+
+int pageFile(const char *file_name, const struct record_delimiter *delimiter, long *line_count)
+{
+    char command[DEFAULT_INPUT_BUFFER];
+    struct stat file_status;
+    struct pager pager;
+    size_t top = 0;
+    size_t next_top;
+    size_t offset;
+    long top_line = 1;
+    long line_number;
+    int lines_shown;
+    int columns;
+    int rows;
+    int fd;
+    int i;
+
+    memset(&pager, 0, sizeof(pager));
+    pager.delimiter = *delimiter;
+    *line_count = -1;
+
+    fd = acquireDescriptor(working_directory_fd, file_name, O_RDONLY);
+    if (fd < 0 || fstat(fd, &file_status))
+    {
+        fprintf(stderr, "\n[Error] Failed to open '%s': %s\n", file_name, strerror(errno));
+        if (fd >= 0)
+        { releaseDescriptor(fd); }
+        return FAILURE;
+    }
+
+    pager.size = file_status.st_size;
+    if (pager.size == 0)
+    {
+        printf("'%s' is empty.\n", file_name);
+        releaseDescriptor(fd);
+        *line_count = 0;
+        return SUCCESS;
+    }
+
+    pager.data = mmap(NULL, pager.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    releaseDescriptor(fd);
+    pager.checkpoint_capacity = 64;
+    pager.checkpoints = allocateTracked(pager.checkpoint_capacity * sizeof(*pager.checkpoints));
+    if (pager.data == MAP_FAILED || !pager.checkpoints)
+    {
+        fprintf(stderr, "\n[Error] Failed to map '%s': %s\n", file_name, strerror(pager.data == MAP_FAILED ? errno : ENOMEM));
+        if (pager.data != MAP_FAILED)
+        { munmap((void *) pager.data, pager.size); }
+        freeTracked(pager.checkpoints);
+        return FAILURE;
+    }
+    pager.checkpoints[pager.checkpoint_count++] = 0;
+
+    while (1)
+    {
+        /* Leave a row for the prompt */
+        getScreenSize(&rows, &columns);
+        rows = rows > 2 ? rows - 1 : 1;
+
+        next_top = showPagerScreen(&pager, top, top_line, rows, columns, &lines_shown);
+        if (top_line > 0)
+        { printf("-- Lines %ld-%ld", top_line, top_line + lines_shown - 1); }
+        else
+        { printf("-- Bytes %zu-%zu", top, next_top); }
+        printf(" of %zu bytes (%d%%) -- (Enter: next, b: back, number: go to line, e: end, q: quit): ",
+               pager.size, (int) (next_top * 100 / pager.size));
+
+        if (!fgets(command, sizeof(command), stdin) || command[0] == 'q' || command[0] == 'Q')
+        { break; }
+
+        if (command[0] == 'b' || command[0] == 'B')
+        {
+            for (i = 0; i < rows && top > 0; i++)
+            {
+                top = findPagerLineStart(&pager, top);
+                if (top_line > 0)
+                { top_line--; }
+            }
+            if (top == 0)
+            { top_line = 1; }
+        }
+        else if (command[0] == 'e' || command[0] == 'E')
+        {
+            /* Walk back a screen from the end; the line numbers are only known if the index reached it */
+            top = pager.size;
+            for (i = 0; i < rows && top > 0; i++)
+            { top = findPagerLineStart(&pager, top); }
+            top_line = pager.indexed_to_end ? pager.indexed_lines - i + 1 : 0;
+            if (top == 0)
+            { top_line = 1; }
+        }
+        else if (isdigit((unsigned char) command[0]))
+        {
+            line_number = strtol(command, NULL, 10);
+            if (findPagerLine(&pager, line_number, &offset))
+            {
+                if (isCancelled())
+                {
+                    fprintf(stderr, "\n[Error] Going to line %ld was cancelled.\n", line_number);
+                    continue;
+                }
+                fprintf(stderr, "\n[Error] Line %ld is out of range (the file has %ld lines).\n", line_number,
+                        pager.indexed_lines + (pager.indexed_offset < pager.size));
+                continue;
+            }
+            top = offset;
+            top_line = line_number;
+        }
+        else if (next_top < pager.size)
+        {
+            top = next_top;
+            if (top_line > 0)
+            { top_line += lines_shown; }
+        }
+        else
+        {
+            printf("(End of file)\n");
+        }
+    }
+
+    /* The index counts an unterminated last line, but a line count only counts terminated ones */
+    if (pager.indexed_to_end)
+    {
+        *line_count = pager.indexed_lines;
+        if (pager.data[pager.size - 1] != pager.delimiter.byte
+            || (pager.delimiter.type == DELIMITER_CRLF && (pager.size < 2 || pager.data[pager.size - 2] != '\r')))
+        { (*line_count)--; }
+    }
+
+    munmap((void *) pager.data, pager.size);
+    freeTracked(pager.checkpoints);
+    return SUCCESS;
+}
+
+/*
+*   Function: insertLineInFile
+*   --------------------------
+*   Creates a new line of content at a particular line number in the specified file
+*
+*   file_name: the name of the file to insert content into.
+*   content: the content to be inserted.
+*   line_number: the line number to insert the content at.
+*   delimiter: the record delimiter that terminates each line.
+*
+*   returns: SUCCESS if the content is inserted withot error,
+*            FAILURE if an operation fails.
+*/
+
+int insertLineInFile(const char *file_name, const char *content, const int line_number,
+                     const struct record_delimiter *delimiter)
+{
+    FILE *temp_file;
+    FILE *file;
+    long line_start;
+    long line_end;
+    int status;
+
+    file = openFile(file_name, "rb");
+    if (!file)
+    {
+        fprintf(stderr, "\n[Error] Failed to insert line into file '%s': See above for more information.\n", file_name);
+        return FAILURE;
+    }
+
+    if (findLineBounds(file, delimiter, line_number, &line_start, &line_end))
+    {
+        fprintf(stderr, "\n[Error] Failed to insert content into '%s' at line %d: Please enter a valid line number.\n", file_name, line_number);
+        fclose(file);
+        return FAILURE;
+    }
+
+    /* Create temporary file to write data to */
+    temp_file = openFile(TEMP_FILE_NAME, "wb");
+    if (!temp_file)
+    {
+        fclose(file);
+        return FAILURE;
+    }
+
+    /* Copy everything before the line, then the new content, then the rest of the file */
+    fseek(file, 0, SEEK_END);
+    startProgress("Inserting", ftell(file));
+    status = copyFileRange(file, temp_file, 0, line_start);
+    fputs(content, temp_file);
+    writeDelimiter(temp_file, delimiter);
+    if (!status)
+    { status = copyFileRange(file, temp_file, line_start, -1); }
+    finishProgress();
+
+    fclose(file);
+    if (fclose(temp_file) || status)
+    {
+        /* The original is only replaced once the temporary file is complete */
+        deleteFile(TEMP_FILE_NAME);
+        if (isCancelled())
+        { fprintf(stderr, "\n[Error] Inserting into '%s' was cancelled: The file is unchanged.\n", file_name); }
+        else
+        { fprintf(stderr, "\n[Error] Failed to insert content at line %d in '%s': %s\n", line_number, file_name, strerror(errno)); }
+        return FAILURE;
+    }
+
+    /* Attempt to replace the old file with the temporary file */
+    if (commitTemporaryFile(file_name))
+    {
+        fprintf(stderr, "\n[Error] Failed to insert content at line %d from '%s': See above for more information.", line_number, file_name);
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
+
+/*
+*   Function: showLineFromFile
+*   --------------------------
+*   Displays the contents of the specified file at a particular line number.
+*
+*   file_name: the name of the file to display the line contents from.
+*   line_number: the line number to read the contents from.
+*   delimiter: the record delimiter that terminates each line.
+*
+*   returns: SUCCESS if the line content is displayed,
+*            FAILURE if an operation fails.
+*/
+
+int showLineFromFile(const char *file_name, const int line_number, const struct record_delimiter *delimiter)
+{
+    FILE *file;
+    long line_start;
+    long line_end;
+
+    file = openFile(file_name, "rb");
+    if (!file || findLineBounds(file, delimiter, line_number, &line_start, &line_end))
+    {
+        fprintf(stderr, "\n[Error] Failed to read contents at line %d of '%s'. See above for more information.\n", line_number, file_name);
+        if (file)
+        {
+            fclose(file);
+        }
+        return FAILURE;
+    }
+
+    printf("Content at line %d:\n", line_number);
+
+    /* Since we're only displaying one line, there's no need to display the delimiter */
+    if (copyFileRange(file, stdout, line_start, line_end - line_start - getDelimiterLength(delimiter)))
+    {
+        fprintf(stderr, "\n[Error] Failed to read contents at line %d of '%s': %s\n", line_number, file_name, strerror(errno));
+        fclose(file);
+        return FAILURE;
+    }
+    fclose(file);
+    printf("\n");
+
+    return SUCCESS;
+}
+
+/*
+*   Function: deleteLineFromFile
+*   ----------------------------
+*   Deletes a line of content at a particular line number in the specified file.
+*
+*   file_name: the name of the file to delete the line content from.
+*   line_number: the line number to delete content at.
+*   delimiter: the record delimiter that terminates each line.
+*
+*   returns: SUCCESS if the line is deleted,
+*            FAILURE if an operation fails.
+*/
+
+int deleteLineFromFile(const char *file_name, const int line_number, const struct record_delimiter *delimiter)
+{
+    FILE *temp_file;
+    FILE *file;
+    long line_start;
+    long line_end;
+    int status;
+
+    file = openFile(file_name, "rb");
+    if (!file || findLineBounds(file, delimiter, line_number, &line_start, &line_end))
+    {
+        fprintf(stderr, "\n[Error] Failed to delete line %d from file '%s': See above for more information.\n", line_number, file_name);
+        if (file)
+        {
+            fclose(file);
+        }
+        return FAILURE;
+    }
+
+    /* Create temp file to write data to */
+    temp_file = openFile(TEMP_FILE_NAME, "wb");
+    if (!temp_file)
+    {
+        fprintf(stderr, "\n[Error] Failed to delete line %d from file '%s': See above for more information.\n", line_number, file_name);
+        fclose(file);
+        return FAILURE;
+    }
+
+    /* Copy everything except the line and its delimiter */
+    fseek(file, 0, SEEK_END);
+    startProgress("Deleting", ftell(file) - (line_end - line_start));
+    status = copyFileRange(file, temp_file, 0, line_start);
+    if (!status)
+    { status = copyFileRange(file, temp_file, line_end, -1); }
+    finishProgress();
+
+    fclose(file);
+    if (fclose(temp_file) || status)
+    {
+        /* The original is only replaced once the temporary file is complete */
+        deleteFile(TEMP_FILE_NAME);
+        if (isCancelled())
+        { fprintf(stderr, "\n[Error] Deleting line %d from '%s' was cancelled: The file is unchanged.\n", line_number, file_name); }
+        else
+        { fprintf(stderr, "\n[Error] Failed to delete line %d from '%s': %s\n", line_number, file_name, strerror(errno)); }
+        return FAILURE;
+    }
+
+    /* Attempt to replace the old file with the temporary file */
+    if (commitTemporaryFile(file_name))
+    {
+        fprintf(stderr, "\n[Error] Failed to delete line %d from '%s': See above for more information.", line_number, file_name);
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+/*
+*   Function: countBlockDelimiters
+*   ------------------------------
+*   Counts the delimiters in one block of a file read from start to end.
+*
+*   buffer: the block.
+*   length: the number of bytes in the block (at least one).
+*   delimiter: the record delimiter that terminates each line.
+*   previous_byte: the last byte of the previous block ('\0' for the first), so a
+*                  CRLF split across blocks is counted.
+*
+*   returns: the number of delimiters that end in this block.
+*/
+
+long countBlockDelimiters(const unsigned char *buffer, const size_t length, const struct record_delimiter *delimiter,
+                          const unsigned char previous_byte)
+{
+    const unsigned char *position;
+    const unsigned char *match;
+    long count = 0;
+
+    for (position = buffer; (match = memchr(position, delimiter->byte, buffer + length - position)) != NULL;
+         position = match + 1)
+    {
+        if (delimiter->type != DELIMITER_CRLF || (match > buffer ? match[-1] : previous_byte) == '\r')
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+/*
+*   Function: insertBlockInFile
+*   ---------------------------
+*   Inserts a block of lines at a particular line number in the specified file,
+*   in a single pass: everything before the line, then the block, then the rest
+*   of the file are copied to a temporary file that replaces the original.
+*
+*   file_name: the name of the file to insert the lines into.
+*   block: the stream holding the lines. A delimiter is added if the last line has none.
+*   line_number: the line number to insert the lines at.
+*   delimiter: the record delimiter that terminates each line.
+*   lines_inserted: set to the number of lines inserted.
+*
+*   returns: SUCCESS if the lines are inserted,
+*            FAILURE if an operation fails.
+*/
+
+int insertBlockInFile(const char *file_name, FILE *block, const int line_number, const struct record_delimiter *delimiter,
+                      long *lines_inserted)
+{
+    unsigned char buffer[SCAN_BUFFER_SIZE];
+    unsigned char last_bytes[2] = { '\0', '\0' };
+    FILE *temp_file;
+    FILE *file;
+    long line_start;
+    long line_end;
+    long block_size;
+    size_t bytes_read;
+    int status;
+
+    *lines_inserted = 0;
+    file = openFile(file_name, "rb");
+    if (!file || findLineBounds(file, delimiter, line_number, &line_start, &line_end))
+    {
+        fprintf(stderr, "\n[Error] Failed to insert lines into '%s' at line %d: Please enter a valid line number.\n", file_name, line_number);
+        if (file)
+        { fclose(file); }
+        return FAILURE;
+    }
+
+    temp_file = openFile(TEMP_FILE_NAME, "wb");
+    if (!temp_file)
+    {
+        fclose(file);
+        return FAILURE;
+    }
+
+    fseek(block, 0, SEEK_END);
+    block_size = ftell(block);
+    fseek(block, 0, SEEK_SET);
+    fseek(file, 0, SEEK_END);
+    startProgress("Inserting", ftell(file) + (block_size > 0 ? block_size : 0));
+
+    /* Copy everything before the line, then the block (counting its lines), then the rest of the file */
+    status = copyFileRange(file, temp_file, 0, line_start);
+    while (!status && (bytes_read = limitedFread(buffer, sizeof(buffer), block)) > 0)
+    {
+        if (isCancelled() || limitedFwrite(buffer, bytes_read, temp_file) != bytes_read)
+        { status = FAILURE; }
+        *lines_inserted += countBlockDelimiters(buffer, bytes_read, delimiter, last_bytes[1]);
+        last_bytes[0] = bytes_read > 1 ? buffer[bytes_read - 2] : last_bytes[1];
+        last_bytes[1] = buffer[bytes_read - 1];
+        reportProgress(bytes_read);
+    }
+    if (!status && ferror(block))
+    { status = FAILURE; }
+
+    /* Keep the last inserted line separate from the line it is inserted before */
+    if (!status && block_size > 0
+        && (last_bytes[1] != delimiter->byte || (delimiter->type == DELIMITER_CRLF && last_bytes[0] != '\r')))
+    {
+        writeDelimiter(temp_file, delimiter);
+        (*lines_inserted)++;
+    }
+    if (!status)
+    { status = copyFileRange(file, temp_file, line_start, -1); }
+    finishProgress();
+
+    fclose(file);
+    if (fclose(temp_file) || status)
+    {
+        /* The original is only replaced once the temporary file is complete */
+        deleteFile(TEMP_FILE_NAME);
+        if (isCancelled())
+        { fprintf(stderr, "\n[Error] Inserting into '%s' was cancelled: The file is unchanged.\n", file_name); }
+        else
+        { fprintf(stderr, "\n[Error] Failed to insert lines at line %d in '%s': %s\n", line_number, file_name, strerror(errno)); }
+        return FAILURE;
+    }
+
+    if (commitTemporaryFile(file_name))
+    {
+        fprintf(stderr, "\n[Error] Failed to insert lines at line %d in '%s': See above for more information.", line_number, file_name);
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
+
+/*
+*   Function: deleteLineRange
+*   -------------------------
+*   Deletes lines first to last from the specified file. Both ends are found in
+*   one scan. A range that runs to the end of the file is cut off in place with
+*   ftruncate(); otherwise everything before and after the range is copied once
+*   to a temporary file that replaces the original, counting the lines kept.
+*
+*   file_name: the name of the file to delete the lines from.
+*   first: the first line to delete.
+*   last: the last line to delete, or -1 to delete up to the end of the file.
+*   delimiter: the record delimiter that terminates each line.
+*   lines_after: set to the number of lines left in the file.
+*
+*   returns: SUCCESS if the lines are deleted,
+*            FAILURE if an operation fails.
+*/
+
+int deleteLineRange(const char *file_name, const long first, const long last, const struct record_delimiter *delimiter,
+                    long *lines_after)
+{
+    unsigned char buffer[SCAN_BUFFER_SIZE];
+    unsigned char previous_byte = '\0';
+    FILE *temp_file;
+    FILE *file;
+    long range_start;
+    long range_end;
+    long file_size;
+    size_t bytes_read;
+    int status;
+
+    /* Opened for writing as well, so a range at the end can be truncated */
+    file = openFile(file_name, last < 0 ? "r+b" : "rb");
+    if (!file)
+    {
+        fprintf(stderr, "\n[Error] Failed to delete lines from '%s': See above for more information.\n", file_name);
+        return FAILURE;
+    }
+    fseek(file, 0, SEEK_END);
+    file_size = ftell(file);
+
+    /* The end of the range is found by carrying on from its start */
+    if (first < 1 || (last >= 0 && last < first)
+        || scanRecords(file, delimiter, 0, first - 1, &range_start) != first - 1 || range_start >= file_size
+        || (last >= 0 && scanRecords(file, delimiter, range_start, last - first + 1, &range_end) != last - first + 1))
+    {
+        if (last < 0)
+        { fprintf(stderr, "\n[Error] Failed to delete lines from '%s': Line %ld is out of range.\n", file_name, first); }
+        else
+        { fprintf(stderr, "\n[Error] Failed to delete lines from '%s': Lines %ld to %ld are out of range.\n", file_name, first, last); }
+        fclose(file);
+        return FAILURE;
+    }
+
+    if (last < 0)
+    {
+        if (ftruncate(fileno(file), range_start))
+        {
+            fprintf(stderr, "\n[Error] Failed to delete lines from '%s': %s\n", file_name, strerror(errno));
+            fclose(file);
+            return FAILURE;
+        }
+        fclose(file);
+        *lines_after = first - 1;
+        return SUCCESS;
+    }
+
+    temp_file = openFile(TEMP_FILE_NAME, "wb");
+    if (!temp_file)
+    {
+        fclose(file);
+        return FAILURE;
+    }
+
+    startProgress("Deleting", file_size - (range_end - range_start));
+    status = copyFileRange(file, temp_file, 0, range_start);
+
+    /* The lines before the range are known; count the ones after it as they are copied */
+    *lines_after = first - 1;
+    fseek(file, range_end, SEEK_SET);
+    while (!status && (bytes_read = limitedFread(buffer, sizeof(buffer), file)) > 0)
+    {
+        if (isCancelled() || limitedFwrite(buffer, bytes_read, temp_file) != bytes_read)
+        { status = FAILURE; }
+        *lines_after += countBlockDelimiters(buffer, bytes_read, delimiter, previous_byte);
+        previous_byte = buffer[bytes_read - 1];
+        reportProgress(bytes_read);
+    }
+    finishProgress();
+
+    fclose(file);
+    if (fclose(temp_file) || status)
+    {
+        /* The original is only replaced once the temporary file is complete */
+        deleteFile(TEMP_FILE_NAME);
+        if (isCancelled())
+        { fprintf(stderr, "\n[Error] Deleting lines from '%s' was cancelled: The file is unchanged.\n", file_name); }
+        else
+        { fprintf(stderr, "\n[Error] Failed to delete lines %ld to %ld from '%s': %s\n", first, last, file_name, strerror(errno)); }
+        return FAILURE;
+    }
+
+    if (commitTemporaryFile(file_name))
+    {
+        fprintf(stderr, "\n[Error] Failed to delete lines %ld to %ld from '%s': See above for more information.", first, last, file_name);
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
+
+/*
+*   Function: escapeLineContent
+*   ---------------------------
+*   Escapes bytes so they fit on one changelog line between double quotes:
+*   backslashes, quotes, line breaks, tabs and other unprintable bytes are
+*   written as C escapes.
+*
+*   bytes: the bytes to escape.
+*   length: the number of bytes.
+*   output: set to the escaped text, ending in "\..." if it had to be cut short.
+*           Every literal backslash is escaped, so that can't be content.
+*   output_size: the size of output (at least 9).
+*/
+
+void escapeLineContent(const unsigned char *bytes, const size_t length, char *output, const size_t output_size)
+{
+    size_t written = 0;
+    size_t i;
+
+    for (i = 0; i < length; i++)
+    {
+        /* Leave room for the longest escape, "\..." and the terminator */
+        if (written + 9 > output_size)
+        {
+            strcpy(output + written, "\\...");
+            return;
+        }
+
+        switch (bytes[i])
+        {
+            case '\\': written += sprintf(output + written, "\\\\"); break;
+            case '"': written += sprintf(output + written, "\\\""); break;
+            case '\n': written += sprintf(output + written, "\\n"); break;
+            case '\r': written += sprintf(output + written, "\\r"); break;
+            case '\t': written += sprintf(output + written, "\\t"); break;
+            default:
+                if (bytes[i] >= ' ' && bytes[i] <= '~')
+                { output[written++] = (char) bytes[i]; }
+                else
+                { written += sprintf(output + written, "\\x%02x", bytes[i]); }
+                break;
+        }
+    }
+    output[written] = '\0';
+}
+
+/*
+*   Function: replaceLineInFile
+*   ---------------------------
+*   Replaces the content of a line, keeping its delimiter. Content of the same
+*   length is written over the old content in place; otherwise the file is
+*   rewritten once through a temporary file.
+*
+*   file_name: the name of the file to replace the line in.
+*   content: the new content of the line.
+*   line_number: the line number to replace.
+*   delimiter: the record delimiter that terminates each line.
+*   old_content: set to the old content, escaped (see escapeLineContent()).
+*   old_content_size: the size of old_content.
+*
+*   returns: SUCCESS if the line is replaced,
+*            FAILURE if an operation fails.
+*/
+
+int replaceLineInFile(const char *file_name, const char *content, const int line_number,
+                      const struct record_delimiter *delimiter, char *old_content, const size_t old_content_size)
+{
+    unsigned char old_bytes[MAX_LOGGED_LINE_SIZE];
+    unsigned char ending[2];
+    FILE *temp_file;
+    FILE *file;
+    long line_start;
+    long line_end;
+    long old_length;
+    size_t new_length = strlen(content);
+    int delimiter_length = getDelimiterLength(delimiter);
+    int status;
+    int fd;
+
+    file = openFile(file_name, "rb");
+    if (!file || findLineBounds(file, delimiter, line_number, &line_start, &line_end))
+    {
+        fprintf(stderr, "\n[Error] Failed to replace line %d in '%s': See above for more information.\n", line_number, file_name);
+        if (file)
+        { fclose(file); }
+        return FAILURE;
+    }
+
+    /* The last line may have no delimiter */
+    old_length = line_end - line_start;
+    if (old_length >= delimiter_length)
+    {
+        fseek(file, line_end - delimiter_length, SEEK_SET);
+        if (fread(ending, 1, delimiter_length, file) == (size_t) delimiter_length && ending[delimiter_length - 1] == delimiter->byte
+            && (delimiter->type != DELIMITER_CRLF || ending[0] == '\r'))
+        { old_length -= delimiter_length; }
+    }
+
+    fseek(file, line_start, SEEK_SET);
+    /* A line longer than old_bytes never fits in MAX_LOGGED_LINE_SIZE once escaped, so it is cut short either way */
+    escapeLineContent(old_bytes, fread(old_bytes, 1, old_length < (long) sizeof(old_bytes) ? old_length : (long) sizeof(old_bytes), file),
+                      old_content, old_content_size);
+
+    /* Content of the same length goes over the old content, leaving the rest of the file alone */
+    if ((long) new_length == old_length)
+    {
+        fclose(file);
+        fd = acquireDescriptor(working_directory_fd, file_name, O_WRONLY);
+        status = fd < 0 || limitedPwrite(fd, content, new_length, line_start) != (ssize_t) new_length;
+        if (status)
+        { fprintf(stderr, "\n[Error] Failed to replace line %d in '%s': %s\n", line_number, file_name, strerror(errno)); }
+        if (fd >= 0)
+        { releaseDescriptor(fd); }
+        return status ? FAILURE : SUCCESS;
+    }
+
+    temp_file = openFile(TEMP_FILE_NAME, "wb");
+    if (!temp_file)
+    {
+        fclose(file);
+        return FAILURE;
+    }
+
+    /* Copy everything before the line, then the new content, then the old delimiter and the rest of the file */
+    fseek(file, 0, SEEK_END);
+    startProgress("Replacing", ftell(file) - old_length);
+    status = copyFileRange(file, temp_file, 0, line_start);
+    if (!status && limitedFwrite(content, new_length, temp_file) != new_length)
+    { status = FAILURE; }
+    if (!status)
+    { status = copyFileRange(file, temp_file, line_start + old_length, -1); }
+    finishProgress();
+
+    fclose(file);
+    if (fclose(temp_file) || status)
+    {
+        /* The original is only replaced once the temporary file is complete */
+        deleteFile(TEMP_FILE_NAME);
+        if (isCancelled())
+        { fprintf(stderr, "\n[Error] Replacing line %d in '%s' was cancelled: The file is unchanged.\n", line_number, file_name); }
+        else
+        { fprintf(stderr, "\n[Error] Failed to replace line %d in '%s': %s\n", line_number, file_name, strerror(errno)); }
+        return FAILURE;
+    }
+
+    if (commitTemporaryFile(file_name))
+    {
+        fprintf(stderr, "\n[Error] Failed to replace line %d in '%s': See above for more information.", line_number, file_name);
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
+
+/*
+*   Function: writeAtOffset
+*   -----------------------
+*   Writes a buffer to a file at an offset, within the I/O limits, reporting progress.
+*
+*   fd: the file to write to.
+*   data: the bytes to write.
+*   length: the number of bytes.
+*   offset: the offset to write them at.
+*
+*   returns: SUCCESS if every byte is written,
+*            FAILURE if a write fails.
+*/
+
+int writeAtOffset(const int fd, const unsigned char *data, const size_t length, const off_t offset)
+{
+    size_t written;
+    ssize_t bytes_written;
+
+    for (written = 0; written < length; written += bytes_written)
+    {
+        bytes_written = limitedPwrite(fd, data + written, getIOChunkSize(length - written), offset + written);
+        if (bytes_written <= 0)
+        {
+            if (bytes_written == 0)
+            { errno = ENOSPC; }
+            return FAILURE;
+        }
+        reportProgress(bytes_written);
+    }
+    return SUCCESS;
+}
+
+/*
+*   Function: moveLines
+*   -------------------
+*   Moves lines first to last so they come before another line. Only the region
+*   between the lines moved and where they go changes: its two parts swap
+*   places. If the region fits in the memory budget it is read once and written
+*   back over itself, leaving every other byte alone; otherwise the file is
+*   rewritten once through a temporary file.
+*
+*   file_name: the name of the file to move the lines in.
+*   first: the first line to move.
+*   last: the last line to move.
+*   position: the line to move them before (one past the last line to move them to the end).
+*   delimiter: the record delimiter that terminates each line.
+*   in_place: set to 1 if the region was rewritten in place, 0 if the whole file was.
+*
+*   returns: SUCCESS if the lines are moved,
+*            FAILURE if an operation fails.
+*/
+
+int moveLines(const char *file_name, const long first, const long last, const long position,
+              const struct record_delimiter *delimiter, int *in_place)
+{
+    long targets[3] = { first, last + 1, position };
+    long offsets[3];
+    long scanned_lines = 1;
+    long scanned_offset = 0;
+    long region_start;
+    long region_middle;
+    long region_end;
+    long region_length;
+    long swap;
+    unsigned char *region;
+    FILE *temp_file;
+    FILE *file;
+    int status;
+    int fd;
+    int i;
+    int j;
+
+    *in_place = 0;
+    if (first < 1 || last < first || position < 1 || (position > first && position <= last + 1))
+    {
+        fprintf(stderr, "\n[Error] Failed to move lines in '%s': Lines can only be moved to a line outside of them.\n", file_name);
+        return FAILURE;
+    }
+
+    file = openFile(file_name, "rb");
+    if (!file)
+    {
+        fprintf(stderr, "\n[Error] Failed to move lines in '%s': See above for more information.\n", file_name);
+        return FAILURE;
+    }
+
+    /* Find the three offsets in one scan, in the order they appear in the file */
+    for (i = 1; i < 3; i++)
+    {
+        for (j = i; j > 0 && targets[j - 1] > targets[j]; j--)
+        {
+            swap = targets[j];
+            targets[j] = targets[j - 1];
+            targets[j - 1] = swap;
+        }
+    }
+    for (i = 0; i < 3; i++)
+    {
+        if (scanRecords(file, delimiter, scanned_offset, targets[i] - scanned_lines, &offsets[i]) != targets[i] - scanned_lines)
+        {
+            fprintf(stderr, "\n[Error] Failed to move lines in '%s': The file has fewer than %ld lines.\n", file_name, targets[i] - 1);
+            fclose(file);
+            return FAILURE;
+        }
+        scanned_lines = targets[i];
+        scanned_offset = offsets[i];
+    }
+
+    /* Moving lines back or forward both swap the two parts of the region either side of its middle */
+    region_start = offsets[0];
+    region_middle = offsets[1];
+    region_end = offsets[2];
+    region_length = region_end - region_start;
+
+    region = fitsMemoryBudget(region_length) ? allocateTracked(region_length ? region_length : 1) : NULL;
+    if (region)
+    {
+        fclose(file);
+        *in_place = 1;
+        startProgress("Moving", 2 * (int64_t) region_length);
+
+        fd = acquireDescriptor(working_directory_fd, file_name, O_RDWR);
+        status = fd < 0 || readIntoBlock(fd, region, region_length, region_start) != region_length;
+        reportProgress(region_length);
+
+        /* Once writing starts it runs to the end, so Ctrl-C can't leave the region half rewritten.
+           The part after the middle goes first, then the part before it */
+        if (!status && isCancelled())
+        { status = FAILURE; }
+        if (!status)
+        { status = writeAtOffset(fd, region + (region_middle - region_start), region_end - region_middle, region_start); }
+        if (!status)
+        { status = writeAtOffset(fd, region, region_middle - region_start, region_start + (region_end - region_middle)); }
+        finishProgress();
+        if (fd >= 0)
+        { releaseDescriptor(fd); }
+        freeTracked(region);
+
+        if (status)
+        {
+            if (isCancelled())
+            { fprintf(stderr, "\n[Error] Moving lines in '%s' was cancelled: The file is unchanged.\n", file_name); }
+            else
+            { fprintf(stderr, "\n[Error] Failed to move lines in '%s': %s\n", file_name, strerror(errno)); }
+            return FAILURE;
+        }
+        return SUCCESS;
+    }
+
+    temp_file = openFile(TEMP_FILE_NAME, "wb");
+    if (!temp_file)
+    {
+        fclose(file);
+        return FAILURE;
+    }
+
+    fseek(file, 0, SEEK_END);
+    startProgress("Moving", ftell(file));
+    status = copyFileRange(file, temp_file, 0, region_start);
+    if (!status)
+    { status = copyFileRange(file, temp_file, region_middle, region_end - region_middle); }
+    if (!status)
+    { status = copyFileRange(file, temp_file, region_start, region_middle - region_start); }
+    if (!status)
+    { status = copyFileRange(file, temp_file, region_end, -1); }
+    finishProgress();
+
+    fclose(file);
+    if (fclose(temp_file) || status)
+    {
+        /* The original is only replaced once the temporary file is complete */
+        deleteFile(TEMP_FILE_NAME);
+        if (isCancelled())
+        { fprintf(stderr, "\n[Error] Moving lines in '%s' was cancelled: The file is unchanged.\n", file_name); }
+        else
+        { fprintf(stderr, "\n[Error] Failed to move lines in '%s': %s\n", file_name, strerror(errno)); }
+        return FAILURE;
+    }
+
+    if (commitTemporaryFile(file_name))
+    {
+        fprintf(stderr, "\n[Error] Failed to move lines in '%s': See above for more information.", file_name);
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
+
+/*
+*   Function: displayNumberOfLinesInFile
+*   ------------------------------------
+*   Displays the number of lines in a file.
+*
+*   file_name: the name of the file to count lines from.
+*   delimiter: the record delimiter that terminates each line.
+*
+*   returns: SUCCESS if the number of lines is displayed,
+*            FAILURE if an operation fails.
+*/
+
+int displayNumberOfLinesInFile(const char *file_name, const struct record_delimiter *delimiter)
+{
+    long line_count;
+    FILE *file;
+
+    file = openFile(file_name, "rb");
+    if (!file)
+    { return FAILURE; }
+
+    line_count = getNumberOfLinesInFile(file, delimiter);
+    printf("Number of lines in '%s': %ld\n", file_name, line_count);
+    fclose(file);
+
+    return SUCCESS;
+}
+
+/*
+*   Function: buildChunkMasks
+*   -------------------------
+*   Classifies the bytes of a STATISTICS_CHUNK_SIZE byte chunk into bitmasks,
+*   where bit i of each mask describes byte i of the chunk.
+*   Uses SSE2 where available (always on x86-64) and a scalar loop otherwise.
+*
+*   chunk: the bytes to classify.
+*   delimiter_byte: the byte that terminates a line.
+*   masks: the masks to fill in.
+*/
+
+void buildChunkMasks(const unsigned char *chunk, const unsigned char delimiter_byte, struct chunk_masks *masks)
+{
+#ifdef __SSE2__
+    const __m128i delimiters = _mm_set1_epi8((char) delimiter_byte);
+    const __m128i carriage_returns = _mm_set1_epi8('\r');
+    const __m128i spaces = _mm_set1_epi8(' ');
+    const __m128i tabs = _mm_set1_epi8('\t');
+    const __m128i four = _mm_set1_epi8(4);
+    const __m128i top_bits = _mm_set1_epi8((char) 0xC0);
+    const __m128i continuation = _mm_set1_epi8((char) 0x80);
+    int i;
+
+    memset(masks, 0, sizeof(*masks));
+    for (i = 0; i < STATISTICS_CHUNK_SIZE; i += 16)
+    {
+        __m128i bytes = _mm_loadu_si128((const __m128i *) (chunk + i));
+
+        /* '\t' to '\r' are 9 to 13, so (byte - 9) <= 4 as an unsigned comparison */
+        __m128i control = _mm_sub_epi8(bytes, tabs);
+        __m128i whitespace = _mm_or_si128(_mm_cmpeq_epi8(bytes, spaces),
+                                          _mm_cmpeq_epi8(_mm_min_epu8(control, four), control));
+
+        masks->delimiters |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, delimiters)) << i;
+        masks->carriage_returns |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, carriage_returns)) << i;
+        masks->whitespace |= (uint64_t) (uint16_t) _mm_movemask_epi8(whitespace) << i;
+        masks->continuation |= (uint64_t) (uint16_t) _mm_movemask_epi8(
+                                   _mm_cmpeq_epi8(_mm_and_si128(bytes, top_bits), continuation)) << i;
+        masks->non_ascii |= (uint64_t) (uint16_t) _mm_movemask_epi8(bytes) << i;
+    }
+#else
+    int i;
+
+    memset(masks, 0, sizeof(*masks));
+    for (i = 0; i < STATISTICS_CHUNK_SIZE; i++)
+    {
+        uint64_t bit = (uint64_t) 1 << i;
+        unsigned char byte = chunk[i];
+
+        if (byte == delimiter_byte)
+        { masks->delimiters |= bit; }
+        if (byte == '\r')
+        { masks->carriage_returns |= bit; }
+        if (byte == ' ' || (byte >= '\t' && byte <= '\r'))
+        { masks->whitespace |= bit; }
+        if ((byte & 0xC0) == 0x80)
+        { masks->continuation |= bit; }
+        if (byte & 0x80)
+        { masks->non_ascii |= bit; }
+    }
+#endif
+}
+
+/*
+*   Function: validateUTF8
+*   ----------------------
+*   Runs bytes through a UTF-8 validator, counting invalid sequences
+*   (bad lead bytes, stray or missing continuation bytes, overlong forms,
+*   surrogates and code points above U+10FFFF). State is carried in the
+*   statistics so sequences may span calls.
+*
+*   bytes: the bytes to validate.
+*   length: the number of bytes.
+*   statistics: the statistics holding the validator state and invalid count.
+*/
+
+void validateUTF8(const unsigned char *bytes, const size_t length, struct file_statistics *statistics)
+{
+    size_t i;
+
+    for (i = 0; i < length; i++)
+    {
+        unsigned char byte = bytes[i];
+
+        if (statistics->utf8_remaining)
+        {
+            if (byte >= statistics->utf8_lower && byte <= statistics->utf8_upper)
+            {
+                statistics->utf8_remaining--;
+                statistics->utf8_lower = 0x80;
+                statistics->utf8_upper = 0xBF;
+                continue;
+            }
+
+            /* The sequence was cut short. Count it and treat this byte as a new start */
+            statistics->invalid_sequences++;
+            statistics->utf8_remaining = 0;
+        }
+
+        statistics->utf8_lower = 0x80;
+        statistics->utf8_upper = 0xBF;
+        if (byte < 0x80)
+        { continue; }
+        else if (byte >= 0xC2 && byte <= 0xDF)
+        { statistics->utf8_remaining = 1; }
+        else if (byte >= 0xE0 && byte <= 0xEF)
+        {
+            statistics->utf8_remaining = 2;
+            if (byte == 0xE0)
+            { statistics->utf8_lower = 0xA0; }
+            else if (byte == 0xED)
+            { statistics->utf8_upper = 0x9F; }
+        }
+        else if (byte >= 0xF0 && byte <= 0xF4)
+        {
+            statistics->utf8_remaining = 3;
+            if (byte == 0xF0)
+            { statistics->utf8_lower = 0x90; }
+            else if (byte == 0xF4)
+            { statistics->utf8_upper = 0x8F; }
+        }
+        else
+        { statistics->invalid_sequences++; }
+    }
+}
+
+/*
+*   Function: addChunkToStatistics
+*   ------------------------------
+*   Updates the statistics with one chunk of a file.
+*
+*   chunk: STATISTICS_CHUNK_SIZE readable bytes, of which only length are part of the file.
+*   length: the number of bytes of the chunk that are part of the file.
+*   delimiter: the record delimiter that terminates each line.
+*   statistics: the statistics to update.
+*/
+
+void addChunkToStatistics(const unsigned char *chunk, const size_t length,
+                          const struct record_delimiter *delimiter, struct file_statistics *statistics)
+{
+    struct chunk_masks masks;
+    uint64_t valid = length == STATISTICS_CHUNK_SIZE ? ~(uint64_t) 0 : ((uint64_t) 1 << length) - 1;
+    uint64_t line_ends;
+    uint64_t word_starts;
+
+    buildChunkMasks(chunk, delimiter->byte, &masks);
+
+    line_ends = masks.delimiters & valid;
+    if (delimiter->type == DELIMITER_CRLF)
+    {
+        /* Only a '\n' directly after a '\r' ends a line */
+        line_ends &= (masks.carriage_returns << 1) | statistics->carriage_return_carry;
+        statistics->carriage_return_carry = (masks.carriage_returns >> (length - 1)) & 1;
+    }
+
+    /* A word starts at every non-whitespace byte that follows whitespace */
+    word_starts = ~masks.whitespace & ((masks.whitespace << 1) | statistics->whitespace_carry) & valid;
+    statistics->whitespace_carry = (masks.whitespace >> (length - 1)) & 1;
+
+    statistics->lines += __builtin_popcountll(line_ends);
+    statistics->words += __builtin_popcountll(word_starts);
+    statistics->characters += length - __builtin_popcountll(masks.continuation & valid);
+
+    /* Walk the line ends to find the longest line */
+    while (line_ends)
+    {
+        long line_end = statistics->bytes + __builtin_ctzll(line_ends);
+        long line_length = line_end - statistics->line_start - (getDelimiterLength(delimiter) - 1);
+
+        if (line_length > statistics->longest_line)
+        {
+            statistics->longest_line = line_length;
+        }
+        statistics->line_start = line_end + 1;
+        line_ends &= line_ends - 1;
+    }
+
+    /* Pure ASCII chunks can only be invalid if a sequence was left open */
+    if ((masks.non_ascii & valid) || statistics->utf8_remaining)
+    {
+        validateUTF8(chunk, length, statistics);
+    }
+
+    statistics->bytes += length;
+}
+
+/*
+*   Function: getFileStatistics
+*   ---------------------------
+*   Computes byte, line, word, UTF-8 character, invalid UTF-8 sequence and
+*   longest line counts for a file in a single pass.
+*
+*   file_name: the name of the file to read.
+*   delimiter: the record delimiter that terminates each line.
+*   statistics: the statistics to fill in.
+*
+*   returns: SUCCESS if the file was read, FAILURE if an operation fails.
+*/
+
+int getFileStatistics(const char *file_name, const struct record_delimiter *delimiter, struct file_statistics *statistics)
+{
+    unsigned char *buffer;
+    unsigned char tail[STATISTICS_CHUNK_SIZE];
+    ssize_t bytes_read;
+    ssize_t offset;
+    off_t position = 0;
+    int fd;
+
+    memset(statistics, 0, sizeof(*statistics));
+
+    /* Treat the start of the file as following whitespace so a leading word is counted */
+    statistics->whitespace_carry = 1;
+
+    fd = acquireDescriptor(working_directory_fd, file_name, O_RDONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "\n[Error] Failed to open file '%s': %s.\n", file_name, strerror(errno));
+        return FAILURE;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    buffer = malloc(STATISTICS_BUFFER_SIZE);
+    if (!buffer)
+    {
+        fprintf(stderr, "\n[Error] Failed to read file '%s': %s.\n", file_name, strerror(errno));
+        releaseDescriptor(fd);
+        return FAILURE;
+    }
+
+    /* The descriptor may be shared through the cache, so read at explicit offsets */
+    while ((bytes_read = limitedPread(fd, buffer, STATISTICS_BUFFER_SIZE, position)) > 0)
+    {
+        position += bytes_read;
+        for (offset = 0; offset + STATISTICS_CHUNK_SIZE <= bytes_read; offset += STATISTICS_CHUNK_SIZE)
+        {
+            addChunkToStatistics(buffer + offset, STATISTICS_CHUNK_SIZE, delimiter, statistics);
+        }
+
+        /* Pad a partial chunk so the vector loads stay in bounds */
+        if (offset < bytes_read)
+        {
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, buffer + offset, bytes_read - offset);
+            addChunkToStatistics(tail, bytes_read - offset, delimiter, statistics);
+        }
+    }
+
+    free(buffer);
+    releaseDescriptor(fd);
+
+    if (bytes_read < 0)
+    {
+        fprintf(stderr, "\n[Error] Failed to read file '%s': %s.\n", file_name, strerror(errno));
+        return FAILURE;
+    }
+
+    /* An unterminated last line and an unfinished UTF-8 sequence still count */
+    if (statistics->bytes - statistics->line_start > statistics->longest_line)
+    {
+        statistics->longest_line = statistics->bytes - statistics->line_start;
+    }
+    if (statistics->utf8_remaining)
+    {
+        statistics->invalid_sequences++;
+    }
+    return SUCCESS;
+}
+
+/*
+*   Function: printFileStatistics
+*   -----------------------------
+*   Displays a row of file statistics.
+*
+*   name: the name to show for the row.
+*   statistics: the statistics to display.
+*/
+
+void printFileStatistics(const char *name, const struct file_statistics *statistics)
+{
+    printf("%12ld %12ld %12ld %12ld %8ld %8ld  %s\n", statistics->lines, statistics->words, statistics->bytes,
+           statistics->characters, statistics->invalid_sequences, statistics->longest_line, name);
+}
+
+/*
+*   Function: statisticsTask
+*   ------------------------
+*   Parallel executor task computing the statistics of one file in a statistics_job.
+*
+*   task_index: the index of the file in the job.
+*   context: the statistics_job.
+*/
+
+void statisticsTask(int task_index, void *context)
+{
+    struct statistics_job *job = context;
+
+    job->errors[task_index] = getFileStatistics(job->files->paths[task_index], job->delimiter,
+                                                &job->results[task_index]);
+}
+
+/*
+*   Function: displayFileStatistics
+*   -------------------------------
+*   Displays wc-style statistics for a file, or for every file in a directory
+*   followed by a total. Directory entries are processed in parallel.
+*
+*   file_name: the name of the file or directory.
+*   delimiter: the record delimiter that terminates each line.
+*
+*   returns: SUCCESS if the statistics are displayed,
+*            FAILURE if an operation fails.
+*/
+
+int displayFileStatistics(const char *file_name, const struct record_delimiter *delimiter)
+{
+    struct file_list files = { NULL, 0, 0 };
+    struct statistics_job job;
+    struct file_statistics total;
+    struct stat file_status;
+    int i;
+
+    if (fstatat(working_directory_fd, file_name, &file_status, 0))
+    {
+        fprintf(stderr, "\n[Error] Failed to read '%s': %s\n", file_name, strerror(errno));
+        return FAILURE;
+    }
+
+    if (S_ISDIR(file_status.st_mode))
+    {
+        if (collectFilesInDirectory(file_name, &files))
+        { return FAILURE; }
+    }
+    else if (addFileToList(&files, file_name))
+    { return FAILURE; }
+
+    job.files = &files;
+    job.delimiter = delimiter;
+    job.results = calloc(files.count + 1, sizeof(*job.results));
+    job.errors = calloc(files.count + 1, sizeof(*job.errors));
+    if (!job.results || !job.errors)
+    {
+        fprintf(stderr, "\n[Error] Failed to read '%s': %s\n", file_name, strerror(errno));
+        free(job.results);
+        free(job.errors);
+        freeFileList(&files);
+        return FAILURE;
+    }
+
+    runInParallel(files.count, statisticsTask, &job);
+
+    memset(&total, 0, sizeof(total));
+    printf("%12s %12s %12s %12s %8s %8s\n", "lines", "words", "bytes", "chars", "invalid", "longest");
+    for (i = 0; i < files.count; i++)
+    {
+        if (job.errors[i])
+        { continue; }
+
+        printFileStatistics(files.paths[i], &job.results[i]);
+        total.lines += job.results[i].lines;
+        total.words += job.results[i].words;
+        total.bytes += job.results[i].bytes;
+        total.characters += job.results[i].characters;
+        total.invalid_sequences += job.results[i].invalid_sequences;
+        if (job.results[i].longest_line > total.longest_line)
+        {
+            total.longest_line = job.results[i].longest_line;
+        }
+    }
+    if (S_ISDIR(file_status.st_mode))
+    {
+        printFileStatistics("total", &total);
+    }
+
+    free(job.results);
+    free(job.errors);
+    freeFileList(&files);
+    return SUCCESS;
+}
+
+/*
+*   Function: findLiteral
+*   ---------------------
+*   Finds the first occurrence of a literal in a block of bytes.
+*   With SSE2 it compares the first and last byte of the literal against
+*   16 positions at once and only runs memcmp() where both match.
+*
+*   haystack: the bytes to search.
+*   haystack_length: the number of bytes to search.
+*   needle: the literal to find.
+*   needle_length: the length of the literal (at least 1).
+*
+*   returns: the offset of the first occurrence, or haystack_length if there is none.
+*/
+
+size_t findLiteral(const char *haystack, const size_t haystack_length, const char *needle, const size_t needle_length)
+{
+    size_t offset = 0;
+    const char *match;
+
+    if (needle_length > haystack_length)
+    { return haystack_length; }
+
+#ifdef __SSE2__
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[needle_length - 1]);
+
+    for (; offset + 16 + needle_length - 1 <= haystack_length; offset += 16)
+    {
+        __m128i starts = _mm_loadu_si128((const __m128i *) (haystack + offset));
+        __m128i ends = _mm_loadu_si128((const __m128i *) (haystack + offset + needle_length - 1));
+        unsigned int candidates = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(starts, first),
+                                                                   _mm_cmpeq_epi8(ends, last)));
+        while (candidates)
+        {
+            size_t candidate = offset + __builtin_ctz(candidates);
+            if (!memcmp(haystack + candidate + 1, needle + 1, needle_length - 1))
+            {
+                return candidate;
+            }
+            candidates &= candidates - 1;
+        }
+    }
+#endif
+
+    match = memmem(haystack + offset, haystack_length - offset, needle, needle_length);
+    return match ? (size_t) (match - haystack) : haystack_length;
+}
+
+/*
+*   Function: skipBracketExpression
+*   -------------------------------
+*   Skips a bracket expression of a regular expression. A ']' first in the list
+*   is part of it, as is any ']' inside a [:class:], [=equivalence=] or
+*   [.collating.] element.
+*
+*   pattern: the character after the opening '['.
+*
+*   returns: the character after the closing ']', or the end of the pattern.
+*/
+
+const char *skipBracketExpression(const char *pattern)
+{
+    char element_end;
+
+    if (*pattern == '^')
+    { pattern++; }
+    if (*pattern == ']')
+    { pattern++; }
+
+    while (*pattern && *pattern != ']')
+    {
+        if (*pattern == '[' && (pattern[1] == ':' || pattern[1] == '=' || pattern[1] == '.'))
+        {
+            /* The element ends at the matching ":]", "=]" or ".]" */
+            element_end = pattern[1];
+            pattern += 2;
+            while (*pattern && !(pattern[0] == element_end && pattern[1] == ']'))
+            { pattern++; }
+            if (*pattern)
+            { pattern += 2; }
+            continue;
+        }
+        pattern++;
+    }
+    return *pattern ? pattern + 1 : pattern;
+}
+
+/*
+*   Function: extractRequiredLiteral
+*   --------------------------------
+*   Finds the longest run of plain characters that every match of an extended
+*   regular expression must contain, so lines without it can be skipped
+*   without running the regex. Gives up (returns an empty literal) on
+*   alternation, since no single run is then required.
+*
+*   pattern: the extended regular expression.
+*   literal: set to the required literal (MAX_LINE_CONTENT_SIZE bytes).
+*
+*   returns: the length of the required literal, 0 if there isn't one.
+*/
+
+size_t extractRequiredLiteral(const char *pattern, char *literal)
+{
+    char run[MAX_LINE_CONTENT_SIZE];
+    size_t run_length = 0;
+    size_t longest = 0;
+    int is_literal;
+    int depth;
+
+    literal[0] = '\0';
+    if (strchr(pattern, '|'))
+    { return 0; }
+
+    while (1)
+    {
+        char character = *pattern;
+        is_literal = character != '\0';
+
+        if (character)
+        { pattern++; }
+
+        if (character == '\\')
+        {
+            /* An escaped metacharacter matches itself. Anything else (\w, \1...) is not plain text */
+            is_literal = *pattern && strchr(".[]()*+?{}|^$\\", *pattern);
+            character = *pattern;
+            if (*pattern)
+            { pattern++; }
+        }
+        else if (character == '[')
+        {
+            pattern = skipBracketExpression(pattern);
+            is_literal = 0;
+        }
+        else if (character == '(')
+        {
+            /* Groups may be optional or repeated, so skip them entirely */
+            for (depth = 1; *pattern && depth; pattern++)
+            {
+                if (*pattern == '\\' && pattern[1])
+                { pattern++; }
+                else if (*pattern == '[')
+                { pattern = skipBracketExpression(pattern + 1) - 1; }
+                else if (*pattern == '(')
+                { depth++; }
+                else if (*pattern == ')')
+                { depth--; }
+            }
+            is_literal = 0;
+        }
+        else if (character == '{')
+        {
+            while (*pattern && *pattern++ != '}');
+            is_literal = 0;
+        }
+        else if (character && strchr(".^$)*+?", character))
+        {
+            is_literal = 0;
+        }
+
+        /* A character followed by *, ? or {m,n} may not appear, so it ends the run without joining it */
+        if (is_literal && *pattern != '*' && *pattern != '?' && *pattern != '{' && run_length < sizeof(run) - 1)
+        {
+            run[run_length++] = character;
+
+            /* c+ needs at least one c, but what follows isn't adjacent to it */
+            if (*pattern != '+')
+            { continue; }
+        }
+
+        if (run_length > longest)
+        {
+            memcpy(literal, run, run_length);
+            longest = run_length;
+        }
+        run_length = 0;
+
+        if (!character)
+        { break; }
+    }
+
+    literal[longest] = '\0';
+    return longest;
+}
+
+/*
+*   Function: freeLineMatcher
+*   -------------------------
+*   Frees everything allocated by compileLineMatcher().
+*
+*   matcher: the matcher to free.
+*/
+
+void freeLineMatcher(struct line_matcher *matcher)
+{
+    int i;
+
+    if (matcher->use_regex)
+    {
+        regfree(&matcher->regex);
+    }
+    for (i = 0; i < matcher->literal_count; i++)
+    {
+        free(matcher->literals[i]);
+    }
+    memset(matcher, 0, sizeof(*matcher));
+}
+
+/*
+*   Function: compileLineMatcher
+*   ----------------------------
+*   Compiles a line matcher once so it can be run against every line of a file.
+*
+*   matcher: the matcher to initialise.
+*   patterns: an extended regular expression, or the list of literals.
+*   pattern_count: the number of patterns (always 1 for a regex).
+*   use_regex: 1 to compile patterns[0] as a regex, 0 to match any of the literals.
+*   capture_groups: 1 if regexec() needs to report where the match and its groups are.
+*
+*   returns: SUCCESS if the matcher is ready, FAILURE if an operation fails.
+*/
+
+int compileLineMatcher(struct line_matcher *matcher, char **patterns, const int pattern_count, const int use_regex,
+                       const int capture_groups)
+{
+    char required[MAX_LINE_CONTENT_SIZE];
+    char *required_patterns[1] = { required };
+    char error_message[MAX_LINE_CONTENT_SIZE];
+    int error;
+    int i;
+
+    memset(matcher, 0, sizeof(*matcher));
+    matcher->use_regex = use_regex;
+
+    if (use_regex)
+    {
+        error = regcomp(&matcher->regex, patterns[0], REG_EXTENDED | (capture_groups ? 0 : REG_NOSUB));
+        if (error)
+        {
+            regerror(error, &matcher->regex, error_message, sizeof(error_message));
+            fprintf(stderr, "\n[Error] Invalid regular expression '%s': %s\n", patterns[0], error_message);
+            return FAILURE;
+        }
+
+        /* Lines without the regex's required literal are skipped without running it */
+        if (extractRequiredLiteral(patterns[0], required))
+        {
+            patterns = required_patterns;
+            matcher->literal_count = 1;
+        }
+    }
+    else
+    {
+        matcher->literal_count = pattern_count;
+    }
+
+    for (i = 0; i < matcher->literal_count; i++)
+    {
+        matcher->literals[i] = strdup(patterns[i]);
+        matcher->literal_lengths[i] = strlen(patterns[i]);
+        if (!matcher->literals[i])
+        {
+            fprintf(stderr, "\n[Error] Failed to compile pattern: %s\n", strerror(errno));
+            freeLineMatcher(matcher);
+            return FAILURE;
+        }
+    }
+    return SUCCESS;
+}
+
+/*
+*   Function: resetLineMatcher
+*   --------------------------
+*   Forgets the cached literal positions, which are relative to the current buffer.
+*
+*   matcher: the matcher to reset.
+*/
+
+void resetLineMatcher(struct line_matcher *matcher)
+{
+    int i;
+
+    for (i = 0; i < matcher->literal_count; i++)
+    {
+        matcher->searched[i] = 0;
+    }
+}
+
+/*
+*   Function: findNextCandidate
+*   ---------------------------
+*   Finds the next position in a buffer where a line could match. For a
+*   literal set that is the next occurrence of any literal, and every line
+*   containing one matches. For a regex it is the next occurrence of its
+*   required literal, or the current position if it has none.
+*   Each literal is only searched forward from where it was last found,
+*   so every literal scans the buffer at most once.
+*
+*   matcher: the compiled matcher.
+*   buffer: the buffer being filtered.
+*   position: the offset to search from.
+*   length: the number of bytes in the buffer.
+*
+*   returns: the offset of the next candidate, or length if there is none.
+*/
+
+size_t findNextCandidate(struct line_matcher *matcher, const char *buffer, const size_t position, const size_t length)
+{
+    size_t nearest = length;
+    int i;
+
+    if (matcher->literal_count == 0)
+    { return position; }
+
+    for (i = 0; i < matcher->literal_count; i++)
+    {
+        if (!matcher->searched[i] || matcher->next_hits[i] < position)
+        {
+            matcher->next_hits[i] = position + findLiteral(buffer + position, length - position,
+                                                           matcher->literals[i], matcher->literal_lengths[i]);
+            matcher->searched[i] = 1;
+        }
+        if (matcher->next_hits[i] < nearest)
+        {
+            nearest = matcher->next_hits[i];
+        }
+    }
+    return nearest;
+}
+
+/*
+*   Function: findDelimiter
+*   -----------------------
+*   Finds the end of the line that contains a position in a buffer.
+*
+*   buffer: the buffer to search. It is assumed to start at the beginning of a line.
+*   position: the offset to search from.
+*   length: the number of bytes in the buffer.
+*   delimiter: the record delimiter that terminates each line.
+*   line_end: set to the offset just past the delimiter, or length if there isn't one.
+*
+*   returns: 1 if a delimiter was found, 0 if the line runs to the end of the buffer.
+*/
+
+int findDelimiter(const char *buffer, size_t position, const size_t length,
+                  const struct record_delimiter *delimiter, size_t *line_end)
+{
+    const char *match;
+
+    while (position < length && (match = memchr(buffer + position, delimiter->byte, length - position)) != NULL)
+    {
+        position = match - buffer + 1;
+        if (delimiter->type != DELIMITER_CRLF || (match > buffer && match[-1] == '\r'))
+        {
+            *line_end = position;
+            return 1;
+        }
+    }
+    *line_end = length;
+    return 0;
+}
+
+/*
+*   Function: findLineStart
+*   -----------------------
+*   Finds the start of the line that contains a position in a buffer.
+*   The buffer is assumed to start at the beginning of a line.
+*
+*   buffer: the buffer to search.
+*   lower_bound: an offset known to be at or before the start of the line.
+*   position: the offset inside the line.
+*   delimiter: the record delimiter that terminates each line.
+*
+*   returns: the offset of the start of the line.
+*/
+
+size_t findLineStart(const char *buffer, const size_t lower_bound, size_t position, const struct record_delimiter *delimiter)
+{
+    const char *match;
+
+    while (position > lower_bound
+           && (match = memrchr(buffer + lower_bound, delimiter->byte, position - lower_bound)) != NULL)
+    {
+        if (delimiter->type != DELIMITER_CRLF || (match > buffer && match[-1] == '\r'))
+        {
+            return match - buffer + 1;
+        }
+        position = match - buffer;
+    }
+    return lower_bound;
+}
+
+/*
+*   Function: countDelimiters
+*   -------------------------
+*   Counts the delimiters in a block of complete lines.
+*
+*   buffer: the block to count.
+*   length: the number of bytes in the block.
+*   delimiter: the record delimiter that terminates each line.
+*
+*   returns: the number of delimiters.
+*/
+
+long countDelimiters(const char *buffer, const size_t length, const struct record_delimiter *delimiter)
+{
+    size_t position = 0;
+    long count = 0;
+
+    while (findDelimiter(buffer, position, length, delimiter, &position))
+    {
+        count++;
+    }
+    return count;
+}
+
+/*
+*   Function: lineMatches
+*   ---------------------
+*   Checks whether a line matches, given that it contains a candidate position.
+*
+*   matcher: the compiled matcher.
+*   line: the start of the line.
+*   line_length: the length of the line without its delimiter.
+*
+*   returns: 1 if the line matches, 0 if it doesn't.
+*/
+
+int lineMatches(const struct line_matcher *matcher, const char *line, const size_t line_length)
+{
+    regmatch_t bounds[1];
+
+    if (!matcher->use_regex)
+    {
+        /* The candidate was an exact literal hit */
+        return 1;
+    }
+
+    bounds[0].rm_so = 0;
+    bounds[0].rm_eo = line_length;
+    return !regexec(&matcher->regex, line, 1, bounds, REG_STARTEND);
+}
+
+/*
+*   Function: initialiseLineBuffer
+*   ------------------------------
+*   Allocates the buffer used to stream a file a block of complete lines at a time.
+*
+*   lines: the line buffer to initialise.
+*
+*   returns: SUCCESS if the buffer was allocated, FAILURE if memory runs out.
+*/
+
+int initialiseLineBuffer(struct line_buffer *lines)
+{
+    memset(lines, 0, sizeof(*lines));
+    lines->data = allocateTracked(FILTER_BUFFER_SIZE);
+    if (!lines->data)
+    {
+        fprintf(stderr, "\n[Error] Failed to allocate line buffer: %s\n", strerror(errno));
+        return FAILURE;
+    }
+    lines->size = FILTER_BUFFER_SIZE;
+    return SUCCESS;
+}
+
+/*
+*   Function: readLines
+*   -------------------
+*   Discards the lines handed out by the previous call and reads until the
+*   buffer holds at least one complete line. The buffer grows if a single line
+*   doesn't fit. At the end of the file the unterminated last line (if any)
+*   is handed out on its own.
+*
+*   lines: the line buffer. On return data[0, region_end) holds complete lines.
+*   file: the file stream to read from.
+*   delimiter: the record delimiter that terminates each line.
+*
+*   returns: 1 if there are lines to process, 0 at the end of the file,
+*            FAILURE if memory runs out.
+*/
+
+int readLines(struct line_buffer *lines, FILE *file, const struct record_delimiter *delimiter)
+{
+    char *larger_data;
+    size_t bytes_read;
+
+    memmove(lines->data, lines->data + lines->region_end, lines->filled - lines->region_end);
+    lines->filled -= lines->region_end;
+    lines->region_end = 0;
+
+    while (!lines->at_end)
+    {
+        if (lines->filled == lines->size)
+        {
+            /* A single line fills the buffer, so make room for the rest of it */
+            if (!fitsMemoryBudget(lines->size))
+            {
+                fprintf(stderr, "\n[Error] A line is too long to fit in the memory budget (%.1f MB).\n",
+                        memory_budget / 1048576.0);
+                return FAILURE;
+            }
+            larger_data = reallocateTracked(lines->data, lines->size * 2);
+            if (!larger_data)
+            {
+                fprintf(stderr, "\n[Error] Failed to grow line buffer: %s\n", strerror(errno));
+                return FAILURE;
+            }
+            lines->data = larger_data;
+            lines->size *= 2;
+        }
+
+        bytes_read = limitedFread(lines->data + lines->filled, lines->size - lines->filled, file);
+        lines->filled += bytes_read;
+        lines->at_end = bytes_read == 0;
+
+        /* Only hand out complete lines, unless this is the unterminated last line */
+        lines->region_end = lines->at_end ? lines->filled : findLineStart(lines->data, 0, lines->filled, delimiter);
+        if (lines->region_end > 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+*   Function: filterLinesInFile
+*   ---------------------------
+*   Keeps, deletes or counts the lines of a file that match a pattern in one streaming pass.
+*   Runs of lines without a candidate are copied (or skipped) as a single block,
+*   so only lines the prefilter flags are looked at individually. The rewritten
+*   file replaces the original atomically.
+*
+*   file_name: the name of the file to filter.
+*   matcher: the compiled matcher.
+*   mode: FILTER_KEEP_MATCHING, FILTER_DELETE_MATCHING or FILTER_COUNT_MATCHING.
+*   delimiter: the record delimiter that terminates each line.
+*   lines_matched: set to the number of matching lines.
+*   lines_removed: set to the number of lines removed from the file.
+*   lines_kept: set to the number of lines in the file afterwards.
+*
+*   returns: SUCCESS if the file was filtered, FAILURE if an operation fails.
+*/
+
+int filterLinesInFile(const char *file_name, struct line_matcher *matcher, const int mode,
+                      const struct record_delimiter *delimiter, long *lines_matched, long *lines_removed,
+                      long *lines_kept)
+{
+    FILE *file;
+    FILE *temp_file = NULL;
+    struct line_buffer lines = { NULL, 0, 0, 0, 0 };
+    char *buffer;
+    size_t region_end;
+    size_t position;
+    long total_lines = 0;
+    int status;
+
+    *lines_matched = 0;
+    *lines_kept = 0;
+
+    file = openFile(file_name, "rb");
+    if (!file)
+    { return FAILURE; }
+
+    if (mode != FILTER_COUNT_MATCHING)
+    {
+        temp_file = openFile(TEMP_FILE_NAME, "wb");
+    }
+    if ((mode != FILTER_COUNT_MATCHING && !temp_file) || initialiseLineBuffer(&lines))
+    {
+        fprintf(stderr, "\n[Error] Failed to filter lines in '%s': See above for more information.\n", file_name);
+        fclose(file);
+        if (temp_file)
+        {
+            fclose(temp_file);
+            deleteFile(TEMP_FILE_NAME);
+        }
+        return FAILURE;
+    }
+
+    while ((status = readLines(&lines, file, delimiter)) == 1)
+    {
+        buffer = lines.data;
+        region_end = lines.region_end;
+
+        resetLineMatcher(matcher);
+        position = 0;
+        while (position < region_end)
+        {
+            size_t candidate = findNextCandidate(matcher, buffer, position, region_end);
+            size_t line_start = candidate < region_end ? findLineStart(buffer, position, candidate, delimiter) : region_end;
+            size_t line_end;
+            size_t content_end;
+            int terminated;
+            int matches;
+
+            /* Everything before the candidate's line can't match */
+            if (line_start > position)
+            {
+                long lines = mode == FILTER_COUNT_MATCHING ? 0
+                             : countDelimiters(buffer + position, line_start - position, delimiter);
+
+                total_lines += lines;
+                if (mode == FILTER_DELETE_MATCHING)
+                {
+                    limitedFwrite(buffer + position, line_start - position, temp_file);
+                    *lines_kept += lines;
+                }
+                position = line_start;
+                if (position == region_end)
+                { break; }
+            }
+
+            terminated = findDelimiter(buffer, line_start, region_end, delimiter, &line_end);
+            content_end = terminated ? line_end - getDelimiterLength(delimiter) : line_end;
+
+            matches = lineMatches(matcher, buffer + line_start, content_end - line_start);
+            total_lines += terminated;
+            if (matches)
+            {
+                (*lines_matched)++;
+            }
+            if ((matches && mode == FILTER_KEEP_MATCHING) || (!matches && mode == FILTER_DELETE_MATCHING))
+            {
+                limitedFwrite(buffer + line_start, line_end - line_start, temp_file);
+                *lines_kept += terminated;
+            }
+            position = line_end;
+        }
+    }
+
+    freeTracked(lines.data);
+    fclose(file);
+
+    *lines_removed = total_lines - *lines_kept;
+
+    if (mode == FILTER_COUNT_MATCHING)
+    {
+        return status;
+    }
+
+    if (fclose(temp_file) || status == FAILURE || commitTemporaryFile(file_name))
+    {
+        fprintf(stderr, "\n[Error] Failed to filter lines in '%s': See above for more information.\n", file_name);
+        if (fileExists(TEMP_FILE_NAME))
+        {
+            deleteFile(TEMP_FILE_NAME);
+        }
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+/*
+*   Function: replaceLiteralInPlace
+*   -------------------------------
+*   Replaces every occurrence of a literal with a replacement of the same
+*   length by writing over the matches with pwrite(). Nothing else in the
+*   file is written, so this costs one read of the file plus one small write per match.
+*
+*   file_name: the name of the file to edit.
+*   search: the literal to replace.
+*   replacement: the text to write over each match (same length as search).
+*   replacements: set to the number of replacements made.
+*
+*   returns: SUCCESS if the file was edited, FAILURE if an operation fails.
+*/
+
+int replaceLiteralInPlace(const char *file_name, const char *search, const char *replacement, long *replacements)
+{
+    size_t search_length = strlen(search);
+    char *buffer;
+    off_t position = 0;
+    ssize_t bytes_read;
+    size_t match;
+    int fd;
+
+    *replacements = 0;
+
+    fd = acquireDescriptor(working_directory_fd, file_name, O_RDWR);
+    buffer = malloc(FILTER_BUFFER_SIZE);
+    if (fd < 0 || !buffer)
+    {
+        fprintf(stderr, "\n[Error] Failed to open file '%s': %s.\n", file_name, strerror(errno));
+        free(buffer);
+        if (fd >= 0)
+        {
+            releaseDescriptor(fd);
+        }
+        return FAILURE;
+    }
+
+    while ((bytes_read = limitedPread(fd, buffer, FILTER_BUFFER_SIZE, position)) >= (ssize_t) search_length)
+    {
+        size_t offset = 0;
+
+        while ((match = offset + findLiteral(buffer + offset, bytes_read - offset, search, search_length)) < (size_t) bytes_read)
+        {
+            if (limitedPwrite(fd, replacement, search_length, position + match) != (ssize_t) search_length)
+            {
+                fprintf(stderr, "\n[Error] Failed to write to file '%s': %s.\n", file_name, strerror(errno));
+                free(buffer);
+                releaseDescriptor(fd);
+                return FAILURE;
+            }
+            (*replacements)++;
+            offset = match + search_length;
+        }
+
+        /* Re-read the last search_length - 1 bytes, as a match may straddle the blocks */
+        if (bytes_read < FILTER_BUFFER_SIZE)
+        { break; }
+        if (offset < (size_t) bytes_read - search_length + 1)
+        {
+            offset = bytes_read - search_length + 1;
+        }
+        position += offset;
+    }
+
+    free(buffer);
+    if (bytes_read < 0 || releaseDescriptor(fd))
+    {
+        fprintf(stderr, "\n[Error] Failed to edit file '%s': %s.\n", file_name, strerror(errno));
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+/*
+*   Function: replaceLiteralStreaming
+*   ---------------------------------
+*   Replaces every occurrence of a literal, streaming the result into the temporary file.
+*
+*   file: the file stream to read from.
+*   temp_file: the file stream to write to.
+*   search: the literal to replace.
+*   replacement: the text to write in place of each match.
+*   replacements: set to the number of replacements made.
+*
+*   returns: SUCCESS if the file was read, FAILURE if an operation fails.
+*/
+
+int replaceLiteralStreaming(FILE *file, FILE *temp_file, const char *search, const char *replacement, long *replacements)
+{
+    size_t search_length = strlen(search);
+    size_t replacement_length = strlen(replacement);
+    size_t filled = 0;
+    size_t bytes_read;
+    size_t offset;
+    size_t match;
+    size_t keep;
+    char *buffer;
+
+    *replacements = 0;
+
+    buffer = malloc(FILTER_BUFFER_SIZE);
+    if (!buffer)
+    {
+        fprintf(stderr, "\n[Error] Failed to allocate replace buffer: %s\n", strerror(errno));
+        return FAILURE;
+    }
+
+    do
+    {
+        bytes_read = limitedFread(buffer + filled, FILTER_BUFFER_SIZE - filled, file);
+        filled += bytes_read;
+
+        offset = 0;
+        while ((match = offset + findLiteral(buffer + offset, filled - offset, search, search_length)) < filled)
+        {
+            limitedFwrite(buffer + offset, match - offset, temp_file);
+            limitedFwrite(replacement, replacement_length, temp_file);
+            (*replacements)++;
+            offset = match + search_length;
+        }
+
+        /* Hold back the last search_length - 1 bytes unless this is the end, as a match may straddle the blocks */
+        keep = bytes_read ? search_length - 1 : 0;
+        if (filled - offset < keep)
+        {
+            keep = filled - offset;
+        }
+        limitedFwrite(buffer + offset, filled - offset - keep, temp_file);
+        memmove(buffer, buffer + filled - keep, keep);
+        filled = keep;
+    }
+    while (bytes_read > 0);
+
+    free(buffer);
+    return ferror(file) ? FAILURE : SUCCESS;
+}
+
+/*
+*   Function: writeRegexReplacement
+*   -------------------------------
+*   Writes a regex replacement, expanding \0 to \9 to the matching groups and \\ to a backslash.
+*
+*   temp_file: the file stream to write to.
+*   replacement: the replacement template.
+*   line: the line the match was made in.
+*   groups: the match and its groups, with offsets relative to line.
+*/
+
+void writeRegexReplacement(FILE *temp_file, const char *replacement, const char *line, const regmatch_t *groups)
+{
+    for (; *replacement; replacement++)
+    {
+        if (replacement[0] == '\\' && replacement[1] >= '0' && replacement[1] <= '9')
+        {
+            const regmatch_t *group = &groups[replacement[1] - '0'];
+            if (group->rm_so >= 0)
+            {
+                limitedFwrite(line + group->rm_so, group->rm_eo - group->rm_so, temp_file);
+            }
+            replacement++;
+        }
+        else if (replacement[0] == '\\' && replacement[1] == '\\')
+        {
+            putc('\\', temp_file);
+            replacement++;
+        }
+        else
+        {
+            putc(*replacement, temp_file);
+        }
+    }
+}
+
+/*
+*   Function: replaceRegexStreaming
+*   -------------------------------
+*   Replaces every match of a regex line by line, streaming the result into
+*   the temporary file. Lines without the regex's required literal are copied
+*   in blocks without running the regex.
+*
+*   file: the file stream to read from.
+*   temp_file: the file stream to write to.
+*   matcher: the compiled matcher (with capture groups).
+*   replacement: the replacement template.
+*   delimiter: the record delimiter that terminates each line.
+*   replacements: set to the number of replacements made.
+*
+*   returns: SUCCESS if the file was read, FAILURE if an operation fails.
+*/
+
+int replaceRegexStreaming(FILE *file, FILE *temp_file, struct line_matcher *matcher, const char *replacement,
+                          const struct record_delimiter *delimiter, long *replacements)
+{
+    struct line_buffer lines;
+    regmatch_t groups[MAX_REGEX_GROUPS];
+    size_t position;
+    int status;
+
+    *replacements = 0;
+
+    if (initialiseLineBuffer(&lines))
+    { return FAILURE; }
+
+    while ((status = readLines(&lines, file, delimiter)) == 1)
+    {
+        resetLineMatcher(matcher);
+        position = 0;
+        while (position < lines.region_end)
+        {
+            size_t candidate = findNextCandidate(matcher, lines.data, position, lines.region_end);
+            size_t line_start = candidate < lines.region_end
+                                ? findLineStart(lines.data, position, candidate, delimiter) : lines.region_end;
+            const char *line = lines.data + line_start;
+            size_t line_end;
+            size_t content_length;
+            size_t offset = 0;
+            int after_match = 0;
+
+            /* Everything before the candidate's line is copied as is */
+            limitedFwrite(lines.data + position, line_start - position, temp_file);
+            if (line_start == lines.region_end)
+            { break; }
+
+            content_length = findDelimiter(lines.data, line_start, lines.region_end, delimiter, &line_end)
+                             ? line_end - line_start - getDelimiterLength(delimiter) : line_end - line_start;
+
+            while (offset <= content_length)
+            {
+                groups[0].rm_so = offset;
+                groups[0].rm_eo = content_length;
+                if (regexec(&matcher->regex, line, MAX_REGEX_GROUPS, groups, REG_STARTEND | (offset ? REG_NOTBOL : 0)))
+                { break; }
+
+                /* Like sed, an empty match straight after a match isn't replaced */
+                if (after_match && groups[0].rm_so == (regoff_t) offset && groups[0].rm_eo == groups[0].rm_so)
+                {
+                    if (offset < content_length)
+                    {
+                        putc(line[offset], temp_file);
+                    }
+                    offset++;
+                    after_match = 0;
+                    continue;
+                }
+
+                limitedFwrite(line + offset, groups[0].rm_so - offset, temp_file);
+                writeRegexReplacement(temp_file, replacement, line, groups);
+                (*replacements)++;
+                offset = groups[0].rm_eo;
+                after_match = groups[0].rm_eo != groups[0].rm_so;
+
+                /* Step over an empty match so the search moves forward */
+                if (!after_match)
+                {
+                    if (offset < content_length)
+                    {
+                        putc(line[offset], temp_file);
+                    }
+                    offset++;
+                }
+            }
+
+            /* Copy the rest of the line and its delimiter (offset passes the content after a final empty match) */
+            if (offset > content_length)
+            {
+                offset = content_length;
+            }
+            limitedFwrite(line + offset, line_end - line_start - offset, temp_file);
+            position = line_end;
+        }
+    }
+
+    freeTracked(lines.data);
+    return status;
+}
+
+/*
+*   Function: replaceInFile
+*   -----------------------
+*   Replaces every occurrence of a literal or every match of a regex in a file.
+*   Equal length literal replacements are written in place. Everything else is
+*   streamed into the temporary file, which replaces the original atomically
+*   (and is discarded if nothing was replaced).
+*
+*   file_name: the name of the file to edit.
+*   search: the literal or extended regular expression to replace.
+*   replacement: the replacement text. For a regex, \0 to \9 insert the match and its groups.
+*   use_regex: 1 if search is a regex, 0 if it is a literal.
+*   delimiter: the record delimiter that terminates each line.
+*   replacements: set to the number of replacements made.
+*
+*   returns: SUCCESS if the file was edited, FAILURE if an operation fails.
+*/
+
+int replaceInFile(const char *file_name, const char *search, const char *replacement, const int use_regex,
+                  const struct record_delimiter *delimiter, long *replacements)
+{
+    struct line_matcher matcher;
+    char *patterns[1] = { (char *) search };
+    FILE *file;
+    FILE *temp_file;
+    int error;
+
+    *replacements = 0;
+
+    if (search[0] == '\0')
+    {
+        fprintf(stderr, "\n[Error] Failed to replace text in '%s': The search text is empty.\n", file_name);
+        return FAILURE;
+    }
+
+    if (!use_regex && strlen(search) == strlen(replacement))
+    {
+        return replaceLiteralInPlace(file_name, search, replacement, replacements);
+    }
+
+    if (use_regex && compileLineMatcher(&matcher, patterns, 1, 1, 1))
+    { return FAILURE; }
+
+    file = openFile(file_name, "rb");
+    temp_file = file ? openFile(TEMP_FILE_NAME, "wb") : NULL;
+    if (!file || !temp_file)
+    {
+        fprintf(stderr, "\n[Error] Failed to replace text in '%s': See above for more information.\n", file_name);
+        if (file)
+        {
+            fclose(file);
+        }
+        if (use_regex)
+        {
+            freeLineMatcher(&matcher);
+        }
+        return FAILURE;
+    }
+
+    if (use_regex)
+    {
+        error = replaceRegexStreaming(file, temp_file, &matcher, replacement, delimiter, replacements);
+        freeLineMatcher(&matcher);
+    }
+    else
+    {
+        error = replaceLiteralStreaming(file, temp_file, search, replacement, replacements);
+    }
+
+    fclose(file);
+    if (fclose(temp_file) || error || *replacements == 0 || commitTemporaryFile(file_name))
+    {
+        if (fileExists(TEMP_FILE_NAME))
+        {
+            deleteFile(TEMP_FILE_NAME);
+        }
+        if (error || *replacements != 0)
+        {
+            fprintf(stderr, "\n[Error] Failed to replace text in '%s': See above for more information.\n", file_name);
+            return FAILURE;
+        }
+    }
+    return SUCCESS;
+}
+
+/*
+*   Function: copyBytesBetweenDescriptors
+*   -------------------------------------
+*   Copies a range of bytes between two files without passing the data through
+*   user space. Uses copy_file_range(), which can share extents on filesystems
+*   that support it, then falls back to splice() through a pipe, and finally
+*   to pread()/pwrite() if neither is supported for these files.
+*
+*   source_fd: the file descriptor to copy from.
+*   source_offset: the offset of the first byte to copy.
+*   destination_fd: the file descriptor to copy to.
+*   destination_offset: the offset to write the first byte at.
+*   length: the number of bytes to copy.
+*
+*   returns: SUCCESS if every byte was copied, FAILURE if an operation fails.
+*/
+
+int copyBytesBetweenDescriptors(const int source_fd, off_t source_offset, const int destination_fd,
+                                off_t destination_offset, off_t length)
+{
+    char buffer[SCAN_BUFFER_SIZE];
+    ssize_t copied = 0;
+    ssize_t written;
+    int64_t started_ns;
+    int pipe_fds[2];
+
+    /* While I/O is limited, each call moves at most a chunk and is charged as a read and a write */
+    while (length > 0)
+    {
+        started_ns = startIO();
+        copied = copy_file_range(source_fd, &source_offset, destination_fd, &destination_offset, getIOChunkSize(length), 0);
+        if (copied <= 0)
+        { break; }
+        limitIO(copied * 2, 2, started_ns);
+        length -= copied;
+    }
+    if (length == 0)
+    { return SUCCESS; }
+    if (copied == 0 || (errno != EXDEV && errno != ENOSYS && errno != EINVAL && errno != EOPNOTSUPP))
+    { return FAILURE; }
+
+    if (!pipe(pipe_fds))
+    {
+        while (length > 0)
+        {
+            started_ns = startIO();
+            copied = splice(source_fd, &source_offset, pipe_fds[1], NULL, length < SCAN_BUFFER_SIZE ? length : SCAN_BUFFER_SIZE, SPLICE_F_MOVE);
+            if (copied <= 0)
+            { break; }
+            limitIO(copied, 1, started_ns);
+
+            /* Drain everything that went into the pipe before moving on */
+            for (written = 0; written < copied; )
+            {
+                started_ns = startIO();
+                ssize_t drained = splice(pipe_fds[0], NULL, destination_fd, &destination_offset, copied - written, SPLICE_F_MOVE);
+                limitIO(drained, 1, started_ns);
+                if (drained <= 0)
+                {
+                    close(pipe_fds[0]);
+                    close(pipe_fds[1]);
+                    return FAILURE;
+                }
+                written += drained;
+            }
+            length -= copied;
+        }
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        if (length == 0)
+        { return SUCCESS; }
+        if (copied == 0)
+        { return FAILURE; }
+    }
+
+    /* Neither zero-copy path works for these files, so copy through a buffer */
+    while (length > 0)
+    {
+        copied = limitedPread(source_fd, buffer, length < (off_t) sizeof(buffer) ? length : (off_t) sizeof(buffer), source_offset);
+        if (copied <= 0 || limitedPwrite(destination_fd, buffer, copied, destination_offset) != copied)
+        { return FAILURE; }
+        source_offset += copied;
+        destination_offset += copied;
+        length -= copied;
+    }
+    return SUCCESS;
+}
+
+/*
+*   Function: scanRange
+*   -------------------
+*   Counts the delimiters that end inside a byte range of a file, optionally
+*   stopping at a given one. Reads with pread() so several threads can scan
+*   different ranges of the same descriptor at once. When looking for a given
+*   delimiter the first read is small and later reads grow, so finding the
+*   end of a nearby line doesn't read a whole block.
+*
+*   fd: the file descriptor to read from.
+*   delimiter: the record delimiter that terminates each line.
+*   start: the start of the range.
+*   end: the end of the range.
+*   target: the delimiter to stop at (1 for the first), or 0 to count them all.
+*   target_end: set to the offset just past the target delimiter, if it was found.
+*
+*   returns: the number of delimiters found (equal to target if it was found).
+*/
+
+long scanRange(const int fd, const struct record_delimiter *delimiter, const off_t start, const off_t end,
+               const long target, off_t *target_end)
+{
+    /* buffer[0] holds the byte before each block, so CRLF pairs split across blocks are found */
+    char buffer[SCAN_BUFFER_SIZE + 1];
+    off_t block_start = start;
+    off_t block_size = target ? SAMPLE_READ_SIZE : SCAN_BUFFER_SIZE;
+    size_t position;
+    size_t line_end;
+    ssize_t bytes_read;
+    long count = 0;
+
+    buffer[0] = '\0';
+    if (start > 0 && delimiter->type == DELIMITER_CRLF && pread(fd, buffer, 1, start - 1) != 1)
+    {
+        buffer[0] = '\0';
+    }
+
+    while (block_start < end)
+    {
+        bytes_read = limitedPread(fd, buffer + 1, end - block_start < block_size ? end - block_start : block_size, block_start);
+        if (bytes_read <= 0)
+        { break; }
+        if (block_size < SCAN_BUFFER_SIZE)
+        {
+            block_size *= 2;
+        }
+
+        position = 1;
+        while (findDelimiter(buffer, position, bytes_read + 1, delimiter, &line_end))
+        {
+            if (++count == target)
+            {
+                *target_end = block_start + line_end - 1;
+                return count;
+            }
+            position = line_end;
+        }
+
+        buffer[0] = buffer[bytes_read];
+        block_start += bytes_read;
+    }
+    return count;
+}
+
+/*
+*   Function: countChunkTask
+*   ------------------------
+*   Parallel executor task counting the lines that end in one chunk of a split_job.
+*
+*   task_index: the chunk to count.
+*   context: the split_job.
+*/
+
+void countChunkTask(int task_index, void *context)
+{
+    struct split_job *job = context;
+    off_t start = task_index * job->chunk_size;
+    off_t end = start + job->chunk_size < job->file_size ? start + job->chunk_size : job->file_size;
+    off_t unused;
+
+    job->chunk_lines[task_index] = scanRange(job->fd, job->delimiter, start, end, 0, &unused);
+}
+
+/*
+*   Function: findBoundaryTask
+*   --------------------------
+*   Parallel executor task finding where one part of a split_job ends. In byte
+*   mode the even split point is moved forward to the next line boundary. In
+*   line mode the end of the part's last line is found inside its chunk.
+*
+*   task_index: the part before the boundary (boundary task_index + 1 is set).
+*   context: the split_job.
+*/
+
+void findBoundaryTask(int task_index, void *context)
+{
+    struct split_job *job = context;
+    off_t *boundary = &job->boundaries[task_index + 1];
+    long target_line;
+    long lines_before = 0;
+    int chunk = 0;
+
+    *boundary = job->file_size;
+    if (!job->by_lines)
+    {
+        off_t target = job->file_size * (task_index + 1) / job->part_count;
+        if (target == 0)
+        {
+            *boundary = 0;
+            return;
+        }
+        scanRange(job->fd, job->delimiter, target - 1, job->file_size, 1, boundary);
+        return;
+    }
+
+    /* Lines are shared out as evenly as possible, earlier parts taking the remainder */
+    target_line = job->total_lines / job->part_count * (task_index + 1)
+                  + (task_index + 1 < job->total_lines % job->part_count ? task_index + 1 : job->total_lines % job->part_count);
+    job->part_lines[task_index + 1] = target_line;
+    if (target_line == 0)
+    {
+        *boundary = 0;
+        return;
+    }
+
+    while (chunk < job->chunk_count && lines_before + job->chunk_lines[chunk] < target_line)
+    {
+        lines_before += job->chunk_lines[chunk++];
+    }
+    if (chunk < job->chunk_count)
+    {
+        scanRange(job->fd, job->delimiter, chunk * job->chunk_size, job->file_size, target_line - lines_before, boundary);
+    }
+}
+
+/*
+*   Function: getPartFileName
+*   -------------------------
+*   Gets the name of one part of a split file (the file + .partNNN).
+*
+*   file_name: the name of the file being split.
+*   part: the part number, starting from 1.
+*   part_file_name: variable to write the part name into.
+*   part_file_name_size: the size of part_file_name.
+*/
+
+void getPartFileName(const char *file_name, const int part, char *part_file_name, const size_t part_file_name_size)
+{
+    snprintf(part_file_name, part_file_name_size, "%s.part%03d", file_name, part);
+}
+
+/*
+*   Function: writePartTask
+*   -----------------------
+*   Parallel executor task writing one part of a split_job to its own file.
+*
+*   task_index: the part to write.
+*   context: the split_job.
+*/
+
+void writePartTask(int task_index, void *context)
+{
+    struct split_job *job = context;
+    char part_file_name[MAX_FILE_PATH_SIZE];
+    int part_fd;
+
+    getPartFileName(job->file_name, task_index + 1, part_file_name, sizeof(part_file_name));
+    part_fd = openat(working_directory_fd, part_file_name, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (part_fd < 0)
+    {
+        fprintf(stderr, "\n[Error] Failed to create file '%s': %s.\n", part_file_name, strerror(errno));
+        job->errors[task_index] = FAILURE;
+        return;
+    }
+
+    job->errors[task_index] = copyBytesBetweenDescriptors(job->fd, job->boundaries[task_index], part_fd, 0,
+                                                          job->boundaries[task_index + 1] - job->boundaries[task_index]);
+    if (close(part_fd) || job->errors[task_index])
+    {
+        fprintf(stderr, "\n[Error] Failed to write file '%s': %s.\n", part_file_name, strerror(errno));
+        job->errors[task_index] = FAILURE;
+    }
+}
+
+/*
+*   Function: splitFile
+*   -------------------
+*   Splits a file into parts named <file>.part001, <file>.part002 and so on.
+*   Parts are balanced by byte size (rounded to line boundaries) or by number
+*   of lines. Split points are found in parallel, and the parts are written
+*   in parallel with copy_file_range(). Parts that would be empty (because
+*   lines are longer than the part size) are merged into their neighbours.
+*
+*   file_name: the name of the file to split.
+*   part_count: the number of parts wanted.
+*   by_lines: 1 to balance by lines, 0 to balance by bytes.
+*   delimiter: the record delimiter that terminates each line.
+*   part_lines: set to an array of the number of lines in each part, or NULL in byte mode.
+*               The caller frees it.
+*
+*   returns: the number of parts written, or FAILURE if an operation fails.
+*/
+
+int splitFile(const char *file_name, int part_count, const int by_lines, const struct record_delimiter *delimiter,
+              long **part_lines)
+{
+    struct split_job job;
+    struct stat file_status;
+    int parts_written = 0;
+    int i;
+
+    *part_lines = NULL;
+    memset(&job, 0, sizeof(job));
+    job.file_name = file_name;
+    job.delimiter = delimiter;
+    job.by_lines = by_lines;
+
+    if (part_count < 1)
+    {
+        fprintf(stderr, "\n[Error] Failed to split '%s': Please enter a valid number of parts.\n", file_name);
+        return FAILURE;
+    }
+
+    job.fd = acquireDescriptor(working_directory_fd, file_name, O_RDONLY);
+    if (job.fd < 0 || fstat(job.fd, &file_status))
+    {
+        fprintf(stderr, "\n[Error] Failed to open file '%s': %s.\n", file_name, strerror(errno));
+        if (job.fd >= 0)
+        {
+            releaseDescriptor(job.fd);
+        }
+        return FAILURE;
+    }
+    job.file_size = file_status.st_size;
+    job.part_count = part_count;
+
+    job.boundaries = calloc(part_count + 1, sizeof(*job.boundaries));
+    job.part_lines = calloc(part_count + 1, sizeof(*job.part_lines));
+    job.errors = calloc(part_count, sizeof(*job.errors));
+    job.chunk_count = getNumberOfWorkers(INT_MAX) * 4;
+    job.chunk_size = job.file_size / job.chunk_count + 1;
+    job.chunk_lines = calloc(job.chunk_count, sizeof(*job.chunk_lines));
+    if (!job.boundaries || !job.part_lines || !job.errors || !job.chunk_lines)
+    {
+        fprintf(stderr, "\n[Error] Failed to split '%s': %s\n", file_name, strerror(errno));
+        parts_written = FAILURE;
+        goto cleanup;
+    }
+
+    if (by_lines)
+    {
+        runInParallel(job.chunk_count, countChunkTask, &job);
+        for (i = 0; i < job.chunk_count; i++)
+        {
+            job.total_lines += job.chunk_lines[i];
+        }
+    }
+    runInParallel(part_count - 1, findBoundaryTask, &job);
+    job.boundaries[part_count] = job.file_size;
+    job.part_lines[part_count] = job.total_lines;
+
+    /* Drop empty parts so every part file has content */
+    for (i = 1; i <= job.part_count; i++)
+    {
+        if (job.boundaries[i] > job.boundaries[parts_written] || (i == job.part_count && parts_written == 0))
+        {
+            parts_written++;
+            job.boundaries[parts_written] = job.boundaries[i];
+            job.part_lines[parts_written] = job.part_lines[i];
+        }
+    }
+    job.part_count = parts_written;
+
+    runInParallel(job.part_count, writePartTask, &job);
+    for (i = 0; i < job.part_count; i++)
+    {
+        if (job.errors[i])
+        {
+            parts_written = FAILURE;
+        }
+    }
+
+    /* Turn the running line totals into per-part counts */
+    if (by_lines && parts_written != FAILURE)
+    {
+        for (i = 0; i < job.part_count; i++)
+        {
+            job.part_lines[i] = job.part_lines[i + 1] - job.part_lines[i];
+        }
+        *part_lines = job.part_lines;
+        job.part_lines = NULL;
+    }
+
+cleanup:
+    releaseDescriptor(job.fd);
+    free(job.boundaries);
+    free(job.part_lines);
+    free(job.errors);
+    free(job.chunk_lines);
+    return parts_written;
+}
+
+/*
+*   Function: joinFiles
+*   -------------------
+*   Creates a new file holding the contents of several files one after another,
+*   copying with copy_file_range() so the data doesn't pass through user space.
+*
+*   source_file_names: the files to join, in order.
+*   source_count: the number of files to join.
+*   new_file_name: the name of the new file.
+*
+*   returns: SUCCESS if the files were joined, FAILURE if an operation fails.
+*/
+
+int joinFiles(char **source_file_names, const int source_count, const char *new_file_name)
+{
+    struct stat file_status;
+    off_t destination_offset = 0;
+    int destination_fd;
+    int source_fd;
+    int i;
+
+    destination_fd = openat(working_directory_fd, new_file_name, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (destination_fd < 0)
+    {
+        fprintf(stderr, "\n[Error] Failed to create file '%s': %s.\n", new_file_name, strerror(errno));
+        return FAILURE;
+    }
+
+    for (i = 0; i < source_count; i++)
+    {
+        source_fd = acquireDescriptor(working_directory_fd, source_file_names[i], O_RDONLY);
+        if (source_fd < 0 || fstat(source_fd, &file_status)
+            || copyBytesBetweenDescriptors(source_fd, 0, destination_fd, destination_offset, file_status.st_size))
+        {
+            fprintf(stderr, "\n[Error] Failed to join '%s' into '%s': %s.\n", source_file_names[i], new_file_name, strerror(errno));
+            if (source_fd >= 0)
+            {
+                releaseDescriptor(source_fd);
+            }
+            close(destination_fd);
+            deleteFile(new_file_name);
+            return FAILURE;
+        }
+        destination_offset += file_status.st_size;
+        releaseDescriptor(source_fd);
+    }
+
+    if (close(destination_fd))
+    {
+        fprintf(stderr, "\n[Error] Failed to write file '%s': %s.\n", new_file_name, strerror(errno));
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+/*
+*   Function: seedRandom
+*   --------------------
+*   Seeds a random number generator from the kernel, falling back to the time and process ID.
+*
+*   state: the generator state to seed.
+*/
+
+void seedRandom(uint64_t *state)
+{
+    if (getrandom(state, sizeof(*state), 0) != sizeof(*state))
+    {
+        *state = (uint64_t) time(NULL) ^ ((uint64_t) getpid() << 32);
+    }
+    if (*state == 0)
+    {
+        *state = 0x9E3779B97F4A7C15ULL;
+    }
+}
+
+/*
+*   Function: nextRandom
+*   --------------------
+*   Gets the next number from a xorshift64* generator. Fast, and more than
+*   random enough for sampling, but not for anything security related.
+*
+*   state: the generator state.
+*
+*   returns: a random 64-bit number.
+*/
+
+uint64_t nextRandom(uint64_t *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+/*
+*   Function: nextRandomFraction
+*   ----------------------------
+*   Gets a random number in the open interval (0, 1).
+*
+*   state: the generator state.
+*
+*   returns: the random number.
+*/
+
+double nextRandomFraction(uint64_t *state)
+{
+    return ((nextRandom(state) >> 11) + 0.5) / 9007199254740992.0;
+}
+
+/*
+*   Function: getReservoirSkip
+*   --------------------------
+*   Gets the number of lines Algorithm L skips before the next line enters the
+*   reservoir, so random numbers are only drawn for lines that are kept.
+*
+*   state: the generator state.
+*   weight: the algorithm's running weight W.
+*
+*   returns: the number of lines to skip.
+*/
+
+long getReservoirSkip(uint64_t *state, const double weight)
+{
+    double skip = floor(log(nextRandomFraction(state)) / log(1 - weight));
+
+    return skip < LONG_MAX ? (long) skip : LONG_MAX;
+}
+
+/*
+*   Function: compareSamples
+*   ------------------------
+*   qsort() comparator ordering samples by where they are in the file.
+*/
+
+int compareSamples(const void *first, const void *second)
+{
+    const struct line_sample *a = first;
+    const struct line_sample *b = second;
+
+    return (a->start > b->start) - (a->start < b->start);
+}
+
+/*
+*   Function: printFileRange
+*   ------------------------
+*   Prints a range of bytes from a file to the console.
+*
+*   fd: the file descriptor to read from.
+*   start: the offset of the first byte to print.
+*   length: the number of bytes to print.
+*/
+
+void printFileRange(const int fd, off_t start, off_t length)
+{
+    char buffer[SCAN_BUFFER_SIZE];
+    ssize_t bytes_read;
+
+    while (length > 0 && (bytes_read = limitedPread(fd, buffer, length < (off_t) sizeof(buffer) ? length : (off_t) sizeof(buffer), start)) > 0)
+    {
+        fwrite(buffer, 1, bytes_read, stdout);
+        start += bytes_read;
+        length -= bytes_read;
+    }
+}
+
+/*
+*   Function: sampleLinesExactly
+*   ----------------------------
+*   Picks a uniform random sample of lines in one pass with reservoir sampling
+*   (Algorithm L). Only the offsets of the sampled lines are kept.
+*
+*   file: the stream to read from, positioned at the start of the file.
+*   samples: the reservoir, with room for sample_count samples.
+*   sample_count: the number of lines wanted.
+*   delimiter: the record delimiter that terminates each line.
+*   random_state: the generator state.
+*   line_count: set to the number of lines in the file.
+*
+*   returns: the number of samples taken (fewer than wanted if the file is short),
+*            or FAILURE if an operation fails.
+*/
+
+long sampleLinesExactly(FILE *file, struct line_sample *samples, const long sample_count,
+                        const struct record_delimiter *delimiter, uint64_t *random_state, long *line_count)
+{
+    struct line_buffer lines;
+    off_t buffer_offset = 0;
+    double weight = 0;
+    long skip = 0;
+    size_t position;
+    size_t line_end;
+    int status;
+
+    *line_count = 0;
+
+    if (initialiseLineBuffer(&lines))
+    { return FAILURE; }
+
+    while (buffer_offset += lines.region_end, (status = readLines(&lines, file, delimiter)) == 1)
+    {
+        position = 0;
+        while (findDelimiter(lines.data, position, lines.region_end, delimiter, &line_end))
+        {
+            long slot = -1;
+
+            if (*line_count < sample_count)
+            {
+                slot = *line_count;
+                if (slot == sample_count - 1)
+                {
+                    weight = exp(log(nextRandomFraction(random_state)) / sample_count);
+                    skip = getReservoirSkip(random_state, weight);
+                }
+            }
+            else if (skip > 0)
+            {
+                skip--;
+            }
+            else
+            {
+                slot = nextRandom(random_state) % sample_count;
+                weight *= exp(log(nextRandomFraction(random_state)) / sample_count);
+                skip = getReservoirSkip(random_state, weight);
+            }
+
+            if (slot >= 0)
+            {
+                samples[slot].start = buffer_offset + position;
+                samples[slot].end = buffer_offset + line_end;
+                samples[slot].line_number = *line_count + 1;
+            }
+            (*line_count)++;
+            position = line_end;
+        }
+    }
+
+    freeTracked(lines.data);
+    if (status == FAILURE)
+    { return FAILURE; }
+
+    return *line_count < sample_count ? *line_count : sample_count;
+}
+
+/*
+*   Function: sampleLinesApproximately
+*   ----------------------------------
+*   Picks lines by jumping to random byte offsets and taking the line that
+*   starts next, so only a few kilobytes are read per sample no matter how
+*   big the file is. Lines that follow long lines are more likely to be
+*   picked, and a line can be picked more than once.
+*
+*   fd: the file descriptor to read from.
+*   file_size: the size of the file.
+*   samples: room for sample_count samples.
+*   sample_count: the number of lines wanted.
+*   delimiter: the record delimiter that terminates each line.
+*   random_state: the generator state.
+*
+*   returns: the number of samples taken (0 for a file with no lines).
+*/
+
+long sampleLinesApproximately(const int fd, const off_t file_size, struct line_sample *samples, const long sample_count,
+                              const struct record_delimiter *delimiter, uint64_t *random_state)
+{
+    long taken = 0;
+    off_t target;
+    off_t start;
+    off_t end;
+    long i;
+
+    for (i = 0; i < sample_count && file_size > 0; i++)
+    {
+        target = nextRandom(random_state) % file_size;
+
+        /* Snap forward to the next line, wrapping around to the first line at the end */
+        start = 0;
+        if (target > 0 && scanRange(fd, delimiter, target - 1, file_size, 1, &start) != 1)
+        {
+            start = 0;
+        }
+        if (start >= file_size || scanRange(fd, delimiter, start, file_size, 1, &end) != 1)
+        {
+            start = 0;
+            if (scanRange(fd, delimiter, 0, file_size, 1, &end) != 1)
+            { break; }
+        }
+
+        samples[taken].start = start;
+        samples[taken].end = end;
+        samples[taken].line_number = 0;
+        taken++;
+    }
+    return taken;
+}
+
+/*
+*   Function: sampleLinesFromFile
+*   -----------------------------
+*   Displays a random sample of the lines of a file, in file order.
+*
+*   file_name: the name of the file to sample.
+*   sample_count: the number of lines wanted.
+*   approximate: 1 to sample by random offsets, 0 for an exact uniform sample.
+*   delimiter: the record delimiter that terminates each line.
+*   line_count: set to the number of lines in the file in exact mode, otherwise -1.
+*
+*   returns: SUCCESS if the sample is displayed, FAILURE if an operation fails.
+*/
+
+int sampleLinesFromFile(const char *file_name, const long sample_count, const int approximate,
+                        const struct record_delimiter *delimiter, long *line_count)
+{
+    struct line_sample *samples;
+    struct stat file_status;
+    uint64_t random_state;
+    FILE *file;
+    long taken;
+    long i;
+    int stream_fd;
+    int fd;
+
+    *line_count = -1;
+
+    if (sample_count < 1)
+    {
+        fprintf(stderr, "\n[Error] Failed to sample '%s': Please enter a valid number of lines.\n", file_name);
+        return FAILURE;
+    }
+
+    fd = acquireDescriptor(working_directory_fd, file_name, O_RDONLY);
+    if (fd < 0 || fstat(fd, &file_status))
+    {
+        fprintf(stderr, "\n[Error] Failed to open file '%s': %s.\n", file_name, strerror(errno));
+        if (fd >= 0)
+        {
+            releaseDescriptor(fd);
+        }
+        return FAILURE;
+    }
+
+    samples = calloc(sample_count, sizeof(*samples));
+    if (!samples)
+    {
+        fprintf(stderr, "\n[Error] Failed to sample '%s': %s.\n", file_name, strerror(errno));
+        releaseDescriptor(fd);
+        return FAILURE;
+    }
+
+    seedRandom(&random_state);
+    if (approximate)
+    {
+        taken = sampleLinesApproximately(fd, file_status.st_size, samples, sample_count, delimiter, &random_state);
+    }
+    else
+    {
+        /* The stream needs its own open file, since a dup of the cached descriptor would share its offset */
+        stream_fd = openat(working_directory_fd, file_name, O_RDONLY | O_CLOEXEC);
+        file = stream_fd >= 0 ? fdopen(stream_fd, "rb") : NULL;
+        if (file)
+        {
+            posix_fadvise(stream_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+            taken = sampleLinesExactly(file, samples, sample_count, delimiter, &random_state, line_count);
+            fclose(file);
+        }
+        else
+        {
+            fprintf(stderr, "\n[Error] Failed to open file '%s': %s.\n", file_name, strerror(errno));
+            if (stream_fd >= 0)
+            {
+                close(stream_fd);
+            }
+            taken = FAILURE;
+        }
+    }
+
+    if (taken == FAILURE)
+    {
+        fprintf(stderr, "\n[Error] Failed to sample '%s': See above for more information.\n", file_name);
+        free(samples);
+        releaseDescriptor(fd);
+        return FAILURE;
+    }
+
+    qsort(samples, taken, sizeof(*samples), compareSamples);
+    printf("Sampled %ld lines from '%s':\n", taken, file_name);
+    for (i = 0; i < taken; i++)
+    {
+        if (samples[i].line_number)
+        { printf("Line %ld: ", samples[i].line_number); }
+        else
+        { printf("Offset %lld: ", (long long) samples[i].start); }
+
+        printFileRange(fd, samples[i].start, samples[i].end - samples[i].start - getDelimiterLength(delimiter));
+        printf("\n");
+    }
+
+    free(samples);
+    releaseDescriptor(fd);
+    return SUCCESS;
+}
+
+/*
+*   Function: getFileMetadata
+*   -------------------------
+*   Reads a file once to count its lines and, optionally, checksum it.
+*   The size and timestamps are taken before reading, so a file that changes
+*   while it is read is seen as changed next time.
+*
+*   file_name: the name of the file.
+*   delimiter: the record delimiter that terminates each line.
+*   with_checksum: 1 to checksum the contents, 0 to skip it.
+*   entry: the metadata to fill in.
+*
+*   returns: SUCCESS if the file was read, FAILURE if an operation fails.
+*/
+
+int getFileMetadata(const char *file_name, const struct record_delimiter *delimiter, const int with_checksum,
+                    struct metadata_entry *entry)
+{
+    struct checksum_state checksum;
+    struct stat file_status;
+    unsigned char previous_byte = '\0';
+    unsigned char *buffer;
+    ssize_t bytes_read;
+    off_t offset = 0;
+    int fd;
+
+    memset(entry, 0, sizeof(*entry));
+    initialiseChecksum(&checksum);
+
+    fd = acquireDescriptor(working_directory_fd, file_name, O_RDONLY);
+    buffer = malloc(STATISTICS_BUFFER_SIZE);
+    if (fd < 0 || !buffer || fstat(fd, &file_status))
+    {
+        fprintf(stderr, "\n[Error] Failed to read file '%s': %s.\n", file_name, strerror(errno));
+        free(buffer);
+        if (fd >= 0)
+        {
+            releaseDescriptor(fd);
+        }
+        return FAILURE;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    entry->device = file_status.st_dev;
+    entry->inode = file_status.st_ino;
+    entry->size = file_status.st_size;
+    entry->modified_ns = getTimeInNanoseconds(file_status.st_mtim.tv_sec, file_status.st_mtim.tv_nsec);
+    entry->changed_ns = getTimeInNanoseconds(file_status.st_ctim.tv_sec, file_status.st_ctim.tv_nsec);
+    entry->delimiter_type = delimiter->type;
+    entry->delimiter_byte = delimiter->byte;
+
+    while ((bytes_read = limitedPread(fd, buffer, STATISTICS_BUFFER_SIZE, offset)) > 0)
+    {
+        entry->lines += countBlockDelimiters(buffer, bytes_read, delimiter, previous_byte);
+        previous_byte = buffer[bytes_read - 1];
+
+        if (with_checksum)
+        {
+            updateChecksum(&checksum, buffer, bytes_read);
+        }
+        offset += bytes_read;
+    }
+
+    free(buffer);
+    releaseDescriptor(fd);
+
+    if (bytes_read < 0)
+    {
+        fprintf(stderr, "\n[Error] Failed to read file '%s': %s.\n", file_name, strerror(errno));
+        return FAILURE;
+    }
+
+    entry->flags = METADATA_IN_USE;
+    if (with_checksum)
+    {
+        entry->checksum = finishChecksum(&checksum);
+        entry->flags |= METADATA_HAS_CHECKSUM;
+    }
+    return SUCCESS;
+}
+
+/*
+*   Function: mapMetadataCache
+*   --------------------------
+*   Maps an open metadata cache file into memory.
+*
+*   cache: the cache, with its fd set.
+*   size: the size of the file.
+*
+*   returns: SUCCESS if the file was mapped, FAILURE if mmap() fails.
+*/
+
+int mapMetadataCache(struct metadata_cache *cache, const size_t size)
+{
+    void *mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, cache->fd, 0);
+
+    if (mapping == MAP_FAILED)
+    {
+        return FAILURE;
+    }
+
+    cache->header = mapping;
+    cache->entries = (struct metadata_entry *) (cache->header + 1);
+    cache->mapped_size = size;
+    return SUCCESS;
+}
+
+/*
+*   Function: createMetadataCacheFile
+*   ---------------------------------
+*   Creates (or empties) a metadata cache file and maps it.
+*
+*   cache: the cache, with its fd set to the file to use.
+*   slot_count: the number of slots in the hash table (a power of two).
+*
+*   returns: SUCCESS if the file was created, FAILURE if an operation fails.
+*/
+
+int createMetadataCacheFile(struct metadata_cache *cache, const uint64_t slot_count)
+{
+    size_t size = sizeof(struct metadata_cache_header) + slot_count * sizeof(struct metadata_entry);
+
+    /* Truncating to 0 first makes every slot read back as zeroes, which marks it unused */
+    if (ftruncate(cache->fd, 0) || ftruncate(cache->fd, size) || mapMetadataCache(cache, size))
+    {
+        return FAILURE;
+    }
+
+    cache->header->magic = METADATA_CACHE_MAGIC;
+    cache->header->entry_size = sizeof(struct metadata_entry);
+    cache->header->slot_count = slot_count;
+    cache->header->entry_count = 0;
+    return SUCCESS;
+}
+
+/*
+*   Function: openMetadataCache
+*   ---------------------------
+*   Opens and maps the metadata cache in the changelog folder, creating it if it
+*   doesn't exist and starting again if it is damaged. The cache stays locked
+*   against other instances of the program until it is closed.
+*
+*   changelog_directory_fd: a handle on the changelog directory.
+*   cache: the cache to open.
+*
+*   returns: SUCCESS if the cache is open, FAILURE if an operation fails.
+*/
+
+int openMetadataCache(const int changelog_directory_fd, struct metadata_cache *cache)
+{
+    struct metadata_cache_header header;
+    struct stat cache_status;
+    struct stat name_status;
+    int valid;
+
+    memset(cache, 0, sizeof(*cache));
+    while (1)
+    {
+        cache->fd = openat(changelog_directory_fd, METADATA_CACHE_NAME, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (cache->fd < 0 || flock(cache->fd, LOCK_EX) || fstat(cache->fd, &cache_status))
+        {
+            fprintf(stderr, "\n[Error] Failed to open the metadata cache: %s\n", strerror(errno));
+            if (cache->fd >= 0)
+            {
+                close(cache->fd);
+            }
+            return FAILURE;
+        }
+
+        /* Another instance may have replaced the cache while we waited for the lock */
+        if (!fstatat(changelog_directory_fd, METADATA_CACHE_NAME, &name_status, 0) && name_status.st_ino == cache_status.st_ino)
+        { break; }
+        close(cache->fd);
+    }
+
+    valid = pread(cache->fd, &header, sizeof(header), 0) == sizeof(header)
+            && header.magic == METADATA_CACHE_MAGIC && header.entry_size == sizeof(struct metadata_entry)
+            && header.slot_count >= MIN_METADATA_CACHE_SLOTS && !(header.slot_count & (header.slot_count - 1))
+            && (uint64_t) cache_status.st_size == sizeof(header) + header.slot_count * sizeof(struct metadata_entry);
+
+    if (valid ? mapMetadataCache(cache, cache_status.st_size) : createMetadataCacheFile(cache, MIN_METADATA_CACHE_SLOTS))
+    {
+        fprintf(stderr, "\n[Error] Failed to map the metadata cache: %s\n", strerror(errno));
+        close(cache->fd);
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+/*
+*   Function: closeMetadataCache
+*   ----------------------------
+*   Unmaps and closes the metadata cache. Changes reach the file through the
+*   shared mapping, so there is nothing to write back.
+*
+*   cache: the cache to close.
+*/
+
+void closeMetadataCache(struct metadata_cache *cache)
+{
+    if (cache->header)
+    {
+        munmap(cache->header, cache->mapped_size);
+        close(cache->fd);
+    }
+    cache->header = NULL;
+    cache->entries = NULL;
+}
+
+/*
+*   Function: findMetadataSlot
+*   --------------------------
+*   Finds the slot for a file in the metadata cache with linear probing.
+*
+*   cache: the open cache.
+*   device: the device holding the file.
+*   inode: the inode of the file.
+*
+*   returns: the file's entry, or the free slot where it belongs.
+*/
+
+struct metadata_entry *findMetadataSlot(const struct metadata_cache *cache, const uint64_t device, const uint64_t inode)
+{
+    uint64_t mask = cache->header->slot_count - 1;
+    uint64_t slot = inode * CHECKSUM_PRIME_1 ^ device * CHECKSUM_PRIME_2;
+
+    slot = (slot ^ (slot >> 29)) & mask;
+    while ((cache->entries[slot].flags & METADATA_IN_USE)
+           && (cache->entries[slot].inode != inode || cache->entries[slot].device != device))
+    {
+        slot = (slot + 1) & mask;
+    }
+    return &cache->entries[slot];
+}
+
+/*
+*   Function: growMetadataCache
+*   ---------------------------
+*   Makes room in the metadata cache for more entries, keeping it at most three
+*   quarters full. The larger table is written to a new file and renamed over the
+*   old one, so the cache is never left half rebuilt.
+*
+*   changelog_directory_fd: a handle on the changelog directory.
+*   cache: the open cache.
+*   new_entries: the number of entries about to be added.
+*
+*   returns: SUCCESS if there is room, FAILURE if an operation fails.
+*/
+
+int growMetadataCache(const int changelog_directory_fd, struct metadata_cache *cache, const uint64_t new_entries)
+{
+    const char *temporary_name = METADATA_CACHE_NAME ".tmp";
+    struct metadata_cache grown;
+    uint64_t needed = cache->header->entry_count + new_entries;
+    uint64_t slot_count = cache->header->slot_count;
+    uint64_t slot;
+
+    while (needed * 4 > slot_count * 3)
+    {
+        slot_count *= 2;
+    }
+    if (slot_count == cache->header->slot_count)
+    {
+        return SUCCESS;
+    }
+
+    memset(&grown, 0, sizeof(grown));
+    grown.fd = openat(changelog_directory_fd, temporary_name, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (grown.fd < 0 || flock(grown.fd, LOCK_EX) || createMetadataCacheFile(&grown, slot_count))
+    {
+        fprintf(stderr, "\n[Error] Failed to grow the metadata cache: %s\n", strerror(errno));
+        if (grown.fd >= 0)
+        {
+            close(grown.fd);
+            unlinkat(changelog_directory_fd, temporary_name, 0);
+        }
+        return FAILURE;
+    }
+
+    for (slot = 0; slot < cache->header->slot_count; slot++)
+    {
+        if (cache->entries[slot].flags & METADATA_IN_USE)
+        {
+            *findMetadataSlot(&grown, cache->entries[slot].device, cache->entries[slot].inode) = cache->entries[slot];
+            grown.header->entry_count++;
+        }
+    }
+
+    if (renameat(changelog_directory_fd, temporary_name, changelog_directory_fd, METADATA_CACHE_NAME))
+    {
+        fprintf(stderr, "\n[Error] Failed to grow the metadata cache: %s\n", strerror(errno));
+        closeMetadataCache(&grown);
+        unlinkat(changelog_directory_fd, temporary_name, 0);
+        return FAILURE;
+    }
+
+    closeMetadataCache(cache);
+    *cache = grown;
+    return SUCCESS;
+}
+
+/*
+*   Function: metadataTask
+*   ----------------------
+*   Parallel task that finds the metadata of one file. Unchanged files are
+*   answered from the cache with a single statx() call. The directory index's
+*   statuses aren't used here, since inotify misses writes made through hard
+*   links in other directories and through shared mappings.
+*
+*   task_index: the index of the file in the job.
+*   context: the metadata_job.
+*/
+
+void metadataTask(int task_index, void *context)
+{
+    struct metadata_job *job = context;
+    const char *file_name = job->files->paths[task_index];
+    const struct metadata_entry *cached;
+    struct entry_status file_status;
+
+    if (getEntryStatus(working_directory_fd, file_name, 0, &file_status))
+    {
+        fprintf(stderr, "\n[Error] Failed to read '%s': %s\n", file_name, strerror(errno));
+        job->errors[task_index] = FAILURE;
+        return;
+    }
+    if (!S_ISREG(file_status.mode))
+    {
+        fprintf(stderr, "\n[Error] Failed to read '%s': Not a regular file.\n", file_name);
+        job->errors[task_index] = FAILURE;
+        return;
+    }
+
+    if (job->cache->header)
+    {
+        cached = findMetadataSlot(job->cache, file_status.device, file_status.inode);
+        if ((cached->flags & METADATA_IN_USE) && cached->size == file_status.size
+            && cached->modified_ns == file_status.modified_ns && cached->changed_ns == file_status.changed_ns
+            && cached->delimiter_type == job->delimiter->type && cached->delimiter_byte == job->delimiter->byte
+            && (!job->with_checksum || (cached->flags & METADATA_HAS_CHECKSUM)))
+        {
+            job->results[task_index] = *cached;
+            job->from_cache[task_index] = 1;
+            return;
+        }
+    }
+
+    job->errors[task_index] = getFileMetadata(file_name, job->delimiter, job->with_checksum, &job->results[task_index]);
+}
+
+/*
+*   Function: getCachedNumberOfLines
+*   --------------------------------
+*   Gets the number of lines in a file from the metadata cache, as long as the
+*   cached entry matches the file as it is now.
+*
+*   file_name: the name of the file.
+*   delimiter: the record delimiter that terminates each line.
+*   changelog_directory_fd: a handle on the changelog directory, which holds the cache.
+*
+*   returns: the number of lines, or -1 if the cache has no current entry for the file.
+*/
+
+long getCachedNumberOfLines(const char *file_name, const struct record_delimiter *delimiter, const int changelog_directory_fd)
+{
+    const struct metadata_entry *cached;
+    struct metadata_cache cache;
+    struct entry_status file_status;
+    long number_of_lines = -1;
+
+    if (getEntryStatus(working_directory_fd, file_name, 0, &file_status) || openMetadataCache(changelog_directory_fd, &cache))
+    { return -1; }
+
+    cached = findMetadataSlot(&cache, file_status.device, file_status.inode);
+    if ((cached->flags & METADATA_IN_USE) && cached->size == file_status.size
+        && cached->modified_ns == file_status.modified_ns && cached->changed_ns == file_status.changed_ns
+        && cached->delimiter_type == delimiter->type && cached->delimiter_byte == delimiter->byte)
+    {
+        number_of_lines = cached->lines;
+    }
+    closeMetadataCache(&cache);
+    return number_of_lines;
+}
+
+/*
+*   Function: printFileMetadata
+*   ---------------------------
+*   Prints one row of the metadata report.
+*
+*   file_name: the name to print for the row.
+*   entry: the file's metadata.
+*   with_checksum: whether to print the checksum.
+*/
+
+void printFileMetadata(const char *file_name, const struct metadata_entry *entry, const int with_checksum)
+{
+    char modified[32] = "-";
+    char checksum[17] = "-";
+    time_t seconds = entry->modified_ns / 1000000000;
+    struct tm modified_time;
+
+    if (localtime_r(&seconds, &modified_time))
+    {
+        strftime(modified, sizeof(modified), "%Y-%m-%d %H:%M:%S", &modified_time);
+    }
+    if (with_checksum)
+    {
+        snprintf(checksum, sizeof(checksum), "%016llx", (unsigned long long) entry->checksum);
+    }
+
+    printf("%14llu  %-19s %12lld %16s  %s\n", (unsigned long long) entry->size, modified, (long long) entry->lines,
+           checksum, file_name);
+}
+
+/*
+*   Function: displayFileMetadata
+*   -----------------------------
+*   Displays the size, modification time, line count and (optionally) checksum of
+*   a file, or of every file in a directory. Files that haven't changed since they
+*   were last reported are answered from the metadata cache without being opened;
+*   the rest are read in parallel and added to the cache.
+*
+*   file_name: the name of the file or directory.
+*   delimiter: the record delimiter that terminates each line.
+*   with_checksum: 1 to report checksums, 0 to skip them.
+*   changelog_directory_fd: a handle on the changelog directory, which holds the cache.
+*   line_count: set to the number of lines for a single file, otherwise to -1.
+*
+*   returns: SUCCESS if the report is displayed,
+*            FAILURE if an operation fails.
+*/
+
+int displayFileMetadata(const char *file_name, const struct record_delimiter *delimiter, const int with_checksum,
+                        const int changelog_directory_fd, long *line_count)
+{
+    struct file_list files = { NULL, 0, 0 };
+    struct metadata_cache cache;
+    struct metadata_job job;
+    struct stat file_status;
+    struct timespec now;
+    struct metadata_entry *slot;
+    uint64_t new_entries = 0;
+    int answered_from_cache = 0;
+    int error = SUCCESS;
+    int i;
+
+    *line_count = -1;
+
+    if (fstatat(working_directory_fd, file_name, &file_status, 0))
+    {
+        fprintf(stderr, "\n[Error] Failed to read '%s': %s\n", file_name, strerror(errno));
+        return FAILURE;
+    }
+
+    if (S_ISDIR(file_status.st_mode))
+    {
+        if (collectFilesInDirectory(file_name, &files))
+        { return FAILURE; }
+    }
+    else if (addFileToList(&files, file_name))
+    { return FAILURE; }
+
+    memset(&job, 0, sizeof(job));
+    job.files = &files;
+    job.cache = &cache;
+    job.delimiter = delimiter;
+    job.with_checksum = with_checksum;
+
+    job.results = calloc(files.count + 1, sizeof(*job.results));
+    job.from_cache = calloc(files.count + 1, sizeof(*job.from_cache));
+    job.errors = calloc(files.count + 1, sizeof(*job.errors));
+    if (!job.results || !job.from_cache || !job.errors)
+    {
+        fprintf(stderr, "\n[Error] Failed to read '%s': %s\n", file_name, strerror(errno));
+        free(job.results);
+        free(job.from_cache);
+        free(job.errors);
+        freeFileList(&files);
+        return FAILURE;
+    }
+
+    /* The report still works without the cache, it just reads every file */
+    if (openMetadataCache(changelog_directory_fd, &cache))
+    {
+        memset(&cache, 0, sizeof(cache));
+    }
+
+    /*
+    *   A file written again within the same timestamp tick looks unchanged, so files
+    *   changed in the last second are left out of the cache until they settle.
+    */
+    clock_gettime(CLOCK_REALTIME, &now);
+    job.cutoff_ns = getTimeInNanoseconds(now.tv_sec - 1, now.tv_nsec);
+
+    runInParallel(files.count, metadataTask, &job);
+
+    for (i = 0; i < files.count; i++)
+    {
+        if (!job.errors[i] && !job.from_cache[i] && job.results[i].changed_ns < job.cutoff_ns)
+        {
+            new_entries++;
+        }
+    }
+    if (cache.header && new_entries && !growMetadataCache(changelog_directory_fd, &cache, new_entries))
+    {
+        for (i = 0; i < files.count; i++)
+        {
+            if (job.errors[i] || job.from_cache[i] || job.results[i].changed_ns >= job.cutoff_ns)
+            { continue; }
+
+            slot = findMetadataSlot(&cache, job.results[i].device, job.results[i].inode);
+            if (!(slot->flags & METADATA_IN_USE))
+            {
+                cache.header->entry_count++;
+            }
+            *slot = job.results[i];
+        }
+    }
+    closeMetadataCache(&cache);
+
+    printf("%14s  %-19s %12s %16s  %s\n", "size", "modified", "lines", "checksum", "name");
+    for (i = 0; i < files.count; i++)
+    {
+        if (job.errors[i])
+        { continue; }
+
+        printFileMetadata(files.paths[i], &job.results[i], with_checksum);
+        answered_from_cache += job.from_cache[i];
+    }
+    if (S_ISDIR(file_status.st_mode))
+    {
+        printf("%d files, %d answered from the metadata cache\n", files.count, answered_from_cache);
+    }
+    else if (!job.errors[0])
+    {
+        *line_count = job.results[0].lines;
+    }
+    else
+    {
+        error = FAILURE;
+    }
+
+    free(job.results);
+    free(job.from_cache);
+    free(job.errors);
+    freeFileList(&files);
+    return error;
+}
+
+/*
+*   Function: formatByteCount
+*   -------------------------
+*   Formats a number of bytes for people to read, e.g. "1.5 MiB".
+*
+*   bytes: the number of bytes.
+*   buffer: the buffer to write the text to.
+*   buffer_size: the size of the buffer.
+*
+*   returns: the buffer, for use in printf() arguments.
+*/
+
+char *formatByteCount(const uint64_t bytes, char *buffer, const size_t buffer_size)
+{
+    const char *units[] = { "B", "KiB", "MiB", "GiB", "TiB", "PiB", "EiB" };
+    double value = bytes;
+    int unit = 0;
+
+    while (value >= 1024 && unit < 6)
+    {
+        value /= 1024;
+        unit++;
+    }
+
+    if (unit == 0)
+    { snprintf(buffer, buffer_size, "%llu B", (unsigned long long) bytes); }
+    else
+    { snprintf(buffer, buffer_size, "%.1f %s", value, units[unit]); }
+    return buffer;
+}
+
+/*
+*   Function: addToUsageHeap
+*   ------------------------
+*   Offers a file or directory to a bounded heap of the largest entries. The path
+*   is only built if the entry makes it into the heap, which is rare once it's full.
+*
+*   heap: the heap to add to.
+*   allocated: the bytes allocated by the entry.
+*   apparent: the apparent size of the entry.
+*   directory_path: the path of the entry, or of the directory holding it.
+*   name: the name of the entry in directory_path, or NULL if directory_path is the entry.
+*
+*   returns: SUCCESS, or FAILURE if memory for the path can't be allocated.
+*/
+
+int addToUsageHeap(struct usage_heap *heap, const uint64_t allocated, const uint64_t apparent,
+                   const char *directory_path, const char *name)
+{
+    struct usage_entry entry;
+    size_t path_size;
+    int position;
+    int child;
+
+    if (heap->capacity == 0 || (heap->count == heap->capacity && allocated <= heap->entries[0].allocated))
+    {
+        return SUCCESS;
+    }
+
+    path_size = strlen(directory_path) + (name ? strlen(name) + 2 : 1);
+    entry.path = malloc(path_size);
+    if (!entry.path)
+    {
+        return FAILURE;
+    }
+    snprintf(entry.path, path_size, name ? "%s/%s" : "%s", directory_path, name);
+    entry.allocated = allocated;
+    entry.apparent = apparent;
+
+    if (heap->count < heap->capacity)
+    {
+        /* Sift the new entry up from the bottom */
+        position = heap->count++;
+        while (position > 0 && heap->entries[(position - 1) / 2].allocated > entry.allocated)
+        {
+            heap->entries[position] = heap->entries[(position - 1) / 2];
+            position = (position - 1) / 2;
+        }
+        heap->entries[position] = entry;
+        return SUCCESS;
+    }
+
+    /* Replace the smallest entry and sift the new one down */
+    free(heap->entries[0].path);
+    position = 0;
+    while ((child = position * 2 + 1) < heap->count)
+    {
+        if (child + 1 < heap->count && heap->entries[child + 1].allocated < heap->entries[child].allocated)
+        {
+            child++;
+        }
+        if (heap->entries[child].allocated >= entry.allocated)
+        { break; }
+
+        heap->entries[position] = heap->entries[child];
+        position = child;
+    }
+    heap->entries[position] = entry;
+    return SUCCESS;
+}
+
+/*
+*   Function: compareUsageEntries
+*   -----------------------------
+*   qsort() comparison that puts the largest entries first.
+*/
+
+int compareUsageEntries(const void *first, const void *second)
+{
+    const struct usage_entry *a = first;
+    const struct usage_entry *b = second;
+
+    if (a->allocated != b->allocated)
+    { return a->allocated < b->allocated ? 1 : -1; }
+    if (a->apparent != b->apparent)
+    { return a->apparent < b->apparent ? 1 : -1; }
+    return strcmp(a->path, b->path);
+}
+
+/*
+*   Function: addInodeToSet
+*   -----------------------
+*   Records a hardlinked inode, so a file with several names is only counted once.
+*
+*   job: the disk usage walk.
+*   device: the device holding the file.
+*   inode: the inode of the file.
+*
+*   returns: 1 if the inode wasn't in the set (or couldn't be added), 0 if it was.
+*/
+
+int addInodeToSet(struct usage_job *job, const uint64_t device, const uint64_t inode)
+{
+    uint64_t hash = inode * CHECKSUM_PRIME_1 ^ device * CHECKSUM_PRIME_2;
+    struct inode_set_shard *shard = &job->inodes[(hash >> 58) % INODE_SET_SHARDS];
+    struct inode_key *keys;
+    size_t capacity;
+    size_t slot;
+    size_t i;
+    int added = 1;
+
+    pthread_mutex_lock(&shard->lock);
+
+    /* Keep the table at most half full */
+    if ((shard->count + 1) * 2 > shard->capacity)
+    {
+        capacity = shard->capacity ? shard->capacity * 2 : 1024;
+        keys = calloc(capacity, sizeof(*keys));
+        if (!keys)
+        {
+            pthread_mutex_unlock(&shard->lock);
+            return 1;
+        }
+
+        for (i = 0; i < shard->capacity; i++)
+        {
+            if (shard->keys[i].inode || shard->keys[i].device)
+            {
+                slot = (shard->keys[i].inode * CHECKSUM_PRIME_1 ^ shard->keys[i].device * CHECKSUM_PRIME_2) & (capacity - 1);
+                while (keys[slot].inode || keys[slot].device)
+                {
+                    slot = (slot + 1) & (capacity - 1);
+                }
+                keys[slot] = shard->keys[i];
+            }
+        }
+        free(shard->keys);
+        shard->keys = keys;
+        shard->capacity = capacity;
+    }
+
+    slot = hash & (shard->capacity - 1);
+    while (shard->keys[slot].inode || shard->keys[slot].device)
+    {
+        if (shard->keys[slot].inode == inode && shard->keys[slot].device == device)
+        {
+            added = 0;
+            break;
+        }
+        slot = (slot + 1) & (shard->capacity - 1);
+    }
+    if (added)
+    {
+        shard->keys[slot].device = device;
+        shard->keys[slot].inode = inode;
+        shard->count++;
+    }
+
+    pthread_mutex_unlock(&shard->lock);
+    return added;
+}
+
+/*
+*   Function: pushUsageDirectory
+*   ----------------------------
+*   Adds a directory to the walk and queues it to be read.
+*   Must be called with the job's lock held.
+*
+*   job: the disk usage walk.
+*   directory: the directory to add. The job takes over its path.
+*
+*   returns: SUCCESS if the directory was queued, FAILURE if memory runs out.
+*/
+
+int pushUsageDirectory(struct usage_job *job, const struct usage_directory *directory)
+{
+    struct usage_directory *directories;
+    long *stack;
+    long capacity;
+
+    if (job->directory_count == job->directory_capacity)
+    {
+        capacity = job->directory_capacity ? job->directory_capacity * 2 : 1024;
+        directories = realloc(job->directories, capacity * sizeof(*directories));
+        if (!directories)
+        { return FAILURE; }
+        job->directories = directories;
+        job->directory_capacity = capacity;
+    }
+    if (job->stack_count == job->stack_capacity)
+    {
+        capacity = job->stack_capacity ? job->stack_capacity * 2 : 1024;
+        stack = realloc(job->stack, capacity * sizeof(*stack));
+        if (!stack)
+        { return FAILURE; }
+        job->stack = stack;
+        job->stack_capacity = capacity;
+    }
+
+    job->directories[job->directory_count] = *directory;
+    job->stack[job->stack_count++] = job->directory_count++;
+    return SUCCESS;
+}
+
+/*
+*   Function: readUsageDirectory
+*   ----------------------------
+*   Reads one directory of the disk usage walk, counting its files and
+*   collecting its subdirectories.
+*
+*   job: the disk usage walk.
+*   worker: the index of the worker reading the directory.
+*   directory: the directory to read. Its sizes are increased by the files in it.
+*   children: the subdirectories found, grown as needed.
+*   child_count: set to the number of subdirectories found.
+*   child_capacity: the allocated size of children.
+*/
+
+void readUsageDirectory(struct usage_job *job, const int worker, struct usage_directory *directory,
+                        struct usage_directory **children, long *child_count, long *child_capacity)
+{
+    struct usage_directory *grown;
+    struct dirent *directory_pointer;
+    struct statx entry_status;
+    DIR *stream;
+    size_t path_size;
+    uint64_t allocated;
+    int fd;
+
+    *child_count = 0;
+
+    fd = openat(working_directory_fd, directory->path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    stream = fd >= 0 ? fdopendir(fd) : NULL;
+    if (!stream)
+    {
+        fprintf(stderr, "\n[Error] Failed to read directory '%s': %s\n", directory->path, strerror(errno));
+        job->errors[worker]++;
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return;
+    }
+
+    while ((directory_pointer = readdir(stream)) != NULL)
+    {
+        if (!strcmp(directory_pointer->d_name, ".") || !strcmp(directory_pointer->d_name, ".."))
+        { continue; }
+
+        if (statx(fd, directory_pointer->d_name, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT,
+                  STATX_TYPE | STATX_SIZE | STATX_BLOCKS | STATX_INO | STATX_NLINK, &entry_status))
+        {
+            job->errors[worker]++;
+            continue;
+        }
+        allocated = entry_status.stx_blocks * 512;
+
+        if (S_ISDIR(entry_status.stx_mode))
+        {
+            if (*child_count == *child_capacity)
+            {
+                grown = realloc(*children, (*child_capacity ? *child_capacity * 2 : 64) * sizeof(**children));
+                if (!grown)
+                {
+                    job->errors[worker]++;
+                    continue;
+                }
+                *children = grown;
+                *child_capacity = *child_capacity ? *child_capacity * 2 : 64;
+            }
+
+            path_size = strlen(directory->path) + strlen(directory_pointer->d_name) + 2;
+            (*children)[*child_count].path = malloc(path_size);
+            if (!(*children)[*child_count].path)
+            {
+                job->errors[worker]++;
+                continue;
+            }
+            snprintf((*children)[*child_count].path, path_size, "%s/%s", directory->path, directory_pointer->d_name);
+            (*children)[*child_count].allocated = allocated;
+            (*children)[*child_count].apparent = entry_status.stx_size;
+            (*child_count)++;
+            continue;
+        }
+
+        /* Every name of a hardlinked file after the first adds nothing */
+        if (entry_status.stx_nlink > 1
+            && !addInodeToSet(job, makedev(entry_status.stx_dev_major, entry_status.stx_dev_minor), entry_status.stx_ino))
+        { continue; }
+
+        job->files[worker]++;
+        directory->allocated += allocated;
+        directory->apparent += entry_status.stx_size;
+        if (addToUsageHeap(&job->heaps[worker], allocated, entry_status.stx_size, directory->path, directory_pointer->d_name))
+        {
+            job->errors[worker]++;
+        }
+    }
+
+    closedir(stream);
+}
+
+/*
+*   Function: diskUsageTask
+*   -----------------------
+*   Parallel task run once per worker. Takes directories from the stack and reads
+*   them until the stack is empty and no other worker can add to it.
+*
+*   worker: the index of the worker.
+*   context: the usage_job.
+*/
+
+void diskUsageTask(int worker, void *context)
+{
+    struct usage_job *job = context;
+    struct usage_directory *children = NULL;
+    struct usage_directory directory;
+    long child_capacity = 0;
+    long child_count;
+    long index;
+    long i;
+
+    pthread_mutex_lock(&job->lock);
+    while (1)
+    {
+        while (job->stack_count == 0 && job->active_workers > 0)
+        {
+            pthread_cond_wait(&job->work_available, &job->lock);
+        }
+        if (job->stack_count == 0)
+        { break; }
+
+        index = job->stack[--job->stack_count];
+        directory = job->directories[index];
+        directory.allocated = 0;
+        directory.apparent = 0;
+        job->active_workers++;
+        pthread_mutex_unlock(&job->lock);
+
+        readUsageDirectory(job, worker, &directory, &children, &child_count, &child_capacity);
+
+        pthread_mutex_lock(&job->lock);
+        job->directories[index].allocated += directory.allocated;
+        job->directories[index].apparent += directory.apparent;
+        for (i = 0; i < child_count; i++)
+        {
+            children[i].parent = index;
+            if (pushUsageDirectory(job, &children[i]))
+            {
+                free(children[i].path);
+                job->errors[worker]++;
+            }
+        }
+        job->active_workers--;
+
+        if (child_count > 0 || job->active_workers == 0)
+        {
+            pthread_cond_broadcast(&job->work_available);
+        }
+    }
+    pthread_mutex_unlock(&job->lock);
+
+    free(children);
+}
+
+/*
+*   Function: printUsageEntries
+*   ---------------------------
+*   Prints ranked files or directories, largest first.
+*
+*   title: the heading to print above the entries.
+*   entries: the entries to print (sorted in place).
+*   count: the number of entries.
+*   limit: the most entries to print.
+*/
+
+void printUsageEntries(const char *title, struct usage_entry *entries, const long count, const int limit)
+{
+    char allocated[32];
+    char apparent[32];
+    long i;
+
+    qsort(entries, count, sizeof(*entries), compareUsageEntries);
+
+    printf("\n%s:\n", title);
+    printf("%12s %12s  %s\n", "allocated", "apparent", "path");
+    for (i = 0; i < count && i < limit; i++)
+    {
+        printf("%12s %12s  %s\n", formatByteCount(entries[i].allocated, allocated, sizeof(allocated)),
+               formatByteCount(entries[i].apparent, apparent, sizeof(apparent)), entries[i].path);
+    }
+}
+
+/*
+*   Function: displayDiskUsage
+*   --------------------------
+*   Displays the disk usage of a directory tree: the space allocated on disk and
+*   the apparent size, followed by the largest files and directories. The tree is
+*   walked in parallel, and files with several hardlinks are counted once.
+*
+*   directory_name: the directory at the top of the tree.
+*   top_count: the number of largest files and directories to show.
+*
+*   returns: SUCCESS if the summary is displayed,
+*            FAILURE if an operation fails.
+*/
+
+int displayDiskUsage(const char *directory_name, const int top_count)
+{
+    struct usage_job job;
+    struct usage_directory top;
+    struct usage_heap largest_directories = { NULL, 0, top_count };
+    struct usage_entry *largest_files = NULL;
+    struct statx top_status;
+    char allocated[32];
+    char apparent[32];
+    long file_count = 0;
+    long error_count = 0;
+    long entry_count = 0;
+    int worker_count = getNumberOfWorkers(INT_MAX);
+    int error = FAILURE;
+    long i;
+    int j;
+
+    if (statx(working_directory_fd, directory_name, 0, STATX_TYPE | STATX_SIZE | STATX_BLOCKS, &top_status))
+    {
+        fprintf(stderr, "\n[Error] Failed to read '%s': %s\n", directory_name, strerror(errno));
+        return FAILURE;
+    }
+    if (!S_ISDIR(top_status.stx_mode))
+    {
+        fprintf(stderr, "\n[Error] '%s' is not a directory.\n", directory_name);
+        return FAILURE;
+    }
+
+    memset(&job, 0, sizeof(job));
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.work_available, NULL);
+    for (j = 0; j < INODE_SET_SHARDS; j++)
+    {
+        pthread_mutex_init(&job.inodes[j].lock, NULL);
+    }
+
+    job.heaps = calloc(worker_count, sizeof(*job.heaps));
+    job.files = calloc(worker_count, sizeof(*job.files));
+    job.errors = calloc(worker_count, sizeof(*job.errors));
+    largest_directories.entries = calloc(top_count + 1, sizeof(*largest_directories.entries));
+    top.path = strdup(directory_name);
+    top.parent = -1;
+    top.allocated = top_status.stx_blocks * 512;
+    top.apparent = top_status.stx_size;
+    if (!job.heaps || !job.files || !job.errors || !largest_directories.entries || !top.path || pushUsageDirectory(&job, &top))
+    {
+        fprintf(stderr, "\n[Error] Failed to read '%s': %s\n", directory_name, strerror(errno));
+        free(top.path);
+        goto cleanup;
+    }
+    for (j = 0; j < worker_count; j++)
+    {
+        job.heaps[j].capacity = top_count;
+        job.heaps[j].entries = calloc(top_count + 1, sizeof(*job.heaps[j].entries));
+        if (!job.heaps[j].entries)
+        {
+            fprintf(stderr, "\n[Error] Failed to read '%s': %s\n", directory_name, strerror(errno));
+            goto cleanup;
+        }
+    }
+
+    runInParallel(worker_count, diskUsageTask, &job);
+
+    /* Every directory comes after its parent, so one backwards pass rolls the totals up */
+    for (i = job.directory_count - 1; i > 0; i--)
+    {
+        job.directories[job.directories[i].parent].allocated += job.directories[i].allocated;
+        job.directories[job.directories[i].parent].apparent += job.directories[i].apparent;
+    }
+    for (i = 0; i < job.directory_count; i++)
+    {
+        addToUsageHeap(&largest_directories, job.directories[i].allocated, job.directories[i].apparent,
+                       job.directories[i].path, NULL);
+    }
+
+    /* Each worker kept its own largest files, so pool them before ranking */
+    for (j = 0; j < worker_count; j++)
+    {
+        file_count += job.files[j];
+        error_count += job.errors[j];
+        entry_count += job.heaps[j].count;
+    }
+    largest_files = calloc(entry_count + 1, sizeof(*largest_files));
+    if (!largest_files)
+    {
+        fprintf(stderr, "\n[Error] Failed to read '%s': %s\n", directory_name, strerror(errno));
+        goto cleanup;
+    }
+    entry_count = 0;
+    for (j = 0; j < worker_count; j++)
+    {
+        memcpy(largest_files + entry_count, job.heaps[j].entries, job.heaps[j].count * sizeof(*largest_files));
+        entry_count += job.heaps[j].count;
+    }
+
+    printf("Disk usage of '%s': %ld files in %ld directories\n", directory_name, file_count, job.directory_count);
+    printf("Allocated on disk: %s (%llu bytes)\n", formatByteCount(job.directories[0].allocated, allocated, sizeof(allocated)),
+           (unsigned long long) job.directories[0].allocated);
+    printf("Apparent size: %s (%llu bytes)\n", formatByteCount(job.directories[0].apparent, apparent, sizeof(apparent)),
+           (unsigned long long) job.directories[0].apparent);
+    if (top_count > 0)
+    {
+        printUsageEntries("Largest files", largest_files, entry_count, top_count);
+        printUsageEntries("Largest directories", largest_directories.entries, largest_directories.count, top_count);
+    }
+    if (error_count)
+    {
+        printf("\n%ld entries could not be read.\n", error_count);
+    }
+    error = SUCCESS;
+
+cleanup:
+    for (j = 0; job.heaps && j < worker_count; j++)
+    {
+        for (i = 0; i < job.heaps[j].count; i++)
+        {
+            free(job.heaps[j].entries[i].path);
+        }
+        free(job.heaps[j].entries);
+    }
+    for (i = 0; i < largest_directories.count; i++)
+    {
+        free(largest_directories.entries[i].path);
+    }
+    for (i = 0; i < job.directory_count; i++)
+    {
+        free(job.directories[i].path);
+    }
+    for (j = 0; j < INODE_SET_SHARDS; j++)
+    {
+        free(job.inodes[j].keys);
+        pthread_mutex_destroy(&job.inodes[j].lock);
+    }
+    pthread_mutex_destroy(&job.lock);
+    pthread_cond_destroy(&job.work_available);
+    free(largest_files);
+    free(largest_directories.entries);
+    free(job.directories);
+    free(job.stack);
+    free(job.heaps);
+    free(job.files);
+    free(job.errors);
+    return error;
+}
+
+/*
+*   Function: compileGlob
+*   ---------------------
+*   Compiles a glob into an NFA. Supports '*', '?', bracket classes ("[a-z]",
+*   "[!0-9]") and backslash escapes. An unterminated '[' matches itself, as in fnmatch().
+*
+*   glob: the glob to compile.
+*   pattern: the compiled glob.
+*
+*   returns: SUCCESS if the glob was compiled, FAILURE if it is too long.
+*/
+
+int compileGlob(const char *glob, struct glob_pattern *pattern)
+{
+    const unsigned char *position = (const unsigned char *) glob;
+    const unsigned char *class_end;
+    const unsigned char *member;
+    int negate;
+    int byte;
+    int token;
+
+    memset(pattern, 0, sizeof(*pattern));
+
+    while (*position)
+    {
+        /* Consecutive stars match the same as one */
+        if (*position == '*' && pattern->token_count > 0 && ((pattern->stars >> (pattern->token_count - 1)) & 1))
+        {
+            position++;
+            continue;
+        }
+
+        if (pattern->token_count == MAX_GLOB_TOKENS)
+        {
+            fprintf(stderr, "\n[Error] The pattern '%s' is too long (the limit is %d characters).\n", glob, MAX_GLOB_TOKENS);
+            return FAILURE;
+        }
+        token = pattern->token_count++;
+        pattern->literals[token] = -1;
+
+        /* Find the end of a bracket class, allowing ']' as its first member */
+        class_end = NULL;
+        if (*position == '[')
+        {
+            class_end = position + 1;
+            class_end += *class_end == '!' || *class_end == '^';
+            class_end += *class_end == ']';
+            while (*class_end && *class_end != ']')
+            {
+                class_end++;
+            }
+            if (!*class_end)
+            { class_end = NULL; }
+        }
+
+        if (*position == '*')
+        {
+            pattern->stars |= 1ULL << token;
+            position++;
+        }
+        else if (*position == '?')
+        {
+            memset(pattern->classes[token], 0xFF, sizeof(pattern->classes[token]));
+            position++;
+        }
+        else if (class_end)
+        {
+            member = position + 1;
+            negate = *member == '!' || *member == '^';
+            member += negate;
+
+            for (; member < class_end; member++)
+            {
+                if (member[1] == '-' && member + 2 < class_end)
+                {
+                    for (byte = member[0]; byte <= member[2]; byte++)
+                    {
+                        pattern->classes[token][byte >> 3] |= 1 << (byte & 7);
+                    }
+                    member += 2;
+                }
+                else
+                {
+                    pattern->classes[token][*member >> 3] |= 1 << (*member & 7);
+                }
+            }
+
+            if (negate)
+            {
+                for (byte = 0; byte < (int) sizeof(pattern->classes[token]); byte++)
+                {
+                    pattern->classes[token][byte] = ~pattern->classes[token][byte];
+                }
+            }
+            position = class_end + 1;
+        }
+        else
+        {
+            if (*position == '\\' && position[1])
+            {
+                position++;
+            }
+            byte = *position++;
+            pattern->classes[token][byte >> 3] |= 1 << (byte & 7);
+            pattern->literals[token] = byte;
+        }
+    }
+
+    /* Literal tokens at either end give a cheap way to reject most names */
+    while (pattern->prefix_length < pattern->token_count && pattern->literals[pattern->prefix_length] >= 0)
+    {
+        pattern->prefix_length++;
+    }
+    while (pattern->suffix_length < pattern->token_count
+           && pattern->literals[pattern->token_count - 1 - pattern->suffix_length] >= 0)
+    {
+        pattern->suffix_length++;
+    }
+    return SUCCESS;
+}
+
+/*
+*   Function: closeGlobPositions
+*   ----------------------------
+*   Adds the positions reached by letting a '*' match nothing.
+*
+*   pattern: the compiled glob.
+*   positions: a set of NFA positions.
+*
+*   returns: the set with every skippable '*' skipped.
+*/
+
+uint64_t closeGlobPositions(const struct glob_pattern *pattern, uint64_t positions)
+{
+    int token;
+
+    for (token = 0; token < pattern->token_count; token++)
+    {
+        if ((positions >> token) & (pattern->stars >> token) & 1)
+        {
+            positions |= 1ULL << (token + 1);
+        }
+    }
+    return positions;
+}
+
+/*
+*   Function: stepGlobPositions
+*   ---------------------------
+*   Moves a set of NFA positions over one byte of a name.
+*
+*   pattern: the compiled glob.
+*   positions: the current set of positions.
+*   byte: the next byte of the name.
+*
+*   returns: the new set of positions.
+*/
+
+uint64_t stepGlobPositions(const struct glob_pattern *pattern, uint64_t positions, const unsigned char byte)
+{
+    uint64_t next = 0;
+    int token;
+
+    /* The accepting position has no token to consume a byte with */
+    positions &= ~(1ULL << pattern->token_count);
+    while (positions)
+    {
+        token = __builtin_ctzll(positions);
+        positions &= positions - 1;
+
+        if ((pattern->stars >> token) & 1)
+        {
+            next |= 1ULL << token;
+        }
+        else if (pattern->classes[token][byte >> 3] & (1 << (byte & 7)))
+        {
+            next |= 1ULL << (token + 1);
+        }
+    }
+    return closeGlobPositions(pattern, next);
+}
+
+/*
+*   Function: addGlobDfaState
+*   -------------------------
+*   Finds the DFA state for a set of NFA positions, adding it if it's new.
+*
+*   dfa: the DFA.
+*   positions: the set of NFA positions.
+*
+*   returns: the state's index, or -1 if the DFA is full.
+*/
+
+int addGlobDfaState(struct glob_dfa *dfa, const uint64_t positions)
+{
+    int *transitions;
+    int capacity;
+    int state;
+
+    for (state = 0; state < dfa->state_count; state++)
+    {
+        if (dfa->states[state] == positions)
+        { return state; }
+    }
+
+    if (dfa->state_count == MAX_GLOB_DFA_STATES)
+    { return -1; }
+
+    if (dfa->state_count == dfa->state_capacity)
+    {
+        capacity = dfa->state_capacity ? dfa->state_capacity * 2 : 16;
+        transitions = realloc(dfa->transitions, capacity * 256 * sizeof(*transitions));
+        if (!transitions)
+        { return -1; }
+        dfa->transitions = transitions;
+        dfa->state_capacity = capacity;
+    }
+
+    state = dfa->state_count++;
+    dfa->states[state] = positions;
+    memset(dfa->transitions + state * 256, 0xFF, 256 * sizeof(*dfa->transitions));
+    return state;
+}
+
+/*
+*   Function: initialiseGlobDfa
+*   ---------------------------
+*   Sets up an empty DFA for a glob, with only the dead and start states.
+*
+*   pattern: the compiled glob.
+*   dfa: the DFA to set up.
+*
+*   returns: SUCCESS, or FAILURE if memory can't be allocated.
+*/
+
+int initialiseGlobDfa(const struct glob_pattern *pattern, struct glob_dfa *dfa)
+{
+    memset(dfa, 0, sizeof(*dfa));
+
+    if (addGlobDfaState(dfa, 0) != 0)
+    { return FAILURE; }
+
+    /* The dead state never leaves itself */
+    memset(dfa->transitions, 0, 256 * sizeof(*dfa->transitions));
+
+    return addGlobDfaState(dfa, closeGlobPositions(pattern, 1)) == 1 ? SUCCESS : FAILURE;
+}
+
+/*
+*   Function: matchGlob
+*   -------------------
+*   Checks whether a name matches a glob. Names that don't have the glob's literal
+*   prefix and suffix are rejected straight away; the rest run through the DFA,
+*   which gains states as new inputs need them.
+*
+*   pattern: the compiled glob.
+*   dfa: the DFA for the glob.
+*   name: the name to match.
+*   length: the length of the name.
+*
+*   returns: 1 if the name matches, 0 if it doesn't.
+*/
+
+int matchGlob(const struct glob_pattern *pattern, struct glob_dfa *dfa, const char *name, const size_t length)
+{
+    const unsigned char *bytes = (const unsigned char *) name;
+    uint64_t positions;
+    size_t i;
+    int state = 1;
+    int next;
+
+    if (length < (size_t) pattern->prefix_length || length < (size_t) pattern->suffix_length
+        || (!pattern->stars && length != (size_t) pattern->token_count))
+    { return 0; }
+    for (i = 0; i < (size_t) pattern->prefix_length; i++)
+    {
+        if (bytes[i] != pattern->literals[i])
+        { return 0; }
+    }
+    for (i = 1; i <= (size_t) pattern->suffix_length; i++)
+    {
+        if (bytes[length - i] != pattern->literals[pattern->token_count - i])
+        { return 0; }
+    }
+
+    for (i = 0; i < length; i++)
+    {
+        next = dfa->transitions[state * 256 + bytes[i]];
+        if (next < 0)
+        {
+            positions = stepGlobPositions(pattern, dfa->states[state], bytes[i]);
+            next = addGlobDfaState(dfa, positions);
+
+            /* The DFA is full, so simulate the NFA for the rest of the name */
+            if (next < 0)
+            {
+                for (i++; i < length && positions; i++)
+                {
+                    positions = stepGlobPositions(pattern, positions, bytes[i]);
+                }
+                return (positions >> pattern->token_count) & 1;
+            }
+            dfa->transitions[state * 256 + bytes[i]] = next;
+        }
+
+        if (next == 0)
+        { return 0; }
+        state = next;
+    }
+    return (dfa->states[state] >> pattern->token_count) & 1;
+}
+
+/*
+*   Function: parseFindSize
+*   -----------------------
+*   Parses a size predicate such as "+1M" (larger than 1 MiB), "-10k" (smaller
+*   than 10 KiB) or "512" (exactly 512 bytes).
+*
+*   text: the predicate, or an empty string for none.
+*   query: the query to set the size predicate of.
+*
+*   returns: SUCCESS if the predicate is valid, FAILURE if it isn't.
+*/
+
+int parseFindSize(const char *text, struct find_query *query)
+{
+    const char *number = text;
+    char *end;
+    uint64_t multiplier = 1;
+
+    query->size_comparison = COMPARE_NONE;
+    if (text[0] == '\0')
+    { return SUCCESS; }
+
+    query->size_comparison = text[0] == '+' ? COMPARE_GREATER : text[0] == '-' ? COMPARE_LESS : COMPARE_EQUAL;
+    number += query->size_comparison != COMPARE_EQUAL;
+
+    errno = 0;
+    query->size = strtoull(number, &end, 10);
+    switch (*end)
+    {
+        case 'k': case 'K': multiplier = 1ULL << 10; end++; break;
+        case 'm': case 'M': multiplier = 1ULL << 20; end++; break;
+        case 'g': case 'G': multiplier = 1ULL << 30; end++; break;
+        case 't': case 'T': multiplier = 1ULL << 40; end++; break;
+    }
+
+    if (end == number || *end != '\0' || errno || !isdigit((unsigned char) *number))
+    {
+        fprintf(stderr, "\n[Error] Invalid size '%s'. Please enter a size such as +1M, -10k or 512.\n", text);
+        return FAILURE;
+    }
+    query->size *= multiplier;
+    return SUCCESS;
+}
+
+/*
+*   Function: parseFindAge
+*   ----------------------
+*   Parses a modification time predicate such as "-2d" (modified in the last
+*   2 days) or "+1h" (modified over an hour ago). Units are s, m, h and d (the default).
+*
+*   text: the predicate, or an empty string for none.
+*   query: the query to set the age predicate of.
+*
+*   returns: SUCCESS if the predicate is valid, FAILURE if it isn't.
+*/
+
+int parseFindAge(const char *text, struct find_query *query)
+{
+    struct timespec now;
+    char *end;
+    int64_t unit = 86400;
+    long long amount;
+
+    query->age_comparison = COMPARE_NONE;
+    if (text[0] == '\0')
+    { return SUCCESS; }
+
+    errno = 0;
+    amount = strtoll(text + 1, &end, 10);
+    switch (*end)
+    {
+        case 's': unit = 1; end++; break;
+        case 'm': unit = 60; end++; break;
+        case 'h': unit = 3600; end++; break;
+        case 'd': unit = 86400; end++; break;
+    }
+
+    if ((text[0] != '+' && text[0] != '-') || end == text + 1 || *end != '\0' || errno
+        || !isdigit((unsigned char) text[1]))
+    {
+        fprintf(stderr, "\n[Error] Invalid age '%s'. Please enter an age such as -2d (newer) or +1h (older).\n", text);
+        return FAILURE;
+    }
+
+    /* Older than the cutoff means an earlier modification time */
+    clock_gettime(CLOCK_REALTIME, &now);
+    query->age_comparison = text[0] == '+' ? COMPARE_LESS : COMPARE_GREATER;
+    query->modified_ns = getTimeInNanoseconds(now.tv_sec - amount * unit, now.tv_nsec);
+    return SUCCESS;
+}
+
+/*
+*   Function: compareFindValue
+*   --------------------------
+*   Applies a COMPARE_* predicate.
+*
+*   comparison: the COMPARE_* constant.
+*   value: the value being tested.
+*   target: the value from the predicate.
+*
+*   returns: 1 if the predicate holds, 0 if it doesn't.
+*/
+
+int compareFindValue(const int comparison, const int64_t value, const int64_t target)
+{
+    switch (comparison)
+    {
+        case COMPARE_LESS: return value < target;
+        case COMPARE_EQUAL: return value == target;
+        case COMPARE_GREATER: return value > target;
+        default: return 1;
+    }
+}
+
+/*
+*   Function: matchFindEntry
+*   ------------------------
+*   Checks a directory entry against a find query. The name is checked first,
+*   straight from the directory entry; the file is only looked at with statx()
+*   if the name matches and the query has size or age predicates.
+*
+*   job: the find.
+*   worker: the index of the worker checking the entry.
+*   directory_fd: the directory holding the entry.
+*   name: the name of the entry.
+*
+*   returns: 1 if the entry matches, 0 if it doesn't.
+*/
+
+int matchFindEntry(struct find_job *job, const int worker, const int directory_fd, const char *name)
+{
+    const struct find_query *query = job->query;
+    struct entry_status entry_status;
+    size_t length = strlen(name);
+    int matched = query->pattern_count == 0;
+    int i;
+
+    for (i = 0; i < query->pattern_count && !matched; i++)
+    {
+        matched = matchGlob(&query->patterns[i], &job->dfas[worker * MAX_GLOB_PATTERNS + i], name, length);
+    }
+    if (!matched || (query->size_comparison == COMPARE_NONE && query->age_comparison == COMPARE_NONE))
+    { return matched; }
+
+    if (getEntryStatus(directory_fd, name, AT_SYMLINK_NOFOLLOW, &entry_status))
+    {
+        job->errors[worker]++;
+        return 0;
+    }
+
+    return compareFindValue(query->size_comparison, entry_status.size, query->size)
+           && compareFindValue(query->age_comparison, entry_status.modified_ns, query->modified_ns);
+}
+
+/*
+*   Function: writeFindMatch
+*   ------------------------
+*   Adds a matching path to a worker's output buffer, writing the buffer out
+*   when it's full. Each write is a whole number of lines, so output from
+*   different workers never interleaves within a line.
+*
+*   output: the worker's output buffer (FIND_BUFFER_SIZE bytes).
+*   output_length: the number of bytes in the buffer.
+*   directory_path: the directory holding the match.
+*   name: the name of the match, or NULL to just write the buffer out.
+*/
+
+void writeFindMatch(char *output, size_t *output_length, const char *directory_path, const char *name)
+{
+    size_t needed = name ? strlen(directory_path) + strlen(name) + 2 : FIND_BUFFER_SIZE + 1;
+
+    if (*output_length + needed > FIND_BUFFER_SIZE)
+    {
+        fwrite(output, 1, *output_length, stdout);
+        *output_length = 0;
+    }
+    if (!name)
+    { return; }
+
+    if (needed > FIND_BUFFER_SIZE)
+    {
+        printf("%s/%s\n", directory_path, name);
+        return;
+    }
+    *output_length += sprintf(output + *output_length, "%s/%s\n", directory_path, name);
+}
+
+/*
+*   Function: addFindEntry
+*   ----------------------
+*   Checks one directory entry of a find against the query, and remembers it
+*   for searching next if it is a subdirectory.
+*
+*   job: the find.
+*   worker: the index of the worker reading the directory.
+*   directory_path: the directory holding the entry.
+*   directory_fd: a handle on the directory.
+*   name: the name of the entry.
+*   type: the entry type (DT_DIR etc.), or DT_UNKNOWN.
+*   output: the worker's output buffer.
+*   output_length: the number of bytes in the output buffer.
+*   children: the subdirectories found, grown as needed.
+*   child_count: the number of subdirectories found.
+*   child_capacity: the allocated size of children.
+*/
+
+void addFindEntry(struct find_job *job, const int worker, const char *directory_path, const int directory_fd,
+                  const char *name, const int type, char *output, size_t *output_length, char ***children,
+                  long *child_count, long *child_capacity)
+{
+    struct stat entry_status;
+    char **grown;
+    size_t path_size;
+    int is_directory = type == DT_DIR;
+
+    if (type == DT_UNKNOWN)
+    {
+        is_directory = !fstatat(directory_fd, name, &entry_status, AT_SYMLINK_NOFOLLOW) && S_ISDIR(entry_status.st_mode);
+    }
+
+    if (matchFindEntry(job, worker, directory_fd, name))
+    {
+        writeFindMatch(output, output_length, directory_path, name);
+        job->matches[worker]++;
+    }
+
+    if (!is_directory)
+    { return; }
+
+    if (*child_count == *child_capacity)
+    {
+        grown = realloc(*children, (*child_capacity ? *child_capacity * 2 : 64) * sizeof(**children));
+        if (!grown)
+        {
+            job->errors[worker]++;
+            return;
+        }
+        *children = grown;
+        *child_capacity = *child_capacity ? *child_capacity * 2 : 64;
+    }
+
+    path_size = strlen(directory_path) + strlen(name) + 2;
+    (*children)[*child_count] = malloc(path_size);
+    if (!(*children)[*child_count])
+    {
+        job->errors[worker]++;
+        return;
+    }
+    snprintf((*children)[*child_count], path_size, "%s/%s", directory_path, name);
+    (*child_count)++;
+}
+
+/*
+*   Function: readFindDirectory
+*   ---------------------------
+*   Reads one directory of a find with getdents64(), checking each entry against
+*   the query and collecting the subdirectories to search next. Entry types come
+*   from the directory entries, so only filesystems that don't report them need a stat.
+*   The top directory is listed from the directory index instead, if it has one.
+*   Sizes and times are still read from the files, since inotify misses writes
+*   made through hard links in other directories and through shared mappings.
+*
+*   job: the find.
+*   worker: the index of the worker reading the directory.
+*   directory_path: the directory to read.
+*   index: the index of the directory, or NULL to read it.
+*   entries: a FIND_BUFFER_SIZE buffer for the directory entries.
+*   output: the worker's output buffer.
+*   output_length: the number of bytes in the output buffer.
+*   children: the subdirectories found, grown as needed.
+*   child_count: set to the number of subdirectories found.
+*   child_capacity: the allocated size of children.
+*/
+
+void readFindDirectory(struct find_job *job, const int worker, const char *directory_path, const struct directory_index *index,
+                       char *entries, char *output, size_t *output_length, char ***children, long *child_count,
+                       long *child_capacity)
+{
+    const struct indexed_entry *indexed;
+    struct dirent64 *entry;
+    ssize_t bytes_read;
+    ssize_t offset;
+    long i;
+    int fd;
+
+    *child_count = 0;
+
+    fd = openat(working_directory_fd, directory_path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0)
+    {
+        fprintf(stderr, "\n[Error] Failed to read directory '%s': %s\n", directory_path, strerror(errno));
+        job->errors[worker]++;
+        return;
+    }
+
+    if (index)
+    {
+        for (i = 0; i < index->count; i++)
+        {
+            indexed = &index->entries[i];
+            addFindEntry(job, worker, directory_path, fd, indexed->name,
+                         indexed->status.mode ? IFTODT(indexed->status.mode) : DT_UNKNOWN,
+                         output, output_length, children, child_count, child_capacity);
+        }
+        close(fd);
+        return;
+    }
+
+    while ((bytes_read = getdents64(fd, entries, FIND_BUFFER_SIZE)) > 0)
+    {
+        for (offset = 0; offset < bytes_read; offset += entry->d_reclen)
+        {
+            entry = (struct dirent64 *) (entries + offset);
+            if (entry->d_name[0] == '.' && (entry->d_name[1] == '\0' || (entry->d_name[1] == '.' && entry->d_name[2] == '\0')))
+            { continue; }
+
+            addFindEntry(job, worker, directory_path, fd, entry->d_name, entry->d_type,
+                         output, output_length, children, child_count, child_capacity);
+        }
+    }
+
+    if (bytes_read < 0)
+    {
+        fprintf(stderr, "\n[Error] Failed to read directory '%s': %s\n", directory_path, strerror(errno));
+        job->errors[worker]++;
+    }
+    close(fd);
+}
+
+/*
+*   Function: findTask
+*   ------------------
+*   Parallel task run once per worker. Takes directories from the stack and
+*   searches them until the stack is empty and no other worker can add to it.
+*
+*   worker: the index of the worker.
+*   context: the find_job.
+*/
+
+void findTask(int worker, void *context)
+{
+    struct find_job *job = context;
+    const struct directory_index *index;
+    char **children = NULL;
+    char **stack;
+    char *directory_path;
+    char *entries = malloc(FIND_BUFFER_SIZE);
+    char *output = malloc(FIND_BUFFER_SIZE);
+    size_t output_length = 0;
+    long child_capacity = 0;
+    long child_count = 0;
+    long capacity;
+    long i;
+
+    if (!entries || !output)
+    {
+        free(entries);
+        free(output);
+        return;
+    }
+
+    pthread_mutex_lock(&job->lock);
+    while (1)
+    {
+        while (job->stack_count == 0 && job->active_workers > 0)
+        {
+            pthread_cond_wait(&job->work_available, &job->lock);
+        }
+        if (job->stack_count == 0)
+        { break; }
+
+        /* The top directory is the first one taken */
+        directory_path = job->stack[--job->stack_count];
+        index = job->index;
+        job->index = NULL;
+        job->active_workers++;
+        pthread_mutex_unlock(&job->lock);
+
+        readFindDirectory(job, worker, directory_path, index, entries, output, &output_length, &children, &child_count,
+                          &child_capacity);
+        free(directory_path);
+
+        pthread_mutex_lock(&job->lock);
+        if (job->stack_count + child_count > job->stack_capacity)
+        {
+            capacity = job->stack_capacity ? job->stack_capacity : 1024;
+            while (capacity < job->stack_count + child_count)
+            {
+                capacity *= 2;
+            }
+            stack = realloc(job->stack, capacity * sizeof(*stack));
+            if (stack)
+            {
+                job->stack = stack;
+                job->stack_capacity = capacity;
+            }
+        }
+        for (i = 0; i < child_count; i++)
+        {
+            if (job->stack_count < job->stack_capacity)
+            {
+                job->stack[job->stack_count++] = children[i];
+            }
+            else
+            {
+                free(children[i]);
+                job->errors[worker]++;
+            }
+        }
+        job->active_workers--;
+
+        if (child_count > 0 || job->active_workers == 0)
+        {
+            pthread_cond_broadcast(&job->work_available);
+        }
+    }
+    pthread_mutex_unlock(&job->lock);
+
+    writeFindMatch(output, &output_length, NULL, NULL);
+    free(children);
+    free(entries);
+    free(output);
+}
+
+/*
+*   Function: findFiles
+*   -------------------
+*   Prints every entry under a directory that matches a query, searching the tree
+*   in parallel. Matches are printed as they are found, so their order varies.
+*
+*   directory_name: the directory at the top of the tree.
+*   query: what to look for.
+*
+*   returns: SUCCESS if the search ran, FAILURE if an operation fails.
+*/
+
+int findFiles(const char *directory_name, const struct find_query *query)
+{
+    struct find_job job;
+    struct stat top_status;
+    int worker_count = getNumberOfWorkers(INT_MAX);
+    long match_count = 0;
+    long error_count = 0;
+    int error = FAILURE;
+    int i;
+
+    if (fstatat(working_directory_fd, directory_name, &top_status, 0))
+    {
+        fprintf(stderr, "\n[Error] Failed to search '%s': %s\n", directory_name, strerror(errno));
+        return FAILURE;
+    }
+    if (!S_ISDIR(top_status.st_mode))
+    {
+        fprintf(stderr, "\n[Error] '%s' is not a directory.\n", directory_name);
+        return FAILURE;
+    }
+
+    memset(&job, 0, sizeof(job));
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.work_available, NULL);
+    job.query = query;
+    job.index = getDirectoryIndex(directory_name);
+    job.dfas = calloc(worker_count * MAX_GLOB_PATTERNS, sizeof(*job.dfas));
+    job.matches = calloc(worker_count, sizeof(*job.matches));
+    job.errors = calloc(worker_count, sizeof(*job.errors));
+    job.stack = malloc(sizeof(*job.stack));
+    if (!job.dfas || !job.matches || !job.errors || !job.stack || !(job.stack[0] = strdup(directory_name)))
+    {
+        fprintf(stderr, "\n[Error] Failed to search '%s': %s\n", directory_name, strerror(errno));
+        goto cleanup;
+    }
+    job.stack_count = 1;
+    job.stack_capacity = 1;
+
+    for (i = 0; i < worker_count * MAX_GLOB_PATTERNS; i++)
+    {
+        if (i % MAX_GLOB_PATTERNS < query->pattern_count
+            && initialiseGlobDfa(&query->patterns[i % MAX_GLOB_PATTERNS], &job.dfas[i]))
+        {
+            fprintf(stderr, "\n[Error] Failed to search '%s': %s\n", directory_name, strerror(errno));
+            goto cleanup;
+        }
+    }
+
+    runInParallel(worker_count, findTask, &job);
+    fflush(stdout);
+
+    for (i = 0; i < worker_count; i++)
+    {
+        match_count += job.matches[i];
+        error_count += job.errors[i];
+    }
+    printf("Found %ld matches in '%s'\n", match_count, directory_name);
+    if (error_count)
+    {
+        printf("%ld entries could not be read.\n", error_count);
+    }
+    error = SUCCESS;
+
+cleanup:
+    for (i = 0; job.dfas && i < worker_count * MAX_GLOB_PATTERNS; i++)
+    {
+        free(job.dfas[i].transitions);
+    }
+    for (i = 0; i < job.stack_count; i++)
+    {
+        free(job.stack[i]);
+    }
+    pthread_mutex_destroy(&job.lock);
+    pthread_cond_destroy(&job.work_available);
+    free(job.stack);
+    free(job.dfas);
+    free(job.matches);
+    free(job.errors);
+    return error;
+}
+
+/*
+*   Function: closeTrigramIndex
+*   ---------------------------
+*   Unmaps a trigram index.
+*
+*   index: the index to close.
+*/
+
+void closeTrigramIndex(struct trigram_index *index)
+{
+    if (index->map)
+    {
+        munmap(index->map, index->mapped_size);
+    }
+    memset(index, 0, sizeof(*index));
+}
+
+/*
+*   Function: openTrigramIndex
+*   --------------------------
+*   Maps a trigram index from the changelog folder and checks that its parts fit in the file.
+*
+*   changelog_directory_fd: a handle on the changelog directory.
+*   index_name: the name of the index file.
+*   index: set to the mapped index.
+*
+*   returns: SUCCESS if the index is mapped, FAILURE if there is no usable index.
+*/
+
+int openTrigramIndex(const int changelog_directory_fd, const char *index_name, struct trigram_index *index)
+{
+    const struct trigram_index_header *header;
+    struct stat index_status;
+    uint64_t size;
+    uint64_t i = 0;
+    uint64_t j = 0;
+    int fd;
+
+    memset(index, 0, sizeof(*index));
+
+    fd = openat(changelog_directory_fd, index_name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    { return FAILURE; }
+
+    if (fstat(fd, &index_status) || (size_t) index_status.st_size < sizeof(*header))
+    {
+        close(fd);
+        return FAILURE;
+    }
+
+    index->mapped_size = index_status.st_size;
+    index->map = mmap(NULL, index->mapped_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (index->map == MAP_FAILED)
+    {
+        index->map = NULL;
+        return FAILURE;
+    }
+
+    /* Each count is checked on its own first, so the sum below can't overflow */
+    header = index->map;
+    size = sizeof(*header);
+    if (header->magic != TRIGRAM_INDEX_MAGIC || header->file_count > index->mapped_size
+        || header->trigram_count > index->mapped_size || header->postings_size > index->mapped_size
+        || header->names_size > index->mapped_size
+        || (size += header->file_count * sizeof(*index->files) + header->trigram_count * sizeof(*index->trigrams)
+                    + header->postings_size + header->names_size) != index->mapped_size)
+    {
+        closeTrigramIndex(index);
+        return FAILURE;
+    }
+
+    index->header = header;
+    index->files = (const struct trigram_file_entry *) (header + 1);
+    index->trigrams = (const struct trigram_entry *) (index->files + header->file_count);
+    index->postings = (const unsigned char *) (index->trigrams + header->trigram_count);
+    index->names = (const char *) (index->postings + header->postings_size);
+
+    /* Lookups trust the names to be terminated and the postings to fit their arrays */
+    for (i = 0; i < header->file_count; i++)
+    {
+        if (index->files[i].name_offset >= header->names_size)
+        { break; }
+    }
+    for (j = 0; i == header->file_count && j < header->trigram_count; j++)
+    {
+        if (index->trigrams[j].file_count > header->file_count || index->trigrams[j].offset > header->postings_size)
+        { break; }
+    }
+    if (i < header->file_count || j < header->trigram_count || (header->names_size && index->names[header->names_size - 1]))
+    {
+        closeTrigramIndex(index);
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+/*
+*   Function: compareFilePaths
+*   --------------------------
+*   Orders file paths by name, for qsort().
+*
+*   first, second: pointers to the two paths.
+*
+*   returns: <0, 0 or >0 as the first path sorts before, with or after the second.
+*/
+
+int compareFilePaths(const void *first, const void *second)
+{
+    return strcmp(*(char *const *) first, *(char *const *) second);
+}
+
+/*
+*   Function: compareTrigrams
+*   -------------------------
+*   Orders trigrams, for qsort().
+*
+*   first, second: pointers to the two trigrams.
+*
+*   returns: <0, 0 or >0 as the first trigram sorts before, with or after the second.
+*/
+
+int compareTrigrams(const void *first, const void *second)
+{
+    uint32_t a = *(const uint32_t *) first;
+    uint32_t b = *(const uint32_t *) second;
+
+    return (a > b) - (a < b);
+}
+
+/*
+*   Function: findIndexedFile
+*   -------------------------
+*   Looks a file up in a trigram index by name.
+*
+*   index: the trigram index.
+*   name: the file's name within the indexed directory.
+*
+*   returns: the file's number in the index, or -1 if it isn't there.
+*/
+
+long findIndexedFile(const struct trigram_index *index, const char *name)
+{
+    long low = 0;
+    long high = index->header ? (long) index->header->file_count : 0;
+    long middle;
+    int order;
+
+    while (low < high)
+    {
+        middle = low + (high - low) / 2;
+        order = strcmp(index->names + index->files[middle].name_offset, name);
+        if (order == 0)
+        { return middle; }
+        if (order < 0)
+        { low = middle + 1; }
+        else
+        { high = middle; }
+    }
+    return -1;
+}
+
+/*
+*   Function: findIndexedTrigram
+*   ----------------------------
+*   Looks a trigram up in a trigram index.
+*
+*   index: the trigram index.
+*   trigram: the trigram to find.
+*
+*   returns: the trigram's entry, or NULL if no file contains it.
+*/
+
+const struct trigram_entry *findIndexedTrigram(const struct trigram_index *index, const uint32_t trigram)
+{
+    long low = 0;
+    long high = index->header->trigram_count;
+    long middle;
+
+    while (low < high)
+    {
+        middle = low + (high - low) / 2;
+        if (index->trigrams[middle].trigram == trigram)
+        { return &index->trigrams[middle]; }
+        if (index->trigrams[middle].trigram < trigram)
+        { low = middle + 1; }
+        else
+        { high = middle; }
+    }
+    return NULL;
+}
+
+/*
+*   Function: decodePostings
+*   ------------------------
+*   Decodes the file numbers of a trigram.
+*
+*   index: the trigram index.
+*   entry: the trigram's entry.
+*   files: set to the file numbers, in increasing order (entry->file_count of them).
+*/
+
+void decodePostings(const struct trigram_index *index, const struct trigram_entry *entry, long *files)
+{
+    const unsigned char *posting = index->postings + entry->offset;
+    const unsigned char *end = index->postings + index->header->postings_size;
+    uint64_t value;
+    long file = 0;
+    uint32_t i;
+    int shift;
+
+    for (i = 0; i < entry->file_count; i++)
+    {
+        value = 0;
+        for (shift = 0; posting < end && shift < 64; shift += 7)
+        {
+            value |= (uint64_t) (*posting & 0x7F) << shift;
+            if (!(*posting++ & 0x80))
+            { break; }
+        }
+        file += value;
+        files[i] = file;
+    }
+}
+
+/*
+*   Function: addToTrigramList
+*   --------------------------
+*   Adds a trigram to the end of a file's trigram list.
+*
+*   list: the list to add to.
+*   trigram: the trigram to add.
+*
+*   returns: SUCCESS if the trigram was added, FAILURE if memory runs out.
+*/
+
+int addToTrigramList(struct trigram_list *list, const uint32_t trigram)
+{
+    uint32_t *trigrams;
+    long capacity;
+
+    if (list->count == list->capacity)
+    {
+        capacity = list->capacity ? list->capacity * 2 : 256;
+        trigrams = reallocateTracked(list->trigrams, capacity * sizeof(*trigrams));
+        if (!trigrams)
+        { return FAILURE; }
+        list->trigrams = trigrams;
+        list->capacity = capacity;
+    }
+    list->trigrams[list->count++] = trigram;
+    return SUCCESS;
+}
+
+/*
+*   Function: readFileTrigrams
+*   --------------------------
+*   Reads a file and lists its distinct trigrams. A bitmap of every possible
+*   trigram finds the distinct ones in a single pass. Files with more than
+*   MAX_FILE_TRIGRAMS distinct trigrams (usually binary files) aren't indexed.
+*
+*   file_name: the file to read.
+*   seen: a zeroed bitmap of 2^24 bits, zeroed again before returning.
+*   buffer: a SCAN_BUFFER_SIZE buffer.
+*   list: the (empty) list to add the trigrams to, sorted on return.
+*   flags: set to TRIGRAM_FILE_UNINDEXED if the file has too many trigrams.
+*
+*   returns: SUCCESS if the file was read, FAILURE if an operation fails.
+*/
+
+int readFileTrigrams(const char *file_name, uint64_t *seen, unsigned char *buffer, struct trigram_list *list,
+                     uint32_t *flags)
+{
+    ssize_t bytes_read = 0;
+    ssize_t offset;
+    off_t position = 0;
+    uint32_t trigram = 0;
+    uint64_t bit;
+    long i;
+    int error = SUCCESS;
+    int fd;
+
+    *flags = 0;
+
+    fd = acquireDescriptor(working_directory_fd, file_name, O_RDONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "\n[Error] Failed to open file '%s': %s.\n", file_name, strerror(errno));
+        return FAILURE;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    /* The descriptor may be shared through the cache, so read at explicit offsets */
+    while (!*flags && (bytes_read = limitedPread(fd, buffer, SCAN_BUFFER_SIZE, position)) > 0)
+    {
+        for (offset = 0; offset < bytes_read; offset++)
+        {
+            trigram = ((trigram << 8) | buffer[offset]) & 0xFFFFFF;
+            if (position + offset < 2)
+            { continue; }
+
+            bit = (uint64_t) 1 << (trigram & 63);
+            if (seen[trigram >> 6] & bit)
+            { continue; }
+            seen[trigram >> 6] |= bit;
+
+            if (list->count == MAX_FILE_TRIGRAMS)
+            {
+                *flags = TRIGRAM_FILE_UNINDEXED;
+                break;
+            }
+            if (addToTrigramList(list, trigram))
+            {
+                fprintf(stderr, "\n[Error] Failed to index file '%s': %s.\n", file_name, strerror(errno));
+                error = FAILURE;
+                *flags = TRIGRAM_FILE_UNINDEXED;
+                break;
+            }
+        }
+        position += bytes_read;
+    }
+
+    if (!*flags && bytes_read < 0)
+    {
+        fprintf(stderr, "\n[Error] Failed to read file '%s': %s.\n", file_name, strerror(errno));
+        error = FAILURE;
+    }
+    releaseDescriptor(fd);
+
+    /* Clearing the bits that were set is much cheaper than clearing the whole bitmap */
+    for (i = 0; i < list->count; i++)
+    {
+        seen[list->trigrams[i] >> 6] = 0;
+    }
+    if (*flags)
+    {
+        memset(seen, 0, ((size_t) 1 << 24) / 8);
+        list->count = 0;
+    }
+    qsort(list->trigrams, list->count, sizeof(*list->trigrams), compareTrigrams);
+    return error;
+}
+
+/*
+*   Function: trigramBuildTask
+*   --------------------------
+*   Parallel task run once per worker. Takes files from the job until none are
+*   left, keeping the trigrams of files that haven't changed since the previous
+*   index and reading the rest.
+*
+*   worker: the index of the worker.
+*   context: the trigram_build_job.
+*/
+
+void trigramBuildTask(int worker, void *context)
+{
+    struct trigram_build_job *job = context;
+    struct trigram_file_entry *entry;
+    const struct trigram_file_entry *old_entry;
+    struct entry_status status;
+    uint64_t *seen = allocateTracked(((size_t) 1 << 24) / 64 * sizeof(*seen));
+    unsigned char *buffer = malloc(SCAN_BUFFER_SIZE);
+    const char *path;
+    long old_file;
+    int file;
+
+    (void) worker;
+
+    if (seen)
+    { memset(seen, 0, ((size_t) 1 << 24) / 64 * sizeof(*seen)); }
+
+    while ((file = __atomic_fetch_add(&job->next_file, 1, __ATOMIC_RELAXED)) < job->files->count)
+    {
+        path = job->files->paths[file];
+        entry = &job->entries[file];
+
+        /* Take the status before reading, so a file changed while it is read looks changed next time */
+        if (getEntryStatus(working_directory_fd, path, 0, &status))
+        {
+            fprintf(stderr, "\n[Error] Failed to read '%s': %s\n", path, strerror(errno));
+            entry->flags = TRIGRAM_FILE_UNINDEXED;
+            __atomic_fetch_add(&job->errors, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+        entry->size = status.size;
+        entry->modified_ns = status.modified_ns;
+        entry->changed_ns = status.changed_ns;
+        entry->device = status.device;
+        entry->inode = status.inode;
+
+        old_file = findIndexedFile(job->old, path + strlen(job->directory_name) + 1);
+        if (old_file >= 0)
+        {
+            old_entry = &job->old->files[old_file];
+            if (old_entry->size == entry->size && old_entry->modified_ns == entry->modified_ns
+                && old_entry->changed_ns == entry->changed_ns && old_entry->device == entry->device
+                && old_entry->inode == entry->inode && old_entry->changed_ns < job->old->header->cutoff_ns)
+            {
+                entry->flags = old_entry->flags;
+                job->old_files[file] = old_file;
+                continue;
+            }
+        }
+
+        __atomic_fetch_add(&job->rescanned, 1, __ATOMIC_RELAXED);
+        if (!seen || !buffer)
+        {
+            entry->flags = TRIGRAM_FILE_UNINDEXED;
+            __atomic_fetch_add(&job->errors, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (readFileTrigrams(path, seen, buffer, &job->lists[file], &entry->flags))
+        {
+            __atomic_fetch_add(&job->errors, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    freeTracked(seen);
+    free(buffer);
+}
+
+/*
+*   Function: writeTrigramIndex
+*   ---------------------------
+*   Writes a new trigram index from the trigrams of every file, replacing the
+*   old index atomically. Trigrams of unchanged files are decoded from the old index.
+*
+*   changelog_directory_fd: a handle on the changelog directory.
+*   index_name: the name of the index file.
+*   job: the finished update.
+*   cutoff_ns: files changed after this time are read again on the next update.
+*
+*   returns: SUCCESS if the index was written, FAILURE if an operation fails.
+*/
+
+int writeTrigramIndex(const int changelog_directory_fd, const char *index_name, struct trigram_build_job *job,
+                      const int64_t cutoff_ns)
+{
+    const size_t trigram_space = (size_t) 1 << 24;
+    struct trigram_index_header header;
+    struct trigram_entry entry;
+    char temporary_name[MAX_FILE_NAME_SIZE];
+    long *new_files = NULL;
+    long *decoded = NULL;
+    uint32_t *ends = NULL;
+    uint32_t *postings = NULL;
+    unsigned char *encoded = NULL;
+    unsigned char *grown;
+    size_t encoded_length = 0;
+    size_t encoded_capacity = 0;
+    size_t total = 0;
+    size_t start = 0;
+    size_t name_offset = 0;
+    uint64_t value;
+    uint64_t i;
+    long j;
+    long previous;
+    FILE *file = NULL;
+    int error = FAILURE;
+
+    snprintf(temporary_name, sizeof(temporary_name), "%s.%d.tmp", index_name, (int) getpid());
+
+    /* Gather the trigrams of unchanged files from the old postings, which are in trigram order */
+    if (job->old->header)
+    {
+        new_files = allocateTracked((job->old->header->file_count + 1) * sizeof(*new_files));
+        decoded = allocateTracked((job->old->header->file_count + 1) * sizeof(*decoded));
+        if (!new_files || !decoded)
+        { goto cleanup; }
+
+        for (i = 0; i < job->old->header->file_count; i++)
+        {
+            new_files[i] = -1;
+        }
+        for (j = 0; j < job->files->count; j++)
+        {
+            if (job->old_files[j] >= 0)
+            { new_files[job->old_files[j]] = j; }
+        }
+        for (i = 0; i < job->old->header->trigram_count; i++)
+        {
+            decodePostings(job->old, &job->old->trigrams[i], decoded);
+            for (j = 0; j < job->old->trigrams[i].file_count; j++)
+            {
+                if (decoded[j] < (long) job->old->header->file_count && new_files[decoded[j]] >= 0
+                    && addToTrigramList(&job->lists[new_files[decoded[j]]], job->old->trigrams[i].trigram))
+                { goto cleanup; }
+            }
+        }
+    }
+
+    /* Bucket the file numbers by trigram. Files are visited in order, so each bucket comes out sorted */
+    ends = allocateTracked(trigram_space * sizeof(*ends));
+    if (!ends)
+    { goto cleanup; }
+    memset(ends, 0, trigram_space * sizeof(*ends));
+    for (j = 0; j < job->files->count; j++)
+    {
+        for (i = 0; i < (uint64_t) job->lists[j].count; i++)
+        {
+            ends[job->lists[j].trigrams[i]]++;
+        }
+        total += job->lists[j].count;
+    }
+    for (i = 0; i < trigram_space; i++)
+    {
+        start += ends[i];
+        ends[i] = start - ends[i];
+    }
+    postings = allocateTracked((total + 1) * sizeof(*postings));
+    if (!postings)
+    { goto cleanup; }
+    for (j = 0; j < job->files->count; j++)
+    {
+        for (i = 0; i < (uint64_t) job->lists[j].count; i++)
+        {
+            postings[ends[job->lists[j].trigrams[i]]++] = j;
+        }
+    }
+
+    file = openFileAt(changelog_directory_fd, temporary_name, "wb");
+    if (!file)
+    { goto cleanup; }
+
+    memset(&header, 0, sizeof(header));
+    header.magic = TRIGRAM_INDEX_MAGIC;
+    header.file_count = job->files->count;
+    header.cutoff_ns = cutoff_ns;
+    for (j = 0; j < job->files->count; j++)
+    {
+        header.names_size += strlen(job->files->paths[j] + strlen(job->directory_name) + 1) + 1;
+    }
+    for (i = 0, start = 0; i < trigram_space; i++)
+    {
+        if (ends[i] > start)
+        { header.trigram_count++; }
+        start = ends[i];
+    }
+
+    /* The header is written again at the end, once the size of the postings is known */
+    fwrite(&header, sizeof(header), 1, file);
+    for (j = 0; j < job->files->count; j++)
+    {
+        job->entries[j].name_offset = name_offset;
+        job->entries[j].name_length = strlen(job->files->paths[j] + strlen(job->directory_name) + 1);
+        name_offset += job->entries[j].name_length + 1;
+    }
+    fwrite(job->entries, sizeof(*job->entries), job->files->count, file);
+
+    /* Encode each trigram's file numbers as varint differences */
+    for (i = 0, start = 0; i < trigram_space; start = ends[i], i++)
+    {
+        if (ends[i] == start)
+        { continue; }
+
+        entry.trigram = i;
+        entry.file_count = ends[i] - start;
+        entry.offset = encoded_length;
+        fwrite(&entry, sizeof(entry), 1, file);
+
+        if (encoded_length + (size_t) entry.file_count * 5 > encoded_capacity)
+        {
+            encoded_capacity = (encoded_capacity ? encoded_capacity * 2 : 65536) + (size_t) entry.file_count * 5;
+            grown = reallocateTracked(encoded, encoded_capacity);
+            if (!grown)
+            { goto cleanup; }
+            encoded = grown;
+        }
+        for (j = start, previous = 0; j < ends[i]; previous = postings[j], j++)
+        {
+            for (value = postings[j] - previous; value >= 0x80; value >>= 7)
+            {
+                encoded[encoded_length++] = (value & 0x7F) | 0x80;
+            }
+            encoded[encoded_length++] = value;
+        }
+    }
+    fwrite(encoded, 1, encoded_length, file);
+    for (j = 0; j < job->files->count; j++)
+    {
+        fwrite(job->files->paths[j] + strlen(job->directory_name) + 1, 1, job->entries[j].name_length + 1, file);
+    }
+
+    header.postings_size = encoded_length;
+    if (fseek(file, 0, SEEK_SET) || fwrite(&header, sizeof(header), 1, file) != 1 || fflush(file)
+        || ferror(file))
+    { goto cleanup; }
+    if (fclose(file))
+    {
+        file = NULL;
+        goto cleanup;
+    }
+    file = NULL;
+
+    if (renameat(changelog_directory_fd, temporary_name, changelog_directory_fd, index_name))
+    { goto cleanup; }
+    error = SUCCESS;
+
+cleanup:
+    if (error)
+    {
+        fprintf(stderr, "\n[Error] Failed to write the trigram index: %s\n", strerror(errno));
+        if (file)
+        { fclose(file); }
+        unlinkat(changelog_directory_fd, temporary_name, 0);
+    }
+    freeTracked(new_files);
+    freeTracked(decoded);
+    freeTracked(ends);
+    freeTracked(postings);
+    freeTracked(encoded);
+    return error;
+}
+
+/*
+*   Function: updateTrigramIndex
+*   ----------------------------
+*   Brings the trigram index of a directory up to date. Only files that are new
+*   or changed (by size, modification or change time) since the last update are
+*   read; if nothing changed, the index is used as it is.
+*
+*   directory_name: the indexed directory.
+*   files: the files in the directory, sorted by name.
+*   changelog_directory_fd: a handle on the changelog directory, which holds the index.
+*   index: set to the up-to-date index.
+*   rescanned: set to the number of files read.
+*
+*   returns: SUCCESS if the index is up to date, FAILURE if an operation fails.
+*/
+
+int updateTrigramIndex(const char *directory_name, const struct file_list *files, const int changelog_directory_fd,
+                       struct trigram_index *index, int *rescanned)
+{
+    struct trigram_build_job job;
+    struct stat directory_status;
+    struct timespec now;
+    char index_name[MAX_FILE_NAME_SIZE];
+    int error = SUCCESS;
+    int i;
+
+    *rescanned = 0;
+
+    if (fstatat(working_directory_fd, directory_name, &directory_status, 0))
+    {
+        fprintf(stderr, "\n[Error] Failed to read '%s': %s\n", directory_name, strerror(errno));
+        return FAILURE;
+    }
+    snprintf(index_name, sizeof(index_name), "%s-%llx-%llx.index", TRIGRAM_INDEX_PREFIX,
+             (unsigned long long) directory_status.st_dev, (unsigned long long) directory_status.st_ino);
+
+    /* A missing or damaged index is simply rebuilt */
+    openTrigramIndex(changelog_directory_fd, index_name, index);
+
+    memset(&job, 0, sizeof(job));
+    job.directory_name = directory_name;
+    job.files = files;
+    job.old = index;
+    job.old_files = malloc((files->count + 1) * sizeof(*job.old_files));
+    job.entries = calloc(files->count + 1, sizeof(*job.entries));
+    job.lists = calloc(files->count + 1, sizeof(*job.lists));
+    if (!job.old_files || !job.entries || !job.lists)
+    {
+        fprintf(stderr, "\n[Error] Failed to update the trigram index: %s\n", strerror(errno));
+        error = FAILURE;
+        goto cleanup;
+    }
+    for (i = 0; i < files->count; i++)
+    {
+        job.old_files[i] = -1;
+    }
+
+    /* Files changed in the last second may change again within the same timestamp tick */
+    clock_gettime(CLOCK_REALTIME, &now);
+    runInParallel(getNumberOfWorkers(files->count), trigramBuildTask, &job);
+    *rescanned = job.rescanned;
+
+    if (job.rescanned == 0 && index->header && index->header->file_count == (uint64_t) files->count)
+    { goto cleanup; }
+
+    error = writeTrigramIndex(changelog_directory_fd, index_name, &job, getTimeInNanoseconds(now.tv_sec - 1, now.tv_nsec));
+    closeTrigramIndex(index);
+    if (!error && openTrigramIndex(changelog_directory_fd, index_name, index))
+    {
+        fprintf(stderr, "\n[Error] Failed to open the trigram index: %s\n", strerror(errno));
+        error = FAILURE;
+    }
+
+cleanup:
+    for (i = 0; job.lists && i < files->count; i++)
+    {
+        freeTracked(job.lists[i].trigrams);
+    }
+    free(job.old_files);
+    free(job.entries);
+    free(job.lists);
+    return error;
+}
+
+/*
+*   Function: findCandidateFiles
+*   ----------------------------
+*   Uses a trigram index to shortlist the files that may contain a literal:
+*   those containing every trigram of the literal, plus any files that
+*   weren't indexed. A literal shorter than a trigram shortlists every file.
+*
+*   index: the trigram index.
+*   literal: the text every match contains.
+*   literal_length: the length of the literal.
+*   candidates: set to the candidate file numbers, in increasing order (free() after use).
+*
+*   returns: the number of candidates, or FAILURE if memory runs out.
+*/
+
+long findCandidateFiles(const struct trigram_index *index, const char *literal, const size_t literal_length,
+                        long **candidates)
+{
+    const struct trigram_entry *rarest = NULL;
+    const struct trigram_entry *entry;
+    long *others = NULL;
+    long count = 0;
+    long kept;
+    long other;
+    long i;
+    size_t position;
+    uint32_t trigram;
+    uint64_t file;
+
+    *candidates = malloc((index->header->file_count + 1) * sizeof(**candidates));
+    if (!*candidates)
+    { return FAILURE; }
+
+    if (literal_length < 3)
+    {
+        for (file = 0; file < index->header->file_count; file++)
+        {
+            (*candidates)[count++] = file;
+        }
+        return count;
+    }
+
+    /* Start from the trigram in the fewest files, so every later list only narrows it down */
+    for (position = 0; position + 3 <= literal_length; position++)
+    {
+        trigram = ((unsigned char) literal[position] << 16) | ((unsigned char) literal[position + 1] << 8)
+                  | (unsigned char) literal[position + 2];
+        entry = findIndexedTrigram(index, trigram);
+        if (!entry)
+        {
+            rarest = NULL;
+            break;
+        }
+        if (!rarest || entry->file_count < rarest->file_count)
+        { rarest = entry; }
+    }
+
+    if (rarest)
+    {
+        others = malloc((index->header->file_count + 1) * sizeof(*others));
+        if (!others)
+        {
+            free(*candidates);
+            return FAILURE;
+        }
+        decodePostings(index, rarest, *candidates);
+        count = rarest->file_count;
+
+        for (position = 0; count > 0 && position + 3 <= literal_length; position++)
+        {
+            trigram = ((unsigned char) literal[position] << 16) | ((unsigned char) literal[position + 1] << 8)
+                      | (unsigned char) literal[position + 2];
+            entry = findIndexedTrigram(index, trigram);
+            if (entry == rarest)
+            { continue; }
+
+            decodePostings(index, entry, others);
+            for (i = 0, other = 0, kept = 0; i < count; i++)
+            {
+                while (other < entry->file_count && others[other] < (*candidates)[i])
+                { other++; }
+                if (other < entry->file_count && others[other] == (*candidates)[i])
+                { (*candidates)[kept++] = (*candidates)[i]; }
+            }
+            count = kept;
+        }
+        free(others);
+    }
+
+    /* Files that weren't indexed could contain anything */
+    for (file = 0; file < index->header->file_count; file++)
+    {
+        if (index->files[file].flags & TRIGRAM_FILE_UNINDEXED)
+        { (*candidates)[count++] = file; }
+    }
+    return count;
+}
+
+/*
+*   Function: searchFileContents
+*   ----------------------------
+*   Prints the lines of a file that match a pattern, with their line numbers,
+*   in one streaming pass. As when filtering, only lines the prefilter flags
+*   are looked at individually.
+*
+*   file_name: the name of the file to search.
+*   matcher: the compiled matcher.
+*   delimiter: the record delimiter that terminates each line.
+*   output: the stream to print the matches to.
+*   lines_matched: set to the number of matching lines.
+*
+*   returns: SUCCESS if the file was searched, FAILURE if an operation fails.
+*/
+
+int searchFileContents(const char *file_name, struct line_matcher *matcher, const struct record_delimiter *delimiter,
+                       FILE *output, long *lines_matched)
+{
+    FILE *file;
+    struct line_buffer lines;
+    size_t candidate;
+    size_t position;
+    size_t line_start;
+    size_t line_end;
+    size_t content_end;
+    long line_number = 1;
+    int terminated;
+    int status;
+
+    *lines_matched = 0;
+
+    file = openFile(file_name, "rb");
+    if (!file)
+    { return FAILURE; }
+    if (initialiseLineBuffer(&lines))
+    {
+        fclose(file);
+        return FAILURE;
+    }
+
+    while ((status = readLines(&lines, file, delimiter)) == 1)
+    {
+        resetLineMatcher(matcher);
+        position = 0;
+        while (position < lines.region_end)
+        {
+            /* Everything before the candidate's line can't match, but its lines still need counting */
+            candidate = findNextCandidate(matcher, lines.data, position, lines.region_end);
+            line_start = candidate < lines.region_end ? findLineStart(lines.data, position, candidate, delimiter)
+                                                     : lines.region_end;
+            line_number += countDelimiters(lines.data + position, line_start - position, delimiter);
+            position = line_start;
+            if (position == lines.region_end)
+            { break; }
+
+            terminated = findDelimiter(lines.data, line_start, lines.region_end, delimiter, &line_end);
+            content_end = terminated ? line_end - getDelimiterLength(delimiter) : line_end;
+
+            if (lineMatches(matcher, lines.data + line_start, content_end - line_start))
+            {
+                fprintf(output, "%s:%ld:", file_name, line_number);
+                fwrite(lines.data + line_start, 1, content_end - line_start, output);
+                fputc('\n', output);
+                (*lines_matched)++;
+            }
+            line_number += terminated;
+            position = line_end;
+        }
+    }
+
+    freeTracked(lines.data);
+    fclose(file);
+    return status;
+}
+
+/*
+*   Function: contentSearchTask
+*   ---------------------------
+*   Parallel task run once per worker. Takes candidate files from the job until
+*   none are left and searches them. Each file's matches are printed together,
+*   so output from different files never interleaves.
+*
+*   worker: the index of the worker.
+*   context: the content_search_job.
+*/
+
+void contentSearchTask(int worker, void *context)
+{
+    struct content_search_job *job = context;
+    struct line_matcher matcher;
+    char *matches = NULL;
+    size_t matches_size = 0;
+    FILE *output;
+    long candidate;
+    long lines_matched;
+    int error;
+
+    (void) worker;
+
+    /* The pattern was checked before the search started, and each worker needs its own prefilter state */
+    if (compileLineMatcher(&matcher, job->patterns, 1, job->use_regex, 0))
+    {
+        __atomic_fetch_add(&job->errors, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    while ((candidate = __atomic_fetch_add(&job->next_candidate, 1, __ATOMIC_RELAXED)) < job->candidate_count)
+    {
+        output = job->candidates[candidate] < job->files->count ? open_memstream(&matches, &matches_size) : NULL;
+        if (!output)
+        {
+            __atomic_fetch_add(&job->errors, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        error = searchFileContents(job->files->paths[job->candidates[candidate]], &matcher, job->delimiter, output,
+                                   &lines_matched);
+        fclose(output);
+        fwrite(matches, 1, matches_size, stdout);
+        free(matches);
+        matches = NULL;
+
+        if (error)
+        { __atomic_fetch_add(&job->errors, 1, __ATOMIC_RELAXED); }
+        if (lines_matched)
+        {
+            __atomic_fetch_add(&job->matching_lines, lines_matched, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&job->matching_files, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    freeLineMatcher(&matcher);
+}
+
+/*
+*   Function: searchDirectoryContents
+*   ---------------------------------
+*   Prints every line matching a pattern in the files of a directory. The
+*   directory's trigram index is brought up to date first, then used to
+*   shortlist the files that can contain the pattern's literal text, and only
+*   those are read, in parallel. Matches are printed as they are found, so the
+*   order of files varies.
+*
+*   directory_name: the directory to search.
+*   pattern: a literal, or an extended regular expression.
+*   use_regex: 1 if the pattern is a regex, 0 if it is a literal.
+*   delimiter: the record delimiter that terminates each line.
+*   changelog_directory_fd: a handle on the changelog directory, which holds the index.
+*
+*   returns: SUCCESS if the search ran, FAILURE if an operation fails.
+*/
+
+int searchDirectoryContents(const char *directory_name, const char *pattern, const int use_regex,
+                            const struct record_delimiter *delimiter, const int changelog_directory_fd)
+{
+    struct file_list files = { NULL, 0, 0 };
+    struct trigram_index index;
+    struct content_search_job job;
+    struct line_matcher matcher;
+    struct timespec start;
+    struct timespec end;
+    char literal[MAX_LINE_CONTENT_SIZE];
+    char *patterns[1] = { (char *) pattern };
+    size_t literal_length;
+    long *candidates;
+    long candidate_count;
+    int rescanned;
+
+    if (compileLineMatcher(&matcher, patterns, 1, use_regex, 0))
+    { return FAILURE; }
+    freeLineMatcher(&matcher);
+
+    /* Every match contains the literal, so only files with all of its trigrams can match */
+    if (use_regex)
+    {
+        literal_length = extractRequiredLiteral(pattern, literal);
+    }
+    else
+    {
+        literal_length = snprintf(literal, sizeof(literal), "%s", pattern);
+    }
+
+    if (collectFilesInDirectory(directory_name, &files))
+    { return FAILURE; }
+    qsort(files.paths, files.count, sizeof(*files.paths), compareFilePaths);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (updateTrigramIndex(directory_name, &files, changelog_directory_fd, &index, &rescanned))
+    {
+        freeFileList(&files);
+        return FAILURE;
+    }
+
+    candidate_count = findCandidateFiles(&index, literal, literal_length, &candidates);
+    closeTrigramIndex(&index);
+    if (candidate_count < 0)
+    {
+        fprintf(stderr, "\n[Error] Failed to search '%s': %s\n", directory_name, strerror(errno));
+        freeFileList(&files);
+        return FAILURE;
+    }
+
+    memset(&job, 0, sizeof(job));
+    job.files = &files;
+    job.candidates = candidates;
+    job.candidate_count = candidate_count;
+    job.patterns = patterns;
+    job.use_regex = use_regex;
+    job.delimiter = delimiter;
+    runInParallel(getNumberOfWorkers(candidate_count), contentSearchTask, &job);
+    fflush(stdout);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    printf("%ld matching lines in %ld files. Scanned %ld of %d files (%d indexed again) in %.3f seconds.\n",
+           job.matching_lines, job.matching_files, candidate_count, files.count, rescanned,
+           (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+    if (job.errors)
+    {
+        printf("%ld files could not be searched.\n", job.errors);
+    }
+
+    free(candidates);
+    freeFileList(&files);
+    return SUCCESS;
+}
+
+/*
+*   The background merge of word index segments. Both are only changed while
+*   word_index_lock is held.
+*/
+
+static pthread_mutex_t word_index_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t word_merge_thread;
+static int word_merge_state = 0;
+
+/*
+*   Function: isWordByte
+*   --------------------
+*   Checks whether a byte is part of a word: ASCII letters, digits and '_',
+*   plus every byte of a multi-byte UTF-8 character.
+*
+*   byte: the byte to check.
+*
+*   returns: 1 if the byte is part of a word, 0 if it separates words.
+*/
+
+int isWordByte(const unsigned char byte)
+{
+    return isalnum(byte) || byte == '_' || byte >= 0x80;
+}
+
+/*
+*   Function: addWordToken
+*   ----------------------
+*   Adds a word to the end of a file's word list.
+*
+*   tokens: the word list.
+*   word: the word (already lowercased).
+*   length: the length of the word (at most MAX_WORD_LENGTH).
+*   line: the line the word is on.
+*
+*   returns: SUCCESS if the word was added, FAILURE if memory runs out.
+*/
+
+int addWordToken(struct word_tokens *tokens, const unsigned char *word, const size_t length, const uint32_t line)
+{
+    unsigned char *data;
+    size_t capacity;
+
+    if (tokens->length + length + 5 > tokens->capacity)
+    {
+        capacity = tokens->capacity ? tokens->capacity * 2 : 65536;
+        if (!fitsMemoryBudget(capacity - tokens->capacity))
+        {
+            errno = EFBIG;
+            return FAILURE;
+        }
+        data = reallocateTracked(tokens->data, capacity);
+        if (!data)
+        { return FAILURE; }
+        tokens->data = data;
+        tokens->capacity = capacity;
+    }
+
+    tokens->data[tokens->length++] = length;
+    memcpy(tokens->data + tokens->length, word, length);
+    memcpy(tokens->data + tokens->length + length, &line, sizeof(line));
+    tokens->length += length + sizeof(line);
+    return SUCCESS;
+}
+
+/*
+*   Function: tokenizeText
+*   ----------------------
+*   Splits text that holds no delimiters into lowercased words, all on one line.
+*
+*   text: the text to split.
+*   line: the line the text is on.
+*   tokens: the word list to add the words to.
+*
+*   returns: SUCCESS if the words were added, FAILURE if memory runs out.
+*/
+
+int tokenizeText(const char *text, const uint32_t line, struct word_tokens *tokens)
+{
+    unsigned char word[MAX_WORD_LENGTH];
+    size_t word_length = 0;
+
+    for (;; text++)
+    {
+        if (*text && isWordByte(*text))
+        {
+            if (word_length < MAX_WORD_LENGTH)
+            { word[word_length++] = tolower((unsigned char) *text); }
+            continue;
+        }
+        if (word_length && addWordToken(tokens, word, word_length, line))
+        { return FAILURE; }
+        word_length = 0;
+        if (!*text)
+        { return SUCCESS; }
+    }
+}
+
+/*
+*   Function: tokenizeFile
+*   ----------------------
+*   Reads a file and lists its words with the line each is on. The file's status
+*   is taken before reading, so a file changed while it is read looks changed next time.
+*
+*   file_name: the file to read.
+*   delimiter: the record delimiter that terminates each line.
+*   tokens: the (empty) word list to fill in, including its entry.
+*
+*   returns: SUCCESS if the file was read, FAILURE if an operation fails.
+*/
+
+int tokenizeFile(const char *file_name, const struct record_delimiter *delimiter, struct word_tokens *tokens)
+{
+    struct entry_status status;
+    unsigned char word[MAX_WORD_LENGTH];
+    unsigned char *buffer;
+    unsigned char previous = 0;
+    size_t word_length = 0;
+    ssize_t bytes_read = 0;
+    ssize_t offset;
+    off_t position = 0;
+    uint32_t line = 1;
+    int line_has_content = 0;
+    int error = SUCCESS;
+    int fd;
+
+    if (getEntryStatus(working_directory_fd, file_name, 0, &status))
+    {
+        fprintf(stderr, "\n[Error] Failed to read '%s': %s\n", file_name, strerror(errno));
+        return FAILURE;
+    }
+    tokens->entry.size = status.size;
+    tokens->entry.modified_ns = status.modified_ns;
+    tokens->entry.changed_ns = status.changed_ns;
+    tokens->entry.device = status.device;
+    tokens->entry.inode = status.inode;
+
+    fd = acquireDescriptor(working_directory_fd, file_name, O_RDONLY);
+    buffer = malloc(SCAN_BUFFER_SIZE);
+    if (fd < 0 || !buffer)
+    {
+        fprintf(stderr, "\n[Error] Failed to open file '%s': %s.\n", file_name, strerror(errno));
+        free(buffer);
+        if (fd >= 0)
+        { releaseDescriptor(fd); }
+        return FAILURE;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    /* The descriptor may be shared through the cache, so read at explicit offsets */
+    while (!error && (bytes_read = limitedPread(fd, buffer, SCAN_BUFFER_SIZE, position)) > 0)
+    {
+        position += bytes_read;
+        for (offset = 0; offset < bytes_read; offset++)
+        {
+            unsigned char byte = buffer[offset];
+            int ends_line = byte == delimiter->byte && (delimiter->type != DELIMITER_CRLF || previous == '\r');
+
+            previous = byte;
+            if (!ends_line && isWordByte(byte))
+            {
+                if (word_length < MAX_WORD_LENGTH)
+                { word[word_length++] = tolower(byte); }
+                line_has_content = 1;
+                continue;
+            }
+
+            if (word_length && addWordToken(tokens, word, word_length, line))
+            {
+                fprintf(stderr, "\n[Error] Failed to index file '%s': %s.\n", file_name, strerror(errno));
+                error = FAILURE;
+                break;
+            }
+            word_length = 0;
+            line_has_content = !ends_line;
+            line += ends_line;
+        }
+    }
+
+    if (!error && bytes_read < 0)
+    {
+        fprintf(stderr, "\n[Error] Failed to read file '%s': %s.\n", file_name, strerror(errno));
+        error = FAILURE;
+    }
+    if (!error && word_length && addWordToken(tokens, word, word_length, line))
+    {
+        error = FAILURE;
+    }
+    free(buffer);
+    releaseDescriptor(fd);
+
+    tokens->entry.lines = line - 1 + line_has_content;
+    tokens->entry.flags = line_has_content ? WORD_FILE_UNTERMINATED : 0;
+    return error;
+}
+
+/*
+*   Function: wordTokenizeTask
+*   --------------------------
+*   Parallel task that reads the words of one file.
+*
+*   task_index: the index of the file in the job.
+*   context: the word_tokenize_job.
+*/
+
+void wordTokenizeTask(int task_index, void *context)
+{
+    struct word_tokenize_job *job = context;
+
+    job->tokens[task_index].error = tokenizeFile(job->paths[task_index], job->delimiter, &job->tokens[task_index]);
+}
+
+/*
+*   Function: freeWordBuilder
+*   -------------------------
+*   Frees a word index segment being built.
+*
+*   builder: the builder to free.
+*/
+
+void freeWordBuilder(struct word_builder *builder)
+{
+    long i;
+
+    for (i = 0; i < builder->word_count; i++)
+    {
+        freeTracked(builder->words[i].word);
+        freeTracked(builder->words[i].postings);
+    }
+    for (i = 0; i < builder->file_count; i++)
+    {
+        freeTracked(builder->names[i]);
+    }
+    freeTracked(builder->words);
+    freeTracked(builder->buckets);
+    freeTracked(builder->files);
+    freeTracked(builder->names);
+    memset(builder, 0, sizeof(*builder));
+}
+
+/*
+*   Function: addWordFile
+*   ---------------------
+*   Adds a file entry to a segment being built.
+*
+*   builder: the builder.
+*   name: the file's name within the indexed directory.
+*   entry: the file's entry (the name fields are filled in when the segment is written).
+*
+*   returns: the file's number in the segment, or -1 if memory runs out.
+*/
+
+long addWordFile(struct word_builder *builder, const char *name, const struct word_file_entry *entry)
+{
+    struct word_file_entry *files;
+    char **names;
+    long capacity;
+
+    if (builder->file_count == builder->file_capacity)
+    {
+        capacity = builder->file_capacity ? builder->file_capacity * 2 : 256;
+        files = reallocateTracked(builder->files, capacity * sizeof(*files));
+        if (files)
+        { builder->files = files; }
+        names = reallocateTracked(builder->names, capacity * sizeof(*names));
+        if (names)
+        { builder->names = names; }
+        if (!files || !names)
+        { return -1; }
+        builder->file_capacity = capacity;
+    }
+
+    builder->names[builder->file_count] = allocateTracked(strlen(name) + 1);
+    if (!builder->names[builder->file_count])
+    { return -1; }
+    strcpy(builder->names[builder->file_count], name);
+    builder->files[builder->file_count] = *entry;
+    return builder->file_count++;
+}
+
+/*
+*   Function: addWordPosting
+*   ------------------------
+*   Records that a word appears on a line of a file in a segment being built.
+*
+*   builder: the builder.
+*   word: the word.
+*   length: the length of the word.
+*   file: the file's number in the segment.
+*   line: the line number.
+*
+*   returns: SUCCESS if the posting was added, FAILURE if memory runs out.
+*/
+
+int addWordPosting(struct word_builder *builder, const char *word, const size_t length, const uint32_t file,
+                   const uint32_t line)
+{
+    struct word_builder_entry *entry;
+    struct word_posting *postings;
+    char key[MAX_WORD_LENGTH + 1];
+    long *buckets;
+    long bucket_count;
+    long found;
+    long i;
+
+    memcpy(key, word, length);
+    key[length] = '\0';
+
+    /* Keep at least one bucket per word */
+    if (builder->word_count >= builder->bucket_count)
+    {
+        bucket_count = builder->bucket_count ? builder->bucket_count * 2 : 4096;
+        buckets = allocateTracked(bucket_count * sizeof(*buckets));
+        if (!buckets)
+        { return FAILURE; }
+        memset(buckets, 0xFF, bucket_count * sizeof(*buckets));
+        for (i = 0; i < builder->word_count; i++)
+        {
+            long *bucket = &buckets[hashEntryName(builder->words[i].word) & (bucket_count - 1)];
+
+            builder->words[i].next = *bucket;
+            *bucket = i;
+        }
+        freeTracked(builder->buckets);
+        builder->buckets = buckets;
+        builder->bucket_count = bucket_count;
+    }
+
+    for (found = builder->buckets[hashEntryName(key) & (builder->bucket_count - 1)]; found >= 0;
+         found = builder->words[found].next)
+    {
+        if (builder->words[found].length == length && !memcmp(builder->words[found].word, key, length))
+        { break; }
+    }
+
+    if (found < 0)
+    {
+        if (builder->word_count == builder->word_capacity)
+        {
+            entry = reallocateTracked(builder->words, (builder->word_capacity ? builder->word_capacity * 2 : 4096) * sizeof(*entry));
+            if (!entry)
+            { return FAILURE; }
+            builder->words = entry;
+            builder->word_capacity = builder->word_capacity ? builder->word_capacity * 2 : 4096;
+        }
+
+        entry = &builder->words[builder->word_count];
+        memset(entry, 0, sizeof(*entry));
+        entry->word = allocateTracked(length + 1);
+        if (!entry->word)
+        { return FAILURE; }
+        memcpy(entry->word, key, length + 1);
+        entry->length = length;
+        entry->next = builder->buckets[hashEntryName(key) & (builder->bucket_count - 1)];
+        builder->buckets[hashEntryName(key) & (builder->bucket_count - 1)] = builder->word_count;
+        found = builder->word_count++;
+    }
+
+    /* A word repeated on the same line only needs one posting */
+    entry = &builder->words[found];
+    if (entry->count && entry->postings[entry->count - 1].file == file && entry->postings[entry->count - 1].line == line)
+    { return SUCCESS; }
+
+    if (entry->count == entry->capacity)
+    {
+        postings = reallocateTracked(entry->postings, (entry->capacity ? entry->capacity * 2 : 4) * sizeof(*postings));
+        if (!postings)
+        { return FAILURE; }
+        entry->postings = postings;
+        entry->capacity = entry->capacity ? entry->capacity * 2 : 4;
+    }
+    entry->postings[entry->count].file = file;
+    entry->postings[entry->count].line = line;
+    entry->count++;
+    return SUCCESS;
+}
+
+/*
+*   Function: addTokensToBuilder
+*   ----------------------------
+*   Adds every word of a file's word list to a segment being built.
+*
+*   builder: the builder.
+*   file: the file's number in the segment.
+*   tokens: the file's words.
+*
+*   returns: SUCCESS if the words were added, FAILURE if memory runs out.
+*/
+
+int addTokensToBuilder(struct word_builder *builder, const uint32_t file, const struct word_tokens *tokens)
+{
+    size_t position = 0;
+    size_t length;
+    uint32_t line;
+
+    while (position < tokens->length)
+    {
+        length = tokens->data[position];
+        memcpy(&line, tokens->data + position + 1 + length, sizeof(line));
+        if (addWordPosting(builder, (const char *) tokens->data + position + 1, length, file, line))
+        { return FAILURE; }
+        position += 1 + length + sizeof(line);
+    }
+    return SUCCESS;
+}
+
+/*
+*   Function: compareWordPostings
+*   -----------------------------
+*   Orders postings by file, then line, for qsort().
+*
+*   first, second: pointers to the two postings.
+*
+*   returns: <0, 0 or >0 as the first posting sorts before, with or after the second.
+*/
+
+int compareWordPostings(const void *first, const void *second)
+{
+    const struct word_posting *a = first;
+    const struct word_posting *b = second;
+
+    if (a->file != b->file)
+    { return a->file < b->file ? -1 : 1; }
+    return (a->line > b->line) - (a->line < b->line);
+}
+
+/*
+*   Function: compareBuilderWords
+*   -----------------------------
+*   Orders the words of a segment being built, for qsort().
+*
+*   first, second: pointers to pointers to the two words.
+*
+*   returns: <0, 0 or >0 as the first word sorts before, with or after the second.
+*/
+
+int compareBuilderWords(const void *first, const void *second)
+{
+    return strcmp((*(struct word_builder_entry *const *) first)->word, (*(struct word_builder_entry *const *) second)->word);
+}
+
+/*
+*   Function: writeVarint
+*   ---------------------
+*   Encodes a number in 7-bit groups, lowest first, with the top bit set on all but the last.
+*
+*   output: where to write the encoding (at most 10 bytes).
+*   value: the number to encode.
+*
+*   returns: the number of bytes written.
+*/
+
+size_t writeVarint(unsigned char *output, uint64_t value)
+{
+    size_t length = 0;
+
+    for (; value >= 0x80; value >>= 7)
+    {
+        output[length++] = (value & 0x7F) | 0x80;
+    }
+    output[length++] = value;
+    return length;
+}
+
+/*
+*   Function: readVarint
+*   --------------------
+*   Decodes a number written by writeVarint().
+*
+*   input: the encoding.
+*   end: the end of the data, which the decoding doesn't read past.
+*   value: set to the number.
+*
+*   returns: the position after the encoding.
+*/
+
+const unsigned char *readVarint(const unsigned char *input, const unsigned char *end, uint64_t *value)
+{
+    int shift;
+
+    *value = 0;
+    for (shift = 0; input < end && shift < 64; shift += 7)
+    {
+        *value |= (uint64_t) (*input & 0x7F) << shift;
+        if (!(*input++ & 0x80))
+        { break; }
+    }
+    return input;
+}
+
+/*
+*   Function: writeWordSegment
+*   --------------------------
+*   Writes a segment being built to the changelog folder. Files changed too
+*   recently to be trusted are flagged so the next update reads them again.
+*
+*   changelog_directory_fd: a handle on the changelog directory.
+*   segment_name: the name of the segment file.
+*   builder: the segment.
+*   delimiter: the record delimiter the line numbers were counted with.
+*   cutoff_ns: files changed after this time are flagged WORD_FILE_RACY.
+*
+*   returns: SUCCESS if the segment was written, FAILURE if an operation fails.
+*/
+
+int writeWordSegment(const int changelog_directory_fd, const char *segment_name, struct word_builder *builder,
+                     const struct record_delimiter *delimiter, const int64_t cutoff_ns)
+{
+    struct word_segment_header header;
+    struct word_builder_entry **order = NULL;
+    struct word_builder_entry *word;
+    struct word_entry *entries = NULL;
+    unsigned char *postings = NULL;
+    unsigned char *grown;
+    size_t postings_length = 0;
+    size_t postings_capacity = 0;
+    uint64_t string_offset = 0;
+    uint32_t previous_file;
+    uint32_t previous_line;
+    char temporary_name[MAX_FILE_PATH_SIZE];
+    FILE *file = NULL;
+    long kept;
+    long i;
+    long j;
+    int error = FAILURE;
+
+    snprintf(temporary_name, sizeof(temporary_name), "%s.tmp", segment_name);
+
+    order = allocateTracked((builder->word_count + 1) * sizeof(*order));
+    entries = allocateTracked((builder->word_count + 1) * sizeof(*entries));
+    if (!order || !entries)
+    { goto cleanup; }
+    memset(entries, 0, (builder->word_count + 1) * sizeof(*entries));
+    for (i = 0; i < builder->word_count; i++)
+    {
+        order[i] = &builder->words[i];
+    }
+    qsort(order, builder->word_count, sizeof(*order), compareBuilderWords);
+
+    for (i = 0; i < builder->file_count; i++)
+    {
+        builder->files[i].name_offset = string_offset;
+        builder->files[i].name_length = strlen(builder->names[i]);
+        if (builder->files[i].changed_ns >= cutoff_ns)
+        { builder->files[i].flags |= WORD_FILE_RACY; }
+        string_offset += builder->files[i].name_length + 1;
+    }
+
+    /* Postings from merged segments arrive out of order, so sort them and drop repeats */
+    for (i = 0; i < builder->word_count; i++)
+    {
+        word = order[i];
+        qsort(word->postings, word->count, sizeof(*word->postings), compareWordPostings);
+        for (j = 1, kept = word->count ? 1 : 0; j < word->count; j++)
+        {
+            if (compareWordPostings(&word->postings[j], &word->postings[kept - 1]))
+            { word->postings[kept++] = word->postings[j]; }
+        }
+        word->count = kept;
+
+        if (postings_length + (size_t) word->count * 10 > postings_capacity)
+        {
+            postings_capacity = (postings_capacity ? postings_capacity * 2 : 65536) + (size_t) word->count * 10;
+            grown = reallocateTracked(postings, postings_capacity);
+            if (!grown)
+            { goto cleanup; }
+            postings = grown;
+        }
+
+        entries[i].word_offset = string_offset;
+        entries[i].word_length = word->length;
+        entries[i].postings_offset = postings_length;
+        entries[i].posting_count = word->count;
+        string_offset += word->length + 1;
+
+        for (j = 0, previous_file = 0, previous_line = 0; j < word->count; j++)
+        {
+            postings_length += writeVarint(postings + postings_length, word->postings[j].file - previous_file);
+            postings_length += writeVarint(postings + postings_length, word->postings[j].file == previous_file
+                                                                       ? word->postings[j].line - previous_line
+                                                                       : word->postings[j].line);
+            previous_file = word->postings[j].file;
+            previous_line = word->postings[j].line;
+        }
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.magic = WORD_SEGMENT_MAGIC;
+    header.delimiter_type = delimiter->type;
+    header.delimiter_byte = (unsigned char) delimiter->byte;
+    header.file_count = builder->file_count;
+    header.word_count = builder->word_count;
+    header.postings_size = postings_length;
+    header.strings_size = string_offset;
+
+    file = openFileAt(changelog_directory_fd, temporary_name, "wb");
+    if (!file)
+    { goto cleanup; }
+
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(builder->files, sizeof(*builder->files), builder->file_count, file);
+    fwrite(entries, sizeof(*entries), builder->word_count, file);
+    fwrite(postings, 1, postings_length, file);
+    for (i = 0; i < builder->file_count; i++)
+    {
+        fwrite(builder->names[i], 1, builder->files[i].name_length + 1, file);
+    }
+    for (i = 0; i < builder->word_count; i++)
+    {
+        fwrite(order[i]->word, 1, order[i]->length + 1, file);
+    }
+
+    error = fflush(file) || ferror(file);
+    error |= fclose(file) != 0;
+    file = NULL;
+    if (!error && renameat(changelog_directory_fd, temporary_name, changelog_directory_fd, segment_name))
+    {
+        error = FAILURE;
+    }
+
+cleanup:
+    if (error)
+    {
+        fprintf(stderr, "\n[Error] Failed to write the word index: %s\n", strerror(errno));
+        if (file)
+        { fclose(file); }
+        unlinkat(changelog_directory_fd, temporary_name, 0);
+        error = FAILURE;
+    }
+    freeTracked(order);
+    freeTracked(entries);
+    freeTracked(postings);
+    return error;
+}
+
+/*
+*   Function: closeWordSegment
+*   --------------------------
+*   Unmaps a word index segment.
+*
+*   segment: the segment to close.
+*/
+
+void closeWordSegment(struct word_segment *segment)
+{
+    if (segment->map)
+    {
+        munmap(segment->map, segment->mapped_size);
+    }
+    memset(segment, 0, sizeof(*segment));
+}
+
+/*
+*   Function: openWordSegment
+*   -------------------------
+*   Maps a word index segment and checks that its parts fit in the file.
+*
+*   changelog_directory_fd: a handle on the changelog directory.
+*   segment_name: the name of the segment file.
+*   delimiter: the record delimiter the line numbers must have been counted with.
+*   segment: set to the mapped segment.
+*
+*   returns: SUCCESS if the segment is mapped, FAILURE if it is missing, damaged or
+*            was counted with another delimiter.
+*/
+
+int openWordSegment(const int changelog_directory_fd, const char *segment_name, const struct record_delimiter *delimiter,
+                    struct word_segment *segment)
+{
+    const struct word_segment_header *header;
+    struct stat segment_status;
+    uint64_t size;
+    uint64_t i;
+    int fd;
+
+    memset(segment, 0, sizeof(*segment));
+
+    fd = openat(changelog_directory_fd, segment_name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    { return FAILURE; }
+    if (fstat(fd, &segment_status) || (size_t) segment_status.st_size < sizeof(*header))
+    {
+        close(fd);
+        return FAILURE;
+    }
+
+    segment->mapped_size = segment_status.st_size;
+    segment->map = mmap(NULL, segment->mapped_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (segment->map == MAP_FAILED)
+    {
+        segment->map = NULL;
+        return FAILURE;
+    }
+
+    /* Each count is checked on its own first, so the sum below can't overflow */
+    header = segment->map;
+    size = sizeof(*header);
+    if (header->magic != WORD_SEGMENT_MAGIC || header->delimiter_type != delimiter->type
+        || header->delimiter_byte != (unsigned char) delimiter->byte || header->file_count > segment->mapped_size
+        || header->word_count > segment->mapped_size || header->postings_size > segment->mapped_size
+        || header->strings_size > segment->mapped_size
+        || (size += header->file_count * sizeof(*segment->files) + header->word_count * sizeof(*segment->words)
+                    + header->postings_size + header->strings_size) != segment->mapped_size)
+    {
+        closeWordSegment(segment);
+        return FAILURE;
+    }
+
+    segment->header = header;
+    segment->files = (const struct word_file_entry *) (header + 1);
+    segment->words = (const struct word_entry *) (segment->files + header->file_count);
+    segment->postings = (const unsigned char *) (segment->words + header->word_count);
+    segment->strings = (const char *) (segment->postings + header->postings_size);
+
+    /* Lookups trust every string to be terminated inside the segment */
+    for (i = 0; i < header->file_count; i++)
+    {
+        if (segment->files[i].name_offset + segment->files[i].name_length >= header->strings_size
+            || segment->strings[segment->files[i].name_offset + segment->files[i].name_length])
+        { break; }
+    }
+    for (size = 0; i == header->file_count && size < header->word_count; size++)
+    {
+        if (segment->words[size].word_offset + segment->words[size].word_length >= header->strings_size
+            || segment->strings[segment->words[size].word_offset + segment->words[size].word_length]
+            || segment->words[size].postings_offset > header->postings_size)
+        { break; }
+    }
+    if (i < header->file_count || size < header->word_count)
+    {
+        closeWordSegment(segment);
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+
+/*
+*   Function: findWordView
+*   ----------------------
+*   Looks a file up in a word index by name.
+*
+*   index: the word index.
+*   name: the file's name within the indexed directory.
+*
+*   returns: the file's view, or -1 if the index doesn't cover it.
+*/
+
+long findWordView(const struct word_index *index, const char *name)
+{
+    long view;
+
+    if (!index->bucket_count)
+    { return -1; }
+
+    for (view = index->buckets[hashEntryName(name) & (index->bucket_count - 1)]; view >= 0; view = index->views[view].next)
+    {
+        if (!strcmp(index->views[view].name, name))
+        { return view; }
+    }
+    return -1;
+}
+
+/*
+*   Function: buildWordViews
+*   ------------------------
+*   Works out the current state of each file from the segments, newest first.
+*   A file's newest entry gives its status; its lines come from that entry plus
+*   the older entries it only appended to, back to the newest full entry.
+*
+*   index: the word index, with its segments mapped.
+*
+*   returns: SUCCESS if the views were built, FAILURE if memory runs out.
+*/
+
+int buildWordViews(struct word_index *index)
+{
+    const struct word_segment *segment;
+    const struct word_file_entry *entry;
+    struct word_view *views;
+    long total = 0;
+    long view;
+    uint64_t file;
+    int i;
+
+    for (i = 0; i < index->segment_count; i++)
+    {
+        total += index->segments[i].header->file_count;
+    }
+    for (index->bucket_count = 1024; index->bucket_count < total; index->bucket_count *= 2);
+
+    index->buckets = malloc(index->bucket_count * sizeof(*index->buckets));
+    index->views = malloc((total + 1) * sizeof(*index->views));
+    index->live = calloc(index->segment_count + 1, sizeof(*index->live));
+    if (!index->buckets || !index->views || !index->live)
+    { return FAILURE; }
+    memset(index->buckets, 0xFF, index->bucket_count * sizeof(*index->buckets));
+    views = index->views;
+
+    for (i = index->segment_count - 1; i >= 0; i--)
+    {
+        segment = &index->segments[i];
+        index->live[i] = malloc((segment->header->file_count + 1) * sizeof(**index->live));
+        if (!index->live[i])
+        { return FAILURE; }
+
+        for (file = 0; file < segment->header->file_count; file++)
+        {
+            entry = &segment->files[file];
+            view = findWordView(index, segment->strings + entry->name_offset);
+            if (view < 0)
+            {
+                view = index->view_count++;
+                views[view].name = segment->strings + entry->name_offset;
+                views[view].newest = entry;
+                views[view].complete = 0;
+                views[view].next = index->buckets[hashEntryName(views[view].name) & (index->bucket_count - 1)];
+                index->buckets[hashEntryName(views[view].name) & (index->bucket_count - 1)] = view;
+            }
+
+            index->live[i][file] = views[view].complete || (entry->flags & WORD_FILE_REMOVED) ? -1 : view;
+            if (!(entry->flags & WORD_FILE_APPENDED))
+            {
+                views[view].complete = 1;
+            }
+        }
+    }
+    return SUCCESS;
+}
+
+/*
+*   Function: freeWordIndex
+*   -----------------------
+*   Unmaps the segments of a word index and frees its views.
+*
+*   index: the index to free.
+*/
+
+void freeWordIndex(struct word_index *index)
+{
+    int i;
+
+    for (i = 0; i < index->segment_count; i++)
+    {
+        closeWordSegment(&index->segments[i]);
+        free(index->segment_names[i]);
+        if (index->live)
+        { free(index->live[i]); }
+    }
+    free(index->segment_names);
+    free(index->segments);
+    free(index->live);
+    free(index->views);
+    free(index->buckets);
+    index->segment_names = NULL;
+    index->segments = NULL;
+    index->live = NULL;
+    index->views = NULL;
+    index->buckets = NULL;
+    index->segment_count = 0;
+    index->view_count = 0;
+    index->bucket_count = 0;
+}
+
+/*
+*   Function: loadWordIndex
+*   -----------------------
+*   Reads a word index's manifest (the list of its segments, oldest first) and
+*   maps the segments. If a segment can't be used, the index is marked to be
+*   rebuilt rather than answering from part of it.
+*
+*   changelog_directory_fd: a handle on the changelog directory.
+*   delimiter: the record delimiter the line numbers must be counted with.
+*   index: the index to load, with base_name set.
+*
+*   returns: SUCCESS if the index was loaded (it is empty if it doesn't exist yet),
+*            FAILURE if an operation fails.
+*/
+
+int loadWordIndex(const int changelog_directory_fd, const struct record_delimiter *delimiter, struct word_index *index)
+{
+    char manifest_name[MAX_FILE_PATH_SIZE];
+    char line[MAX_FILE_NAME_SIZE];
+    char **names;
+    struct word_segment *segments;
+    FILE *manifest;
+    size_t length;
+    int i;
+
+    freeWordIndex(index);
+    index->next_segment = 1;
+    index->rebuild = 0;
+
+    /* An index that hasn't been written yet is empty */
+    snprintf(manifest_name, sizeof(manifest_name), "%s.manifest", index->base_name);
+    if (faccessat(changelog_directory_fd, manifest_name, F_OK, 0))
+    { return errno == ENOENT ? SUCCESS : FAILURE; }
+    manifest = openFileAt(changelog_directory_fd, manifest_name, "r");
+    if (!manifest)
+    { return FAILURE; }
+
+    if (!fgets(line, sizeof(line), manifest) || sscanf(line, "next %ld", &index->next_segment) != 1)
+    {
+        index->rebuild = 1;
+    }
+
+    while (fgets(line, sizeof(line), manifest))
+    {
+        length = strcspn(line, "\n");
+        line[length] = '\0';
+
+        names = realloc(index->segment_names, (index->segment_count + 1) * sizeof(*names));
+        if (names)
+        { index->segment_names = names; }
+        segments = realloc(index->segments, (index->segment_count + 1) * sizeof(*segments));
+        if (segments)
+        { index->segments = segments; }
+        if (!names || !segments || !(names[index->segment_count] = strdup(line)))
+        {
+            fclose(manifest);
+            return FAILURE;
+        }
+        memset(&segments[index->segment_count], 0, sizeof(*segments));
+        index->segment_count++;
+    }
+    fclose(manifest);
+
+    for (i = 0; !index->rebuild && i < index->segment_count; i++)
+    {
+        if (strchr(index->segment_names[i], '/')
+            || openWordSegment(changelog_directory_fd, index->segment_names[i], delimiter, &index->segments[i]))
+        {
+            index->rebuild = 1;
+        }
+    }
+    if (index->rebuild)
+    {
+        for (i = 0; i < index->segment_count; i++)
+        {
+            closeWordSegment(&index->segments[i]);
+        }
+        return SUCCESS;
+    }
+    return buildWordViews(index);
+}
+
+/*
+*   Function: writeWordManifest
+*   ---------------------------
+*   Replaces a word index's manifest atomically.
+*
+*   changelog_directory_fd: a handle on the changelog directory.
+*   base_name: the name the index files start with.
+*   names: the segment names, oldest first.
+*   count: the number of segments.
+*   next_segment: the number of the next segment to be written.
+*
+*   returns: SUCCESS if the manifest was written, FAILURE if an operation fails.
+*/
+
+int writeWordManifest(const int changelog_directory_fd, const char *base_name, char **names, const int count,
+                      const long next_segment)
+{
+    char manifest_name[MAX_FILE_PATH_SIZE];
+    char temporary_name[MAX_FILE_PATH_SIZE];
+    FILE *manifest;
+    int error;
+    int i;
+
+    snprintf(manifest_name, sizeof(manifest_name), "%s.manifest", base_name);
+    snprintf(temporary_name, sizeof(temporary_name), "%s.manifest.tmp", base_name);
+
+    manifest = openFileAt(changelog_directory_fd, temporary_name, "w");
+    if (!manifest)
+    { return FAILURE; }
+
+    fprintf(manifest, "next %ld\n", next_segment);
+    for (i = 0; i < count; i++)
+    {
+        fprintf(manifest, "%s\n", names[i]);
+    }
+    error = fflush(manifest) || ferror(manifest);
+    error |= fclose(manifest) != 0;
+
+    if (error || renameat(changelog_directory_fd, temporary_name, changelog_directory_fd, manifest_name))
+    {
+        fprintf(stderr, "\n[Error] Failed to write the word index: %s\n", strerror(errno));
+        unlinkat(changelog_directory_fd, temporary_name, 0);
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+/*
+*   Function: lockWordIndex
+*   -----------------------
+*   Locks the word indexes against the merge thread and other instances of the program.
+*
+*   changelog_directory_fd: a handle on the changelog directory.
+*   base_name: the name the index files start with.
+*
+*   returns: the lock, to pass to unlockWordIndex().
+*/
+
+int lockWordIndex(const int changelog_directory_fd, const char *base_name)
+{
+    char lock_name[MAX_FILE_PATH_SIZE];
+    int fd;
+
+    pthread_mutex_lock(&word_index_lock);
+
+    /* Without the lock file, other instances just aren't kept out */
+    snprintf(lock_name, sizeof(lock_name), "%s.lock", base_name);
+    fd = openat(changelog_directory_fd, lock_name, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd >= 0)
+    {
+        flock(fd, LOCK_EX);
+    }
+    return fd;
+}
+
+/*
+*   Function: unlockWordIndex
+*   -------------------------
+*   Releases a lock taken by lockWordIndex().
+*
+*   fd: the lock.
+*/
+
+void unlockWordIndex(const int fd)
+{
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    pthread_mutex_unlock(&word_index_lock);
+}
+
+/*
+*   Function: readWordPosting
+*   -------------------------
+*   Decodes the next (file, line) pair of a word's postings.
+*
+*   input: the encoded pair.
+*   end: the end of the postings.
+*   file: the previous file number, updated to this pair's.
+*   line: the previous line number, updated to this pair's.
+*
+*   returns: the position after the pair.
+*/
+
+const unsigned char *readWordPosting(const unsigned char *input, const unsigned char *end, uint64_t *file, uint64_t *line)
+{
+    uint64_t file_delta;
+    uint64_t value;
+
+    input = readVarint(input, end, &file_delta);
+    input = readVarint(input, end, &value);
+    *file += file_delta;
+    *line = file_delta ? value : *line + value;
+    return input;
+}
+
+/*
+*   Function: mergeWordIndex
+*   ------------------------
+*   Thread body that merges every segment of a word index into one. The
+*   segments are only locked while they are listed and while the merged
+*   segment replaces them, so edits and searches carry on during the merge.
+*   Segments added meanwhile are newer than the merged one and are kept.
+*
+*   argument: the word_merge, freed when the merge ends.
+*
+*   returns: NULL.
+*/
+
+void *mergeWordIndex(void *argument)
+{
+    struct word_merge *merge = argument;
+    struct word_index index;
+    struct word_index current;
+    struct word_builder builder;
+    struct word_file_entry entry;
+    const struct word_segment *segment;
+    const unsigned char *posting;
+    const unsigned char *end;
+    char segment_name[MAX_FILE_PATH_SIZE];
+    char **names = NULL;
+    long *files = NULL;
+    uint64_t word;
+    uint64_t file;
+    uint64_t line;
+    uint32_t i;
+    long view;
+    int merged = 0;
+    int lock;
+    int s;
+
+    memset(&index, 0, sizeof(index));
+    memset(&current, 0, sizeof(current));
+    memset(&builder, 0, sizeof(builder));
+    strcpy(index.base_name, merge->base_name);
+    strcpy(current.base_name, merge->base_name);
+
+    /* Take a snapshot of the segments and reserve a number for the merged one */
+    lock = lockWordIndex(merge->changelog_directory_fd, merge->base_name);
+    if (loadWordIndex(merge->changelog_directory_fd, &merge->delimiter, &index) || index.rebuild || index.segment_count < 2
+        || writeWordManifest(merge->changelog_directory_fd, merge->base_name, index.segment_names, index.segment_count,
+                             index.next_segment + 1))
+    {
+        unlockWordIndex(lock);
+        goto cleanup;
+    }
+    unlockWordIndex(lock);
+    snprintf(segment_name, sizeof(segment_name), "%s-%ld.segment", merge->base_name, index.next_segment);
+
+    /* Each file present in the snapshot becomes one full entry */
+    files = malloc((index.view_count + 1) * sizeof(*files));
+    if (!files)
+    { goto cleanup; }
+    for (view = 0; view < index.view_count; view++)
+    {
+        files[view] = -1;
+        if (index.views[view].newest->flags & WORD_FILE_REMOVED)
+        { continue; }
+
+        entry = *index.views[view].newest;
+        entry.flags &= WORD_FILE_UNTERMINATED | WORD_FILE_RACY;
+        files[view] = addWordFile(&builder, index.views[view].name, &entry);
+        if (files[view] < 0)
+        { goto cleanup; }
+    }
+
+    for (s = 0; s < index.segment_count; s++)
+    {
+        applyIOPriority();
+        segment = &index.segments[s];
+        end = segment->postings + segment->header->postings_size;
+        for (word = 0; word < segment->header->word_count; word++)
+        {
+            posting = segment->postings + segment->words[word].postings_offset;
+            for (i = 0, file = 0, line = 0; i < segment->words[word].posting_count; i++)
+            {
+                posting = readWordPosting(posting, end, &file, &line);
+                view = file < segment->header->file_count ? index.live[s][file] : -1;
+                if (view >= 0 && files[view] >= 0
+                    && addWordPosting(&builder, segment->strings + segment->words[word].word_offset,
+                                      segment->words[word].word_length, files[view], line))
+                { goto cleanup; }
+            }
+        }
+    }
+
+    /* Entries keep the racy flags they had, so the merge doesn't trust anything new */
+    applyIOPriority();
+    if (writeWordSegment(merge->changelog_directory_fd, segment_name, &builder, &merge->delimiter, INT64_MAX))
+    { goto cleanup; }
+
+    /* The merged segment only replaces the snapshot if those are still the oldest segments */
+    lock = lockWordIndex(merge->changelog_directory_fd, merge->base_name);
+    if (!loadWordIndex(merge->changelog_directory_fd, &merge->delimiter, &current) && !current.rebuild
+        && current.segment_count >= index.segment_count)
+    {
+        for (s = 0; s < index.segment_count && !strcmp(index.segment_names[s], current.segment_names[s]); s++);
+
+        names = malloc((current.segment_count - index.segment_count + 1) * sizeof(*names));
+        if (s == index.segment_count && names)
+        {
+            names[0] = segment_name;
+            memcpy(names + 1, current.segment_names + index.segment_count,
+                   (current.segment_count - index.segment_count) * sizeof(*names));
+            merged = !writeWordManifest(merge->changelog_directory_fd, merge->base_name, names,
+                                        current.segment_count - index.segment_count + 1, current.next_segment);
+        }
+    }
+    for (s = 0; s < index.segment_count && merged; s++)
+    {
+        unlinkat(merge->changelog_directory_fd, index.segment_names[s], 0);
+    }
+    if (!merged)
+    {
+        unlinkat(merge->changelog_directory_fd, segment_name, 0);
+    }
+    unlockWordIndex(lock);
+
+cleanup:
+    freeWordBuilder(&builder);
+    freeWordIndex(&index);
+    freeWordIndex(&current);
+    free(files);
+    free(names);
+    free(merge);
+
+    pthread_mutex_lock(&word_index_lock);
+    word_merge_state = 2;
+    pthread_mutex_unlock(&word_index_lock);
+    return NULL;
+}
+
+/*
+*   Function: startWordIndexMerge
+*   -----------------------------
+*   Starts merging a word index's segments in the background, unless a merge is
+*   already running. Must be called with word_index_lock held.
+*
+*   changelog_directory_fd: a handle on the changelog directory.
+*   base_name: the name the index files start with.
+*   delimiter: the record delimiter the index was counted with.
+*/
+
+void startWordIndexMerge(const int changelog_directory_fd, const char *base_name, const struct record_delimiter *delimiter)
+{
+    struct word_merge *merge;
+
+    if (word_merge_state == 1)
+    { return; }
+    if (word_merge_state == 2)
+    {
+        pthread_join(word_merge_thread, NULL);
+        word_merge_state = 0;
+    }
+
+    merge = malloc(sizeof(*merge));
+    if (!merge)
+    { return; }
+    merge->changelog_directory_fd = changelog_directory_fd;
+    snprintf(merge->base_name, sizeof(merge->base_name), "%s", base_name);
+    merge->delimiter = *delimiter;
+
+    if (pthread_create(&word_merge_thread, NULL, mergeWordIndex, merge))
+    {
+        free(merge);
+        return;
+    }
+    word_merge_state = 1;
+}
+
+/*
+*   Function: waitForWordIndexMerge
+*   -------------------------------
+*   Waits for a background merge to finish. Called before the program exits.
+*/
+
+void waitForWordIndexMerge()
+{
+    int state;
+
+    pthread_mutex_lock(&word_index_lock);
+    state = word_merge_state;
+    word_merge_state = 0;
+    pthread_mutex_unlock(&word_index_lock);
+
+    if (state)
+    {
+        pthread_join(word_merge_thread, NULL);
+    }
+}
+
+/*
+*   Function: addWordSegment
+*   ------------------------
+*   Writes a new segment and adds it to a word index as its newest. If the index
+*   had to be rebuilt, the new segment replaces all the old ones. Starts a
+*   background merge once the index has too many segments.
+*   Must be called with the index locked.
+*
+*   changelog_directory_fd: a handle on the changelog directory.
+*   index: the loaded index.
+*   builder: the new segment.
+*   delimiter: the record delimiter the line numbers were counted with.
+*   cutoff_ns: files changed after this time are read again on the next update.
+*
+*   returns: SUCCESS if the segment was added, FAILURE if an operation fails.
+*/
+
+int addWordSegment(const int changelog_directory_fd, struct word_index *index, struct word_builder *builder,
+                   const struct record_delimiter *delimiter, const int64_t cutoff_ns)
+{
+    char segment_name[MAX_FILE_PATH_SIZE];
+    char **names;
+    int count = index->rebuild ? 1 : index->segment_count + 1;
+    int i;
+
+    snprintf(segment_name, sizeof(segment_name), "%s-%ld.segment", index->base_name, index->next_segment);
+    names = malloc(count * sizeof(*names));
+    if (!names || writeWordSegment(changelog_directory_fd, segment_name, builder, delimiter, cutoff_ns))
+    {
+        free(names);
+        return FAILURE;
+    }
+
+    for (i = 0; i < count - 1; i++)
+    {
+        names[i] = index->segment_names[i];
+    }
+    names[count - 1] = segment_name;
+    if (writeWordManifest(changelog_directory_fd, index->base_name, names, count, index->next_segment + 1))
+    {
+        unlinkat(changelog_directory_fd, segment_name, 0);
+        free(names);
+        return FAILURE;
+    }
+    free(names);
+
+    for (i = 0; index->rebuild && i < index->segment_count; i++)
+    {
+        unlinkat(changelog_directory_fd, index->segment_names[i], 0);
+    }
+    if (count > WORD_MERGE_THRESHOLD)
+    {
+        startWordIndexMerge(changelog_directory_fd, index->base_name, delimiter);
+    }
+    return SUCCESS;
+}
+
+
+/*
+*   Function: getWordIndexName
+*   --------------------------
+*   Gets the name the word index files of a directory start with.
+*
+*   directory_name: the directory.
+*   base_name: set to the name (MAX_FILE_NAME_SIZE bytes).
+*
+*   returns: SUCCESS, or FAILURE if the directory can't be read.
+*/
+
+int getWordIndexName(const char *directory_name, char *base_name)
+{
+    struct stat directory_status;
+
+    if (fstatat(working_directory_fd, directory_name, &directory_status, 0))
+    {
+        fprintf(stderr, "\n[Error] Failed to read '%s': %s\n", directory_name, strerror(errno));
+        return FAILURE;
+    }
+    snprintf(base_name, MAX_FILE_NAME_SIZE, "%s-%llx-%llx", WORD_INDEX_PREFIX,
+             (unsigned long long) directory_status.st_dev, (unsigned long long) directory_status.st_ino);
+    return SUCCESS;
+}
+
+/*
+*   Function: isCurrentWordEntry
+*   ----------------------------
+*   Checks whether a file's newest index entry still describes it.
+*
+*   entry: the file's newest entry.
+*   status: the file's current status.
+*
+*   returns: 1 if the entry can be trusted, 0 if the file must be read again.
+*/
+
+int isCurrentWordEntry(const struct word_file_entry *entry, const struct entry_status *status)
+{
+    return !(entry->flags & (WORD_FILE_REMOVED | WORD_FILE_RACY)) && entry->size == status->size
+           && entry->modified_ns == status->modified_ns && entry->changed_ns == status->changed_ns
+           && entry->device == status->device && entry->inode == status->inode;
+}
+
+/*
+*   Function: wordStatusTask
+*   ------------------------
+*   Parallel task that gets the status of one file of a word index update.
+*
+*   task_index: the index of the file in the job.
+*   context: the word_tokenize_job, whose entries receive the statuses.
+*/
+
+void wordStatusTask(int task_index, void *context)
+{
+    struct word_tokenize_job *job = context;
+    struct entry_status status;
+
+    job->tokens[task_index].error = getEntryStatus(working_directory_fd, job->paths[task_index], 0, &status);
+    job->tokens[task_index].entry.size = status.size;
+    job->tokens[task_index].entry.modified_ns = status.modified_ns;
+    job->tokens[task_index].entry.changed_ns = status.changed_ns;
+    job->tokens[task_index].entry.device = status.device;
+    job->tokens[task_index].entry.inode = status.inode;
+}
+
+/*
+*   Function: updateWordIndex
+*   -------------------------
+*   Brings the word index of a directory up to date and loads it. Files that are
+*   new or changed since they were indexed are read in parallel into one new
+*   segment, which also records the files that no longer exist.
+*
+*   directory_name: the indexed directory.
+*   files: the files in the directory.
+*   delimiter: the record delimiter that terminates each line.
+*   changelog_directory_fd: a handle on the changelog directory, which holds the index.
+*   index: set to the up-to-date index.
+*   reindexed: set to the number of files read.
+*
+*   returns: SUCCESS if the index is loaded, FAILURE if an operation fails.
+*/
+
+int updateWordIndex(const char *directory_name, const struct file_list *files, const struct record_delimiter *delimiter,
+                    const int changelog_directory_fd, struct word_index *index, int *reindexed)
+{
+    struct word_tokenize_job job;
+    struct word_builder builder;
+    struct word_file_entry entry;
+    struct entry_status status;
+    struct timespec now;
+    char **stale_paths = NULL;
+    char *seen = NULL;
+    long view;
+    long file;
+    int stale_count = 0;
+    int removed_count = 0;
+    int error = FAILURE;
+    int lock;
+    int i;
+
+    *reindexed = 0;
+    memset(index, 0, sizeof(*index));
+    memset(&builder, 0, sizeof(builder));
+    memset(&job, 0, sizeof(job));
+    if (getWordIndexName(directory_name, index->base_name))
+    { return FAILURE; }
+
+    lock = lockWordIndex(changelog_directory_fd, index->base_name);
+    if (loadWordIndex(changelog_directory_fd, delimiter, index))
+    {
+        fprintf(stderr, "\n[Error] Failed to read the word index: %s\n", strerror(errno));
+        goto cleanup;
+    }
+
+    /* Files changed in the last second may change again within the same timestamp tick */
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    job.paths = files->paths;
+    job.delimiter = delimiter;
+    job.tokens = calloc(files->count + 1, sizeof(*job.tokens));
+    stale_paths = malloc((files->count + 1) * sizeof(*stale_paths));
+    seen = calloc(index->view_count + 1, 1);
+    if (!job.tokens || !stale_paths || !seen)
+    { goto cleanup; }
+    runInParallel(files->count, wordStatusTask, &job);
+
+    for (i = 0; i < files->count; i++)
+    {
+        view = findWordView(index, files->paths[i] + strlen(directory_name) + 1);
+        if (view >= 0)
+        { seen[view] = 1; }
+        status.size = job.tokens[i].entry.size;
+        status.modified_ns = job.tokens[i].entry.modified_ns;
+        status.changed_ns = job.tokens[i].entry.changed_ns;
+        status.device = job.tokens[i].entry.device;
+        status.inode = job.tokens[i].entry.inode;
+        if (job.tokens[i].error || view < 0 || !isCurrentWordEntry(index->views[view].newest, &status))
+        {
+            stale_paths[stale_count++] = files->paths[i];
+        }
+    }
+    for (view = 0; view < index->view_count; view++)
+    {
+        removed_count += !seen[view] && !(index->views[view].newest->flags & WORD_FILE_REMOVED);
+    }
+
+    if (stale_count == 0 && removed_count == 0 && !index->rebuild)
+    {
+        error = SUCCESS;
+        goto cleanup;
+    }
+
+    /* Read the stale files again. A file that has gone is dropped from the index; one that
+       can't be read (too many words for the memory budget, say) keeps its older entry and is
+       read again by the next search */
+    free(job.tokens);
+    job.paths = stale_paths;
+    job.tokens = calloc(stale_count + 1, sizeof(*job.tokens));
+    if (!job.tokens)
+    { goto cleanup; }
+    runInParallel(stale_count, wordTokenizeTask, &job);
+    *reindexed = stale_count;
+
+    for (i = 0; i < stale_count; i++)
+    {
+        view = findWordView(index, stale_paths[i] + strlen(directory_name) + 1);
+        if (job.tokens[i].error)
+        {
+            if (!faccessat(working_directory_fd, stale_paths[i], F_OK, 0))
+            {
+                fprintf(stderr, "\n[Error] '%s' couldn't be indexed, so its matches may be missing or out of date.\n",
+                        stale_paths[i]);
+                continue;
+            }
+            if (view < 0)
+            { continue; }
+            job.tokens[i].entry = *index->views[view].newest;
+            job.tokens[i].entry.flags = WORD_FILE_REMOVED;
+        }
+
+        file = addWordFile(&builder, stale_paths[i] + strlen(directory_name) + 1, &job.tokens[i].entry);
+        if (file < 0 || addTokensToBuilder(&builder, file, &job.tokens[i]))
+        { goto cleanup; }
+    }
+    for (view = 0; view < index->view_count; view++)
+    {
+        if (seen[view] || (index->views[view].newest->flags & WORD_FILE_REMOVED))
+        { continue; }
+
+        entry = *index->views[view].newest;
+        entry.flags = WORD_FILE_REMOVED;
+        if (addWordFile(&builder, index->views[view].name, &entry) < 0)
+        { goto cleanup; }
+    }
+
+    if (addWordSegment(changelog_directory_fd, index, &builder, delimiter, getTimeInNanoseconds(now.tv_sec - 1, now.tv_nsec))
+        || loadWordIndex(changelog_directory_fd, delimiter, index))
+    { goto cleanup; }
+    error = SUCCESS;
+
+cleanup:
+    if (error)
+    {
+        fprintf(stderr, "\n[Error] Failed to update the word index of '%s': %s\n", directory_name, strerror(errno));
+        freeWordIndex(index);
+    }
+    unlockWordIndex(lock);
+
+    for (i = 0; job.tokens && i < (job.paths == stale_paths ? stale_count : files->count); i++)
+    {
+        freeTracked(job.tokens[i].data);
+    }
+    free(job.tokens);
+    freeWordBuilder(&builder);
+    free(stale_paths);
+    free(seen);
+    return error;
+}
+
+/*
+*   Function: updateWordIndexAfterEdit
+*   ----------------------------------
+*   Keeps the word index of the working directory (if it has one) up to date after
+*   an edit. An appended line is added on its own, with the line number following
+*   the file's last indexed line; any other edit reads the file again, which also
+*   moves the line numbers after an inserted or deleted line.
+*
+*   file_name: the edited file.
+*   before: the file's status before the edit.
+*   appended: the appended line, or NULL for any other edit.
+*   session: the current session settings.
+*/
+
+void updateWordIndexAfterEdit(const char *file_name, const struct entry_status *before, const char *appended,
+                              const struct session *session)
+{
+    struct word_index index;
+    struct word_builder builder;
+    struct word_tokens tokens;
+    struct entry_status after;
+    char manifest_name[MAX_FILE_PATH_SIZE];
+    long view;
+    long file;
+    int error;
+    int lock;
+
+    memset(&index, 0, sizeof(index));
+    memset(&builder, 0, sizeof(builder));
+    memset(&tokens, 0, sizeof(tokens));
+
+    /* Only files directly in the working directory are covered by its index */
+    if (strchr(file_name, '/') || getWordIndexName(".", index.base_name))
+    { return; }
+    snprintf(manifest_name, sizeof(manifest_name), "%s.manifest", index.base_name);
+    if (faccessat(session->changelog_directory_fd, manifest_name, F_OK, 0))
+    { return; }
+
+    lock = lockWordIndex(session->changelog_directory_fd, index.base_name);
+    if (loadWordIndex(session->changelog_directory_fd, &session->delimiter, &index) || index.rebuild)
+    {
+        freeWordIndex(&index);
+        unlockWordIndex(lock);
+        return;
+    }
+    view = findWordView(&index, file_name);
+    if (appended && view >= 0 && !strchr(appended, session->delimiter.byte)
+        && !(index.views[view].newest->flags & WORD_FILE_UNTERMINATED)
+        && isCurrentWordEntry(index.views[view].newest, before)
+        && !getEntryStatus(working_directory_fd, file_name, 0, &after))
+    {
+        tokens.entry.size = after.size;
+        tokens.entry.modified_ns = after.modified_ns;
+        tokens.entry.changed_ns = after.changed_ns;
+        tokens.entry.device = after.device;
+        tokens.entry.inode = after.inode;
+        tokens.entry.lines = index.views[view].newest->lines + 1;
+        tokens.entry.flags = WORD_FILE_APPENDED;
+        error = tokenizeText(appended, tokens.entry.lines, &tokens);
+    }
+    else
+    {
+        error = tokenizeFile(file_name, &session->delimiter, &tokens);
+    }
+
+    /* The program has just written the file itself, so the entry is trusted even though the change is recent */
+    file = error ? -1 : addWordFile(&builder, file_name, &tokens.entry);
+    if (file < 0 || addTokensToBuilder(&builder, file, &tokens)
+        || addWordSegment(session->changelog_directory_fd, &index, &builder, &session->delimiter, INT64_MAX))
+    {
+        fprintf(stderr, "\n[Error] Failed to update the word index for '%s'. It will be updated by the next search.\n", file_name);
+    }
+
+    unlockWordIndex(lock);
+    freeTracked(tokens.data);
+    freeWordBuilder(&builder);
+    freeWordIndex(&index);
+}
+
+/*
+*   Function: parseWordQuery
+*   ------------------------
+*   Splits a word query into words. Words are joined by AND unless separated by
+*   OR, and AND binds more tightly, so "a b OR c" finds lines with both a and b,
+*   or with c. Words are lowercased and split the same way files are.
+*
+*   query: the query.
+*   words: set to the words (MAX_QUERY_WORDS of MAX_WORD_LENGTH + 1 bytes).
+*   starts_group: set for each word that starts a new OR alternative.
+*
+*   returns: the number of words, or FAILURE if the query is invalid.
+*/
+
+int parseWordQuery(const char *query, char words[][MAX_WORD_LENGTH + 1], int *starts_group)
+{
+    char token[MAX_LINE_CONTENT_SIZE];
+    char *word;
+    int word_count = 0;
+    int new_group = 1;
+    int length;
+    int consumed;
+    int i;
+
+    while (sscanf(query, "%2047s%n", token, &consumed) == 1)
+    {
+        query += consumed;
+        if (!strcmp(token, "AND"))
+        { continue; }
+        if (!strcmp(token, "OR"))
+        {
+            if (new_group)
+            { break; }
+            new_group = 1;
+            continue;
+        }
+
+        /* Text joined by punctuation, e.g. "time-out", must have all of its words */
+        for (word = token; *word;)
+        {
+            for (; *word && !isWordByte(*word); word++);
+            for (length = 0; word[length] && isWordByte(word[length]); length++);
+            if (!length)
+            { break; }
+            if (word_count == MAX_QUERY_WORDS)
+            {
+                fprintf(stderr, "\n[Error] A query can have at most %d words.\n", MAX_QUERY_WORDS);
+                return FAILURE;
+            }
+
+            snprintf(words[word_count], MAX_WORD_LENGTH + 1, "%.*s", length, word);
+            for (i = 0; words[word_count][i]; i++)
+            {
+                words[word_count][i] = tolower((unsigned char) words[word_count][i]);
+            }
+            starts_group[word_count++] = new_group;
+            new_group = 0;
+            word += length;
+        }
+    }
+
+    if (word_count == 0 || new_group)
+    {
+        fprintf(stderr, "\n[Error] Invalid query. Enter words separated by spaces, AND or OR.\n");
+        return FAILURE;
+    }
+    return word_count;
+}
+
+/*
+*   Function: compareLineHits
+*   -------------------------
+*   Orders line hits (view << 32 | line), for qsort().
+*
+*   first, second: pointers to the two hits.
+*
+*   returns: <0, 0 or >0 as the first hit sorts before, with or after the second.
+*/
+
+int compareLineHits(const void *first, const void *second)
+{
+    uint64_t a = *(const uint64_t *) first;
+    uint64_t b = *(const uint64_t *) second;
+
+    return (a > b) - (a < b);
+}
+
+/*
+*   Function: compareHitsByName
+*   ---------------------------
+*   Orders line hits by file name, then line, for qsort_r().
+*
+*   first, second: pointers to the two hits.
+*   context: the word_index the hits refer to.
+*
+*   returns: <0, 0 or >0 as the first hit sorts before, with or after the second.
+*/
+
+int compareHitsByName(const void *first, const void *second, void *context)
+{
+    const struct word_index *index = context;
+    uint64_t a = *(const uint64_t *) first;
+    uint64_t b = *(const uint64_t *) second;
+    int order = strcmp(index->views[a >> 32].name, index->views[b >> 32].name);
+
+    return order ? order : compareLineHits(first, second);
+}
+
+/*
+*   Function: getWordHits
+*   ---------------------
+*   Finds the lines containing a word, from the postings of every segment.
+*
+*   index: the word index.
+*   word: the word.
+*   hits: set to the lines (view << 32 | line), sorted and without repeats (free() after use).
+*
+*   returns: the number of lines, or FAILURE if memory runs out.
+*/
+
+long getWordHits(const struct word_index *index, const char *word, uint64_t **hits)
+{
+    const struct word_segment *segment;
+    const struct word_entry *entry;
+    const unsigned char *posting;
+    const unsigned char *end;
+    uint64_t *grown;
+    uint64_t file;
+    uint64_t line;
+    size_t length = strlen(word);
+    long capacity = 0;
+    long count = 0;
+    long low;
+    long high;
+    long middle;
+    long view;
+    int order;
+    int s;
+    uint32_t i;
+
+    *hits = NULL;
+    for (s = 0; s < index->segment_count; s++)
+    {
+        segment = &index->segments[s];
+        entry = NULL;
+        for (low = 0, high = segment->header->word_count; low < high && !entry;)
+        {
+            middle = low + (high - low) / 2;
+            order = strcmp(segment->strings + segment->words[middle].word_offset, word);
+            if (order == 0)
+            { entry = &segment->words[middle]; }
+            else if (order < 0)
+            { low = middle + 1; }
+            else
+            { high = middle; }
+        }
+        if (!entry || entry->word_length != length)
+        { continue; }
+
+        if (count + entry->posting_count > capacity)
+        {
+            capacity = (capacity ? capacity * 2 : 1024) + entry->posting_count;
+            grown = realloc(*hits, capacity * sizeof(**hits));
+            if (!grown)
+            {
+                free(*hits);
+                return FAILURE;
+            }
+            *hits = grown;
+        }
+
+        /* Only lines from each file's current entries count */
+        posting = segment->postings + entry->postings_offset;
+        end = segment->postings + segment->header->postings_size;
+        for (i = 0, file = 0, line = 0; i < entry->posting_count; i++)
+        {
+            posting = readWordPosting(posting, end, &file, &line);
+            view = file < segment->header->file_count ? index->live[s][file] : -1;
+            if (view >= 0)
+            { (*hits)[count++] = (uint64_t) view << 32 | (uint32_t) line; }
+        }
+    }
+
+    qsort(*hits, count, sizeof(**hits), compareLineHits);
+    for (low = 0, high = 0; low < count; low++)
+    {
+        if (high == 0 || (*hits)[low] != (*hits)[high - 1])
+        { (*hits)[high++] = (*hits)[low]; }
+    }
+    return high;
+}
+
+/*
+*   Function: searchWords
+*   ---------------------
+*   Prints the lines of the files in a directory that match a word query, as
+*   file:line. The directory's word index is brought up to date first; the query
+*   itself only reads postings, never file contents.
+*
+*   directory_name: the directory to search.
+*   query: the words to find, joined by AND and OR.
+*   delimiter: the record delimiter that terminates each line.
+*   changelog_directory_fd: a handle on the changelog directory, which holds the index.
+*
+*   returns: SUCCESS if the search ran, FAILURE if an operation fails.
+*/
+
+int searchWords(const char *directory_name, const char *query, const struct record_delimiter *delimiter,
+                const int changelog_directory_fd)
+{
+    struct file_list files = { NULL, 0, 0 };
+    struct word_index index;
+    struct timespec start;
+    struct timespec end;
+    char words[MAX_QUERY_WORDS][MAX_WORD_LENGTH + 1];
+    int starts_group[MAX_QUERY_WORDS];
+    uint64_t *results = NULL;
+    uint64_t *group = NULL;
+    uint64_t *hits = NULL;
+    uint64_t *merged;
+    long result_count = 0;
+    long group_count = 0;
+    long hit_count;
+    long merged_count;
+    long file_count = 0;
+    long a;
+    long b;
+    int word_count;
+    int reindexed;
+    int error = FAILURE;
+    int i;
+
+    word_count = parseWordQuery(query, words, starts_group);
+    if (word_count < 0 || collectFilesInDirectory(directory_name, &files))
+    { return FAILURE; }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (updateWordIndex(directory_name, &files, delimiter, changelog_directory_fd, &index, &reindexed))
+    {
+        freeFileList(&files);
+        return FAILURE;
+    }
+
+    /* Intersect the lines of each AND group, and unite the groups */
+    for (i = 0; i <= word_count; i++)
+    {
+        if (i == word_count || starts_group[i])
+        {
+            if (i > 0)
+            {
+                merged = malloc((result_count + group_count + 1) * sizeof(*merged));
+                if (!merged)
+                { goto cleanup; }
+                for (a = 0, b = 0, merged_count = 0; a < result_count || b < group_count;)
+                {
+                    if (b == group_count || (a < result_count && results[a] < group[b]))
+                    { merged[merged_count++] = results[a++]; }
+                    else if (a == result_count || group[b] < results[a])
+                    { merged[merged_count++] = group[b++]; }
+                    else
+                    {
+                        merged[merged_count++] = results[a++];
+                        b++;
+                    }
+                }
+                free(results);
+                free(group);
+                group = NULL;
+                results = merged;
+                result_count = merged_count;
+            }
+            if (i == word_count)
+            { break; }
+        }
+
+        hit_count = getWordHits(&index, words[i], &hits);
+        if (hit_count < 0)
+        { goto cleanup; }
+
+        if (starts_group[i])
+        {
+            group = hits;
+            group_count = hit_count;
+            hits = NULL;
+            continue;
+        }
+        for (a = 0, b = 0, merged_count = 0; a < group_count && b < hit_count;)
+        {
+            if (group[a] < hits[b])
+            { a++; }
+            else if (hits[b] < group[a])
+            { b++; }
+            else
+            {
+                group[merged_count++] = group[a++];
+                b++;
+            }
+        }
+        group_count = merged_count;
+        free(hits);
+        hits = NULL;
+    }
+
+    qsort_r(results, result_count, sizeof(*results), compareHitsByName, &index);
+    for (a = 0; a < result_count; a++)
+    {
+        printf("%s/%s:%u\n", directory_name, index.views[results[a] >> 32].name, (unsigned) (uint32_t) results[a]);
+        file_count += a == 0 || (results[a] >> 32) != (results[a - 1] >> 32);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    printf("%ld matching lines in %ld files (%d files indexed again) in %.3f seconds.\n", result_count, file_count,
+           reindexed, (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+    error = SUCCESS;
+
+cleanup:
+    if (error)
+    {
+        fprintf(stderr, "\n[Error] Failed to search '%s': %s\n", directory_name, strerror(errno));
+    }
+    free(results);
+    free(group);
+    free(hits);
+    freeWordIndex(&index);
+    freeFileList(&files);
+    return error;
+}
+
+/*
+*   Function: showChangelog
+*   -----------------------
+*   Displays the sequence of operations performed on a file by this program.
+*
+*   file_name: the name of the file to show the changelog of.
+*   changelog_directory_fd: a handle on the changelog directory.
+*
+*   returns: SUCCESS if the changelog is displayed,
+*            FAILURE if an operation fails.
+*/
+
+int showChangelog(const char *file_name, const int changelog_directory_fd)
+{
+    char changelog_file_name[MAX_FILE_NAME_SIZE];
+
+    /* Take the file name and convert it to the name of its changelog file */
+    if (getChangelogFileName(file_name, changelog_file_name, sizeof(changelog_file_name)))
+    { return FAILURE; }
+
+    if (displayFileAt(changelog_directory_fd, changelog_file_name))
+    {
+        fprintf(stderr, "\n[Error] Failed to read changelog for file '%s': %s\n", file_name, strerror(errno));
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+/*
+*   Function: resetChangelog
+*   ------------------------
+*   Resets the changelog for a specified file.
+*
+*   file_name: the name of the file that will have its changelog reset
+*   changelog_directory_fd: a handle on the changelog directory
+*
+*   returns: SUCCESS if the changelog is reset,
+*            FAILURE if an operation fails.
+*/
+
+int resetChangelog(const char *file_name, const int changelog_directory_fd)
+{
+    char changelog_file_name[MAX_FILE_NAME_SIZE];
+
+    /* Take the file name and convert it to the name of its changelog file */
+    if (getChangelogFileName(file_name, changelog_file_name, sizeof(changelog_file_name)))
+    { return FAILURE; }
+
+    invalidateDescriptors(changelog_directory_fd, changelog_file_name);
+    if (unlinkat(changelog_directory_fd, changelog_file_name, 0))
+    {
+        fprintf(stderr, "\n[Error] Failed to reset changelog for '%s': %s\n", file_name, strerror(errno));
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+/*
+*   Function: getLoggedNumberOfLines
+*   --------------------------------
+*   Gets the number of lines recorded by the most recent changelog entry for a file,
+*   by reading only the end of its changelog.
+*
+*   file_name: the name of the file.
+*   changelog_directory_fd: a handle on the changelog directory.
+*
+*   returns: the number of lines, or -1 if the file has no changelog entries.
+*/
+
+long getLoggedNumberOfLines(const char *file_name, const int changelog_directory_fd)
+{
+    const char *marker = "Number of lines after action: ";
+    char changelog_file_name[MAX_FILE_NAME_SIZE];
+    char tail[MAX_LINE_CONTENT_SIZE + 1];
+    char *entry;
+    char *last_entry = NULL;
+    struct stat changelog_status;
+    ssize_t bytes_read;
+    off_t offset;
+    long number_of_lines = -1;
+    int changelog_fd;
+
+    if (getChangelogFileName(file_name, changelog_file_name, sizeof(changelog_file_name)))
+    { return -1; }
+
+    changelog_fd = acquireDescriptor(changelog_directory_fd, changelog_file_name, O_RDONLY);
+    if (changelog_fd < 0)
+    { return -1; }
+
+    /* Entries are short, so the last one is always in the final MAX_LINE_CONTENT_SIZE bytes */
+    offset = 0;
+    if (!fstat(changelog_fd, &changelog_status) && changelog_status.st_size > MAX_LINE_CONTENT_SIZE)
+    {
+        offset = changelog_status.st_size - MAX_LINE_CONTENT_SIZE;
+    }
+    bytes_read = pread(changelog_fd, tail, MAX_LINE_CONTENT_SIZE, offset);
+    releaseDescriptor(changelog_fd);
+    tail[bytes_read > 0 ? bytes_read : 0] = '\0';
+
+    for (entry = strstr(tail, marker); entry; entry = strstr(entry + 1, marker))
+    {
+        last_entry = entry;
+    }
+    if (last_entry)
+    {
+        number_of_lines = strtol(last_entry + strlen(marker), NULL, 10);
+    }
+    return number_of_lines;
+}
+
+/*
+*   Function: writeChangelogEntry
+*   -----------------------------
+*   Updates the change log for a file by inserting the specified action,
+*   an optional description of what changed and the number of lines after the action.
+*
+*   file_name: the name of the file to update the changelog of.
+*   action: the constant number for the action performed.
+*   detail: extra information about the action, or NULL for none.
+*   number_of_lines: the number of lines in the file after the action,
+*                    or -1 to count them.
+*   session: the current session, which holds the changelog directory
+*            and the delimiter used to count the file's lines.
+*
+*   returns: SUCCESS if the action was added to the file's changelog,
+*            FAILURE if an operation fails.
+*/
+
+int writeChangelogEntry(const char *file_name, const int action, const char *detail, long number_of_lines,
+                        const struct session *session)
+{
+    FILE *source_file;
+    const char *action_strings[] = { "Inserted line", "Appended line", "Deleted line", "Created file", "Read File", "Read Line",
+                                     "Filtered lines", "Replaced text", "Recounted lines", "Inserted lines",
+                                     "Deleted lines", "Replaced line", "Moved lines" };
+    FILE *changelog_file;
+    char changelog_string[MAX_LINE_CONTENT_SIZE];
+    char changelog_file_name[MAX_FILE_NAME_SIZE];
+    int error;
+
+    /* Take the file name and convert it the name of its changelog file */
+    if (getChangelogFileName(file_name, changelog_file_name, sizeof(changelog_file_name)))
+    { return FAILURE; }
+
+    if (number_of_lines < 0)
+    {
+        source_file = openFile(file_name, "rb");
+        if (!source_file)
+        {
+            fprintf(stderr, "\n[Error] Failed to write to changelog for file '%s': See above for more information.\n", file_name);
+            return FAILURE;
+        }
+
+        number_of_lines = getNumberOfLinesInFile(source_file, &session->delimiter);
+        fclose(source_file);
+    }
+
+    snprintf(changelog_string, sizeof(changelog_string), "[%s] %s%sNumber of lines after action: %ld",
+             action_strings[action], detail ? detail : "", detail ? ". " : "", number_of_lines);
+
+    /* Appending creates the changelog if this is the file's first entry */
+    changelog_file = openFileAt(session->changelog_directory_fd, changelog_file_name, "a");
+    error = !changelog_file;
+    if (changelog_file)
+    {
+        error = fprintf(changelog_file, "%s\n", changelog_string) < 0;
+        error |= fclose(changelog_file) != 0;
+    }
+
+    if (error)
+    {
+        fprintf(stderr, "\n[Error] Failed to write to changelog for file '%s': See above for more information.\n", file_name);
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
+
+/*
+*   Function: addActionToChangeLog
+*   -------------------------
+*   Updates the change log for a file by inserting the specified action
+*   and number of lines affected
+*
+*   file_name: the name of the file to update the changelog of.
+*   action: the constant number for the action performed.
+*   session: the current session, which holds the changelog directory
+*            and the delimiter used to count the file's lines.
+*
+*   returns: SUCCESS if the action was added to the file's changelog,
+*            FAILURE if an operation fails.
+*/
+
+int addActionToChangelog(const char *file_name, const int action, const struct session *session)
+{
+    return writeChangelogEntry(file_name, action, NULL, -1, session);
+}
+
+/*
+*   Function: deleteFileFromChangelog
+*   ---------------------------------
+*   Deletes a file's changelog.
+*
+*   file_name: the name of the file to delete the changelog of.
+*   changelog_directory_fd: a handle on the changelog directory.
+*
+*   returns: SUCCESS if the changelog file is deleted,
+*            FAILURE if an operation fails.
+*/
+
+int deleteFileFromChangelog(const char *file_name, const int changelog_directory_fd)
+{
+    char changelog_file_name[MAX_FILE_NAME_SIZE];
+
+    /* Take the file name and convert it the name of its changelog file */
+    if (getChangelogFileName(file_name, changelog_file_name, sizeof(changelog_file_name)))
+    { return FAILURE; }
+
+    if (deleteFileAt(changelog_directory_fd, changelog_file_name))
+    {
+        fprintf(stderr, "\n[Error] Failed to delete the changelog for '%s': %s\n", file_name, strerror(errno));
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+
+/*
+*   Background changelog scrub. The thread and its settings are only changed while
+*   scrub_lock is held; scrub_wakeup ends the pause between passes early.
+*/
+
+static pthread_mutex_t scrub_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t scrub_wakeup = PTHREAD_COND_INITIALIZER;
+static pthread_t scrub_thread;
+static int scrub_running = 0;
+static int scrub_stop = 0;
+
+/*
+*   Function: waitForScrubThrottle
+*   ------------------------------
+*   Accounts for bytes read by the scrub and sleeps until the read rate is back
+*   under the throttle's limit. Sleeps are short so a stop request is seen quickly.
+*
+*   throttle: the throttle shared by the scrub's workers.
+*   bytes: the number of bytes just read.
+*   stop: set when the scrub should end, or NULL.
+*/
+
+void waitForScrubThrottle(struct scrub_throttle *throttle, const int64_t bytes, const int *stop)
+{
+    struct timespec now;
+    struct timespec pause;
+    int64_t due_ns;
+    int64_t wait_ns;
+
+    if (throttle->bytes_per_second <= 0)
+    { return; }
+
+    pthread_mutex_lock(&throttle->lock);
+    throttle->bytes += bytes;
+    due_ns = throttle->start_ns + (int64_t) ((double) throttle->bytes * 1e9 / throttle->bytes_per_second);
+    pthread_mutex_unlock(&throttle->lock);
+
+    while (!(stop && __atomic_load_n(stop, __ATOMIC_RELAXED)))
+    {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        wait_ns = due_ns - getTimeInNanoseconds(now.tv_sec, now.tv_nsec);
+        if (wait_ns <= 0)
+        { return; }
+
+        wait_ns = wait_ns < 100000000 ? wait_ns : 100000000;
+        pause.tv_sec = 0;
+        pause.tv_nsec = wait_ns;
+        nanosleep(&pause, NULL);
+    }
+}
+
+/*
+*   Function: countScrubbedLines
+*   ----------------------------
+*   Counts the lines of a file for the scrub, within the read rate of the throttle.
+*
+*   file_name: the file to count.
+*   delimiter: the record delimiter that terminates each line.
+*   throttle: the throttle shared by the scrub's workers.
+*   stop: set when the scrub should end, or NULL.
+*   lines: set to the number of lines.
+*   status: set to the file's status before it was read.
+*
+*   returns: SUCCESS if the file was counted, FAILURE if it can't be read or the scrub was stopped.
+*/
+
+int countScrubbedLines(const char *file_name, const struct record_delimiter *delimiter, struct scrub_throttle *throttle,
+                       const int *stop, long *lines, struct entry_status *status)
+{
+    unsigned char previous_byte = '\0';
+    unsigned char *buffer;
+    ssize_t bytes_read;
+    off_t offset = 0;
+    int fd;
+
+    *lines = 0;
+    if (getEntryStatus(working_directory_fd, file_name, 0, status))
+    { return FAILURE; }
+
+    fd = acquireDescriptor(working_directory_fd, file_name, O_RDONLY);
+    buffer = malloc(STATISTICS_BUFFER_SIZE);
+    if (fd < 0 || !buffer)
+    {
+        free(buffer);
+        if (fd >= 0)
+        { releaseDescriptor(fd); }
+        return FAILURE;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    while ((bytes_read = limitedPread(fd, buffer, STATISTICS_BUFFER_SIZE, offset)) > 0)
+    {
+        *lines += countBlockDelimiters(buffer, bytes_read, delimiter, previous_byte);
+        previous_byte = buffer[bytes_read - 1];
+        offset += bytes_read;
+
+        waitForScrubThrottle(throttle, bytes_read, stop);
+        if (stop && __atomic_load_n(stop, __ATOMIC_RELAXED))
+        { break; }
+        applyIOPriority();
+    }
+
+    free(buffer);
+    releaseDescriptor(fd);
+    return bytes_read == 0 ? SUCCESS : FAILURE;
+}
+
+/*
+*   Function: collectScrubNames
+*   ---------------------------
+*   Lists the regular files of a directory, optionally only those with a given
+*   suffix (which is removed). Dot-files are skipped, as elsewhere.
+*
+*   directory_fd: the directory to list.
+*   suffix: the suffix names must end with, or NULL for every file.
+*   names: the list to add the names to.
+*
+*   returns: SUCCESS if the directory was listed, FAILURE if an operation fails.
+*/
+
+int collectScrubNames(const int directory_fd, const char *suffix, struct file_list *names)
+{
+    char name[MAX_FILE_NAME_SIZE];
+    struct dirent *entry;
+    struct stat entry_status;
+    size_t suffix_length = suffix ? strlen(suffix) : 0;
+    size_t length;
+    DIR *directory;
+    int fd;
+
+    fd = openat(directory_fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    directory = fd >= 0 ? fdopendir(fd) : NULL;
+    if (!directory)
+    {
+        if (fd >= 0)
+        { close(fd); }
+        return FAILURE;
+    }
+
+    while ((entry = readdir(directory)) != NULL)
+    {
+        length = strlen(entry->d_name);
+        if (entry->d_name[0] == '.' || length <= suffix_length
+            || (suffix && strcmp(entry->d_name + length - suffix_length, suffix)))
+        { continue; }
+
+        if (entry->d_type != DT_REG && (entry->d_type != DT_UNKNOWN
+            || fstatat(directory_fd, entry->d_name, &entry_status, AT_SYMLINK_NOFOLLOW) || !S_ISREG(entry_status.st_mode)))
+        { continue; }
+
+        snprintf(name, sizeof(name), "%.*s", (int) (length - suffix_length), entry->d_name);
+        if (addFileToList(names, name))
+        {
+            closedir(directory);
+            return FAILURE;
+        }
+    }
+
+    closedir(directory);
+    return SUCCESS;
+}
+
+/*
+*   Function: compareScrubNames
+*   ---------------------------
+*   Orders file names, for qsort().
+*
+*   first, second: pointers to the two names.
+*
+*   returns: <0, 0 or >0 as the first name sorts before, with or after the second.
+*/
+
+int compareScrubNames(const void *first, const void *second)
+{
+    return strcmp(*(char *const *) first, *(char *const *) second);
+}
+
+/*
+*   Function: scrubTask
+*   -------------------
+*   Parallel task that checks one file against its changelog, and repairs the
+*   changelog if asked. A file that changes while it is checked is left for the
+*   next pass rather than repaired from a count that may already be stale.
+*
+*   task_index: the index of the entry in the job.
+*   context: the scrub_job.
+*/
+
+void scrubTask(int task_index, void *context)
+{
+    struct scrub_job *job = context;
+    struct scrub_entry *entry = &job->entries[task_index];
+    struct entry_status before;
+    struct entry_status after;
+    char detail[MAX_LINE_CONTENT_SIZE];
+
+    if (job->stop && __atomic_load_n(job->stop, __ATOMIC_RELAXED))
+    {
+        entry->outcome = SCRUB_SKIPPED;
+        return;
+    }
+
+    /* Dot-files aren't listed, but a tracked one still exists */
+    if (!entry->exists && !getEntryStatus(working_directory_fd, entry->name, 0, &before) && S_ISREG(before.mode))
+    {
+        entry->exists = 1;
+    }
+
+    if (!entry->exists)
+    {
+        entry->outcome = SCRUB_ORPHANED;
+        if (job->repair && faccessat(working_directory_fd, entry->name, F_OK, AT_SYMLINK_NOFOLLOW)
+            && !deleteFileFromChangelog(entry->name, job->session->changelog_directory_fd))
+        {
+            entry->repaired = 1;
+        }
+        return;
+    }
+
+    entry->logged = entry->has_changelog ? getLoggedNumberOfLines(entry->name, job->session->changelog_directory_fd) : -1;
+    if (countScrubbedLines(entry->name, &job->session->delimiter, job->throttle, job->stop, &entry->counted, &before))
+    {
+        entry->outcome = job->stop && __atomic_load_n(job->stop, __ATOMIC_RELAXED) ? SCRUB_SKIPPED : SCRUB_FAILED;
+        entry->error = errno;
+        return;
+    }
+
+    /* An edit during the count shows up as a new status or a new changelog entry */
+    if (getEntryStatus(working_directory_fd, entry->name, 0, &after) || after.size != before.size
+        || after.modified_ns != before.modified_ns || after.changed_ns != before.changed_ns || after.inode != before.inode
+        || (entry->has_changelog && getLoggedNumberOfLines(entry->name, job->session->changelog_directory_fd) != entry->logged))
+    {
+        entry->outcome = SCRUB_CHANGED;
+        return;
+    }
+
+    if (!entry->has_changelog)
+    {
+        entry->outcome = SCRUB_UNTRACKED;
+        snprintf(detail, sizeof(detail), "Started tracking a file changed outside the program");
+    }
+    else if (entry->logged != entry->counted)
+    {
+        entry->outcome = SCRUB_MISMATCH;
+        if (entry->logged < 0)
+        { snprintf(detail, sizeof(detail), "No line count was logged"); }
+        else
+        { snprintf(detail, sizeof(detail), "Logged %ld lines", entry->logged); }
+    }
+    else
+    {
+        entry->outcome = SCRUB_OK;
+        return;
+    }
+
+    if (job->repair && !writeChangelogEntry(entry->name, ACTION_RECOUNT_LINES, detail, entry->counted, job->session))
+    {
+        entry->repaired = 1;
+    }
+}
+
+/*
+*   Function: reportScrubEntry
+*   --------------------------
+*   Writes one finding of the scrub.
+*
+*   output: where to write the finding.
+*   entry: the checked file.
+*/
+
+void reportScrubEntry(FILE *output, const struct scrub_entry *entry)
+{
+    const char *repaired = entry->repaired ? " (repaired)" : "";
+
+    switch (entry->outcome)
+    {
+        case SCRUB_MISMATCH:
+            if (entry->logged < 0)
+            { fprintf(output, "No line count logged for '%s', found %ld lines%s\n", entry->name, entry->counted, repaired); }
+            else
+            {
+                fprintf(output, "Line count differs for '%s': logged %ld, found %ld%s\n", entry->name, entry->logged,
+                        entry->counted, repaired);
+            }
+            break;
+        case SCRUB_ORPHANED:
+            fprintf(output, "Orphaned changelog for missing file '%s'%s\n", entry->name, repaired);
+            break;
+        case SCRUB_UNTRACKED:
+            fprintf(output, "Untracked file '%s' with %ld lines%s\n", entry->name, entry->counted, repaired);
+            break;
+        case SCRUB_CHANGED:
+            fprintf(output, "File '%s' changed while it was checked, left for the next pass\n", entry->name);
+            break;
+        case SCRUB_FAILED:
+            fprintf(output, "Failed to read '%s': %s\n", entry->name, strerror(entry->error));
+            break;
+    }
+}
+
+/*
+*   Function: scrubChangelogs
+*   -------------------------
+*   Checks the line count logged for every file against the file itself, and
+*   finds changelogs whose file is gone and files that have no changelog. Files
+*   are counted in parallel, within an optional read rate.
+*
+*   session: the current session settings (changelog directory and delimiter).
+*   repair: 1 to fix what is found, 0 to only report it.
+*   bytes_per_second: the most bytes read per second, or 0 for no limit.
+*   parallel: 1 to count files in parallel, 0 to count them on the calling thread.
+*   stop: set when the scrub should end early, or NULL.
+*   output: where to write the findings and the summary.
+*
+*   returns: SUCCESS if the scrub ran, FAILURE if an operation fails.
+*/
+
+int scrubChangelogs(const struct session *session, const int repair, const int64_t bytes_per_second, const int parallel,
+                    const int *stop, FILE *output)
+{
+    struct file_list tracked = { NULL, 0, 0 };
+    struct file_list present = { NULL, 0, 0 };
+    struct scrub_throttle throttle;
+    struct scrub_job job;
+    struct timespec start;
+    struct timespec end;
+    int counts[SCRUB_SKIPPED + 1] = { 0 };
+    int order;
+    int t = 0;
+    int p = 0;
+    int i;
+
+    memset(&job, 0, sizeof(job));
+    if (collectScrubNames(session->changelog_directory_fd, ".changelog", &tracked)
+        || collectScrubNames(working_directory_fd, NULL, &present))
+    {
+        fprintf(stderr, "\n[Error] Failed to list the changelogs: %s\n", strerror(errno));
+        freeFileList(&tracked);
+        freeFileList(&present);
+        return FAILURE;
+    }
+    qsort(tracked.paths, tracked.count, sizeof(*tracked.paths), compareScrubNames);
+    qsort(present.paths, present.count, sizeof(*present.paths), compareScrubNames);
+
+    /* Merge the two sorted lists so each name is checked once */
+    job.entries = calloc(tracked.count + present.count + 1, sizeof(*job.entries));
+    if (!job.entries)
+    {
+        fprintf(stderr, "\n[Error] Failed to scrub the changelogs: %s\n", strerror(errno));
+        freeFileList(&tracked);
+        freeFileList(&present);
+        return FAILURE;
+    }
+    while (t < tracked.count || p < present.count)
+    {
+        order = t == tracked.count ? 1 : p == present.count ? -1 : strcmp(tracked.paths[t], present.paths[p]);
+        job.entries[job.count].name = order <= 0 ? tracked.paths[t] : present.paths[p];
+        job.entries[job.count].has_changelog = order <= 0;
+        job.entries[job.count].exists = order >= 0;
+        job.count++;
+        t += order <= 0;
+        p += order >= 0;
+    }
+
+    memset(&throttle, 0, sizeof(throttle));
+    pthread_mutex_init(&throttle.lock, NULL);
+    throttle.bytes_per_second = bytes_per_second;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    throttle.start_ns = getTimeInNanoseconds(start.tv_sec, start.tv_nsec);
+
+    job.session = session;
+    job.throttle = &throttle;
+    job.repair = repair;
+    job.stop = stop;
+    if (parallel)
+    {
+        runInParallel(job.count, scrubTask, &job);
+    }
+    else
+    {
+        for (i = 0; i < job.count; i++)
+        {
+            scrubTask(i, &job);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    for (i = 0; i < job.count; i++)
+    {
+        reportScrubEntry(output, &job.entries[i]);
+        counts[job.entries[i].outcome]++;
+    }
+    fprintf(output, "Checked %d files in %.3f seconds: %d line counts differ, %d orphaned changelogs, %d untracked files%s.\n",
+            job.count - counts[SCRUB_SKIPPED], (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9,
+            counts[SCRUB_MISMATCH], counts[SCRUB_ORPHANED], counts[SCRUB_UNTRACKED], repair ? " (repaired)" : "");
+    if (counts[SCRUB_SKIPPED])
+    {
+        fprintf(output, "Stopped before checking %d files.\n", counts[SCRUB_SKIPPED]);
+    }
+
+    pthread_mutex_destroy(&throttle.lock);
+    free(job.entries);
+    freeFileList(&tracked);
+    freeFileList(&present);
+    return SUCCESS;
+}
+
+/*
+*   Function: backgroundScrub
+*   -------------------------
+*   Thread body that scrubs the changelogs over and over at the lowest CPU
+*   priority, one file at a time, appending what it finds to the scrub log.
+*
+*   argument: the background_scrub settings, freed when the thread ends.
+*
+*   returns: NULL.
+*/
+
+void *backgroundScrub(void *argument)
+{
+    struct background_scrub *settings = argument;
+    struct timespec wake_time;
+    struct tm started_time;
+    char started[32] = "-";
+    time_t now;
+    FILE *log;
+
+    /* On Linux each thread has its own nice value */
+    setpriority(PRIO_PROCESS, gettid(), 19);
+
+    pthread_mutex_lock(&scrub_lock);
+    while (!scrub_stop)
+    {
+        pthread_mutex_unlock(&scrub_lock);
+
+        now = time(NULL);
+        if (localtime_r(&now, &started_time))
+        {
+            strftime(started, sizeof(started), "%Y-%m-%d %H:%M:%S", &started_time);
+        }
+        log = openFileAt(settings->session.changelog_directory_fd, SCRUB_LOG_NAME, "a");
+        if (log)
+        {
+            fprintf(log, "[%s] Scrub started\n", started);
+            scrubChangelogs(&settings->session, settings->repair, settings->bytes_per_second, 0, &scrub_stop, log);
+            fclose(log);
+        }
+
+        pthread_mutex_lock(&scrub_lock);
+        clock_gettime(CLOCK_REALTIME, &wake_time);
+        wake_time.tv_sec += SCRUB_INTERVAL_SECONDS;
+        while (!scrub_stop && pthread_cond_timedwait(&scrub_wakeup, &scrub_lock, &wake_time) != ETIMEDOUT);
+    }
+    pthread_mutex_unlock(&scrub_lock);
+
+    free(settings);
+    return NULL;
+}
+
+/*
+*   Function: stopBackgroundScrub
+*   -----------------------------
+*   Stops the background scrub, if one is running, and waits for it to end.
+*   A pass in progress stops after the file block being read.
+*
+*   returns: 1 if a scrub was stopped, 0 if none was running.
+*/
+
+int stopBackgroundScrub()
+{
+    int running;
+
+    pthread_mutex_lock(&scrub_lock);
+    running = scrub_running;
+    __atomic_store_n(&scrub_stop, 1, __ATOMIC_RELAXED);
+    scrub_running = 0;
+    pthread_cond_signal(&scrub_wakeup);
+    pthread_mutex_unlock(&scrub_lock);
+
+    if (running)
+    {
+        pthread_join(scrub_thread, NULL);
+    }
+    return running;
+}
+
+/*
+*   Function: startBackgroundScrub
+*   ------------------------------
+*   Starts scrubbing the changelogs in the background, replacing a scrub that is already running.
+*
+*   session: the current session settings.
+*   repair: 1 to fix what is found, 0 to only log it.
+*   bytes_per_second: the most bytes read per second, or 0 for no limit.
+*
+*   returns: SUCCESS if the scrub started, FAILURE if the thread can't be started.
+*/
+
+int startBackgroundScrub(const struct session *session, const int repair, const int64_t bytes_per_second)
+{
+    struct background_scrub *settings;
+
+    stopBackgroundScrub();
+
+    settings = malloc(sizeof(*settings));
+    if (!settings)
+    { return FAILURE; }
+    settings->session = *session;
+    settings->repair = repair;
+    settings->bytes_per_second = bytes_per_second;
+
+    pthread_mutex_lock(&scrub_lock);
+    scrub_stop = 0;
+    if (pthread_create(&scrub_thread, NULL, backgroundScrub, settings))
+    {
+        pthread_mutex_unlock(&scrub_lock);
+        fprintf(stderr, "\n[Error] Failed to start the background scrub: %s\n", strerror(errno));
+        free(settings);
+        return FAILURE;
+    }
+    scrub_running = 1;
+    pthread_mutex_unlock(&scrub_lock);
+    return SUCCESS;
+}
+
+/*
+*   Function: getInput
+*   ------------------
+*   Receives user input and writes it to the specified variable.
+*
+*   msg: the message shown to the user before receiving input.
+*   input_var: the variable to write the input to.
+*   var_size: the size of the variable to write to.
+*/
+
+void getInput(const char *msg, char *input_var, const int var_size)
+{
+    printf("%s", msg);
+    if (!fgets(input_var, var_size, stdin))
+    {
+        input_var[0] = '\0';
+    }
+
+    /* Remove newline added by fgets (strtok() would leave it on an empty line) */
+    input_var[strcspn(input_var, "\n")] = '\0';
+}
+
+
+/* BEGIN MAIN WRAPPER FUNCTIONS */
+
+/*
+*   Function: createFileMain
+*   --------------------------
+*   Wrapper for createFile().
+*   Takes user input and creates a file given a name.
+*
+*   session: the current session settings.
+*/
+
+void createFileMain(struct session *session)
+{
+    char file_name[MAX_FILE_NAME_SIZE];
+    int error;
+
+    getInput("Enter the name of the file you want to create: ", file_name, sizeof(file_name));
+
+    error = createFile(file_name);
+    if (!error)
+    {
+        printf("Successully created file '%s'\n", file_name);
+        addActionToChangelog(file_name, ACTION_CREATE_FILE, session);
+    }
+}
+
+/*
+*   Function: displayFileMain
+*   ---------------------------
+*   Wrapper for openFile().
+*   Takes user input and displays the contents of a given file.
+*
+*   session: the current session settings.
+*/
+
+void displayFileMain(struct session *session)
+{
+    char file_name[MAX_FILE_NAME_SIZE];
+    int error;
+
+    getInput("Enter the name of the file you want to see the contents of: ", file_name, sizeof(file_name));
+
+    error = displayFile(file_name);
+
+    if (error)
+    {
+        printf("\n[Error] Failed to display contents of '%s'. See above for more information.\n", file_name);
+    }
+    else
+    {
+        addActionToChangelog(file_name, ACTION_READ_FILE, session);
+    }
+}
+
+/*
+*   Function: copyFileMain
+*   ------------------------
+*   Wrapper for copyFile().
+*   Takes user input, copies the contents of one given file,
+*   and writes it into a newly created file (given the name).
+*
+*   session: the current session settings.
+*/
+
+void copyFileMain(struct session *session)
+{
+    char source_file_name[MAX_FILE_NAME_SIZE];
+    char new_file_name[MAX_FILE_NAME_SIZE];
+    char verify_input[DEFAULT_INPUT_BUFFER];
+    int error;
+
+    getInput("Enter the name of the file you want to copy: ", source_file_name, sizeof(source_file_name));
+    getInput("Enter the name of your new file: ", new_file_name, sizeof(new_file_name));
+    getInput("Verify the copy by reading it back? (yes/no): ", verify_input, sizeof(verify_input));
+
+    error = copyFile(source_file_name, new_file_name, verify_input[0] == 'y' || verify_input[0] == 'Y');
+    if (!error)
     {
-        fprintf(stderr, "\n[Error] Cannot append to file '%s': See above for more information.\n", file_name);
-        return FAILURE;
-     }
+        printf("Successfully copied file '%s' to '%s'\n", source_file_name, new_file_name);
+        addActionToChangelog(new_file_name, ACTION_CREATE_FILE, session);
+    }
+}
 
-    fputs(content, file);
-    fputs("\n", file);
-    fclose(file);
+/*
+*   Function: deleteFileMain
+*   --------------------------
+*   Wrapper for deleteFile().
+*   Takes user input and deletes the file with the given name.
+*
+*   session: the current session settings.
+*/
 
-    return SUCCESS;
+void deleteFileMain(struct session *session)
+{
+    char file_name[MAX_FILE_NAME_SIZE];
+    int error;
+
+    getInput("Enter the name of the file you want to delete: ", file_name, sizeof(file_name));
+
+    error = deleteFile(file_name);
+    if (!error)
+    {
+        printf("Successfully deleted file '%s'\n", file_name);
+        deleteFileFromChangelog(file_name, session->changelog_directory_fd);
+    }
 }
 
 /*
-*   Function: displayFile
-*   ---------------------
-*   Reads the contents of a file and displays them to the console.
+*   Function: appendLineMain
+*   --------------------------
+*   Wrapper for appendLineToFile().
+*   Takes user input and appends the given content to the file with the given name.
 *
-*   file_name: the name of the file to read from.
+*   session: the current session settings.
+*/
+
+void appendLineMain(struct session *session)
+{
+    char file_name[MAX_FILE_NAME_SIZE];
+    char line_content[MAX_LINE_CONTENT_SIZE];
+    struct entry_status before;
+    int error;
+
+    getInput("Enter the file you want to append content to: ", file_name, sizeof(file_name));
+    getInput("Enter the content you want to append:\n", line_content, sizeof(line_content));
+
+    /* The word index can add just the new line if the file is unchanged since it was indexed */
+    memset(&before, 0, sizeof(before));
+    getEntryStatus(working_directory_fd, file_name, 0, &before);
+
+    error = appendLineToFile(file_name, line_content, &session->delimiter);
+    if (!error)
+    {
+        printf("Sucessfully appended content to file '%s'\n", file_name);
+        addActionToChangelog(file_name, ACTION_APPEND_LINE, session);
+        updateWordIndexAfterEdit(file_name, &before, line_content, session);
+    }
+}
+
+/*
+*   Function: deleteLineMain
+*   ------------------------
+*   Wrapper for deleteLineFromFile().
+*   Takes user input and deletes the specified line from the file.
+*
+*   session: the current session settings.
+*/
+
+void deleteLineMain(struct session *session)
+{
+    char file_name[MAX_FILE_NAME_SIZE];
+    char line_number[DEFAULT_INPUT_BUFFER];
+    int line_number_int;
+    int error;
+
+    getInput("Enter the file you want to delete a line from: ", file_name, sizeof(file_name));
+    getInput("Enter the line number you want to delete: ", line_number, sizeof(line_number));
+
+    /* Convert user input to an integer */
+    line_number_int = atoi(line_number);
+
+    error = deleteLineFromFile(file_name, line_number_int, &session->delimiter);
+    if (!error)
+    {
+        printf("Successfully deleted line %d from '%s'\n", line_number_int, file_name);
+        addActionToChangelog(file_name, ACTION_DELETE_LINE, session);
+        updateWordIndexAfterEdit(file_name, NULL, NULL, session);
+    }
+}
+
+/*
+*   Function: insertLineMain
+*   ------------------------
+*   Wrapper for insertLineInFile().
+*   Takes user input and inserts content at the specified line number.
+*
+*   session: the current session settings.
+*/
+
+void insertLineMain(struct session *session)
+{
+    char file_name[MAX_FILE_NAME_SIZE];
+    char line_number[DEFAULT_INPUT_BUFFER];
+    char line_content[MAX_LINE_CONTENT_SIZE];
+    int line_number_int;
+    int error;
+
+    getInput("Enter the file you want to insert a line into: ", file_name, sizeof(file_name));
+    getInput("Enter the line number you want to insert content at: ", line_number, sizeof(line_number));
+    getInput("Enter the content you want to insert: ", line_content, sizeof(line_content));
+
+    /* Convert user input to an integer */
+    line_number_int = atoi(line_number);
+
+    error = insertLineInFile(file_name, line_content, line_number_int, &session->delimiter);
+    if (!error)
+    {
+        printf("Successully inserted content at line %d in '%s'\n", line_number_int, file_name);
+        addActionToChangelog(file_name, ACTION_INSERT_LINE, session);
+        updateWordIndexAfterEdit(file_name, NULL, NULL, session);
+    }
+}
+
+/*
+*   Function: showLineMain
+*   ------------------------
+*   Wrapper for showLineFromFile().
+*   Takes user input and displays the contents of a file at a specified line number.
+*
+*   session: the current session settings.
+*/
+
+void showLineMain(struct session *session)
+{
+    char file_name[MAX_FILE_NAME_SIZE];
+    char line_number[DEFAULT_INPUT_BUFFER];
+    int line_number_int;
+    int error;
+
+    getInput("Enter the file you want to read a line from: ", file_name, sizeof(file_name));
+    getInput("Ether the line number you want to read the contents at: ", line_number, sizeof(line_number));
+
+    /* COnvert user input to an integer */
+    line_number_int = atoi(line_number);
+
+    error = showLineFromFile(file_name, line_number_int, &session->delimiter);
+    if (!error)
+    {
+        addActionToChangelog(file_name, ACTION_READ_LINE, session);
+    }
+}
+
+/*
+*   Function: getLinesMain
+*   ------------------------
+*   Wrapper for displayNumberOfLinesInFile().
+*   Takes user input and counts the number of lines in a specified file.
+*
+*   session: the current session settings.
+*/
+
+void getLinesMain(struct session *session)
+{
+    char file_name[MAX_FILE_NAME_SIZE];
+    int line_count;
+    int error;
+
+    getInput("Enter the file you want to count the number of lines from: ", file_name, sizeof(file_name));
+
+    error = displayNumberOfLinesInFile(file_name, &session->delimiter);
+    if (error)
+    {
+        printf("\n[Error] Failed to count lines in '%s'. See above for more information.\n", file_name);
+    }
+    else
+    {
+        addActionToChangelog(file_name, ACTION_READ_FILE, session);
+    }
+}
+
+
+/*
+*   Function: getCurrentDirectoryMain
+*   ------------------------
+*   Displays all files in the current directory.
+*
+*   session: the current session settings.
+*/
+
+void getCurrentDirectoryMain(struct session *session)
+{
+    DIR *current_directory;
+    struct dirent *directory_pointer;
+    char current_file_name[MAX_FILE_NAME_SIZE];
+    const struct directory_index *index = getDirectoryIndex(".");
+    long entry;
+
+    (void) session;
+
+    if (index)
+    {
+        printf("Files in current directory:\n");
+        for (entry = 0; entry < index->count; entry++)
+        {
+            if (index->entries[entry].name[0] != '.')
+            {
+                printf("%s\n", index->entries[entry].name);
+            }
+        }
+        return;
+    }
+
+    current_directory = openDirectory(".");
+    if (current_directory)
+    {
+        printf("Files in current directory:\n");
+        directory_pointer = readdir(current_directory);
+
+        while (directory_pointer != NULL)
+        {
+            if (directory_pointer->d_name[0] != '.')
+            {
+                printf("%s\n", directory_pointer->d_name);
+            }
+            directory_pointer = readdir(current_directory);
+        }
+
+        closedir(current_directory);
+    }
+}
+
+/*
+*   Function: resetChangelogMain
+*   -----------------------------
+*   Wrapper for resetChangelog()
+*   Takes user input and resets the changelog for a specified file
+*
+*   session: the current session settings.
+*/
+
+void resetChangelogMain(struct session *session)
+{
+    char file_name[MAX_FILE_NAME_SIZE];
+    int error;
+
+    getInput("Enter the file that you want to reset the changelog of: ", file_name, sizeof(file_name));
+
+    error = resetChangelog(file_name, session->changelog_directory_fd);
+    if (!error)
+    {
+        printf("Successfully reset changelog for '%s'\n", file_name);
+    }
+}
+
+
+/*
+*   Function: showChangelogMain
+*   ------------------------
+*   Wrapper for showChangelog().
+*   Shows the changelog for a specified file.
 *
-*   returns: SUCCESS if the content is displayed,
-*            FAILURE if an operation fails.
+*   session: the current session settings.
 */
 
-int displayFile(const char *file_name)
+void showChangelogMain(struct session *session)
 {
-    FILE *file;
-    char *file_contents;
+    char file_name[MAX_FILE_NAME_SIZE];
+    int error;
 
-    file = openFile(file_name, "rb");
-    if (!file)
-    { return FAILURE; }
+    getInput("Enter the file you want to see the changelog of: ", file_name, sizeof(file_name));
 
-    file_contents = getFileContents(file);
-    fclose(file);
-    printf("Contents of file:\n%s", file_contents);
+    error = showChangelog(file_name, session->changelog_directory_fd);
 
-    free(file_contents);
-    return SUCCESS;
+    if (error)
+    {
+        fprintf(stderr, "\n[Error] Failed to display changelog for file '%s': See above for more information.\n", file_name);
+    }
 }
 
 /*
-*   Function: insertLineInFile
+*   Function: setDelimiterMain
 *   --------------------------
-*   Creates a new line of content at a particular line number in the specified file
-*
-*   file_name: the name of the file to insert content into.
-*   content: the content to be inserted.
-*   line_number: the line number to insert the content at.
+*   Takes user input and sets the record delimiter used by the line operations.
+*   Accepts LF, CRLF, NUL, a single character or a byte written as 0xNN.
 *
-*   returns: SUCCESS if the content is inserted withot error,
-*            FAILURE if an operation fails.
+*   session: the current session settings.
 */
 
-int insertLineInFile(const char *file_name, const char *content, const int line_number)
+void setDelimiterMain(struct session *session)
 {
-    FILE *temp_file;
-    FILE *file;
-    int current_line = 1;
-    int current_character;
+    char delimiter[DEFAULT_INPUT_BUFFER];
+    char *end;
+    long byte;
 
-    file = openFile(file_name, "r");
-    if (!file)
+    getInput("Enter the record delimiter (LF, CRLF, NUL, a single character or 0xNN): ", delimiter, sizeof(delimiter));
+
+    if (!strcasecmp(delimiter, "LF") || !strcmp(delimiter, "\\n"))
     {
-        fprintf(stderr, "\n[Error] Failed to insert line into file '%s': See above for more information.\n", file_name);
-        return FAILURE;
+        session->delimiter.type = DELIMITER_LF;
+        session->delimiter.byte = '\n';
     }
-
-    int line_count = getNumberOfLinesInFile(file);
-    if (line_number > line_count || line_number < 1)
+    else if (!strcasecmp(delimiter, "CRLF") || !strcmp(delimiter, "\\r\\n"))
     {
-        fprintf(stderr, "\n[Error] Failed to insert content into '%s' at line %d: Please enter a valid line number.\n", file_name, line_number);
-        return FAILURE;
+        session->delimiter.type = DELIMITER_CRLF;
+        session->delimiter.byte = '\n';
     }
-
-    /* Create temporary file to write data to */
-    temp_file = openFile(TEMP_FILE_NAME, "w");
-    if (!temp_file)
-    { return FAILURE; }
-
-    current_character = getc(file);
-
-    while (current_character != EOF)
+    else if (!strcasecmp(delimiter, "NUL") || !strcmp(delimiter, "\\0"))
     {
-        if (current_line != line_number)
-        {
-            putc(current_character, temp_file);
-        }
-        else
-        {
-            if (line_number != 1)
-            {
-                putc('\n', temp_file);
-            }
-
-            /* Write specified content into the temporary file */
-            fputs(content, temp_file);
-            putc('\n', temp_file);
-            current_line++;
-        }
-        current_character = fgetc(file);
-        if (current_character == '\n')
-        {
-            current_line++;
-        }
-
+        session->delimiter.type = DELIMITER_NUL;
+        session->delimiter.byte = '\0';
     }
-
-    fclose(file);
-    fclose(temp_file);
-
-    /* Attempt to delete the old file and rename the temporary file to the source file name */
-    int not_deleted = deleteFile(file_name);
-    if (not_deleted || wrename(TEMP_FILE_NAME, file_name))
+    else if (!strncasecmp(delimiter, "0x", 2) && (byte = strtol(delimiter + 2, &end, 16)) >= 0
+             && byte <= 0xFF && end != delimiter + 2 && *end == '\0')
     {
-        fprintf(stderr, "\n[Error] Failed to insert content at line %d from '%s': See above for more information.", line_number, file_name);
-        /* Clean up and delete the temp file for future use if original file delete fails */
-        if (not_deleted)
-        {
-            deleteFile(TEMP_FILE_NAME);
-        }
-        return FAILURE;
+        /* Keep the specialised scanners for bytes that have one */
+        session->delimiter.type = byte == '\n' ? DELIMITER_LF : byte == '\0' ? DELIMITER_NUL : DELIMITER_CUSTOM;
+        session->delimiter.byte = (unsigned char) byte;
+    }
+    else if (strlen(delimiter) == 1)
+    {
+        session->delimiter.type = DELIMITER_CUSTOM;
+        session->delimiter.byte = (unsigned char) delimiter[0];
+    }
+    else
+    {
+        fprintf(stderr, "\n[Error] Invalid record delimiter '%s'.\n", delimiter);
+        return;
     }
 
-    return SUCCESS;
+    printf("Line operations will now use the %s record delimiter\n", delimiter);
 }
 
 /*
-*   Function: showLineFromFile
-*   --------------------------
-*   Displays the contents of the specified file at a particular line number.
-*
-*   file_name: the name of the file to display the line contents from.
-*   line_number: the line number to read the contents from.
+*   Function: statisticsMain
+*   ------------------------
+*   Wrapper for displayFileStatistics().
+*   Takes user input and displays statistics for a file or every file in a directory.
 *
-*   returns: SUCCESS if the line content is displayed,
-*            FAILURE if an operation fails.
+*   session: the current session settings.
 */
 
-int showLineFromFile(const char *file_name, const int line_number)
+void statisticsMain(struct session *session)
 {
-    FILE *file;
-    int current_line = 1;
-    int current_character;
+    char file_name[MAX_FILE_PATH_SIZE];
+    struct stat file_status;
+    int error;
 
-    file = openFile(file_name, "r");
-    if (!file || validateLineNumber(file, line_number))
+    getInput("Enter the file or directory you want statistics for: ", file_name, sizeof(file_name));
+
+    error = displayFileStatistics(file_name, &session->delimiter);
+    if (error)
     {
-        fprintf(stderr, "\n[Error] Failed to read contents at line %d of '%s'. See above for more information.\n", line_number, file_name);
-        return FAILURE;
+        printf("\n[Error] Failed to get statistics for '%s'. See above for more information.\n", file_name);
     }
-
-    printf("Content at line %d:\n", line_number);
-    current_character = getc(file);
-    while (current_character != EOF)
+    else if (!fstatat(working_directory_fd, file_name, &file_status, 0) && S_ISREG(file_status.st_mode))
     {
-        /* Since we're only displaying one line, there's no need to display the new line */
-        if (current_line == line_number && current_character != '\n')
-        {
-            printf("%c", current_character);
-        }
-        current_character = fgetc(file);
-        if (current_character == '\n')
-        {
-            current_line++;
-        }
-
+        addActionToChangelog(file_name, ACTION_READ_FILE, session);
     }
-    fclose(file);
-    printf("\n");
-
-    return SUCCESS;
 }
 
 /*
-*   Function: deleteLineFromFile
-*   ----------------------------
-*   Deletes a line of content at a particular line number in the specified file.
-*
-*   file_name: the name of the file to delete the line content from.
-*   line_number: the line number to delete content at.
+*   Function: filterLinesMain
+*   -------------------------
+*   Wrapper for filterLinesInFile().
+*   Takes user input and keeps, deletes or counts the lines of a file matching
+*   a regular expression or any of a set of literals.
 *
-*   returns: SUCCESS if the line is deleted,
-*            FAILURE if an operation fails.
+*   session: the current session settings.
 */
 
-int deleteLineFromFile(const char *file_name, const int line_number)
+void filterLinesMain(struct session *session)
 {
-    FILE *temp_file;
-    FILE *file;
-    int current_line = 1;
-    int current_character;
+    char file_name[MAX_FILE_NAME_SIZE];
+    char mode_input[DEFAULT_INPUT_BUFFER];
+    char type_input[DEFAULT_INPUT_BUFFER];
+    char detail[MAX_LINE_CONTENT_SIZE];
+    char *patterns[MAX_FILTER_LITERALS];
+    struct line_matcher matcher;
+    long lines_matched;
+    long lines_removed;
+    long lines_kept;
+    int pattern_count = 0;
+    int mode;
+    int error;
 
-    file = openFile(file_name, "r");
-    /* Create temp file to write data to */
-    temp_file = openFile(TEMP_FILE_NAME, "w");
+    getInput("Enter the file you want to filter lines in: ", file_name, sizeof(file_name));
+    getInput("Enter the filter mode (keep, delete or count matching lines): ", mode_input, sizeof(mode_input));
+    getInput("Match a regular expression or a set of literals? (regex/literal): ", type_input, sizeof(type_input));
 
-    if (!file || validateLineNumber(file, line_number) || !temp_file)
+    if (!strcasecmp(mode_input, "keep"))
+    { mode = FILTER_KEEP_MATCHING; }
+    else if (!strcasecmp(mode_input, "delete"))
+    { mode = FILTER_DELETE_MATCHING; }
+    else if (!strcasecmp(mode_input, "count"))
+    { mode = FILTER_COUNT_MATCHING; }
+    else
     {
-        fprintf(stderr, "\n[Error] Failed to delete line %d from file '%s': See above for more information.\n", line_number, file_name);
-        return FAILURE;
+        fprintf(stderr, "\n[Error] Invalid filter mode '%s'.\n", mode_input);
+        return;
     }
 
-    current_character = getc(file);
-    while (current_character != EOF)
+    while (pattern_count < MAX_FILTER_LITERALS)
     {
-        if (current_line != line_number)
+        patterns[pattern_count] = malloc(MAX_LINE_CONTENT_SIZE);
+        if (!patterns[pattern_count])
+        { break; }
+
+        if (type_input[0] == 'r' || type_input[0] == 'R')
         {
-            putc(current_character, temp_file);
+            getInput("Enter the regular expression: ", patterns[pattern_count++], MAX_LINE_CONTENT_SIZE);
+            break;
         }
-        current_character = fgetc(file);
-        if (current_character == '\n')
+
+        getInput("Enter a literal to match (or an empty line to finish): ", patterns[pattern_count], MAX_LINE_CONTENT_SIZE);
+        if (patterns[pattern_count][0] == '\0')
         {
-            current_line++;
+            free(patterns[pattern_count]);
+            break;
         }
+        pattern_count++;
+    }
 
+    error = pattern_count == 0
+            || compileLineMatcher(&matcher, patterns, pattern_count, type_input[0] == 'r' || type_input[0] == 'R', 0);
+    while (pattern_count > 0)
+    {
+        free(patterns[--pattern_count]);
+    }
+    if (error)
+    {
+        fprintf(stderr, "\n[Error] Failed to filter lines in '%s': No valid pattern was given.\n", file_name);
+        return;
     }
 
-    fclose(file);
-    fclose(temp_file);
+    error = filterLinesInFile(file_name, &matcher, mode, &session->delimiter, &lines_matched, &lines_removed, &lines_kept);
+    freeLineMatcher(&matcher);
+    if (error)
+    { return; }
 
-    /* Attempt to delete the old file and rename the temporary file to the source file name */
-    int not_deleted = deleteFile(file_name);
-    if (not_deleted || wrename(TEMP_FILE_NAME, file_name))
+    printf("%ld lines in '%s' match\n", lines_matched, file_name);
+    if (mode == FILTER_COUNT_MATCHING)
     {
-        fprintf(stderr, "\n[Error] Failed to delete line %d from '%s': See above for more information.", line_number, file_name);
-        /* Clean up and delete the temporary file for future use if original file delete fails */
-        if (not_deleted)
-        {
-            deleteFile(TEMP_FILE_NAME);
-        }
-        return FAILURE;
+        addActionToChangelog(file_name, ACTION_READ_FILE, session);
+        return;
     }
-    return SUCCESS;
+
+    printf("Successfully removed %ld lines from '%s'\n", lines_removed, file_name);
+    snprintf(detail, sizeof(detail), "Lines removed: %ld", lines_removed);
+    writeChangelogEntry(file_name, ACTION_FILTER_LINES, detail, lines_kept, session);
 }
 
 /*
-*   Function: displayNumberOfLinesInFile
-*   ------------------------------------
-*   Displays the number of lines in a file.
-*
-*   file_name: the name of the file to count lines from.
+*   Function: replaceMain
+*   ---------------------
+*   Wrapper for replaceInFile().
+*   Takes user input and replaces a literal or regex match throughout a file.
 *
-*   returns: SUCCESS if the number of lines is displayed,
-*            FAILURE if an operation fails.
+*   session: the current session settings.
 */
 
-int displayNumberOfLinesInFile(const char *file_name)
+void replaceMain(struct session *session)
 {
-    int line_count;
-    FILE *file;
-
-    file = openFile(file_name, "r");
-    if (!file)
-    { return FAILURE; }
+    char file_name[MAX_FILE_NAME_SIZE];
+    char type_input[DEFAULT_INPUT_BUFFER];
+    char search[MAX_LINE_CONTENT_SIZE];
+    char replacement[MAX_LINE_CONTENT_SIZE];
+    char detail[MAX_LINE_CONTENT_SIZE];
+    long replacements;
+    int use_regex;
+    int error;
 
-    line_count = getNumberOfLinesInFile(file);
-    printf("Number of lines in '%s': %d\n", file_name, line_count);
-    fclose(file);
+    getInput("Enter the file you want to replace text in: ", file_name, sizeof(file_name));
+    getInput("Search for a regular expression or a literal? (regex/literal): ", type_input, sizeof(type_input));
+    use_regex = type_input[0] == 'r' || type_input[0] == 'R';
+    getInput(use_regex ? "Enter the regular expression: " : "Enter the text to search for: ", search, sizeof(search));
+    getInput(use_regex ? "Enter the replacement (\\0 to \\9 insert the match and its groups): "
+                       : "Enter the replacement text: ", replacement, sizeof(replacement));
 
-    return SUCCESS;
+    error = replaceInFile(file_name, search, replacement, use_regex, &session->delimiter, &replacements);
+    if (!error)
+    {
+        printf("Successfully made %ld replacements in '%s'\n", replacements, file_name);
+        snprintf(detail, sizeof(detail), "Replacements: %ld", replacements);
+        writeChangelogEntry(file_name, ACTION_REPLACE_TEXT, detail, -1, session);
+    }
 }
 
 /*
-*   Function: showChangelog
+*   Function: splitFileMain
 *   -----------------------
-*   Displays the sequence of operations performed on a file by this program.
-*
-*   file_name: the name of the file to show the changelog of.
-*   changelog_directory: the name of the changelog directory.
+*   Wrapper for splitFile().
+*   Takes user input and splits a file into a number of parts.
 *
-*   returns: SUCCESS if the changelog is displayed,
-*            FAILURE if an operation fails.
+*   session: the current session settings.
 */
 
-int showChangelog(const char *file_name, const char *changelog_directory)
+void splitFileMain(struct session *session)
 {
-    char *file_contents;
-    char changelog_file_path[MAX_FILE_PATH_SIZE];
-    char changelog_file_name[MAX_FILE_NAME_SIZE];
-
-    /* Take the file name and convert it to the name of its changelog file */
-    getChangelogFileName(file_name, changelog_file_name, sizeof(changelog_file_name));
-    sprintf(changelog_file_path, "changelog/%s", changelog_file_name);
+    char file_name[MAX_FILE_NAME_SIZE];
+    char part_file_name[MAX_FILE_PATH_SIZE];
+    char part_count[DEFAULT_INPUT_BUFFER];
+    char mode[DEFAULT_INPUT_BUFFER];
+    long *part_lines;
+    int parts_written;
+    int i;
+
+    getInput("Enter the file you want to split: ", file_name, sizeof(file_name));
+    getInput("Enter the number of parts: ", part_count, sizeof(part_count));
+    getInput("Balance the parts by lines or by bytes? (lines/bytes): ", mode, sizeof(mode));
+
+    parts_written = splitFile(file_name, atoi(part_count), mode[0] == 'l' || mode[0] == 'L', &session->delimiter, &part_lines);
+    if (parts_written == FAILURE)
+    {
+        printf("\n[Error] Failed to split '%s'. See above for more information.\n", file_name);
+        return;
+    }
 
-    if (displayFile(changelog_file_path))
+    printf("Successfully split '%s' into %d parts\n", file_name, parts_written);
+    for (i = 0; i < parts_written; i++)
     {
-        fprintf(stderr, "\n[Error] Failed to read changelog for file '%s': %s\n", file_name, strerror(errno));
-        return FAILURE;
+        getPartFileName(file_name, i + 1, part_file_name, sizeof(part_file_name));
+        writeChangelogEntry(part_file_name, ACTION_CREATE_FILE, NULL, part_lines ? part_lines[i] : -1, session);
     }
-    return SUCCESS;
+    free(part_lines);
 }
 
 /*
-*   Function: resetChangelog
-*   ------------------------
-*   Resets the changelog for a specified file.
-*
-*   file_name: the name of the file that will have its changelog reset
-*   changelog_directory: the full path to the changelog directory
+*   Function: joinFilesMain
+*   -----------------------
+*   Wrapper for joinFiles().
+*   Takes user input and joins a list of files into a new file.
 *
-*   returns: SUCCESS if the changelog is reset,
-*            FAILURE if an operation fails.
+*   session: the current session settings.
 */
 
-int resetChangelog(const char *file_name, const char *changelog_directory)
+void joinFilesMain(struct session *session)
 {
-    FILE *changelog_file;
-    char changelog_file_path[MAX_FILE_PATH_SIZE];
-    char changelog_file_name[MAX_FILE_NAME_SIZE];
+    char new_file_name[MAX_FILE_NAME_SIZE];
+    char *source_file_names[MAX_JOIN_FILES];
+    int source_count = 0;
+    int error;
 
-    /* Take the file name and convert it to the name of its changelog file */
-    getChangelogFileName(file_name, changelog_file_name, sizeof(changelog_file_name));
-    sprintf(changelog_file_path, "changelog/%s", changelog_file_name);
+    while (source_count < MAX_JOIN_FILES)
+    {
+        source_file_names[source_count] = malloc(MAX_FILE_NAME_SIZE);
+        if (!source_file_names[source_count])
+        { break; }
+
+        getInput("Enter a file to join (or an empty line to finish): ", source_file_names[source_count], MAX_FILE_NAME_SIZE);
+        if (source_file_names[source_count][0] == '\0')
+        {
+            free(source_file_names[source_count]);
+            break;
+        }
+        source_count++;
+    }
+    getInput("Enter the name of your new file: ", new_file_name, sizeof(new_file_name));
 
-    if (remove(changelog_file_path))
+    error = joinFiles(source_file_names, source_count, new_file_name);
+    if (!error)
     {
-        fprintf(stderr, "\n[Error] Failed to reset changelog for '%s': %s\n", file_name, strerror(errno));
-        return FAILURE;
+        printf("Successfully joined %d files into '%s'\n", source_count, new_file_name);
+        addActionToChangelog(new_file_name, ACTION_CREATE_FILE, session);
+    }
+
+    while (source_count > 0)
+    {
+        free(source_file_names[--source_count]);
     }
-    return SUCCESS;
 }
 
 /*
-*   Function: addActionToChangeLog
+*   Function: sampleLinesMain
 *   -------------------------
-*   Updates the change log for a file by inserting the specified action
-*   and number of lines affected
-*
-*   file_name: the name of the file to update the changelog of.
-*   action: the constant number for the action performed.
-*   changelog_directory: the full path to the changelog directory
+*   Wrapper for sampleLinesFromFile().
+*   Takes user input and displays a random sample of lines from a file.
 *
-*   returns: SUCCESS if the action was added to the file's changelog,
-*            FAILURE if an operation fails.
+*   session: the current session settings.
 */
 
-int addActionToChangelog(const char *file_name, const int action, const char *changelog_directory)
+void sampleLinesMain(struct session *session)
 {
-    FILE *changelog_file;
-    FILE *source_file;
-    int number_of_lines;
-    const char *action_strings[] = { "Inserted line", "Appended line", "Deleted line", "Created file", "Read File", "Read Line" };
-    char changelog_string[MAX_LINE_CONTENT_SIZE];
-    char changelog_file_name[MAX_FILE_NAME_SIZE];
-
-    /* Take the file name and convert it the name of its changelog file */
-    getChangelogFileName(file_name, changelog_file_name, sizeof(changelog_file_name));
+    char file_name[MAX_FILE_NAME_SIZE];
+    char sample_count[DEFAULT_INPUT_BUFFER];
+    char mode[DEFAULT_INPUT_BUFFER];
+    long line_count;
+    int approximate;
+    int error;
 
-    char path_to_changelog_file[MAX_FILE_PATH_SIZE];
-    sprintf(path_to_changelog_file, "%s/%s", changelog_directory, changelog_file_name);
+    getInput("Enter the file you want to sample lines from: ", file_name, sizeof(file_name));
+    getInput("Enter the number of lines to sample: ", sample_count, sizeof(sample_count));
+    getInput("Sample exactly (reads the whole file) or approximately (random offsets)? (exact/approximate): ", mode, sizeof(mode));
+    approximate = mode[0] == 'a' || mode[0] == 'A';
 
-    changelog_file = openFile(path_to_changelog_file, "a");
-    source_file = openFile(file_name, "r");
-    if (!changelog_file || !source_file)
+    error = sampleLinesFromFile(file_name, atol(sample_count), approximate, &session->delimiter, &line_count);
+    if (!error)
     {
-        fprintf(stderr, "\n[Error] Failed to write to changelog for file '%s': See above for more information.\n", file_name);
-        return FAILURE;
+        /* Approximate sampling doesn't count the lines, so the file is only recounted if the metadata cache can't vouch for a count */
+        if (line_count < 0)
+        {
+            line_count = getCachedNumberOfLines(file_name, &session->delimiter, session->changelog_directory_fd);
+        }
+        writeChangelogEntry(file_name, ACTION_READ_FILE, NULL, line_count, session);
     }
+}
+
+/*
+*   Function: fileMetadataMain
+*   --------------------------
+*   Wrapper for displayFileMetadata().
+*   Takes user input and reports the size, modification time, line count and
+*   (optionally) checksum of a file or of every file in a directory.
+*
+*   session: the current session settings.
+*/
+
+void fileMetadataMain(struct session *session)
+{
+    char file_name[MAX_FILE_PATH_SIZE];
+    char checksum_input[DEFAULT_INPUT_BUFFER];
+    long line_count;
+    int error;
 
-    number_of_lines = getNumberOfLinesInFile(source_file);
-    sprintf(changelog_string, "[%s] Number of lines after action: %d", action_strings[action], number_of_lines);
-    fclose(changelog_file);
+    getInput("Enter the file or directory you want metadata for: ", file_name, sizeof(file_name));
+    getInput("Include checksums? (yes/no): ", checksum_input, sizeof(checksum_input));
 
-    if (appendLineToFile(path_to_changelog_file, changelog_string))
+    error = displayFileMetadata(file_name, &session->delimiter, checksum_input[0] == 'y' || checksum_input[0] == 'Y',
+                                session->changelog_directory_fd, &line_count);
+    if (error)
     {
-        fprintf(stderr, "\n[Error] Failed to write to changelog for file '%s': See above for more information.\n", file_name);
-        return FAILURE;
+        printf("\n[Error] Failed to get metadata for '%s'. See above for more information.\n", file_name);
+    }
+    else if (line_count >= 0)
+    {
+        writeChangelogEntry(file_name, ACTION_READ_FILE, NULL, line_count, session);
     }
-
-    return SUCCESS;
 }
 
 /*
-*   Function: deleteFileFromChangelog
-*   ---------------------------------
-*   Deletes a file's changelog.
-*
-*   file_name: the name of the file to delete the changelog of.
-*   changelog_directory: the full path to the changelog directory.
+*   Function: diskUsageMain
+*   -----------------------
+*   Wrapper for displayDiskUsage().
+*   Takes user input and summarises the disk usage of a directory tree.
 *
-*   returns: SUCCESS if the changelog file is deleted,
-*            FAILURE if an operation fails.
+*   session: the current session settings.
 */
 
-int deleteFileFromChangelog(const char *file_name, const char *changelog_directory)
+void diskUsageMain(struct session *session)
 {
-    char changelog_file_path[MAX_FILE_PATH_SIZE];
-    char changelog_file_name[MAX_FILE_NAME_SIZE];
+    char directory_name[MAX_FILE_PATH_SIZE];
+    char count_input[DEFAULT_INPUT_BUFFER];
+    char *end;
+    long top_count;
 
-    /* Take the file name and convert it the name of its changelog file */
-    getChangelogFileName(file_name, changelog_file_name, sizeof(changelog_file_name));
-    sprintf(changelog_file_path, "%s/%s", changelog_directory, changelog_file_name);
+    (void) session;
 
-    if (deleteFile(changelog_file_path))
+    getInput("Enter the directory you want the disk usage of (or an empty line for the current directory): ",
+             directory_name, sizeof(directory_name));
+    getInput("Enter how many of the largest files and directories to show: ", count_input, sizeof(count_input));
+
+    if (directory_name[0] == '\0')
     {
-        fprintf(stderr, "\n[Error] Failed to delete the changelog for '%s': %s\n", file_name, strerror(errno));
-        return FAILURE;
+        strcpy(directory_name, ".");
+    }
+
+    top_count = strtol(count_input, &end, 10);
+    if (end == count_input || top_count < 0 || top_count > MAX_USAGE_ENTRIES)
+    {
+        fprintf(stderr, "\n[Error] Please enter a number from 0 to %d.\n", MAX_USAGE_ENTRIES);
+        return;
     }
-    return SUCCESS;
-}
 
+    if (displayDiskUsage(directory_name, top_count))
+    {
+        printf("\n[Error] Failed to get the disk usage of '%s'. See above for more information.\n", directory_name);
+    }
+}
 
 /*
-*   Function: getInput
-*   ------------------
-*   Receives user input and writes it to the specified variable.
+*   Function: findFilesMain
+*   -----------------------
+*   Wrapper for findFiles().
+*   Takes user input and lists the entries under a directory matching name
+*   patterns and size and age predicates.
 *
-*   msg: the message shown to the user before receiving input.
-*   input_var: the variable to write the input to.
-*   var_size: the size of the variable to write to.
+*   session: the current session settings.
 */
 
-void getInput(const char *msg, char *input_var, const int var_size)
+void findFilesMain(struct session *session)
 {
-    printf("%s", msg);
-    fgets(input_var, var_size, stdin);
+    char directory_name[MAX_FILE_PATH_SIZE];
+    char glob[DEFAULT_INPUT_BUFFER];
+    char size_input[DEFAULT_INPUT_BUFFER];
+    char age_input[DEFAULT_INPUT_BUFFER];
+    struct find_query *query;
 
-    /* Remove newline added by fgets */
-    strtok(input_var, "\n");
-}
+    (void) session;
+
+    query = calloc(1, sizeof(*query));
+    if (!query)
+    {
+        fprintf(stderr, "\n[Error] Failed to start the search: %s\n", strerror(errno));
+        return;
+    }
+
+    getInput("Enter the directory to search (or an empty line for the current directory): ", directory_name, sizeof(directory_name));
+    if (directory_name[0] == '\0')
+    {
+        strcpy(directory_name, ".");
+    }
 
+    while (query->pattern_count < MAX_GLOB_PATTERNS)
+    {
+        getInput("Enter a name pattern using *, ? and [...] (or an empty line to finish): ", glob, sizeof(glob));
+        if (glob[0] == '\0')
+        { break; }
 
-/* BEGIN MAIN WRAPPER FUNCTIONS */
+        if (compileGlob(glob, &query->patterns[query->pattern_count]))
+        {
+            free(query);
+            return;
+        }
+        query->pattern_count++;
+    }
+
+    getInput("Enter a size to match, e.g. +1M (larger) or -10k (smaller), or an empty line for any: ", size_input, sizeof(size_input));
+    getInput("Enter an age to match, e.g. -2d (newer) or +1h (older), or an empty line for any: ", age_input, sizeof(age_input));
+
+    if (!parseFindSize(size_input, query) && !parseFindAge(age_input, query)
+        && findFiles(directory_name, query))
+    {
+        printf("\n[Error] Failed to search '%s'. See above for more information.\n", directory_name);
+    }
+    free(query);
+}
 
 /*
-*   Function: createFileMain
-*   --------------------------
-*   Wrapper for createFile().
-*   Takes user input and creates a file given a name.
+*   Function: directoryIndexMain
+*   ----------------------------
+*   Wrapper for startDirectoryIndex() and stopDirectoryIndex()
+*   Turns the live index of the current directory on or off
 *
-*   changelog_directory: the full path to the changelog directory.
+*   session: the current session settings.
 */
 
-void createFileMain(const char *changelog_directory)
+void directoryIndexMain(struct session *session)
 {
-    char file_name[MAX_FILE_NAME_SIZE];
-    int error;
+    struct timespec start;
+    struct timespec end;
 
-    getInput("Enter the name of the file you want to create: ", file_name, sizeof(file_name));
+    (void) session;
 
-    error = createFile(file_name);
-    if (!error)
+    if (working_directory_index)
     {
-        printf("Successully created file '%s'\n", file_name);
-        addActionToChangelog(file_name, ACTION_CREATE_FILE, changelog_directory);
+        stopDirectoryIndex();
+        printf("The directory index is off.\n");
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (startDirectoryIndex())
+    {
+        printf("\n[Error] Failed to index the current directory. See above for more information.\n");
+        return;
     }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    printf("The directory index is on: %ld entries indexed in %.3f seconds.\n", working_directory_index->count,
+           (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+    printf("Listing, find, statistics and the metadata report now read the current directory from the index.\n");
 }
 
 /*
-*   Function: displayFileMain
-*   ---------------------------
-*   Wrapper for openFile().
-*   Takes user input and displays the contents of a given file.
+*   Function: searchContentsMain
+*   ----------------------------
+*   Wrapper for searchDirectoryContents()
+*   Takes user input and prints the lines matching a pattern in the files of a directory
 *
-*   changelog_directory: the full path to the changelog directory.
+*   session: the current session settings.
 */
 
-void displayFileMain(const char *changelog_directory)
+void searchContentsMain(struct session *session)
 {
-    char file_name[MAX_FILE_NAME_SIZE];
-    int error;
-
-    getInput("Enter the name of the file you want to see the contents of: ", file_name, sizeof(file_name));
-
-    error = displayFile(file_name);
+    char directory_name[MAX_FILE_PATH_SIZE];
+    char type_input[DEFAULT_INPUT_BUFFER];
+    char pattern[MAX_LINE_CONTENT_SIZE];
+    int use_regex;
 
-    if (error)
+    getInput("Enter the directory to search (or an empty line for the current directory): ", directory_name, sizeof(directory_name));
+    if (directory_name[0] == '\0')
     {
-        printf("\n[Error] Failed to display contents of '%s'. See above for more information.\n", file_name);
+        strcpy(directory_name, ".");
     }
-    else
+    getInput("Match a regular expression or a literal? (regex/literal): ", type_input, sizeof(type_input));
+    use_regex = type_input[0] == 'r' || type_input[0] == 'R';
+    getInput(use_regex ? "Enter the regular expression: " : "Enter the literal to search for: ", pattern, sizeof(pattern));
+
+    if (searchDirectoryContents(directory_name, pattern, use_regex, &session->delimiter, session->changelog_directory_fd))
     {
-        addActionToChangelog(file_name, ACTION_READ_FILE, changelog_directory);
+        printf("\n[Error] Failed to search '%s'. See above for more information.\n", directory_name);
     }
 }
 
 /*
-*   Function: copyFileMain
+*   Function: wordSearchMain
 *   ------------------------
-*   Wrapper for copyFile().
-*   Takes user input, copies the contents of one given file,
-*   and writes it into a newly created file (given the name).
+*   Wrapper for searchWords()
+*   Takes user input and prints the lines containing the queried words in the files of a directory
 *
-*   changelog_directory: the full path to the changelog directory.
+*   session: the current session settings.
 */
 
-void copyFileMain(const char *changelog_directory)
+void wordSearchMain(struct session *session)
 {
-    char source_file_name[MAX_FILE_NAME_SIZE];
-    char new_file_name[MAX_FILE_NAME_SIZE];
-    char *file_contents;
-    int error;
+    char directory_name[MAX_FILE_PATH_SIZE];
+    char query[MAX_LINE_CONTENT_SIZE];
 
-    getInput("Enter the name of the file you want to copy: ", source_file_name, sizeof(source_file_name));
-    getInput("Enter the name of your new file: ", new_file_name, sizeof(new_file_name));
+    getInput("Enter the directory to search (or an empty line for the current directory): ", directory_name, sizeof(directory_name));
+    if (directory_name[0] == '\0')
+    {
+        strcpy(directory_name, ".");
+    }
+    getInput("Enter the words to find (e.g. 'error AND timeout', 'error OR warning'): ", query, sizeof(query));
 
-    error = copyFile(source_file_name, new_file_name);
-    if (!error)
+    if (searchWords(directory_name, query, &session->delimiter, session->changelog_directory_fd))
     {
-        printf("Successfully copied file '%s' to '%s'\n", source_file_name, new_file_name);
-        addActionToChangelog(new_file_name, ACTION_CREATE_FILE, changelog_directory);
+        printf("\n[Error] Failed to search '%s'. See above for more information.\n", directory_name);
     }
 }
 
 /*
-*   Function: deleteFileMain
-*   --------------------------
-*   Wrapper for deleteFile().
-*   Takes user input and deletes the file with the given name.
+*   Function: scrubMain
+*   -------------------
+*   Wrapper for scrubChangelogs() and the background scrub
+*   Takes user input and checks the changelogs now, starts checking them in the background or stops that
 *
-*   changelog_directory: the full path to the changelog directory.
+*   session: the current session settings.
 */
 
-void deleteFileMain(const char *changelog_directory)
+void scrubMain(struct session *session)
 {
-    char file_name[MAX_FILE_NAME_SIZE];
-    int error;
+    char mode_input[DEFAULT_INPUT_BUFFER];
+    char repair_input[DEFAULT_INPUT_BUFFER];
+    char rate_input[DEFAULT_INPUT_BUFFER];
+    int64_t bytes_per_second;
+    int repair;
+
+    getInput("Scrub now, start scrubbing in the background, or stop? (now/background/stop): ", mode_input, sizeof(mode_input));
+    if (mode_input[0] == 's' || mode_input[0] == 'S')
+    {
+        printf(stopBackgroundScrub() ? "Stopped the background scrub.\n" : "No background scrub is running.\n");
+        return;
+    }
 
-    getInput("Enter the name of the file you want to delete: ", file_name, sizeof(file_name));
+    getInput("Only report problems or repair them? (report/repair): ", repair_input, sizeof(repair_input));
+    repair = !strcasecmp(repair_input, "repair");
+    getInput("Enter the most megabytes to read per second (0 for no limit): ", rate_input, sizeof(rate_input));
+    bytes_per_second = atof(rate_input) > 0 ? (int64_t) (atof(rate_input) * 1048576) : 0;
 
-    error = deleteFile(file_name);
-    if (!error)
+    if (mode_input[0] == 'b' || mode_input[0] == 'B')
     {
-        printf("Successfully deleted file '%s'\n", file_name);
-        deleteFileFromChangelog(file_name, changelog_directory);
+        if (!startBackgroundScrub(session, repair, bytes_per_second))
+        {
+            printf("Scrubbing every %d seconds in the background. Findings are logged to '%s/%s'.\n",
+                   SCRUB_INTERVAL_SECONDS, CHANGELOG_NAME, SCRUB_LOG_NAME);
+        }
+    }
+    else if (scrubChangelogs(session, repair, bytes_per_second, 1, NULL, stdout))
+    {
+        printf("\n[Error] Failed to scrub the changelogs. See above for more information.\n");
     }
 }
 
 /*
-*   Function: appendLineMain
-*   --------------------------
-*   Wrapper for appendLineToFile().
-*   Takes user input and appends the given content to the file with the given name.
+*   Function: memoryMain
+*   --------------------
+*   Wrapper for showMemoryUse()
+*   Displays the memory used by each operation and takes user input to change the memory budget
 *
-*   changelog_directory: the full path to the changelog directory.
+*   session: the current session settings.
 */
 
-void appendLineMain(const char *changelog_directory)
+void memoryMain(struct session *session)
 {
-    char file_name[MAX_FILE_NAME_SIZE];
-    char line_content[MAX_LINE_CONTENT_SIZE];
-    int error;
+    char budget_input[DEFAULT_INPUT_BUFFER];
+    double megabytes;
 
-    getInput("Enter the file you want to append content to: ", file_name, sizeof(file_name));
-    getInput("Enter the content you want to append:\n", line_content, sizeof(line_content));
+    (void) session;
 
-    error = appendLineToFile(file_name, line_content);
-    if (!error)
+    showMemoryUse();
+
+    getInput("Enter a new memory budget in megabytes (0 for half of physical memory, or an empty line to keep it): ",
+             budget_input, sizeof(budget_input));
+    if (budget_input[0] == '\0')
+    { return; }
+
+    megabytes = atof(budget_input);
+    if (megabytes < 0)
     {
-        printf("Sucessfully appended content to file '%s'\n", file_name);
-        addActionToChangelog(file_name, ACTION_APPEND_LINE, changelog_directory);
+        fprintf(stderr, "\n[Error] Invalid memory budget '%s'.\n", budget_input);
+        return;
     }
+    memory_budget = megabytes > 0 ? (int64_t) (megabytes * 1048576) : getDefaultMemoryBudget();
+    printf("Memory budget set to %.1f MB\n", memory_budget / 1048576.0);
 }
 
 /*
-*   Function: deleteLineMain
-*   ------------------------
-*   Wrapper for deleteLineFromFile().
-*   Takes user input and deletes the specified line from the file.
+*   Function: ioLimitsMain
+*   ----------------------
+*   Wrapper for setIOLimits() and setIOPriority()
+*   Takes user input and limits the bandwidth, I/O operations and I/O priority of bulk operations
 *
-*   changelog_directory: the full path to the changelog directory.
+*   session: the current session settings.
 */
 
-void deleteLineMain(const char *changelog_directory)
+void ioLimitsMain(struct session *session)
 {
-    char file_name[MAX_FILE_NAME_SIZE];
-    char line_number[DEFAULT_INPUT_BUFFER];
-    int line_number_int;
-    int error;
-
-    getInput("Enter the file you want to delete a line from: ", file_name, sizeof(file_name));
-    getInput("Enter the line number you want to delete: ", line_number, sizeof(line_number));
+    char rate_input[DEFAULT_INPUT_BUFFER];
+    char operations_input[DEFAULT_INPUT_BUFFER];
+    char latency_input[DEFAULT_INPUT_BUFFER];
+    char class_input[DEFAULT_INPUT_BUFFER];
+    char level_input[DEFAULT_INPUT_BUFFER];
+    double megabytes_per_second;
+    double operations_per_second;
+    double latency_target_ms;
+
+    (void) session;
+
+    getInput("Enter the most megabytes read and written per second (0 for no limit): ", rate_input, sizeof(rate_input));
+    getInput("Enter the most reads and writes per second (0 for no limit): ", operations_input, sizeof(operations_input));
+    getInput("Enter the I/O latency in milliseconds above which to back off (0 to keep the limits fixed): ",
+             latency_input, sizeof(latency_input));
+    megabytes_per_second = atof(rate_input);
+    operations_per_second = atof(operations_input);
+    latency_target_ms = atof(latency_input);
+
+    if (megabytes_per_second < 0 || operations_per_second < 0 || latency_target_ms < 0)
+    {
+        fprintf(stderr, "\n[Error] Limits can't be negative.\n");
+        return;
+    }
+    if (latency_target_ms > 0 && megabytes_per_second == 0 && operations_per_second == 0)
+    {
+        fprintf(stderr, "\n[Error] Backing off scales the limits, so set a bandwidth or operations limit as well.\n");
+        return;
+    }
+    setIOLimits((int64_t) (megabytes_per_second * 1048576), (int64_t) operations_per_second, (int64_t) (latency_target_ms * 1e6));
 
-    /* Convert user input to an integer */
-    line_number_int = atoi(line_number);
+    getInput("Enter the I/O priority class (idle/best-effort/default): ", class_input, sizeof(class_input));
+    if (class_input[0] == 'i' || class_input[0] == 'I')
+    {
+        setIOPriority(IOPRIO_CLASS_IDLE, 0);
+    }
+    else if (class_input[0] == 'b' || class_input[0] == 'B')
+    {
+        getInput("Enter the best-effort level (0 for the highest to 7 for the lowest): ", level_input, sizeof(level_input));
+        setIOPriority(IOPRIO_CLASS_BE, atoi(level_input) < 0 ? 0 : atoi(level_input) > 7 ? 7 : atoi(level_input));
+    }
+    else
+    {
+        setIOPriority(IOPRIO_CLASS_NONE, 0);
+    }
 
-    error = deleteLineFromFile(file_name, line_number_int);
-    if (!error)
+    if (megabytes_per_second == 0 && operations_per_second == 0)
     {
-        printf("Successfully deleted line %d from '%s'\n", line_number_int, file_name);
-        addActionToChangelog(file_name, ACTION_DELETE_LINE, changelog_directory);
+        printf("Bulk I/O is not rate limited.\n");
+    }
+    else
+    {
+        printf("Bulk I/O is limited to ");
+        if (megabytes_per_second > 0)
+        { printf("%.1f MB/s%s", megabytes_per_second, operations_per_second > 0 ? " and " : ""); }
+        if (operations_per_second > 0)
+        { printf("%.0f operations/s", operations_per_second); }
+        printf("%s.\n", latency_target_ms > 0 ? ", backing off while latency is above the target" : "");
     }
 }
 
 /*
-*   Function: insertLineMain
-*   ------------------------
-*   Wrapper for insertLineInFile().
-*   Takes user input and inserts content at the specified line number.
+*   Function: byteRangeMain
+*   -----------------------
+*   Wrapper for displayByteRange().
+*   Takes user input and displays a range of bytes of a file in hex or as they are.
 *
-*   changelog_directory: the full path to the changelog directory.
+*   session: the current session settings.
 */
 
-void insertLineMain(const char *changelog_directory)
+void byteRangeMain(struct session *session)
 {
     char file_name[MAX_FILE_NAME_SIZE];
-    char line_number[DEFAULT_INPUT_BUFFER];
-    char line_content[MAX_LINE_CONTENT_SIZE];
-    int line_number_int;
-    int error;
+    char offset_input[DEFAULT_INPUT_BUFFER];
+    char length_input[DEFAULT_INPUT_BUFFER];
+    char format_input[DEFAULT_INPUT_BUFFER];
+    char rows_input[DEFAULT_INPUT_BUFFER];
+    long long offset;
+    long long length = -1;
+    long page_rows = 0;
+    char *end;
+    int as_hex;
+
+    getInput("Enter the name of the file you want to see bytes of: ", file_name, sizeof(file_name));
+    getInput("Enter the offset to start at (0x for hex, negative to count back from the end): ", offset_input, sizeof(offset_input));
+    offset = strtoll(offset_input, &end, 0);
+    if (end == offset_input)
+    {
+        fprintf(stderr, "\n[Error] Please enter a valid offset.\n");
+        return;
+    }
 
-    getInput("Enter the file you want to insert a line into: ", file_name, sizeof(file_name));
-    getInput("Enter the line number you want to insert content at: ", line_number, sizeof(line_number));
-    getInput("Enter the content you want to insert: ", line_content, sizeof(line_content));
+    getInput("Enter the number of bytes to show (or an empty line for the rest of the file): ", length_input, sizeof(length_input));
+    if (length_input[0] != '\0')
+    {
+        length = strtoll(length_input, &end, 0);
+        if (end == length_input || length < 0)
+        {
+            fprintf(stderr, "\n[Error] Please enter a valid number of bytes.\n");
+            return;
+        }
+    }
 
-    /* Convert user input to an integer */
-    line_number_int = atoi(line_number);
+    getInput("Show the bytes in hex or as they are? (hex/raw): ", format_input, sizeof(format_input));
+    as_hex = format_input[0] != 'r' && format_input[0] != 'R';
+    if (as_hex)
+    {
+        getInput("Enter the number of rows per page (or 0 to show them all): ", rows_input, sizeof(rows_input));
+        page_rows = strtol(rows_input, &end, 10);
+        if (end == rows_input || page_rows < 0)
+        {
+            fprintf(stderr, "\n[Error] Please enter a valid number of rows.\n");
+            return;
+        }
+    }
 
-    error = insertLineInFile(file_name, line_content, line_number_int);
-    if (!error)
+    if (displayByteRange(file_name, offset, length, as_hex, page_rows))
     {
-        printf("Successully inserted content at line %d in '%s'\n", line_number_int, file_name);
-        addActionToChangelog(file_name, ACTION_INSERT_LINE, changelog_directory);
+        printf("\n[Error] Failed to display bytes of '%s'. See above for more information.\n", file_name);
+    }
+    else
+    {
+        /* Only a few bytes may have been read, so the file is only recounted if the metadata cache can't vouch for a count */
+        writeChangelogEntry(file_name, ACTION_READ_FILE, NULL,
+                            getCachedNumberOfLines(file_name, &session->delimiter, session->changelog_directory_fd), session);
     }
 }
 
 /*
-*   Function: showLineMain
-*   ------------------------
-*   Wrapper for showLineFromFile().
-*   Takes user input and displays the contents of a file at a specified line number.
+*   Function: pageFileMain
+*   ----------------------
+*   Wrapper for pageFile().
+*   Takes user input and shows a file one screen at a time.
 *
-*   changelog_directory: the full path to the changelog directory.
+*   session: the current session settings.
 */
 
-void showLineMain(const char *changelog_directory)
+void pageFileMain(struct session *session)
 {
     char file_name[MAX_FILE_NAME_SIZE];
-    char line_number[DEFAULT_INPUT_BUFFER];
-    int line_number_int;
-    int error;
-
-    getInput("Enter the file you want to read a line from: ", file_name, sizeof(file_name));
-    getInput("Ether the line number you want to read the contents at: ", line_number, sizeof(line_number));
+    long line_count;
 
-    /* COnvert user input to an integer */
-    line_number_int = atoi(line_number);
+    getInput("Enter the name of the file you want to page through: ", file_name, sizeof(file_name));
 
-    error = showLineFromFile(file_name, line_number_int);
-    if (!error)
+    if (pageFile(file_name, &session->delimiter, &line_count))
     {
-        addActionToChangelog(file_name, ACTION_READ_LINE, changelog_directory);
+        printf("\n[Error] Failed to page through '%s'. See above for more information.\n", file_name);
+    }
+    else
+    {
+        /* The pager only counts the lines if it went to the end. Otherwise the file is only recounted if the
+           metadata cache can't vouch for a count */
+        if (line_count < 0)
+        {
+            line_count = getCachedNumberOfLines(file_name, &session->delimiter, session->changelog_directory_fd);
+        }
+        writeChangelogEntry(file_name, ACTION_READ_FILE, NULL, line_count, session);
     }
 }
 
 /*
-*   Function: getLinesMain
-*   ------------------------
-*   Wrapper for displayNumberOfLinesInFile().
-*   Takes user input and counts the number of lines in a specified file.
+*   Function: insertBlockMain
+*   -------------------------
+*   Wrapper for insertBlockInFile().
+*   Takes user input and inserts the lines of another file, or lines typed in,
+*   at the specified line number.
 *
-*   changelog_directory: the full path to the changelog directory.
+*   session: the current session settings.
 */
 
-void getLinesMain(const char *changelog_directory)
+void insertBlockMain(struct session *session)
 {
     char file_name[MAX_FILE_NAME_SIZE];
-    int line_count;
+    char source_file_name[MAX_FILE_NAME_SIZE];
+    char line_number[DEFAULT_INPUT_BUFFER];
+    char source_input[DEFAULT_INPUT_BUFFER];
+    char line_content[MAX_LINE_CONTENT_SIZE];
+    char detail[DEFAULT_INPUT_BUFFER];
+    char *typed_lines = NULL;
+    size_t typed_length = 0;
+    size_t content_length;
+    FILE *block;
+    long lines_inserted;
+    int line_number_int;
+    int line_start = 1;
     int error;
 
-    getInput("Enter the file you want to count the number of lines from: ", file_name, sizeof(file_name));
+    getInput("Enter the file you want to insert lines into: ", file_name, sizeof(file_name));
+    getInput("Enter the line number you want to insert the lines at: ", line_number, sizeof(line_number));
+    getInput("Insert the lines of a file, or type them in? (file/type): ", source_input, sizeof(source_input));
+    line_number_int = atoi(line_number);
 
-    error = displayNumberOfLinesInFile(file_name);
-    if (error)
+    if (source_input[0] == 'f' || source_input[0] == 'F')
     {
-        printf("\n[Error] Failed to count lines in '%s'. See above for more information.\n", file_name);
+        getInput("Enter the file to insert the lines of: ", source_file_name, sizeof(source_file_name));
+        block = openFile(source_file_name, "rb");
     }
     else
     {
-        addActionToChangelog(file_name, ACTION_READ_FILE, changelog_directory);
+        /* Typed lines are collected in memory, so the file is still rewritten once */
+        block = open_memstream(&typed_lines, &typed_length);
+        printf("Enter the lines to insert, then a line with only '.' to finish:\n");
+        while (block && fgets(line_content, sizeof(line_content), stdin))
+        {
+            content_length = strcspn(line_content, "\n");
+            if (line_start && !strcmp(line_content, line_content[content_length] ? ".\n" : "."))
+            { break; }
+
+            /* Lines longer than the buffer arrive in pieces; only the last piece ends the line */
+            line_start = line_content[content_length] == '\n';
+            fwrite(line_content, 1, content_length, block);
+            if (line_start)
+            { writeDelimiter(block, &session->delimiter); }
+        }
+        if (block)
+        {
+            fclose(block);
+            if (!typed_length)
+            {
+                fprintf(stderr, "\n[Error] No lines were entered.\n");
+                free(typed_lines);
+                return;
+            }
+            block = fmemopen(typed_lines, typed_length, "rb");
+        }
+    }
+
+    if (!block)
+    {
+        fprintf(stderr, "\n[Error] Failed to read the lines to insert: %s\n", strerror(errno));
+        free(typed_lines);
+        return;
     }
-}
 
+    error = insertBlockInFile(file_name, block, line_number_int, &session->delimiter, &lines_inserted);
+    fclose(block);
+    free(typed_lines);
+    if (!error)
+    {
+        printf("Successfully inserted %ld lines at line %d in '%s'\n", lines_inserted, line_number_int, file_name);
+        snprintf(detail, sizeof(detail), "%ld lines at line %d", lines_inserted, line_number_int);
+        writeChangelogEntry(file_name, ACTION_INSERT_LINES, detail, -1, session);
+        updateWordIndexAfterEdit(file_name, NULL, NULL, session);
+    }
+}
 
 /*
-*   Function: getCurrentDirectoryMain
-*   ------------------------
-*   Displays all files in the current directory.
+*   Function: deleteRangeMain
+*   -------------------------
+*   Wrapper for deleteLineRange().
+*   Takes user input and deletes a range of lines, or every line from one to the end.
 *
-*   changelog_directory: the full path to the changelog directory.
+*   session: the current session settings.
 */
 
-void getCurrentDirectoryMain(const char *changelog_directory)
+void deleteRangeMain(struct session *session)
 {
-    DIR *current_directory;
-    struct dirent *directory_pointer;
-    char current_file_name[MAX_FILE_NAME_SIZE];
-    current_directory = opendir(".");
-    if (current_directory)
-    {
-        printf("Files in current directory:\n");
-        directory_pointer = readdir(current_directory);
+    char file_name[MAX_FILE_NAME_SIZE];
+    char first_input[DEFAULT_INPUT_BUFFER];
+    char last_input[DEFAULT_INPUT_BUFFER];
+    char detail[DEFAULT_INPUT_BUFFER];
+    long lines_after;
+    long first;
+    long last = -1;
+    int error;
 
-        while (directory_pointer != NULL)
+    getInput("Enter the file you want to delete lines from: ", file_name, sizeof(file_name));
+    getInput("Enter the first line to delete: ", first_input, sizeof(first_input));
+    getInput("Enter the last line to delete (or an empty line to delete to the end of the file): ", last_input, sizeof(last_input));
+
+    first = atol(first_input);
+    if (last_input[0] != '\0')
+    {
+        last = atol(last_input);
+        if (last < 1)
         {
-            if (directory_pointer->d_name[0] != '.')
-            {
-                printf("%s\n", directory_pointer->d_name);
-            }
-            directory_pointer = readdir(current_directory);
+            fprintf(stderr, "\n[Error] Please enter a valid line number.\n");
+            return;
         }
-
-        closedir(current_directory);
     }
-    else
+
+    error = deleteLineRange(file_name, first, last, &session->delimiter, &lines_after);
+    if (!error)
     {
-        fprintf(stderr, "\n[Error] Failed to open current directory: %s\n", strerror(errno));
+        if (last < 0)
+        { snprintf(detail, sizeof(detail), "Lines %ld to the end", first); }
+        else
+        { snprintf(detail, sizeof(detail), "Lines %ld to %ld", first, last); }
+        printf("Successfully deleted lines from '%s' (%ld lines left)\n", file_name, lines_after);
+        writeChangelogEntry(file_name, ACTION_DELETE_LINES, detail, lines_after, session);
+        updateWordIndexAfterEdit(file_name, NULL, NULL, session);
     }
 }
 
 /*
-*   Function: resetChangelogMain
-*   -----------------------------
-*   Wrapper for resetChangelog()
-*   Takes user input and resets the changelog for a specified file
+*   Function: replaceLineMain
+*   -------------------------
+*   Wrapper for replaceLineInFile().
+*   Takes user input and replaces the content at the specified line number,
+*   logging the old content so the change can be undone.
 *
-*   changelog_directory: the full path to the changelog directory.
+*   session: the current session settings.
 */
 
-void resetChangelogMain(const char *changelog_directory)
+void replaceLineMain(struct session *session)
 {
     char file_name[MAX_FILE_NAME_SIZE];
+    char line_number[DEFAULT_INPUT_BUFFER];
+    char line_content[MAX_LINE_CONTENT_SIZE];
+    char old_content[MAX_LOGGED_LINE_SIZE];
+    char detail[MAX_LINE_CONTENT_SIZE];
+    int line_number_int;
+    long line_count;
     int error;
 
-    getInput("Enter the file that you want to reset the changelog of: ", file_name, sizeof(file_name));
+    getInput("Enter the file you want to replace a line in: ", file_name, sizeof(file_name));
+    getInput("Enter the line number you want to replace: ", line_number, sizeof(line_number));
+    getInput("Enter the new content of the line: ", line_content, sizeof(line_content));
+    line_number_int = atoi(line_number);
 
-    error = resetChangelog(file_name, changelog_directory);
+    /*
+    *   The line count only changes if the new content holds a delimiter. Otherwise the count from
+    *   before the edit still holds, but only the metadata cache can vouch for it; without a current
+    *   entry the file is recounted.
+    */
+    line_count = memchr(line_content, session->delimiter.byte, strlen(line_content))
+                 ? -1 : getCachedNumberOfLines(file_name, &session->delimiter, session->changelog_directory_fd);
+
+    error = replaceLineInFile(file_name, line_content, line_number_int, &session->delimiter, old_content, sizeof(old_content));
     if (!error)
     {
-        printf("Successfully reset changelog for '%s'\n", file_name);
+        printf("Successfully replaced line %d in '%s'\n", line_number_int, file_name);
+
+        snprintf(detail, sizeof(detail), "Line %d was \"%s\"", line_number_int, old_content);
+        writeChangelogEntry(file_name, ACTION_REPLACE_LINE, detail, line_count, session);
+        updateWordIndexAfterEdit(file_name, NULL, NULL, session);
     }
 }
 
-
 /*
-*   Function: showChangelogMain
-*   ------------------------
-*   Wrapper for showChangelog().
-*   Shows the changelog for a specified file.
+*   Function: moveLinesMain
+*   -----------------------
+*   Wrapper for moveLines().
+*   Takes user input and moves a range of lines before another line.
 *
-*   changelog_directory: the full path to the changelog directory.
+*   session: the current session settings.
 */
 
-void showChangelogMain(const char *changelog_directory)
+void moveLinesMain(struct session *session)
 {
     char file_name[MAX_FILE_NAME_SIZE];
+    char first_input[DEFAULT_INPUT_BUFFER];
+    char last_input[DEFAULT_INPUT_BUFFER];
+    char position_input[DEFAULT_INPUT_BUFFER];
+    char detail[DEFAULT_INPUT_BUFFER];
+    long first;
+    long last;
+    long position;
+    long line_count;
+    int in_place;
     int error;
 
-    getInput("Enter the file you want to see the changelog of: ", file_name, sizeof(file_name));
+    getInput("Enter the file you want to move lines in: ", file_name, sizeof(file_name));
+    getInput("Enter the first line to move: ", first_input, sizeof(first_input));
+    getInput("Enter the last line to move: ", last_input, sizeof(last_input));
+    getInput("Enter the line to move them before (one past the last line to move them to the end): ",
+             position_input, sizeof(position_input));
+    first = atol(first_input);
+    last = atol(last_input);
+    position = atol(position_input);
 
-    error = showChangelog(file_name, changelog_directory);
+    /* Moving lines doesn't change how many there are, so a count the metadata cache vouches for still holds */
+    line_count = getCachedNumberOfLines(file_name, &session->delimiter, session->changelog_directory_fd);
 
-    if (error)
+    error = moveLines(file_name, first, last, position, &session->delimiter, &in_place);
+    if (!error)
     {
-        fprintf(stderr, "\n[Error] Failed to display changelog for file '%s': See above for more information.\n", file_name);
+        printf("Successfully moved lines %ld to %ld before line %ld in '%s'%s\n", first, last, position, file_name,
+               in_place ? " (in place)" : "");
+
+        snprintf(detail, sizeof(detail), "Lines %ld to %ld before line %ld", first, last, position);
+        writeChangelogEntry(file_name, ACTION_MOVE_LINES, detail, line_count, session);
+        updateWordIndexAfterEdit(file_name, NULL, NULL, session);
     }
 }
 
@@ -1142,7 +15227,29 @@ void showOptionsList()
     printf("10 - Get all files in the current directory\n");
     printf("11 - Reset the changelog for a file\n");
     printf("12 - Show the changelog for a file\n");
-    printf("13 - Quit the program\n"); /* Spooky */
+    printf("13 - Set the record delimiter used by line operations\n");
+    printf("14 - Show statistics (lines, words, bytes, characters) for a file or directory\n");
+    printf("15 - Keep, delete or count lines matching a pattern\n");
+    printf("16 - Search and replace text in a file\n");
+    printf("17 - Split a file into parts\n");
+    printf("18 - Join files into a new file\n");
+    printf("19 - Show a random sample of lines from a file\n");
+    printf("20 - Show size, modification time, lines and checksum for a file or directory\n");
+    printf("21 - Show the disk usage and the largest files and directories of a directory\n");
+    printf("22 - Find files by name pattern, size and age\n");
+    printf("23 - Turn the live index of the current directory on or off\n");
+    printf("24 - Search the contents of the files in a directory (using a trigram index)\n");
+    printf("25 - Search for words in the files of a directory (using a word index)\n");
+    printf("26 - Check the changelogs against the files, once or continuously in the background\n");
+    printf("27 - Show the memory used by each operation and set the memory budget\n");
+    printf("28 - Limit the disk bandwidth and I/O priority of bulk operations\n");
+    printf("29 - Display a range of bytes of a file, in hex or as they are\n");
+    printf("30 - Page through a file one screen at a time\n");
+    printf("31 - Insert a block of lines at a certain line number\n");
+    printf("32 - Delete a range of lines\n");
+    printf("33 - Replace the content at a certain line number\n");
+    printf("34 - Move a range of lines to another position\n");
+    printf("q (or %d) - Quit the program\n", NUMBER_OF_OPERATIONS); /* Spooky */
 }
 
 
@@ -1154,18 +15261,25 @@ int main(int argc, char *argv[])
     printf("\n");
 
     char operation[DEFAULT_INPUT_BUFFER];
+    int64_t memory_baseline;
     int operationInt;
     char term;
 
-    /* Get and store current working directory */
-    char cwd[MAX_FILE_PATH_SIZE];
-    getcwd(cwd, sizeof(cwd));
-
-    char changelog_directory[MAX_FILE_PATH_SIZE];
-    sprintf(changelog_directory, "%s/%s", cwd, CHANGELOG_NAME);
+    /* Resolve the working and changelog directories once; every operation works relative to them */
+    struct session session;
+    working_directory_fd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+    session.changelog_directory_fd = openat(working_directory_fd, CHANGELOG_NAME, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (working_directory_fd < 0 || session.changelog_directory_fd < 0)
+    {
+        fprintf(stderr, "\n[Error] Failed to open the working directory: %s\n", strerror(errno));
+        return FAILURE;
+    }
+    session.delimiter = LINE_FEED_DELIMITER;
+    memory_budget = getDefaultMemoryBudget();
+    installInterruptHandler();
 
     /* Array of pointers to our main functions */
-    void (*functions[13])() = {
+    void (*functions[NUMBER_OF_OPERATIONS])() = {
         showOptionsList,
         createFileMain,
         displayFileMain,
@@ -1178,7 +15292,29 @@ int main(int argc, char *argv[])
         getLinesMain,
         getCurrentDirectoryMain,
         resetChangelogMain,
-        showChangelogMain
+        showChangelogMain,
+        setDelimiterMain,
+        statisticsMain,
+        filterLinesMain,
+        replaceMain,
+        splitFileMain,
+        joinFilesMain,
+        sampleLinesMain,
+        fileMetadataMain,
+        diskUsageMain,
+        findFilesMain,
+        directoryIndexMain,
+        searchContentsMain,
+        wordSearchMain,
+        scrubMain,
+        memoryMain,
+        ioLimitsMain,
+        byteRangeMain,
+        pageFileMain,
+        insertBlockMain,
+        deleteRangeMain,
+        replaceLineMain,
+        moveLinesMain
     };
 
     printf("Welcome to the file manager!\n");
@@ -1190,20 +15326,29 @@ int main(int argc, char *argv[])
 
     while (1)
     {
-        printf("Enter the operation you would like to perform (or '0' to display them again): ");
+        printf("Enter the operation you would like to perform (or '0' to display them again, 'q' to quit): ");
 
-        fgets(operation, sizeof(operation), stdin);
+        /* 'q' quits however many operations the menu has, so scripted input keeps working as operations
+           are added. The number after the last operation still quits, and so does the end of the input */
+        if (!fgets(operation, sizeof(operation), stdin))
+        { operation[0] = 'q'; }
         operationInt = atoi(operation);
 
-        if (operationInt == 13)
+        if (operation[0] == 'q' || operation[0] == 'Q' || operationInt == NUMBER_OF_OPERATIONS)
         {
             printf("Quitting...\n");
+            waitForWordIndexMerge();
+            stopBackgroundScrub();
             break;
         }
-        else if (operationInt >= 0 && operationInt < 13)
+        else if (operationInt >= 0 && operationInt < NUMBER_OF_OPERATIONS)
         {
-            /* Get the function pointer matching the index and call it */
-            (*functions[operationInt])(changelog_directory);
+            /* Get the function pointer matching the index and call it, measuring its memory use */
+            memory_baseline = beginOperationMemory();
+            /* A Ctrl-C that cancelled an earlier operation mustn't stop this one */
+            cancel_requested = 0;
+            (*functions[operationInt])(&session);
+            endOperationMemory(operationInt, memory_baseline);
             printf("\n");
         }
         else